@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_BASE_FLAT_HASH_MAP_H_
+#define INCLUDE_PERFETTO_BASE_FLAT_HASH_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace base {
+
+// Hash map using open addressing with linear probing. Keys and values are
+// stored inline in flat arrays, so an entry costs sizeof(Key) + sizeof(Value)
+// + 1 bytes (plus the slack of the load factor) instead of a heap allocation
+// with two or three pointers of overhead, as for std::unordered_map and
+// std::map.
+// Erase() uses backward shift deletion, so lookups never have to skip over
+// tombstones, regardless of the insertion / deletion pattern.
+//
+// The output of |Hasher| is mixed with Fibonacci hashing, so an identity hash
+// (e.g. std::hash for integers and pointers) is fine even for keys that only
+// differ in the high bits or that have trailing zeros (e.g. aligned pointers).
+//
+// Pointers to keys and values are invalidated by Insert() and Erase(). Keys
+// and values need to be default constructible and move assignable.
+template <typename Key, typename Value, typename Hasher = std::hash<Key>>
+class FlatHashMap {
+ public:
+  // Iterates over all the entries, in unspecified order. The map must not be
+  // modified while iterating.
+  class Iterator {
+   public:
+    explicit operator bool() const { return idx_ < map_->capacity_; }
+    Iterator& operator++() {
+      idx_++;
+      SkipFree();
+      return *this;
+    }
+
+    const Key& key() const { return map_->keys_[idx_]; }
+    Value& value() const { return map_->values_[idx_]; }
+
+   private:
+    friend class FlatHashMap;
+
+    explicit Iterator(FlatHashMap* map) : map_(map) { SkipFree(); }
+
+    void SkipFree() {
+      while (idx_ < map_->capacity_ && !map_->used_[idx_])
+        idx_++;
+    }
+
+    FlatHashMap* map_;
+    size_t idx_ = 0;
+  };
+
+  FlatHashMap() = default;
+  // The moved-from map is left empty, and can be reused.
+  FlatHashMap(FlatHashMap&& other) noexcept { MoveFrom(&other); }
+  FlatHashMap& operator=(FlatHashMap&& other) noexcept {
+    if (this != &other)
+      MoveFrom(&other);
+    return *this;
+  }
+  FlatHashMap(const FlatHashMap&) = delete;
+  FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+  Value* Find(const Key& key) {
+    size_t idx;
+    return FindSlot(key, &idx) ? &values_[idx] : nullptr;
+  }
+
+  // Inserts |value| if |key| is not in the map. Returns a pointer to the value
+  // stored in the map and whether the insertion happened.
+  std::pair<Value*, bool> Insert(Key key, Value value) {
+    if ((size_ + 1) * kMaxLoadFactorDenominator >
+        capacity_ * kMaxLoadFactorNumerator) {
+      Grow(capacity_ ? capacity_ * 2 : kMinCapacity);
+    }
+    size_t idx;
+    if (FindSlot(key, &idx))
+      return {&values_[idx], false};
+    used_[idx] = true;
+    keys_[idx] = std::move(key);
+    values_[idx] = std::move(value);
+    size_++;
+    return {&values_[idx], true};
+  }
+
+  // Returns whether |key| was in the map.
+  bool Erase(const Key& key) {
+    size_t idx;
+    if (!FindSlot(key, &idx))
+      return false;
+    EraseSlot(idx);
+    return true;
+  }
+
+  // Makes room for |n| entries without rehashing.
+  void Reserve(size_t n) {
+    size_t new_capacity = capacity_ ? capacity_ : kMinCapacity;
+    while (n * kMaxLoadFactorDenominator >
+           new_capacity * kMaxLoadFactorNumerator) {
+      new_capacity *= 2;
+    }
+    if (new_capacity > capacity_)
+      Grow(new_capacity);
+  }
+
+  void Clear() {
+    for (size_t i = 0; i < capacity_; i++) {
+      if (used_[i]) {
+        keys_[i] = Key();
+        values_[i] = Value();
+      }
+      used_[i] = false;
+    }
+    size_ = 0;
+  }
+
+  Iterator GetIterator() { return Iterator(this); }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return capacity_; }
+
+ private:
+  static constexpr size_t kMinCapacity = 16;
+  // Grow when more than 3/4 of the slots are used.
+  static constexpr size_t kMaxLoadFactorNumerator = 3;
+  static constexpr size_t kMaxLoadFactorDenominator = 4;
+
+  // Fibonacci hashing: the top bits of the product are well distributed even
+  // if the hash is not.
+  size_t IdealSlot(const Key& key) const {
+    uint64_t hash = static_cast<uint64_t>(Hasher()(key));
+    return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ULL) >> hash_shift_);
+  }
+
+  // Returns true and sets |idx| to the slot of |key| if present. Otherwise
+  // returns false and sets |idx| to the free slot where |key| would go.
+  bool FindSlot(const Key& key, size_t* idx) const {
+    if (capacity_ == 0) {
+      *idx = 0;
+      return false;
+    }
+    const size_t mask = capacity_ - 1;
+    for (size_t i = IdealSlot(key);; i = (i + 1) & mask) {
+      if (!used_[i]) {
+        *idx = i;
+        return false;
+      }
+      if (keys_[i] == key) {
+        *idx = i;
+        return true;
+      }
+    }
+  }
+
+  void EraseSlot(size_t hole) {
+    const size_t mask = capacity_ - 1;
+    // Move back entries that would not be reachable anymore from their ideal
+    // slot once |hole| is freed.
+    for (size_t i = (hole + 1) & mask; used_[i]; i = (i + 1) & mask) {
+      size_t ideal = IdealSlot(keys_[i]);
+      // Distance from the ideal slot to the current one and to the hole,
+      // taking wraparound into account.
+      if (((i - ideal) & mask) >= ((i - hole) & mask)) {
+        keys_[hole] = std::move(keys_[i]);
+        values_[hole] = std::move(values_[i]);
+        hole = i;
+      }
+    }
+    used_[hole] = false;
+    keys_[hole] = Key();
+    values_[hole] = Value();
+    size_--;
+  }
+
+  void MoveFrom(FlatHashMap* other) {
+    keys_ = std::move(other->keys_);
+    values_ = std::move(other->values_);
+    used_ = std::move(other->used_);
+    capacity_ = other->capacity_;
+    size_ = other->size_;
+    hash_shift_ = other->hash_shift_;
+    other->capacity_ = 0;
+    other->size_ = 0;
+    other->hash_shift_ = 64;
+  }
+
+  void Grow(size_t new_capacity) {
+    std::unique_ptr<Key[]> old_keys = std::move(keys_);
+    std::unique_ptr<Value[]> old_values = std::move(values_);
+    std::unique_ptr<bool[]> old_used = std::move(used_);
+    size_t old_capacity = capacity_;
+
+    keys_.reset(new Key[new_capacity]);
+    values_.reset(new Value[new_capacity]);
+    used_.reset(new bool[new_capacity]());
+    capacity_ = new_capacity;
+    hash_shift_ = 64;
+    for (size_t c = new_capacity; c > 1; c >>= 1)
+      hash_shift_--;
+    PERFETTO_DCHECK((size_t(1) << (64 - hash_shift_)) == new_capacity);
+
+    for (size_t i = 0; i < old_capacity; i++) {
+      if (!old_used[i])
+        continue;
+      size_t idx;
+      bool found = FindSlot(old_keys[i], &idx);
+      PERFETTO_DCHECK(!found);
+      used_[idx] = true;
+      keys_[idx] = std::move(old_keys[i]);
+      values_[idx] = std::move(old_values[i]);
+    }
+  }
+
+  std::unique_ptr<Key[]> keys_;
+  std::unique_ptr<Value[]> values_;
+  std::unique_ptr<bool[]> used_;
+  size_t capacity_ = 0;  // Always 0 or a power of two.
+  size_t size_ = 0;
+  uint32_t hash_shift_ = 64;
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_BASE_FLAT_HASH_MAP_H_
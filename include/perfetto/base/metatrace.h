@@ -17,51 +17,109 @@
 #ifndef INCLUDE_PERFETTO_BASE_METATRACE_H_
 #define INCLUDE_PERFETTO_BASE_METATRACE_H_
 
+#include <stdint.h>
 #include <string.h>
 
+#include <atomic>
 #include <string>
+#include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
 #include "perfetto/base/utils.h"
 
 namespace perfetto {
 namespace base {
 
+// Traces the scope in which it lives. The events can go to two places:
+// - In debug standalone builds, a JSON file set by the PERFETTO_METATRACE_FILE
+//   env var. Each begin/end event is formatted and written right away.
+// - In any build, in-memory rings, if enabled by EnableRing(). Each thread
+//   records into its own ring, so recording an event there takes no lock, no
+//   atomic read-modify-write and no allocation, and is cheap enough for hot
+//   paths. The events are read back with ReadRing(), e.g. by traced_probes to
+//   emit them as PerfettoMetatrace packets.
 class MetaTrace {
  public:
   static constexpr uint32_t kMainThreadCpu = 255;
 
+  // Number of events held by the ring of each thread. When the reader falls
+  // behind, the oldest events of the thread are overwritten.
+  static constexpr size_t kRingCapacity = 1024;
+
+  // Maximum number of threads that can record at the same time. The rings of
+  // the threads that exited are reused, the events of the threads beyond this
+  // are dropped (and reported as overruns).
+  static constexpr size_t kMaxRings = 256;
+
+  // An event read from the ring.
+  struct Record {
+    uint64_t start_ns;  // CLOCK_BOOTTIME.
+    uint64_t duration_ns;
+    const char* name;
+    uint32_t cpu;
+    uint32_t tid;
+  };
+
+  // Position of a reader in the rings. Each reader keeps its own, so readers
+  // don't steal each other's events.
+  struct RingCursor {
+    std::vector<uint64_t> read_indices;  // Indexed by ring.
+    uint64_t dropped = 0;
+  };
+
+  // |evt_name| must outlive the process (a literal, or from InternName()).
   MetaTrace(const char* evt_name, size_t cpu) : evt_name_(evt_name), cpu_(cpu) {
+#if PERFETTO_DCHECK_IS_ON() && PERFETTO_BUILDFLAG(PERFETTO_STANDALONE_BUILD)
     WriteEvent('B', evt_name, cpu);
+#endif
+    if (PERFETTO_UNLIKELY(ring_enabled_.load(std::memory_order_acquire)))
+      start_ns_ = static_cast<uint64_t>(GetBootTimeNs().count());
   }
 
-  MetaTrace(const std::string& str, size_t cpu)
-      : str_copy_(str), evt_name_(str_copy_.c_str()), cpu_(cpu) {
-    WriteEvent('B', evt_name_, cpu);
+  ~MetaTrace() {
+    if (PERFETTO_UNLIKELY(start_ns_))
+      WriteRecord();
+#if PERFETTO_DCHECK_IS_ON() && PERFETTO_BUILDFLAG(PERFETTO_STANDALONE_BUILD)
+    WriteEvent('E', evt_name_, cpu_);
+#endif
   }
 
-  ~MetaTrace() { WriteEvent('E', evt_name_, cpu_); }
+  // Returns a copy of |name| that is never freed, for names built at runtime.
+  // Takes a lock: call it once and reuse the result, not once per event.
+  static const char* InternName(const std::string& name);
+
+  // Enabling is refcounted: the rings record as long as there is one more
+  // EnableRing() call than DisableRing() calls. Returns a cursor past the
+  // events recorded so far, from which the caller can start reading with
+  // ReadRing().
+  static RingCursor EnableRing();
+  static void DisableRing();
+
+  // Appends the events recorded since |*cursor| to |records|, sorted by end
+  // time, and advances |*cursor| past them. Returns the number of events that
+  // were overwritten or dropped before they could be read.
+  static uint64_t ReadRing(RingCursor* cursor, std::vector<Record>* records);
 
  private:
   MetaTrace(const MetaTrace&) = delete;
   MetaTrace& operator=(const MetaTrace&) = delete;
 
   void WriteEvent(char type, const char* evt_name, size_t cpu);
+  void WriteRecord();
+
+  static std::atomic<bool> ring_enabled_;
 
-  std::string str_copy_;
   const char* const evt_name_;
   const size_t cpu_;
+  uint64_t start_ns_ = 0;
 };
 
 #define PERFETTO_METATRACE_UID2(a, b) a##b
 #define PERFETTO_METATRACE_UID(x) PERFETTO_METATRACE_UID2(metatrace_, x)
-#if PERFETTO_DCHECK_IS_ON() && PERFETTO_BUILDFLAG(PERFETTO_STANDALONE_BUILD)
-
 #define PERFETTO_METATRACE(...) \
   ::perfetto::base::MetaTrace PERFETTO_METATRACE_UID(__COUNTER__)(__VA_ARGS__)
-#else
-#define PERFETTO_METATRACE(...) ::perfetto::base::ignore_result(__VA_ARGS__)
-#endif
 
 }  // namespace base
 }  // namespace perfetto
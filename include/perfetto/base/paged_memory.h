@@ -53,13 +53,38 @@ class PagedMemory {
     // reserved and the user should call EnsureCommitted() before writing to
     // memory addresses.
     kDontCommit = 1 << 1,
+
+    // Linux/Android only, ignored elsewhere. Aligns the memory to
+    // kHugePageSize and asks for transparent huge pages (MADV_HUGEPAGE), to
+    // reduce TLB misses on large buffers. Only effective if the system-wide
+    // THP mode is "madvise" or "always". Pages are then committed in
+    // kHugePageSize chunks.
+    kHugePages = 1 << 2,
+
+    // Linux/Android only, ignored elsewhere. Backs the memory with explicitly
+    // reserved huge pages (MAP_HUGETLB). |size| must be a multiple of
+    // kHugePageSize. There are no guard regions, and AdviseDontNeed() is a
+    // NOP. Falls back to kHugePages if no huge pages are reserved
+    // (/proc/sys/vm/nr_hugepages).
+    kHugeTlb = 1 << 3,
   };
 
+  // The default huge page size on x86_64 and arm64.
+  static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+  // For the |numa_node| argument of Allocate().
+  static constexpr int kAnyNumaNode = -1;
+
   // Allocates |size| bytes using mmap(MAP_ANONYMOUS). The returned memory is
   // guaranteed to be page-aligned and guaranteed to be zeroed. |size| must be a
   // multiple of 4KB (a page size). For |flags|, see the AllocationFlags enum
   // above.
-  static PagedMemory Allocate(size_t size, int flags = 0);
+  // On Linux/Android, a |numa_node| other than kAnyNumaNode makes the kernel
+  // allocate the pages from that node when it has free memory
+  // (MPOL_PREFERRED), e.g. the node of the threads that mostly access them.
+  static PagedMemory Allocate(size_t size,
+                              int flags = 0,
+                              int numa_node = kAnyNumaNode);
 
   // Hint to the OS that the memory range is not needed and can be discarded.
   // The memory remains accessible and its contents may be retained, or they
@@ -89,6 +114,7 @@ class PagedMemory {
 
   char* p_ = nullptr;
   size_t size_ = 0;
+  bool huge_tlb_ = false;  // Mapped with MAP_HUGETLB, without guard regions.
 
 #if TRACK_COMMITTED_SIZE()
   size_t committed_size_ = 0u;
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_BASE_SMALL_VECTOR_H_
+#define INCLUDE_PERFETTO_BASE_SMALL_VECTOR_H_
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace base {
+
+// Vector that stores up to |N| elements inline, and moves them to the heap
+// when it grows past that. Meant for short lists that are built and thrown
+// away on hot paths (e.g. the frames of a callstack, the fields of an event),
+// where the malloc() of a std::vector would dominate.
+// Like for std::vector, push_back() and emplace_back() invalidate pointers and
+// iterators when the size exceeds the capacity. Unlike std::vector, moving a
+// SmallVector with inline storage moves the elements one by one, so pointers
+// to them are invalidated by moves too.
+template <typename T, size_t N>
+class SmallVector {
+  static_assert(N > 0, "Use std::vector if there is no inline storage");
+
+ public:
+  using value_type = T;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  SmallVector() = default;
+
+  SmallVector(const SmallVector& other) { CopyFrom(other); }
+
+  SmallVector& operator=(const SmallVector& other) {
+    if (this != &other) {
+      clear();
+      CopyFrom(other);
+    }
+    return *this;
+  }
+
+  SmallVector(SmallVector&& other) noexcept { MoveFrom(&other); }
+
+  SmallVector& operator=(SmallVector&& other) noexcept {
+    if (this != &other) {
+      clear();
+      FreeHeap();
+      MoveFrom(&other);
+    }
+    return *this;
+  }
+
+  ~SmallVector() {
+    clear();
+    FreeHeap();
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    if (size_ == capacity_)
+      return GrowAndEmplaceBack(std::forward<Args>(args)...);
+    T* slot = &begin_[size_];
+    new (slot) T(std::forward<Args>(args)...);
+    size_++;
+    return *slot;
+  }
+
+  void push_back(const T& value) { emplace_back(value); }
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+  void pop_back() {
+    PERFETTO_DCHECK(size_ > 0);
+    begin_[--size_].~T();
+  }
+
+  // Destroys the elements but keeps the capacity, so that the vector can be
+  // refilled without allocating.
+  void clear() {
+    for (size_t i = 0; i < size_; i++)
+      begin_[i].~T();
+    size_ = 0;
+  }
+
+  void reserve(size_t n) {
+    if (n > capacity_)
+      Grow(n);
+  }
+
+  T& operator[](size_t i) {
+    PERFETTO_DCHECK(i < size_);
+    return begin_[i];
+  }
+  const T& operator[](size_t i) const {
+    PERFETTO_DCHECK(i < size_);
+    return begin_[i];
+  }
+
+  T& back() { return (*this)[size_ - 1]; }
+  const T& back() const { return (*this)[size_ - 1]; }
+
+  T* data() { return begin_; }
+  const T* data() const { return begin_; }
+  iterator begin() { return begin_; }
+  iterator end() { return begin_ + size_; }
+  const_iterator begin() const { return begin_; }
+  const_iterator end() const { return begin_ + size_; }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return capacity_; }
+  bool is_inline() const { return begin_ == InlineStorage(); }
+
+ private:
+  T* InlineStorage() { return reinterpret_cast<T*>(&inline_storage_); }
+  const T* InlineStorage() const {
+    return reinterpret_cast<const T*>(&inline_storage_);
+  }
+
+  // |args| can refer to an element of the vector (e.g. v.push_back(v[0])), so
+  // the new element is constructed before the old ones are moved and freed.
+  template <typename... Args>
+  T& GrowAndEmplaceBack(Args&&... args) {
+    size_t new_capacity = capacity_ * 2;
+    T* new_begin = Allocate(new_capacity);
+    T* slot = &new_begin[size_];
+    new (slot) T(std::forward<Args>(args)...);
+    MoveTo(new_begin, new_capacity);
+    size_++;
+    return *slot;
+  }
+
+  void Grow(size_t new_capacity) {
+    PERFETTO_DCHECK(new_capacity > capacity_);
+    MoveTo(Allocate(new_capacity), new_capacity);
+  }
+
+  static T* Allocate(size_t capacity) {
+    size_t malloc_size = capacity * sizeof(T);
+    PERFETTO_CHECK(malloc_size / sizeof(T) == capacity);
+    T* storage = static_cast<T*>(malloc(malloc_size));
+    PERFETTO_CHECK(storage);
+    return storage;
+  }
+
+  // Moves the elements to |new_begin| and frees the old storage.
+  void MoveTo(T* new_begin, size_t new_capacity) {
+    for (size_t i = 0; i < size_; i++) {
+      new (&new_begin[i]) T(std::move(begin_[i]));  // Placement move ctor.
+      begin_[i].~T();
+    }
+    FreeHeap();
+    begin_ = new_begin;
+    capacity_ = new_capacity;
+  }
+
+  void FreeHeap() {
+    if (!is_inline())
+      free(begin_);
+    begin_ = InlineStorage();
+    capacity_ = N;
+  }
+
+  // Both assume that |this| is empty and uses the inline storage.
+  void CopyFrom(const SmallVector& other) {
+    reserve(other.size_);
+    for (const T& value : other)
+      new (&begin_[size_++]) T(value);
+  }
+
+  void MoveFrom(SmallVector* other) {
+    if (other->is_inline()) {
+      for (T& value : *other)
+        new (&begin_[size_++]) T(std::move(value));
+      other->clear();
+      return;
+    }
+    // Steal the heap buffer.
+    begin_ = other->begin_;
+    size_ = other->size_;
+    capacity_ = other->capacity_;
+    other->begin_ = other->InlineStorage();
+    other->size_ = 0;
+    other->capacity_ = N;
+  }
+
+  T* begin_ = InlineStorage();
+  size_t size_ = 0;
+  size_t capacity_ = N;
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type inline_storage_[N];
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_BASE_SMALL_VECTOR_H_
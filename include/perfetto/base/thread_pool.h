@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_BASE_THREAD_POOL_H_
+#define INCLUDE_PERFETTO_BASE_THREAD_POOL_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace perfetto {
+namespace base {
+
+class TaskRunner;
+
+// A fixed set of worker threads that run CPU-bound tasks in parallel, to be
+// shared by the subsystems that would otherwise spawn their own threads.
+//
+// Each worker has its own queue. Tasks posted from a worker go to its own
+// queue, where they are picked up LIFO while their data is still in cache.
+// Tasks posted from other threads are spread round-robin. Idle workers steal
+// the oldest tasks from the other queues.
+//
+// Unlike a TaskRunner, there are no ordering guarantees between tasks. Tasks
+// must not block on I/O or on each other, other than through TaskGroup::Wait()
+// (which runs queued tasks while waiting).
+//
+// With zero workers, tasks only run on the threads that call TaskGroup::Wait().
+// This is what platforms without threads (i.e. WASM) should use.
+class ThreadPool {
+ public:
+  // Number of workers that keeps all the cores busy, counting the thread that
+  // waits for the results: hardware_concurrency() - 1.
+  static size_t DefaultNumWorkers();
+
+  explicit ThreadPool(size_t num_workers = DefaultNumWorkers());
+
+  // Runs all the tasks that are still queued, then joins the workers.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Can be called from any thread, including from tasks.
+  void PostTask(std::function<void()> task);
+
+  size_t num_workers() const { return threads_.size(); }
+
+ private:
+  friend class TaskGroup;
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void RunWorker(size_t index);
+
+  // Pops a task from the queue of the worker |index| (if it is a worker of
+  // this pool), or steals one from the other queues.
+  bool TryPopTask(size_t index, std::function<void()>* task);
+
+  // Index of the worker running on the calling thread, or num_workers().
+  size_t CurrentWorkerIndex() const;
+
+  // One queue per worker, plus one for the pools without workers.
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_queue_{0};
+
+  // Number of queued tasks. Incremented before a task is queued and
+  // decremented after it's popped, so it never underflows.
+  std::atomic<size_t> pending_tasks_{0};
+
+  // Only taken to sleep on and notify the condition variables, and to finish
+  // the TaskGroups of this pool. The threads that sleep are counted, so that
+  // PostTask() only takes it when there is someone to wake up.
+  std::mutex mutex_;
+  std::condition_variable worker_cv_;
+  std::condition_variable waiter_cv_;
+  std::atomic<size_t> num_sleeping_workers_{0};
+  std::atomic<size_t> num_waiters_{0};
+  bool quit_ = false;  // Guarded by |mutex_|.
+};
+
+// Tracks a set of tasks posted on a ThreadPool, to wait for them, cancel them,
+// or be notified on a TaskRunner when they are done. Not thread-safe: all the
+// methods must be called on the same thread, but not from the tasks of the
+// group, which can only poll is_cancelled() and PostTask() more tasks to the
+// group (e.g. to walk a tree without knowing its size upfront).
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool* pool);
+
+  // Cancels the tasks that have not started yet, and waits for the others.
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  void PostTask(std::function<void()> task);
+
+  // Calls |fn| for each index in [begin, end), in parallel. The range is split
+  // in chunks of |grain| consecutive indexes, which run in order on the same
+  // thread. A |grain| of 0 picks one that gives a few chunks per worker.
+  // Indexes are skipped once the group is cancelled.
+  void ParallelFor(size_t begin,
+                   size_t end,
+                   std::function<void(size_t)> fn,
+                   size_t grain = 0);
+
+  // Cooperative cancellation: the tasks that have not started yet are dropped,
+  // the running ones are expected to poll is_cancelled() and return early.
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  bool is_cancelled() const {
+    return cancelled_.load(std::memory_order_relaxed);
+  }
+
+  // Blocks until all the tasks posted so far are done (or dropped), running
+  // queued tasks of the pool in the meantime.
+  void Wait();
+
+  // Posts |callback| on |task_runner| once all the tasks posted so far are
+  // done, or right away if there are none. Both must outlive the tasks.
+  void PostWhenDone(TaskRunner* task_runner, std::function<void()> callback);
+
+ private:
+  void OnTaskDone();
+
+  ThreadPool* const pool_;
+  std::atomic<bool> cancelled_{false};
+
+  // Only drops to 0 with |pool_->mutex_| held, so that the group is not used
+  // anymore once Wait() or PostWhenDone() observe it under the lock.
+  std::atomic<size_t> outstanding_tasks_{0};
+  // Guarded by |pool_->mutex_|.
+  std::vector<std::pair<TaskRunner*, std::function<void()>>> done_callbacks_;
+};
+
+// Calls |fn| for each index in [begin, end) on |pool|, with the calling thread
+// helping, and returns once all of them are done.
+void ParallelFor(ThreadPool* pool,
+                 size_t begin,
+                 size_t end,
+                 std::function<void(size_t)> fn,
+                 size_t grain = 0);
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_BASE_THREAD_POOL_H_
@@ -39,6 +39,62 @@ namespace protozero {
 
 class MessageHandleBase;
 
+// Encodes fields into a contiguous span of the stream reserved by
+// Message::BeginReservedWrite(), without the per-field bounds checks of the
+// Message::Append*() methods. Evaluates to false if the reservation failed.
+class ReservedFieldWriter {
+ public:
+  ReservedFieldWriter() = default;
+
+  explicit operator bool() const { return write_ptr_ != nullptr; }
+
+  // Number of bytes written so far.
+  size_t size() const { return static_cast<size_t>(write_ptr_ - begin_); }
+
+  template <typename T>
+  void AppendVarInt(uint32_t field_id, T value) {
+    write_ptr_ = proto_utils::WriteVarInt(proto_utils::MakeTagVarInt(field_id),
+                                          write_ptr_);
+    write_ptr_ = proto_utils::WriteVarInt(value, write_ptr_);
+    PERFETTO_DCHECK(write_ptr_ <= end_);
+  }
+
+  template <typename T>
+  void AppendSignedVarInt(uint32_t field_id, T value) {
+    AppendVarInt(field_id, proto_utils::ZigZagEncode(value));
+  }
+
+  template <typename T>
+  void AppendFixed(uint32_t field_id, T value) {
+    write_ptr_ = proto_utils::WriteVarInt(
+        proto_utils::MakeTagFixed<T>(field_id), write_ptr_);
+    memcpy(write_ptr_, &value, sizeof(T));
+    write_ptr_ += sizeof(T);
+    PERFETTO_DCHECK(write_ptr_ <= end_);
+  }
+
+  void AppendBytes(uint32_t field_id, const void* src, size_t size) {
+    PERFETTO_DCHECK(size < proto_utils::kMaxMessageLength);
+    write_ptr_ = proto_utils::WriteVarInt(
+        proto_utils::MakeTagLengthDelimited(field_id), write_ptr_);
+    write_ptr_ =
+        proto_utils::WriteVarInt(static_cast<uint32_t>(size), write_ptr_);
+    PERFETTO_DCHECK(write_ptr_ + size <= end_);
+    memcpy(write_ptr_, src, size);
+    write_ptr_ += size;
+  }
+
+ private:
+  friend class Message;
+
+  ReservedFieldWriter(uint8_t* begin, uint8_t* end)
+      : begin_(begin), write_ptr_(begin), end_(end) {}
+
+  uint8_t* begin_ = nullptr;
+  uint8_t* write_ptr_ = nullptr;
+  uint8_t* end_ = nullptr;  // Only used by DCHECKs.
+};
+
 // Base class extended by the proto C++ stubs generated by the ProtoZero
 // compiler. This class provides the minimal runtime required to support
 // append-only operations and is designed for performance. None of the methods
@@ -53,6 +109,10 @@ class PERFETTO_EXPORT Message {
   // static_assert in the .cc file will bark.
   static constexpr uint32_t kMaxNestingDepth = 10;
 
+  // Number of values of a packed field encoded on the stack before being
+  // written to the stream.
+  static constexpr size_t kPackedBatchSize = 32;
+
   // Ctor and Dtor of Message are never called, with the exeception
   // of root (non-nested) messages. Nested messages are allocated via placement
   // new in the |nested_messages_arena_| and implictly destroyed when the arena
@@ -143,6 +203,72 @@ class PERFETTO_EXPORT Message {
     WriteToStream(buffer, pos);
   }
 
+  // Proto types: repeated (u)int(32|64), bool, enum with [packed = true].
+  // Writes all the |values| as a single length-delimited field, which costs
+  // one tag for the whole array rather than one per element. The length is
+  // reserved and backfilled like the size of a nested message, so the values
+  // are encoded in a single pass. Calling this several times for the same
+  // field appends to it, as readers concatenate all the runs.
+  template <typename T>
+  void AppendPackedVarInts(uint32_t field_id, const T* values, size_t count) {
+    // bool has no unsigned counterpart for WriteVarInt().
+    using VarIntType =
+        typename std::conditional<std::is_same<T, bool>::value, uint8_t,
+                                  T>::type;
+    Message* packed = BeginNestedMessage<Message>(field_id);
+    uint8_t buffer[kPackedBatchSize * proto_utils::kMaxVarIntEncodedSize];
+    for (size_t i = 0; i < count;) {
+      uint8_t* pos = buffer;
+      size_t batch_end = count - i > kPackedBatchSize ? i + kPackedBatchSize
+                                                      : count;
+      for (; i < batch_end; ++i)
+        pos = proto_utils::WriteVarInt(static_cast<VarIntType>(values[i]), pos);
+      packed->WriteToStream(buffer, pos);
+    }
+  }
+
+  // Proto types: repeated fixed64, sfixed64, fixed32, sfixed32, double, float
+  // with [packed = true]. See AppendPackedVarInts().
+  template <typename T>
+  void AppendPackedFixed(uint32_t field_id, const T* values, size_t count) {
+    static_assert(sizeof(T) == 8 || sizeof(T) == 4,
+                  "Value must be 4 or 8 bytes");
+    Message* packed = BeginNestedMessage<Message>(field_id);
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(values);
+    packed->WriteToStream(src, src + count * sizeof(T));
+  }
+
+  // Fast path for hot emitters of many small fields, e.g. the fields of one
+  // ftrace event. Reserves |max_size| contiguous bytes in the current chunk,
+  // which must be an upper bound of the encoded size of all the fields that
+  // will be appended through the returned writer. Returns an invalid writer if
+  // the current chunk has less than |max_size| bytes left, in which case the
+  // caller must fall back on the Append*() methods above. The bytes actually
+  // written are committed by EndReservedWrite(). No other method of this
+  // message can be called in between. Example usage:
+  // if (auto writer = msg->BeginReservedWrite(kMaxSize)) {
+  //   writer.AppendVarInt(1, x); ...
+  //   msg->EndReservedWrite(writer);
+  // } else {
+  //   msg->AppendVarInt(1, x); ...
+  // }
+  ReservedFieldWriter BeginReservedWrite(size_t max_size) {
+    if (nested_message_)
+      EndNestedMessage();
+    PERFETTO_DCHECK(!finalized_);
+    if (PERFETTO_UNLIKELY(stream_writer_->bytes_available() < max_size))
+      return ReservedFieldWriter();
+    uint8_t* begin = stream_writer_->write_ptr();
+    return ReservedFieldWriter(begin, begin + max_size);
+  }
+
+  void EndReservedWrite(const ReservedFieldWriter& writer) {
+    PERFETTO_DCHECK(writer && writer.begin_ == stream_writer_->write_ptr());
+    const size_t size = writer.size();
+    stream_writer_->ReserveBytesUnsafe(size);
+    size_ += static_cast<uint32_t>(size);
+  }
+
   void AppendString(uint32_t field_id, const char* str);
   void AppendBytes(uint32_t field_id, const void* value, size_t size);
 
@@ -18,8 +18,11 @@
 #define INCLUDE_PERFETTO_PROTOZERO_PROTO_DECODER_H_
 
 #include <stdint.h>
+#include <string.h>
+
 #include <array>
 #include <memory>
+#include <type_traits>
 #include <vector>
 
 #include "perfetto/base/logging.h"
@@ -144,6 +147,126 @@ class RepeatedFieldIterator {
   const Field* last_;
 };
 
+// Iterates over the values of a packed repeated field ([packed = true])
+// without allocating. |wire_type| is the encoding of the values (kVarInt,
+// kFixed32 or kFixed64). Used by TypedProtoDecoder. Example usage:
+// bool parse_error = false;
+// for (auto it = decoder.field(&parse_error); it; ++it) { ... *it ... }
+// if (parse_error) { ... }
+// As for any proto parser, every occurrence of the field is iterated, in
+// order: both packed runs (length-delimited fields whose payload is the
+// concatenation of the encoded values) and single values written with the
+// unpacked encoding. The iteration stops early and |*parse_error_ptr| is set if
+// a packed run is truncated or an occurrence has any other wire type.
+template <proto_utils::ProtoWireType wire_type, typename CppType>
+class PackedRepeatedFieldIterator {
+ public:
+  PackedRepeatedFieldIterator(RepeatedFieldIterator field_it,
+                              bool* parse_error_ptr)
+      : field_it_(field_it), parse_error_ptr_(parse_error_ptr) {
+    static_assert(wire_type == proto_utils::ProtoWireType::kVarInt ||
+                      wire_type == proto_utils::ProtoWireType::kFixed32 ||
+                      wire_type == proto_utils::ProtoWireType::kFixed64,
+                  "Only scalar fields can be packed");
+    PERFETTO_DCHECK(parse_error_ptr_);
+    ++(*this);
+  }
+
+  inline CppType operator*() const { return value_; }
+  inline explicit operator bool() const { return valid_; }
+
+  PackedRepeatedFieldIterator& operator++() {
+    for (;;) {
+      if (read_ptr_ < end_) {
+        valid_ = ReadValue(WireTypeTag());
+        if (PERFETTO_UNLIKELY(!valid_))
+          Fail();
+        return *this;
+      }
+      if (!field_it_ || failed_) {
+        valid_ = false;
+        return *this;
+      }
+      const Field& field = *field_it_;
+      ++field_it_;
+      if (field.type() == proto_utils::ProtoWireType::kLengthDelimited) {
+        read_ptr_ = field.data();
+        end_ = field.data() + field.size();
+        continue;  // The run can be empty.
+      }
+      if (PERFETTO_UNLIKELY(field.type() != wire_type)) {
+        Fail();
+        valid_ = false;
+        return *this;
+      }
+      SetValue(field.as_uint64(), WireTypeTag());
+      valid_ = true;
+      return *this;
+    }
+  }
+
+ private:
+  using WireTypeTag = std::integral_constant<proto_utils::ProtoWireType,
+                                             wire_type>;
+  using VarIntTag = std::integral_constant<proto_utils::ProtoWireType,
+                                           proto_utils::ProtoWireType::kVarInt>;
+
+  template <typename Tag>
+  static constexpr size_t FixedSize(Tag) {
+    return Tag::value == proto_utils::ProtoWireType::kFixed64 ? 8 : 4;
+  }
+
+  inline void Fail() {
+    *parse_error_ptr_ = true;
+    failed_ = true;
+    read_ptr_ = end_;
+  }
+
+  inline bool ReadValue(VarIntTag) {
+    uint64_t value;
+    const uint8_t* next = proto_utils::ParseVarInt(read_ptr_, end_, &value);
+    if (PERFETTO_UNLIKELY(next == read_ptr_))
+      return false;
+    read_ptr_ = next;
+    value_ = static_cast<CppType>(value);
+    return true;
+  }
+
+  template <typename FixedTag>
+  inline bool ReadValue(FixedTag tag) {
+    constexpr size_t kSize = FixedSize(tag);
+    static_assert(sizeof(CppType) == kSize, "Value must match the wire type");
+    if (PERFETTO_UNLIKELY(static_cast<size_t>(end_ - read_ptr_) < kSize))
+      return false;
+    memcpy(&value_, read_ptr_, kSize);
+    read_ptr_ += kSize;
+    return true;
+  }
+
+  // Sets |value_| from the value of an unpacked occurrence of the field, as
+  // stored by Field.
+  inline void SetValue(uint64_t value, VarIntTag) {
+    value_ = static_cast<CppType>(value);
+  }
+
+  template <typename FixedTag>
+  inline void SetValue(uint64_t value, FixedTag tag) {
+    constexpr size_t kSize = FixedSize(tag);
+    uint32_t value32 = static_cast<uint32_t>(value);
+    memcpy(&value_, kSize == 4 ? static_cast<const void*>(&value32) : &value,
+           kSize);
+  }
+
+  RepeatedFieldIterator field_it_;
+  // The rest of the packed run being iterated, if any.
+  const uint8_t* read_ptr_ = nullptr;
+  const uint8_t* end_ = nullptr;
+  bool* const parse_error_ptr_;
+  CppType value_{};
+  bool valid_ = false;
+  bool failed_ = false;
+};
+
 // This decoder loads all fields upfront, without recursing in nested messages.
 // It is used as a base class for typed decoders generated by the pbzero plugin.
 // The split between TypedProtoDecoderBase and TypedProtoDecoder<> is to have
@@ -170,6 +293,23 @@ class TypedProtoDecoderBase : public ProtoDecoder {
                                  &fields_[size_], &fields_[field_id]);
   }
 
+  // Returns an iterator over the values of the packed repeated field |id|,
+  // see PackedRepeatedFieldIterator. Example:
+  // GetPackedRepeated<proto_utils::ProtoWireType::kVarInt, uint64_t>(N, &err)
+  template <proto_utils::ProtoWireType wire_type, typename CppType>
+  inline PackedRepeatedFieldIterator<wire_type, CppType> GetPackedRepeated(
+      uint32_t field_id,
+      bool* parse_error_ptr) const {
+    // Fields with higher ids are never stored, fields_[0] is always invalid.
+    const Field* last = PERFETTO_LIKELY(field_id < num_fields_)
+                            ? &fields_[field_id]
+                            : &fields_[0];
+    return PackedRepeatedFieldIterator<wire_type, CppType>(
+        RepeatedFieldIterator(field_id, &fields_[num_fields_], &fields_[size_],
+                              last),
+        parse_error_ptr);
+  }
+
  protected:
   TypedProtoDecoderBase(Field* storage,
                         uint32_t num_fields,
@@ -262,6 +402,124 @@ class TypedProtoDecoder : public TypedProtoDecoderBase {
   Field on_stack_storage_[kCapacity];
 };
 
+// Iterates over all the occurrences of a field by re-scanning the message,
+// without storing them. Used by LazyProtoDecoder. Unlike RepeatedFieldIterator
+// the values are visited in the order they appear in the buffer.
+class StreamingRepeatedFieldIterator {
+ public:
+  StreamingRepeatedFieldIterator(uint32_t field_id,
+                                 const uint8_t* buffer,
+                                 size_t length)
+      : decoder_(buffer, length), field_id_(field_id) {
+    ++(*this);
+  }
+
+  inline const Field* operator->() const { return &field_; }
+  inline const Field& operator*() const { return field_; }
+  inline explicit operator bool() const { return field_.valid(); }
+
+  StreamingRepeatedFieldIterator& operator++() {
+    do {
+      field_ = decoder_.ReadField();
+    } while (field_.valid() && field_.id() != field_id_);
+    return *this;
+  }
+
+ private:
+  ProtoDecoder decoder_;
+  uint32_t field_id_;
+  Field field_;
+};
+
+// A decoder for large messages of which only a few fields are read. Rather than
+// tokenizing the whole message upfront like TypedProtoDecoder, Get(id) resumes
+// the scan where the previous call stopped and returns as soon as it meets
+// |id|, remembering the first occurrence of all the fields met on the way.
+// Hence every byte is tokenized at most once, and the tail of the message is
+// not tokenized at all if the fields looked up come before it.
+// Repeated fields are not stored: GetRepeated() scans the message on each
+// iteration instead. This makes the decoder cheap to construct (no large
+// on-stack storage to clear, no heap expansion) for messages with thousands
+// of repeated fields, e.g. FtraceEventBundle.
+// Note that Get() returns the *first* occurrence of a field, whereas
+// TypedProtoDecoder returns the last one. The two match for non-repeated
+// fields, which are written only once by protozero.
+class LazyProtoDecoderBase {
+ public:
+  // Returns the first occurrence of the field |id|, or an invalid Field if the
+  // message doesn't contain it.
+  Field Get(uint32_t id);
+
+  // Returns an object that allows to iterate over all instances of a repeated
+  // field given its id, in the order they appear in the message. Example:
+  // for (auto it = decoder.GetRepeated(N); it; ++it) { ... }
+  inline StreamingRepeatedFieldIterator GetRepeated(uint32_t field_id) const {
+    return StreamingRepeatedFieldIterator(
+        field_id, begin_, static_cast<size_t>(end_ - begin_));
+  }
+
+  const uint8_t* begin() const { return begin_; }
+  const uint8_t* end() const { return end_; }
+
+ protected:
+  LazyProtoDecoderBase(Field* fields,
+                       uint64_t* found_bitmap,
+                       uint32_t num_fields,
+                       const uint8_t* buffer,
+                       size_t length)
+      : begin_(buffer),
+        end_(buffer + length),
+        scan_ptr_(buffer),
+        fields_(fields),
+        found_bitmap_(found_bitmap),
+        num_fields_(num_fields) {
+    static_assert(std::is_trivial<Field>::value,
+                  "Field must be a trivial aggregate type");
+    // Only the bitmap is cleared, |fields_| entries are written before being
+    // marked as found.
+    memset(found_bitmap_, 0, sizeof(uint64_t) * ((num_fields_ + 63) / 64));
+  }
+
+ private:
+  inline bool IsFound(uint32_t id) const {
+    return found_bitmap_[id / 64] & (uint64_t(1) << (id % 64));
+  }
+
+  const uint8_t* const begin_;
+  const uint8_t* const end_;
+
+  // Position of the first field that hasn't been tokenized yet.
+  const uint8_t* scan_ptr_;
+
+  // First occurrence of each field id, valid only if set in |found_bitmap_|.
+  Field* fields_;
+  uint64_t* found_bitmap_;
+
+  // MAX_FIELD_ID + 1. Fields with higher ids are skipped by Get().
+  uint32_t num_fields_;
+};
+
+template <int MAX_FIELD_ID>
+class LazyProtoDecoder : public LazyProtoDecoderBase {
+ public:
+  LazyProtoDecoder(const uint8_t* buffer, size_t length)
+      : LazyProtoDecoderBase(fields_storage_,
+                             found_bitmap_storage_,
+                             /*num_fields=*/MAX_FIELD_ID + 1,
+                             buffer,
+                             length) {}
+
+  template <uint32_t FIELD_ID>
+  inline Field at() {
+    static_assert(FIELD_ID <= MAX_FIELD_ID, "FIELD_ID > MAX_FIELD_ID");
+    return Get(FIELD_ID);
+  }
+
+ private:
+  Field fields_storage_[MAX_FIELD_ID + 1];
+  uint64_t found_bitmap_storage_[(MAX_FIELD_ID + 1 + 63) / 64];
+};
+
 }  // namespace protozero
 
 #endif  // INCLUDE_PERFETTO_PROTOZERO_PROTO_DECODER_H_
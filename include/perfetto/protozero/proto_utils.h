@@ -19,6 +19,7 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <string.h>
 
 #include <type_traits>
 
@@ -116,7 +117,9 @@ constexpr size_t kMaxMessageLength = (1u << (kMessageLengthFieldSize * 7)) - 1;
 // Largest value of simple (not length-delimited) field is 64-bit varint
 // (10 bytes at most). 15 bytes buffer is enough to store a simple field.
 constexpr size_t kMaxTagEncodedSize = 5;
-constexpr size_t kMaxSimpleFieldEncodedSize = kMaxTagEncodedSize + 10;
+constexpr size_t kMaxVarIntEncodedSize = 10;
+constexpr size_t kMaxSimpleFieldEncodedSize =
+    kMaxTagEncodedSize + kMaxVarIntEncodedSize;
 
 // Proto types: (int|uint|sint)(32|64), bool, enum.
 constexpr uint32_t MakeTagVarInt(uint32_t field_id) {
@@ -196,14 +199,15 @@ void StaticAssertSingleBytePreamble() {
 }
 
 // Parses a VarInt from the encoded buffer [start, end). |end| is STL-style and
-// points one byte past the end of buffer.
+// points one byte past the end of buffer. Decodes one byte at a time, see
+// ParseVarInt() below for the fast path.
 // The parsed int value is stored in the output arg |value|. Returns a pointer
 // to the next unconsumed byte (so start < retval <= end) or |start| if the
 // VarInt could not be fully parsed because there was not enough space in the
 // buffer.
-inline const uint8_t* ParseVarInt(const uint8_t* start,
-                                  const uint8_t* end,
-                                  uint64_t* value) {
+inline const uint8_t* ParseVarIntSlow(const uint8_t* start,
+                                      const uint8_t* end,
+                                      uint64_t* value) {
   const uint8_t* pos = start;
   uint64_t shift = 0;
   *value = 0;
@@ -219,6 +223,45 @@ inline const uint8_t* ParseVarInt(const uint8_t* start,
   return pos;
 }
 
+// Same contract as ParseVarIntSlow(). Single-byte VarInts (most field tags and
+// small values) are returned straight away. Longer VarInts of up to 8 bytes
+// (56 bits), when at least 8 bytes are left in the buffer, are decoded from a
+// single unaligned little-endian load without a loop: the first clear MSB
+// marks the last byte, and the 7-bit groups are then compacted pairwise.
+inline const uint8_t* ParseVarInt(const uint8_t* start,
+                                  const uint8_t* end,
+                                  uint64_t* value) {
+  if (PERFETTO_LIKELY(start < end && *start < 0x80)) {
+    *value = *start;
+    return start + 1;
+  }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (PERFETTO_LIKELY(end - start >= 8)) {
+    uint64_t word;
+    memcpy(&word, start, sizeof(word));
+    // One bit set for each byte without the continuation bit.
+    const uint64_t stop_bits = ~word & 0x8080808080808080ull;
+    if (PERFETTO_LIKELY(stop_bits)) {
+      // Keeps the bytes up to and including the first one without the
+      // continuation bit, and drops the continuation bits.
+      word &= (stop_bits ^ (stop_bits - 1)) & 0x7f7f7f7f7f7f7f7full;
+      const size_t size =
+          static_cast<size_t>(__builtin_ctzll(stop_bits)) / 8 + 1;
+      // 8 x 7 bits in 8 x 8 -> 4 x 14 bits in 4 x 16 -> 2 x 28 in 2 x 32 -> 56.
+      word = ((word & 0x7f007f007f007f00ull) >> 1) |
+             (word & 0x007f007f007f007full);
+      word = ((word & 0x3fff00003fff0000ull) >> 2) |
+             (word & 0x00003fff00003fffull);
+      word = ((word & 0x0fffffff00000000ull) >> 4) |
+             (word & 0x000000000fffffffull);
+      *value = word;
+      return start + size;
+    }
+  }
+#endif
+  return ParseVarIntSlow(start, end, value);
+}
+
 }  // namespace proto_utils
 }  // namespace protozero
 
@@ -19,12 +19,19 @@
 
 #include <stdint.h>
 
+#include <string>
+
 namespace perfetto {
 namespace trace_processor {
 
 
 struct Config {
   uint64_t window_size_ns = 180 * 1000 * 1000 * 1000ULL;  // 3 minutes.
+
+  // If set, the heap profile frames without a function name are symbolized
+  // when NotifyEndOfFile() is called, using the unstripped ELF files in this
+  // directory (and its subdirectories) that have the build id of the mapping.
+  std::string symbol_dir;
 };
 
 // Represents a dynamically typed value returned by SQL.
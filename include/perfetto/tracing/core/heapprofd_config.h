@@ -71,9 +71,13 @@ class PERFETTO_EXPORT HeapprofdConfig {
     uint32_t dump_interval_ms() const { return dump_interval_ms_; }
     void set_dump_interval_ms(uint32_t value) { dump_interval_ms_ = value; }
 
+    bool incremental() const { return incremental_; }
+    void set_incremental(bool value) { incremental_ = value; }
+
    private:
     uint32_t dump_phase_ms_ = {};
     uint32_t dump_interval_ms_ = {};
+    bool incremental_ = {};
 
     // Allows to preserve unknown protobuf fields for compatibility
     // with future versions of .proto files.
@@ -155,6 +159,9 @@ class PERFETTO_EXPORT HeapprofdConfig {
   bool block_client() const { return block_client_; }
   void set_block_client(bool value) { block_client_ = value; }
 
+  bool adaptive_stack_copy() const { return adaptive_stack_copy_; }
+  void set_adaptive_stack_copy(bool value) { adaptive_stack_copy_ = value; }
+
  private:
   uint64_t sampling_interval_bytes_ = {};
   std::vector<std::string> process_cmdline_;
@@ -164,6 +171,7 @@ class PERFETTO_EXPORT HeapprofdConfig {
   ContinuousDumpConfig continuous_dump_config_ = {};
   uint64_t shmem_size_bytes_ = {};
   bool block_client_ = {};
+  bool adaptive_stack_copy_ = {};
 
   // Allows to preserve unknown protobuf fields for compatibility
   // with future versions of .proto files.
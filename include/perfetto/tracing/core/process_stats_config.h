@@ -93,12 +93,16 @@ class PERFETTO_EXPORT ProcessStatsConfig {
     proc_stats_cache_ttl_ms_ = value;
   }
 
+  bool use_proc_connector() const { return use_proc_connector_; }
+  void set_use_proc_connector(bool value) { use_proc_connector_ = value; }
+
  private:
   std::vector<Quirks> quirks_;
   bool scan_all_processes_on_start_ = {};
   bool record_thread_names_ = {};
   uint32_t proc_stats_poll_ms_ = {};
   uint32_t proc_stats_cache_ttl_ms_ = {};
+  bool use_proc_connector_ = {};
 
   // Allows to preserve unknown protobuf fields for compatibility
   // with future versions of .proto files.
@@ -100,9 +100,21 @@ class PERFETTO_EXPORT TraceConfig {
     FillPolicy fill_policy() const { return fill_policy_; }
     void set_fill_policy(FillPolicy value) { fill_policy_ = value; }
 
+    bool use_huge_pages() const { return use_huge_pages_; }
+    void set_use_huge_pages(bool value) { use_huge_pages_ = value; }
+
+    bool use_numa_node() const { return use_numa_node_; }
+    void set_use_numa_node(bool value) { use_numa_node_ = value; }
+
+    uint32_t numa_node() const { return numa_node_; }
+    void set_numa_node(uint32_t value) { numa_node_ = value; }
+
    private:
     uint32_t size_kb_ = {};
     FillPolicy fill_policy_ = {};
+    bool use_huge_pages_ = {};
+    bool use_numa_node_ = {};
+    uint32_t numa_node_ = {};
 
     // Allows to preserve unknown protobuf fields for compatibility
     // with future versions of .proto files.
@@ -203,6 +203,11 @@ class PERFETTO_EXPORT TraceStats {
   uint64_t patches_discarded() const { return patches_discarded_; }
   void set_patches_discarded(uint64_t value) { patches_discarded_ = value; }
 
+  uint64_t max_read_behind_bytes() const { return max_read_behind_bytes_; }
+  void set_max_read_behind_bytes(uint64_t value) {
+    max_read_behind_bytes_ = value;
+  }
+
  private:
   std::vector<BufferStats> buffer_stats_;
   uint32_t producers_connected_ = {};
@@ -213,6 +218,7 @@ class PERFETTO_EXPORT TraceStats {
   uint32_t total_buffers_ = {};
   uint64_t chunks_discarded_ = {};
   uint64_t patches_discarded_ = {};
+  uint64_t max_read_behind_bytes_ = {};
 
   // Allows to preserve unknown protobuf fields for compatibility
   // with future versions of .proto files.
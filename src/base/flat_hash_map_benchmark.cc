@@ -0,0 +1,132 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/flat_hash_map.h"
+
+namespace {
+
+// Thin adapters, so that the same benchmark bodies run on all the maps.
+struct FlatMap {
+  perfetto::base::FlatHashMap<uint64_t, uint64_t> map;
+  void Insert(uint64_t k, uint64_t v) { map.Insert(k, v); }
+  uint64_t* Find(uint64_t k) { return map.Find(k); }
+  void Erase(uint64_t k) { map.Erase(k); }
+};
+
+struct UnorderedMap {
+  std::unordered_map<uint64_t, uint64_t> map;
+  void Insert(uint64_t k, uint64_t v) { map.emplace(k, v); }
+  uint64_t* Find(uint64_t k) {
+    auto it = map.find(k);
+    return it == map.end() ? nullptr : &it->second;
+  }
+  void Erase(uint64_t k) { map.erase(k); }
+};
+
+struct OrderedMap {
+  std::map<uint64_t, uint64_t> map;
+  void Insert(uint64_t k, uint64_t v) { map.emplace(k, v); }
+  uint64_t* Find(uint64_t k) {
+    auto it = map.find(k);
+    return it == map.end() ? nullptr : &it->second;
+  }
+  void Erase(uint64_t k) { map.erase(k); }
+};
+
+// Heap addresses, as for the allocations tracked by heapprofd: 16-byte aligned
+// and clustered.
+std::vector<uint64_t> MakeKeys(size_t n) {
+  std::minstd_rand rnd(0);
+  std::uniform_int_distribution<uint64_t> dist(0, 1 << 28);
+  std::vector<uint64_t> keys(n);
+  for (uint64_t& key : keys)
+    key = 0x7000000000 + dist(rnd) * 16;
+  return keys;
+}
+
+void SetArgs(benchmark::internal::Benchmark* b) {
+  b->Arg(64)->Arg(4096)->Arg(1 << 18);
+}
+
+template <typename Map>
+void BM_MapInsert(benchmark::State& state) {
+  const std::vector<uint64_t> keys =
+      MakeKeys(static_cast<size_t>(state.range(0)));
+  for (auto _ : state) {
+    Map map;
+    for (uint64_t key : keys)
+      map.Insert(key, key);
+    benchmark::DoNotOptimize(map);
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * keys.size()));
+}
+
+template <typename Map>
+void BM_MapFind(benchmark::State& state) {
+  const std::vector<uint64_t> keys =
+      MakeKeys(static_cast<size_t>(state.range(0)));
+  Map map;
+  for (size_t i = 0; i < keys.size(); i += 2)
+    map.Insert(keys[i], keys[i]);
+  // Half of the lookups miss.
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (uint64_t key : keys) {
+      uint64_t* value = map.Find(key);
+      sum += value ? *value : 0;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * keys.size()));
+}
+
+// Steady state of a map of live allocations: every insertion is followed by
+// the erasure of an older key.
+template <typename Map>
+void BM_MapInsertErase(benchmark::State& state) {
+  const std::vector<uint64_t> keys =
+      MakeKeys(static_cast<size_t>(state.range(0)));
+  const size_t live = keys.size() / 2;
+  Map map;
+  for (size_t i = 0; i < live; i++)
+    map.Insert(keys[i], keys[i]);
+  size_t i = 0;
+  for (auto _ : state) {
+    map.Insert(keys[(i + live) % keys.size()], i);
+    map.Erase(keys[i % keys.size()]);
+    i++;
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_MapInsert, FlatMap)->Apply(SetArgs);
+BENCHMARK_TEMPLATE(BM_MapInsert, UnorderedMap)->Apply(SetArgs);
+BENCHMARK_TEMPLATE(BM_MapInsert, OrderedMap)->Apply(SetArgs);
+BENCHMARK_TEMPLATE(BM_MapFind, FlatMap)->Apply(SetArgs);
+BENCHMARK_TEMPLATE(BM_MapFind, UnorderedMap)->Apply(SetArgs);
+BENCHMARK_TEMPLATE(BM_MapFind, OrderedMap)->Apply(SetArgs);
+BENCHMARK_TEMPLATE(BM_MapInsertErase, FlatMap)->Apply(SetArgs);
+BENCHMARK_TEMPLATE(BM_MapInsertErase, UnorderedMap)->Apply(SetArgs);
+BENCHMARK_TEMPLATE(BM_MapInsertErase, OrderedMap)->Apply(SetArgs);
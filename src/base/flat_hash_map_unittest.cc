@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/flat_hash_map.h"
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+TEST(FlatHashMapTest, InsertFindErase) {
+  FlatHashMap<uint64_t, int> map;
+  EXPECT_EQ(map.Find(1), nullptr);
+  EXPECT_FALSE(map.Erase(1));
+
+  auto res = map.Insert(1, 10);
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ(*res.first, 10);
+  res = map.Insert(1, 20);
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(*res.first, 10);
+  EXPECT_EQ(map.size(), 1u);
+
+  map.Insert(2, 20);
+  ASSERT_NE(map.Find(2), nullptr);
+  EXPECT_EQ(*map.Find(2), 20);
+  *map.Find(2) = 21;
+  EXPECT_EQ(*map.Find(2), 21);
+
+  EXPECT_TRUE(map.Erase(1));
+  EXPECT_EQ(map.Find(1), nullptr);
+  EXPECT_EQ(*map.Find(2), 21);
+  EXPECT_EQ(map.size(), 1u);
+
+  map.Clear();
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.Find(2), nullptr);
+}
+
+TEST(FlatHashMapTest, PointerKeys) {
+  int a, b;
+  FlatHashMap<int*, int> map;
+  map.Insert(&a, 1);
+  map.Insert(&b, 2);
+  map.Insert(nullptr, 3);
+  EXPECT_EQ(*map.Find(&a), 1);
+  EXPECT_EQ(*map.Find(&b), 2);
+  EXPECT_EQ(*map.Find(nullptr), 3);
+}
+
+TEST(FlatHashMapTest, Iterator) {
+  FlatHashMap<uint64_t, uint64_t> map;
+  EXPECT_FALSE(map.GetIterator());
+  for (uint64_t i = 0; i < 100; i++)
+    map.Insert(i * 4096, i);
+  std::map<uint64_t, uint64_t> seen;
+  for (auto it = map.GetIterator(); it; ++it)
+    EXPECT_TRUE(seen.emplace(it.key(), it.value()).second);
+  ASSERT_EQ(seen.size(), 100u);
+  for (const auto& kv : seen)
+    EXPECT_EQ(kv.first, kv.second * 4096);
+}
+
+// Mixes insertions and deletions on a small key space, so that there are long
+// probe chains and wraparounds, and compares against std::map.
+TEST(FlatHashMapTest, CompareWithStdMap) {
+  std::minstd_rand0 rng(42);
+  FlatHashMap<uint64_t, uint64_t> map;
+  std::map<uint64_t, uint64_t> ref;
+  for (int i = 0; i < 100000; i++) {
+    uint64_t key = rng() % 2048;
+    switch (rng() % 3) {
+      case 0:
+      case 1: {
+        bool inserted = map.Insert(key, i).second;
+        EXPECT_EQ(inserted, ref.emplace(key, i).second);
+        break;
+      }
+      case 2:
+        EXPECT_EQ(map.Erase(key), ref.erase(key) == 1);
+        break;
+    }
+  }
+  ASSERT_EQ(map.size(), ref.size());
+  for (const auto& kv : ref) {
+    ASSERT_NE(map.Find(kv.first), nullptr);
+    EXPECT_EQ(*map.Find(kv.first), kv.second);
+  }
+  for (uint64_t key = 0; key < 2048; key++)
+    EXPECT_EQ(map.Find(key) != nullptr, ref.count(key) == 1);
+}
+
+TEST(FlatHashMapTest, Grow) {
+  FlatHashMap<uint64_t, uint64_t> map;
+  for (uint64_t i = 0; i < 10000; i++)
+    map.Insert(i, i + 1);
+  EXPECT_EQ(map.size(), 10000u);
+  EXPECT_GE(map.capacity() * 3, map.size() * 4);
+  for (uint64_t i = 0; i < 10000; i++)
+    EXPECT_EQ(*map.Find(i), i + 1);
+}
+
+TEST(FlatHashMapTest, Reserve) {
+  FlatHashMap<uint64_t, uint64_t> map;
+  map.Reserve(1000);
+  size_t capacity = map.capacity();
+  EXPECT_GE(capacity * 3, 1000u * 4);
+  for (uint64_t i = 0; i < 1000; i++)
+    map.Insert(i, i);
+  EXPECT_EQ(map.capacity(), capacity);
+  map.Reserve(10);
+  EXPECT_EQ(map.capacity(), capacity);
+}
+
+TEST(FlatHashMapTest, StringKeys) {
+  FlatHashMap<std::string, int> map;
+  for (int i = 0; i < 1000; i++)
+    EXPECT_TRUE(map.Insert("key" + std::to_string(i), i).second);
+  EXPECT_FALSE(map.Insert("key42", 0).second);
+  for (int i = 0; i < 1000; i += 2)
+    EXPECT_TRUE(map.Erase("key" + std::to_string(i)));
+  EXPECT_EQ(map.size(), 500u);
+  for (int i = 0; i < 1000; i++) {
+    int* value = map.Find("key" + std::to_string(i));
+    if (i % 2) {
+      ASSERT_NE(value, nullptr);
+      EXPECT_EQ(*value, i);
+    } else {
+      EXPECT_EQ(value, nullptr);
+    }
+  }
+}
+
+TEST(FlatHashMapTest, MoveOnlyValues) {
+  FlatHashMap<int, std::unique_ptr<int>> map;
+  for (int i = 0; i < 100; i++)
+    map.Insert(i, std::unique_ptr<int>(new int(i)));
+  for (int i = 0; i < 100; i += 3)
+    map.Erase(i);
+  for (auto it = map.GetIterator(); it; ++it)
+    EXPECT_EQ(*it.value(), it.key());
+
+  FlatHashMap<int, std::unique_ptr<int>> moved(std::move(map));
+  EXPECT_EQ(moved.size(), 66u);
+  EXPECT_EQ(**moved.Find(1), 1);
+}
+
+TEST(FlatHashMapTest, MovedFromIsEmptyAndReusable) {
+  FlatHashMap<int, int> map;
+  for (int i = 0; i < 100; i++)
+    map.Insert(i, i);
+
+  FlatHashMap<int, int> moved(std::move(map));
+  EXPECT_EQ(moved.size(), 100u);
+  EXPECT_EQ(map.size(), 0u);
+  EXPECT_EQ(map.capacity(), 0u);
+  EXPECT_EQ(map.Find(1), nullptr);
+  EXPECT_FALSE(map.GetIterator());
+  EXPECT_FALSE(map.Erase(1));
+  EXPECT_TRUE(map.Insert(1, 2).second);
+  EXPECT_EQ(*map.Find(1), 2);
+
+  FlatHashMap<int, int> assigned;
+  assigned.Insert(1000, 1000);
+  assigned = std::move(moved);
+  EXPECT_EQ(assigned.size(), 100u);
+  EXPECT_EQ(assigned.Find(1000), nullptr);
+  EXPECT_EQ(*assigned.Find(99), 99);
+  EXPECT_EQ(moved.size(), 0u);
+  EXPECT_EQ(moved.Find(99), nullptr);
+  size_t count = 0;
+  for (auto it = moved.GetIterator(); it; ++it)
+    count++;
+  EXPECT_EQ(count, 0u);
+  for (int i = 0; i < 100; i++)
+    EXPECT_TRUE(moved.Insert(i, -i).second);
+  EXPECT_EQ(moved.size(), 100u);
+  EXPECT_EQ(*moved.Find(42), -42);
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
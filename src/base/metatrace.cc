@@ -19,8 +19,14 @@
 #include <fcntl.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <mutex>
+#include <set>
+
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/file_utils.h"
+#include "perfetto/base/no_destructor.h"
+#include "perfetto/base/thread_utils.h"
 #include "perfetto/base/time.h"
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
@@ -31,6 +37,114 @@ namespace perfetto {
 namespace base {
 
 namespace {
+
+static_assert((MetaTrace::kRingCapacity & (MetaTrace::kRingCapacity - 1)) == 0,
+              "kRingCapacity must be a power of two");
+
+// A slot of a ring. It's written with a seqlock: |seq| is odd while the slot is
+// being written and even once it's complete, see WritingSeq() and
+// CompleteSeq(). Each ring has a single writer, its owner thread, so the
+// reader can tell an event that was overwritten while being read by |seq|
+// changing. The fields are atomics only so that the reader can race with the
+// writer without UB, all the accesses are relaxed.
+struct RingSlot {
+  std::atomic<uint64_t> seq;
+  std::atomic<uint64_t> start_ns;
+  std::atomic<uint64_t> duration_ns;
+  std::atomic<const char*> name;
+  std::atomic<uint32_t> cpu;
+  std::atomic<uint32_t> tid;
+};
+
+// The ring of a thread. |write_index| is published after the slot, so all the
+// events before it are complete, unless overwritten since. Allocated with
+// new ThreadRing(), which zero-initializes the slots.
+struct ThreadRing {
+  RingSlot slots[MetaTrace::kRingCapacity];
+  std::atomic<uint64_t> write_index{0};
+  std::atomic<bool> in_use{false};
+};
+
+uint64_t WritingSeq(uint64_t index) {
+  return 2 * index + 1;
+}
+
+uint64_t CompleteSeq(uint64_t index) {
+  return 2 * index + 2;
+}
+
+// The rings are allocated by the first event of each thread and never freed,
+// as a reader might still be reading them. When a thread exits its ring is
+// handed over to the next thread that needs one, the reader doesn't care as
+// the events carry their tid.
+std::atomic<ThreadRing*> g_rings[MetaTrace::kMaxRings];
+std::atomic<size_t> g_num_rings{0};
+std::atomic<uint64_t> g_dropped{0};  // Events of threads without a ring.
+int g_ring_users = 0;                // Guarded by RingMutex().
+
+std::mutex& InternMutex() {
+  static NoDestructor<std::mutex> mutex;
+  return mutex.ref();
+}
+
+// Serializes EnableRing(), DisableRing() and the hand over of the rings between
+// threads.
+std::mutex& RingMutex() {
+  static NoDestructor<std::mutex> mutex;
+  return mutex.ref();
+}
+
+ThreadRing* AcquireRing() {
+  std::lock_guard<std::mutex> lock(RingMutex());
+  size_t num_rings = g_num_rings.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < num_rings; i++) {
+    ThreadRing* ring = g_rings[i].load(std::memory_order_relaxed);
+    if (!ring->in_use.load(std::memory_order_relaxed)) {
+      ring->in_use.store(true, std::memory_order_relaxed);
+      return ring;
+    }
+  }
+  if (num_rings == MetaTrace::kMaxRings)
+    return nullptr;
+  ThreadRing* ring = new ThreadRing();
+  ring->in_use.store(true, std::memory_order_relaxed);
+  g_rings[num_rings].store(ring, std::memory_order_relaxed);
+  // Publishes the ring to ReadRing(), which doesn't take the lock.
+  g_num_rings.store(num_rings + 1, std::memory_order_release);
+  return ring;
+}
+
+// Plain thread_locals, so that they can be accessed from other thread_local
+// destructors, after the releaser below is gone.
+thread_local ThreadRing* g_thread_ring = nullptr;
+thread_local bool g_thread_exiting = false;
+
+// Hands the ring of the thread over to other threads when it exits.
+struct RingReleaser {
+  ~RingReleaser() {
+    g_thread_exiting = true;
+    if (!g_thread_ring)
+      return;
+    std::lock_guard<std::mutex> lock(RingMutex());
+    g_thread_ring->in_use.store(false, std::memory_order_relaxed);
+    g_thread_ring = nullptr;
+  }
+};
+
+ThreadRing* GetThreadRing() {
+  if (PERFETTO_LIKELY(g_thread_ring) || g_thread_exiting)
+    return g_thread_ring;
+  static thread_local RingReleaser releaser;
+  g_thread_ring = AcquireRing();
+  return g_thread_ring;
+}
+
+uint32_t GetCachedThreadId() {
+  // gettid() is a syscall on Linux, too slow to make it for each event.
+  static thread_local uint32_t tid = static_cast<uint32_t>(GetThreadId());
+  return tid;
+}
+
 int MaybeOpenTraceFile() {
   static const char* tracing_path = getenv("PERFETTO_METATRACE_FILE");
   if (tracing_path == nullptr)
@@ -38,9 +152,14 @@ int MaybeOpenTraceFile() {
   static int fd = open(tracing_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
   return fd;
 }
+
 }  // namespace
 
 constexpr uint32_t MetaTrace::kMainThreadCpu;
+constexpr size_t MetaTrace::kRingCapacity;
+constexpr size_t MetaTrace::kMaxRings;
+
+std::atomic<bool> MetaTrace::ring_enabled_{false};
 
 void MetaTrace::WriteEvent(char type, const char* evt_name, size_t cpu) {
   int fd = MaybeOpenTraceFile();
@@ -59,5 +178,107 @@ void MetaTrace::WriteEvent(char type, const char* evt_name, size_t cpu) {
   ignore_result(WriteAll(fd, json, static_cast<size_t>(len)));
 }
 
+void MetaTrace::WriteRecord() {
+  uint64_t end_ns = static_cast<uint64_t>(GetBootTimeNs().count());
+  ThreadRing* ring = GetThreadRing();
+  if (PERFETTO_UNLIKELY(!ring)) {
+    g_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // This thread is the only writer of the ring.
+  uint64_t index = ring->write_index.load(std::memory_order_relaxed);
+  RingSlot& slot = ring->slots[index & (kRingCapacity - 1)];
+  slot.seq.store(WritingSeq(index), std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.start_ns.store(start_ns_, std::memory_order_relaxed);
+  slot.duration_ns.store(end_ns - start_ns_, std::memory_order_relaxed);
+  slot.name.store(evt_name_, std::memory_order_relaxed);
+  slot.cpu.store(static_cast<uint32_t>(cpu_), std::memory_order_relaxed);
+  slot.tid.store(GetCachedThreadId(), std::memory_order_relaxed);
+  slot.seq.store(CompleteSeq(index), std::memory_order_release);
+  ring->write_index.store(index + 1, std::memory_order_release);
+}
+
+// static
+const char* MetaTrace::InternName(const std::string& name) {
+  static NoDestructor<std::set<std::string>> names;
+  std::lock_guard<std::mutex> lock(InternMutex());
+  return names.ref().insert(name).first->c_str();
+}
+
+// static
+MetaTrace::RingCursor MetaTrace::EnableRing() {
+  std::lock_guard<std::mutex> lock(RingMutex());
+  if (g_ring_users++ == 0)
+    ring_enabled_.store(true, std::memory_order_release);
+  RingCursor cursor;
+  size_t num_rings = g_num_rings.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < num_rings; i++) {
+    ThreadRing* ring = g_rings[i].load(std::memory_order_relaxed);
+    cursor.read_indices.push_back(
+        ring->write_index.load(std::memory_order_acquire));
+  }
+  cursor.dropped = g_dropped.load(std::memory_order_relaxed);
+  return cursor;
+}
+
+// static
+void MetaTrace::DisableRing() {
+  std::lock_guard<std::mutex> lock(RingMutex());
+  PERFETTO_DCHECK(g_ring_users > 0);
+  if (--g_ring_users == 0)
+    ring_enabled_.store(false, std::memory_order_release);
+}
+
+// static
+uint64_t MetaTrace::ReadRing(RingCursor* cursor,
+                             std::vector<Record>* records) {
+  const size_t first_record = records->size();
+  uint64_t dropped = g_dropped.load(std::memory_order_relaxed);
+  uint64_t overruns = dropped - cursor->dropped;
+  cursor->dropped = dropped;
+
+  // The rings created after the cursor are read from their start.
+  size_t num_rings = g_num_rings.load(std::memory_order_acquire);
+  cursor->read_indices.resize(num_rings);
+  for (size_t i = 0; i < num_rings; i++) {
+    ThreadRing* ring = g_rings[i].load(std::memory_order_relaxed);
+    uint64_t index = cursor->read_indices[i];
+    uint64_t write_index = ring->write_index.load(std::memory_order_acquire);
+    if (write_index - index > kRingCapacity) {
+      overruns += write_index - kRingCapacity - index;
+      index = write_index - kRingCapacity;
+    }
+    for (; index < write_index; index++) {
+      const uint64_t seq = CompleteSeq(index);
+      RingSlot& slot = ring->slots[index & (kRingCapacity - 1)];
+      if (slot.seq.load(std::memory_order_acquire) == seq) {
+        Record record;
+        record.start_ns = slot.start_ns.load(std::memory_order_relaxed);
+        record.duration_ns = slot.duration_ns.load(std::memory_order_relaxed);
+        record.name = slot.name.load(std::memory_order_relaxed);
+        record.cpu = slot.cpu.load(std::memory_order_relaxed);
+        record.tid = slot.tid.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == seq) {
+          records->push_back(record);
+          continue;
+        }
+      }
+      // The writer wrapped around and overwrote the event.
+      overruns++;
+    }
+    cursor->read_indices[i] = index;
+  }
+
+  // Each ring is in order of end, merge them.
+  std::stable_sort(records->begin() + static_cast<ptrdiff_t>(first_record),
+                   records->end(), [](const Record& a, const Record& b) {
+                     return a.start_ns + a.duration_ns <
+                            b.start_ns + b.duration_ns;
+                   });
+  return overruns;
+}
+
 }  // namespace base
 }  // namespace perfetto
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/metatrace.h"
+
+#include <map>
+#include <set>
+#include <thread>
+
+#include "perfetto/base/thread_utils.h"
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+class MetaTraceRingTest : public ::testing::Test {
+ protected:
+  void SetUp() override { cursor_ = MetaTrace::EnableRing(); }
+
+  void TearDown() override { MetaTrace::DisableRing(); }
+
+  uint64_t Read() {
+    records_.clear();
+    return MetaTrace::ReadRing(&cursor_, &records_);
+  }
+
+  MetaTrace::RingCursor cursor_;
+  std::vector<MetaTrace::Record> records_;
+};
+
+TEST_F(MetaTraceRingTest, RecordsScopes) {
+  {
+    PERFETTO_METATRACE("outer", 1);
+    { PERFETTO_METATRACE("inner", MetaTrace::kMainThreadCpu); }
+  }
+
+  EXPECT_EQ(Read(), 0u);
+  ASSERT_EQ(records_.size(), 2u);
+  const MetaTrace::Record& inner = records_[0];
+  const MetaTrace::Record& outer = records_[1];
+  EXPECT_STREQ(inner.name, "inner");
+  EXPECT_EQ(inner.cpu, MetaTrace::kMainThreadCpu);
+  EXPECT_STREQ(outer.name, "outer");
+  EXPECT_EQ(outer.cpu, 1u);
+  EXPECT_EQ(outer.tid, static_cast<uint32_t>(GetThreadId()));
+  EXPECT_LE(outer.start_ns, inner.start_ns);
+  EXPECT_GE(outer.start_ns + outer.duration_ns,
+            inner.start_ns + inner.duration_ns);
+
+  // Events are read only once.
+  EXPECT_EQ(Read(), 0u);
+  EXPECT_TRUE(records_.empty());
+}
+
+TEST_F(MetaTraceRingTest, RecordsOnlyWhileEnabled) {
+  MetaTrace::EnableRing();
+  MetaTrace::DisableRing();
+  { PERFETTO_METATRACE("still enabled", 0); }
+  MetaTrace::DisableRing();
+  { PERFETTO_METATRACE("disabled", 0); }
+  MetaTrace::EnableRing();
+
+  Read();
+  ASSERT_EQ(records_.size(), 1u);
+  EXPECT_STREQ(records_[0].name, "still enabled");
+}
+
+TEST_F(MetaTraceRingTest, IndependentReaders) {
+  { PERFETTO_METATRACE("first", 0); }
+  MetaTrace::RingCursor other_cursor = MetaTrace::EnableRing();
+  { PERFETTO_METATRACE("second", 0); }
+
+  std::vector<MetaTrace::Record> other_records;
+  EXPECT_EQ(MetaTrace::ReadRing(&other_cursor, &other_records), 0u);
+  ASSERT_EQ(other_records.size(), 1u);
+  EXPECT_STREQ(other_records[0].name, "second");
+  MetaTrace::DisableRing();
+
+  // The other reader didn't consume the events.
+  EXPECT_EQ(Read(), 0u);
+  ASSERT_EQ(records_.size(), 2u);
+  EXPECT_STREQ(records_[0].name, "first");
+  EXPECT_STREQ(records_[1].name, "second");
+}
+
+TEST_F(MetaTraceRingTest, CountsOverruns) {
+  const size_t kNumEvents = MetaTrace::kRingCapacity + 10;
+  for (size_t i = 0; i < kNumEvents; i++) {
+    PERFETTO_METATRACE("evt", i);
+  }
+
+  EXPECT_EQ(Read(), 10u);
+  ASSERT_EQ(records_.size(), MetaTrace::kRingCapacity);
+  EXPECT_EQ(records_.front().cpu, 10u);
+  EXPECT_EQ(records_.back().cpu, static_cast<uint32_t>(kNumEvents - 1));
+}
+
+TEST_F(MetaTraceRingTest, ConcurrentWriters) {
+  const size_t kNumThreads = 4;
+  const size_t kEventsPerThread = 10000;
+  std::atomic<size_t> threads_done{0};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([i, &threads_done] {
+      for (size_t j = 0; j < kEventsPerThread; j++) {
+        PERFETTO_METATRACE("evt", i);
+      }
+      threads_done++;
+    });
+  }
+
+  // Read while the threads are writing.
+  uint64_t overruns = 0;
+  std::vector<MetaTrace::Record> records;
+  while (threads_done.load() < kNumThreads)
+    overruns += MetaTrace::ReadRing(&cursor_, &records);
+  for (std::thread& thread : threads)
+    thread.join();
+  overruns += MetaTrace::ReadRing(&cursor_, &records);
+
+  EXPECT_EQ(records.size() + overruns, kNumThreads * kEventsPerThread);
+  std::map<uint32_t, std::set<uint32_t>> cpus_by_tid;
+  for (size_t i = 0; i < records.size(); i++) {
+    const MetaTrace::Record& record = records[i];
+    EXPECT_STREQ(record.name, "evt");
+    EXPECT_LT(record.cpu, kNumThreads);
+    cpus_by_tid[record.tid].insert(record.cpu);
+    if (i > 0) {
+      EXPECT_LE(records[i - 1].start_ns + records[i - 1].duration_ns,
+                record.start_ns + record.duration_ns);
+    }
+  }
+  // Each record is whole: a thread always records the same cpu.
+  for (const auto& tid_and_cpus : cpus_by_tid)
+    EXPECT_EQ(tid_and_cpus.second.size(), 1u);
+}
+
+// The rings of the threads that exited are reused by the new ones, without
+// losing the events that weren't read yet.
+TEST_F(MetaTraceRingTest, ReusesRingsOfExitedThreads) {
+  const size_t kNumThreads = MetaTrace::kMaxRings + 10;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    std::thread thread([i] { PERFETTO_METATRACE("evt", i); });
+    thread.join();
+  }
+
+  EXPECT_EQ(Read(), 0u);
+  ASSERT_EQ(records_.size(), kNumThreads);
+  for (size_t i = 0; i < kNumThreads; i++)
+    EXPECT_EQ(records_[i].cpu, static_cast<uint32_t>(i));
+}
+
+// Each thread must see the ring enabled as soon as its own EnableRing()
+// returns, even if another thread is enabling it concurrently.
+TEST(MetaTraceTest, ConcurrentEnableRing) {
+  const size_t kNumThreads = 4;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([i] {
+      for (size_t j = 0; j < 100; j++) {
+        MetaTrace::EnableRing();
+        { PERFETTO_METATRACE("evt", i); }
+        MetaTrace::DisableRing();
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+TEST(MetaTraceTest, InternName) {
+  const char* name = MetaTrace::InternName("Drain(" + std::to_string(1) + ")");
+  EXPECT_STREQ(name, "Drain(1)");
+  EXPECT_EQ(MetaTrace::InternName("Drain(1)"), name);
+  EXPECT_NE(MetaTrace::InternName("Drain(2)"), name);
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -25,6 +25,12 @@
 #include <sys/mman.h>
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "perfetto/base/logging.h"
 #include "perfetto/base/utils.h"
 
@@ -39,28 +45,109 @@ constexpr size_t kGuardSize = kPageSize;
 constexpr size_t kCommitChunkSize = kPageSize * 1024;  // 4mB
 #endif  // TRACK_COMMITTED_SIZE()
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+// From <linux/mempolicy.h>.
+constexpr int kMpolPreferred = 1;
+
+// Best effort: if the node doesn't exist, or the kernel has no NUMA support,
+// the pages come from wherever the default policy puts them.
+void PreferNumaNode(void* p, size_t size, int node) {
+  constexpr size_t kBitsPerLong = sizeof(unsigned long) * 8;
+  unsigned long node_mask[1024 / kBitsPerLong] = {};
+  if (node < 0 || static_cast<size_t>(node) >= sizeof(node_mask) * 8) {
+    PERFETTO_DLOG("Invalid NUMA node %d", node);
+    return;
+  }
+  const size_t bit = static_cast<size_t>(node);
+  node_mask[bit / kBitsPerLong] |= 1ul << (bit % kBitsPerLong);
+  // The kernel ignores the last bit of |maxnode|, hence the +1.
+  long res = syscall(__NR_mbind, p, size, kMpolPreferred, node_mask,
+                     sizeof(node_mask) * 8 + 1, 0);
+  if (res != 0)
+    PERFETTO_DPLOG("mbind(node=%d)", node);
+}
+#endif
+
 }  // namespace
 
+constexpr size_t PagedMemory::kHugePageSize;
+constexpr int PagedMemory::kAnyNumaNode;
+
 // static
-PagedMemory PagedMemory::Allocate(size_t size, int flags) {
+PagedMemory PagedMemory::Allocate(size_t size, int flags, int numa_node) {
   PERFETTO_DCHECK(size % kPageSize == 0);
   size_t outer_size = size + kGuardSize * 2;
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  base::ignore_result(numa_node);
   void* ptr = VirtualAlloc(nullptr, outer_size, MEM_RESERVE, PAGE_NOACCESS);
   if (!ptr && (flags & kMayFail))
     return PagedMemory();
   PERFETTO_CHECK(ptr);
   char* usable_region = reinterpret_cast<char*>(ptr) + kGuardSize;
 #else   // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-  void* ptr = mmap(nullptr, outer_size, PROT_READ | PROT_WRITE,
+  size_t alignment = kPageSize;
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  if (flags & kHugeTlb) {
+    PERFETTO_DCHECK(size % kHugePageSize == 0);
+    void* huge_ptr =
+        size % kHugePageSize == 0
+            ? mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)
+            : MAP_FAILED;
+    if (huge_ptr != MAP_FAILED) {
+      if (numa_node != kAnyNumaNode)
+        PreferNumaNode(huge_ptr, size, numa_node);
+      auto memory = PagedMemory(static_cast<char*>(huge_ptr), size);
+      memory.huge_tlb_ = true;
+#if TRACK_COMMITTED_SIZE()
+      memory.EnsureCommitted(size);
+#endif  // TRACK_COMMITTED_SIZE()
+      return memory;
+    }
+    PERFETTO_DLOG("MAP_HUGETLB failed, falling back to transparent huge pages");
+    flags |= kHugePages;
+  }
+  // Smaller regions can't contain a huge page anyways.
+  if ((flags & kHugePages) && size >= kHugePageSize)
+    alignment = kHugePageSize;
+#else
+  base::ignore_result(numa_node);
+#endif
+  // Over-allocate by |alignment| and trim the excess on both sides, so that
+  // the usable region is aligned and the guard regions are right around it.
+  const size_t mapped_size = outer_size + alignment - kPageSize;
+  void* ptr = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
   if (ptr == MAP_FAILED && (flags & kMayFail))
     return PagedMemory();
   PERFETTO_CHECK(ptr && ptr != MAP_FAILED);
-  char* usable_region = reinterpret_cast<char*>(ptr) + kGuardSize;
-  int res = mprotect(ptr, kGuardSize, PROT_NONE);
+  char* mapped_region = reinterpret_cast<char*>(ptr);
+  const uintptr_t misalignment =
+      reinterpret_cast<uintptr_t>(mapped_region + kGuardSize) % alignment;
+  const size_t head = misalignment ? alignment - misalignment : 0;
+  const size_t tail = alignment - kPageSize - head;
+  char* outer_region = mapped_region + head;
+  char* usable_region = outer_region + kGuardSize;
+  int res = 0;
+  if (head)
+    res |= munmap(mapped_region, head);
+  if (tail)
+    res |= munmap(outer_region + outer_size, tail);
+  res |= mprotect(outer_region, kGuardSize, PROT_NONE);
   res |= mprotect(usable_region + size, kGuardSize, PROT_NONE);
   PERFETTO_CHECK(res == 0);
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  // Fails if the kernel has no THP support, in which case these are just
+  // normal pages.
+  if (flags & kHugePages)
+    madvise(usable_region, size, MADV_HUGEPAGE);
+  if (numa_node != kAnyNumaNode)
+    PreferNumaNode(usable_region, size, numa_node);
+#endif
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 
   auto memory = PagedMemory(usable_region, size);
@@ -94,12 +181,12 @@ PagedMemory::~PagedMemory() {
   if (!p_)
     return;
   PERFETTO_CHECK(size_);
-  char* start = p_ - kGuardSize;
+  char* start = huge_tlb_ ? p_ : p_ - kGuardSize;
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
   BOOL res = VirtualFree(start, 0, MEM_RELEASE);
   PERFETTO_CHECK(res != 0);
 #else   // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-  const size_t outer_size = size_ + kGuardSize * 2;
+  const size_t outer_size = huge_tlb_ ? size_ : size_ + kGuardSize * 2;
   int res = munmap(start, outer_size);
   PERFETTO_CHECK(res == 0);
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
@@ -115,6 +202,10 @@ bool PagedMemory::AdviseDontNeed(void* p, size_t size) {
   // possible memory savings.
   return false;
 #else   // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  // Older kernels don't support discarding huge TLB pages, and they couldn't
+  // be discarded partially anyways.
+  if (huge_tlb_)
+    return false;
   // http://man7.org/linux/man-pages/man2/madvise.2.html
   int res = madvise(p, size, MADV_DONTNEED);
   PERFETTO_DCHECK(res == 0);
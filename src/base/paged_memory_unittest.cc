@@ -145,6 +145,54 @@ TEST(PagedMemoryTest, GuardRegions) {
   EXPECT_DEATH({ raw[kSize] = 'x'; }, ".*");
 }
 
+TEST(PagedMemoryTest, HugePages) {
+  const size_t kSize = PagedMemory::kHugePageSize * 2;
+  for (int flags : {PagedMemory::kHugePages, PagedMemory::kHugeTlb}) {
+    PagedMemory mem = PagedMemory::Allocate(kSize, flags);
+    ASSERT_TRUE(mem.IsValid());
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(mem.Get()) %
+                      PagedMemory::kHugePageSize);
+#endif
+    volatile char* raw = reinterpret_cast<char*>(mem.Get());
+    for (size_t i = 0; i < kSize; i += 4096) {
+      ASSERT_EQ(0, raw[i]);
+      raw[i] = 'x';
+    }
+  }
+
+  // Too small to be aligned, but still guarded.
+  PagedMemory small = PagedMemory::Allocate(4096, PagedMemory::kHugePages);
+  ASSERT_TRUE(small.IsValid());
+  volatile char* raw = reinterpret_cast<char*>(small.Get());
+  EXPECT_DEATH({ raw[-1] = 'x'; }, ".*");
+  EXPECT_DEATH({ raw[4096] = 'x'; }, ".*");
+}
+
+TEST(PagedMemoryTest, HugePagesGuardRegions) {
+  const size_t kSize = PagedMemory::kHugePageSize;
+  PagedMemory mem = PagedMemory::Allocate(kSize, PagedMemory::kHugePages);
+  ASSERT_TRUE(mem.IsValid());
+  volatile char* raw = reinterpret_cast<char*>(mem.Get());
+  EXPECT_DEATH({ raw[-1] = 'x'; }, ".*");
+  EXPECT_DEATH({ raw[kSize] = 'x'; }, ".*");
+}
+
+TEST(PagedMemoryTest, NumaNode) {
+  const size_t kSize = 4096 * 16;
+  // Node 0 always exists, the other one is ignored.
+  for (int node : {0, 4000}) {
+    PagedMemory mem = PagedMemory::Allocate(kSize, 0, node);
+    ASSERT_TRUE(mem.IsValid());
+    volatile char* raw = reinterpret_cast<char*>(mem.Get());
+    for (size_t i = 0; i < kSize; i += 4096) {
+      ASSERT_EQ(0, raw[i]);
+      raw[i] = 'x';
+    }
+  }
+}
+
 // Disable this on:
 // MacOS: because it doesn't seem to have an equivalent rlimit to bound mmap().
 // Fuchsia: doesn't support rlimit.
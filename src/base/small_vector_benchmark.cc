@@ -0,0 +1,52 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/small_vector.h"
+
+namespace {
+
+constexpr size_t kInlineSize = 16;
+
+void SetArgs(benchmark::internal::Benchmark* b) {
+  // Fits inline, just fits inline, spills to the heap.
+  b->Arg(4)->Arg(kInlineSize)->Arg(64);
+}
+
+// Builds and destroys a short-lived list per iteration, as for the frames of
+// a callstack.
+template <typename Vector>
+void BM_VectorBuild(benchmark::State& state) {
+  const uint64_t n = static_cast<uint64_t>(state.range(0));
+  for (auto _ : state) {
+    Vector vec;
+    for (uint64_t i = 0; i < n; i++)
+      vec.push_back(i);
+    uint64_t sum = 0;
+    for (uint64_t v : vec)
+      sum += v;
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * n));
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_VectorBuild, std::vector<uint64_t>)->Apply(SetArgs);
+BENCHMARK_TEMPLATE(BM_VectorBuild,
+                   perfetto::base::SmallVector<uint64_t, kInlineSize>)
+    ->Apply(SetArgs);
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/small_vector.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+// Counts the live instances, to check that every element is destroyed once.
+struct Counted {
+  static int live;
+
+  explicit Counted(int v) : value(v) { live++; }
+  Counted(const Counted& other) : value(other.value) { live++; }
+  Counted(Counted&& other) noexcept : value(other.value) { live++; }
+  ~Counted() { live--; }
+
+  int value;
+};
+
+int Counted::live = 0;
+
+TEST(SmallVectorTest, InlineThenHeap) {
+  SmallVector<int, 4> vec;
+  EXPECT_TRUE(vec.empty());
+  EXPECT_TRUE(vec.is_inline());
+  for (int i = 0; i < 4; i++)
+    vec.push_back(i);
+  EXPECT_TRUE(vec.is_inline());
+  EXPECT_EQ(vec.capacity(), 4u);
+
+  vec.push_back(4);
+  EXPECT_FALSE(vec.is_inline());
+  EXPECT_EQ(vec.capacity(), 8u);
+  ASSERT_EQ(vec.size(), 5u);
+  for (int i = 0; i < 5; i++)
+    EXPECT_EQ(vec[static_cast<size_t>(i)], i);
+  EXPECT_EQ(vec.back(), 4);
+
+  vec.pop_back();
+  EXPECT_EQ(vec.size(), 4u);
+  EXPECT_EQ(std::vector<int>(vec.begin(), vec.end()),
+            (std::vector<int>{0, 1, 2, 3}));
+
+  vec.clear();
+  EXPECT_TRUE(vec.empty());
+  EXPECT_EQ(vec.capacity(), 8u);
+}
+
+TEST(SmallVectorTest, Reserve) {
+  SmallVector<int, 4> vec;
+  vec.reserve(2);
+  EXPECT_TRUE(vec.is_inline());
+  vec.reserve(100);
+  EXPECT_FALSE(vec.is_inline());
+  EXPECT_EQ(vec.capacity(), 100u);
+}
+
+TEST(SmallVectorTest, NonTrivialElements) {
+  {
+    SmallVector<std::string, 2> vec;
+    for (int i = 0; i < 10; i++)
+      vec.emplace_back(std::string(100, static_cast<char>('a' + i)));
+    for (size_t i = 0; i < 10; i++)
+      EXPECT_EQ(vec[i], std::string(100, static_cast<char>('a' + i)));
+
+    SmallVector<std::unique_ptr<int>, 2> ptrs;
+    for (int i = 0; i < 10; i++)
+      ptrs.emplace_back(new int(i));
+    EXPECT_EQ(*ptrs[9], 9);
+  }
+
+  {
+    SmallVector<Counted, 3> vec;
+    for (int i = 0; i < 7; i++)
+      vec.emplace_back(i);
+    EXPECT_EQ(Counted::live, 7);
+    vec.pop_back();
+    EXPECT_EQ(Counted::live, 6);
+  }
+  EXPECT_EQ(Counted::live, 0);
+}
+
+TEST(SmallVectorTest, CopyAndMove) {
+  for (int num : {2, 10}) {
+    {
+      SmallVector<Counted, 4> vec;
+      for (int i = 0; i < num; i++)
+        vec.emplace_back(i);
+
+      SmallVector<Counted, 4> copy(vec);
+      ASSERT_EQ(copy.size(), vec.size());
+      EXPECT_EQ(copy[1].value, 1);
+
+      SmallVector<Counted, 4> moved(std::move(vec));
+      EXPECT_TRUE(vec.empty());
+      EXPECT_TRUE(vec.is_inline());
+      ASSERT_EQ(moved.size(), static_cast<size_t>(num));
+      EXPECT_EQ(moved[1].value, 1);
+      EXPECT_EQ(Counted::live, 2 * num);
+
+      vec.emplace_back(42);
+      copy = vec;
+      ASSERT_EQ(copy.size(), 1u);
+      EXPECT_EQ(copy[0].value, 42);
+
+      moved = std::move(copy);
+      ASSERT_EQ(moved.size(), 1u);
+      EXPECT_EQ(moved[0].value, 42);
+      EXPECT_EQ(Counted::live, 2);
+    }
+    EXPECT_EQ(Counted::live, 0);
+  }
+}
+
+// The argument of push_back() can be an element of the vector itself, also when
+// the push_back() moves the elements to a new storage.
+TEST(SmallVectorTest, PushBackOwnElementWhileGrowing) {
+  SmallVector<std::string, 2> vec;
+  vec.push_back(std::string(100, 'a'));
+  vec.push_back(std::string(100, 'b'));
+
+  vec.push_back(vec[0]);  // Inline to heap.
+  vec.push_back(vec[1]);
+  vec.push_back(vec.back());  // Heap to heap.
+  vec.emplace_back(vec[0]);
+
+  ASSERT_EQ(vec.size(), 6u);
+  EXPECT_EQ(vec.capacity(), 8u);
+  EXPECT_EQ(vec[0], std::string(100, 'a'));
+  EXPECT_EQ(vec[1], std::string(100, 'b'));
+  EXPECT_EQ(vec[2], std::string(100, 'a'));
+  EXPECT_EQ(vec[3], std::string(100, 'b'));
+  EXPECT_EQ(vec[4], std::string(100, 'b'));
+  EXPECT_EQ(vec[5], std::string(100, 'a'));
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/thread_pool.h"
+
+#include <algorithm>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/task_runner.h"
+
+namespace perfetto {
+namespace base {
+
+namespace {
+
+// The pool and index of the worker running on the current thread, if any.
+thread_local const ThreadPool* g_worker_pool = nullptr;
+thread_local size_t g_worker_index = 0;
+
+}  // namespace
+
+// static
+size_t ThreadPool::DefaultNumWorkers() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  return 0;
+#else
+  return std::max(std::thread::hardware_concurrency(), 1u) - 1;
+#endif
+}
+
+ThreadPool::ThreadPool(size_t num_workers) {
+  for (size_t i = 0; i < std::max(num_workers, size_t(1)); i++)
+    queues_.emplace_back(new Queue());
+  for (size_t i = 0; i < num_workers; i++)
+    threads_.emplace_back(&ThreadPool::RunWorker, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+    worker_cv_.notify_all();
+  }
+  for (std::thread& thread : threads_)
+    thread.join();
+
+  // Without workers, nothing else runs the leftover tasks.
+  std::function<void()> task;
+  while (TryPopTask(num_workers(), &task))
+    task();
+}
+
+void ThreadPool::PostTask(std::function<void()> task) {
+  size_t index = CurrentWorkerIndex();
+  if (index == num_workers())
+    index = next_queue_.fetch_add(1, std::memory_order_relaxed) %
+            queues_.size();
+  pending_tasks_.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> queue_lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(std::move(task));
+  }
+  // The sleepers are counted before they check |pending_tasks_|, and we
+  // check them after incrementing it, so one of the two sides sees the other.
+  if (num_sleeping_workers_.load() > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    worker_cv_.notify_one();
+  }
+  if (num_waiters_.load() > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiter_cv_.notify_all();
+  }
+}
+
+void ThreadPool::RunWorker(size_t index) {
+  g_worker_pool = this;
+  g_worker_index = index;
+  std::function<void()> task;
+  for (;;) {
+    if (TryPopTask(index, &task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_sleeping_workers_++;
+    worker_cv_.wait(lock, [this] { return quit_ || pending_tasks_ > 0; });
+    num_sleeping_workers_--;
+    if (quit_ && pending_tasks_ == 0)
+      return;
+  }
+}
+
+bool ThreadPool::TryPopTask(size_t index, std::function<void()>* task) {
+  if (pending_tasks_.load(std::memory_order_relaxed) == 0)
+    return false;
+  const size_t num_queues = queues_.size();
+  for (size_t i = 0; i < num_queues; i++) {
+    const size_t queue_index = (index + i) % num_queues;
+    Queue* queue = queues_[queue_index].get();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->tasks.empty())
+      continue;
+    // Newest task from our own queue, oldest task from the others.
+    if (queue_index == index) {
+      *task = std::move(queue->tasks.back());
+      queue->tasks.pop_back();
+    } else {
+      *task = std::move(queue->tasks.front());
+      queue->tasks.pop_front();
+    }
+    size_t prev_pending_tasks = pending_tasks_.fetch_sub(1);
+    PERFETTO_DCHECK(prev_pending_tasks > 0);
+    return true;
+  }
+  return false;
+}
+
+size_t ThreadPool::CurrentWorkerIndex() const {
+  return g_worker_pool == this ? g_worker_index : num_workers();
+}
+
+TaskGroup::TaskGroup(ThreadPool* pool) : pool_(pool) {}
+
+TaskGroup::~TaskGroup() {
+  Cancel();
+  Wait();
+}
+
+void TaskGroup::PostTask(std::function<void()> task) {
+  outstanding_tasks_++;
+  pool_->PostTask([this, task]() mutable {
+    if (!is_cancelled())
+      task();
+    // Destroy the captures while the group is still alive.
+    task = nullptr;
+    OnTaskDone();
+  });
+}
+
+void TaskGroup::ParallelFor(size_t begin,
+                            size_t end,
+                            std::function<void(size_t)> fn,
+                            size_t grain) {
+  if (begin >= end)
+    return;
+  if (grain == 0) {
+    size_t num_chunks = 4 * (pool_->num_workers() + 1);
+    grain = std::max((end - begin + num_chunks - 1) / num_chunks, size_t(1));
+  }
+  // Shared by all the chunks, rather than copied in each of them.
+  std::shared_ptr<std::function<void(size_t)>> shared_fn(
+      new std::function<void(size_t)>(std::move(fn)));
+  for (size_t chunk_begin = begin; chunk_begin < end;) {
+    size_t chunk_end = chunk_begin + std::min(grain, end - chunk_begin);
+    PostTask([this, shared_fn, chunk_begin, chunk_end] {
+      for (size_t i = chunk_begin; i < chunk_end && !is_cancelled(); i++)
+        (*shared_fn)(i);
+    });
+    chunk_begin = chunk_end;
+  }
+}
+
+void TaskGroup::Wait() {
+  const size_t index = pool_->CurrentWorkerIndex();
+  std::function<void()> task;
+  for (;;) {
+    if (outstanding_tasks_ == 0) {
+      // Wait for the last task to be done with the group.
+      std::lock_guard<std::mutex> lock(pool_->mutex_);
+      return;
+    }
+    // Help with whatever is queued, not only the tasks of this group, rather
+    // than idling.
+    if (pool_->TryPopTask(index, &task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(pool_->mutex_);
+    pool_->num_waiters_++;
+    pool_->waiter_cv_.wait(lock, [this] {
+      return outstanding_tasks_ == 0 || pool_->pending_tasks_ > 0;
+    });
+    pool_->num_waiters_--;
+    if (outstanding_tasks_ == 0)
+      return;
+  }
+}
+
+void TaskGroup::PostWhenDone(TaskRunner* task_runner,
+                             std::function<void()> callback) {
+  {
+    std::lock_guard<std::mutex> lock(pool_->mutex_);
+    if (outstanding_tasks_ > 0) {
+      done_callbacks_.emplace_back(task_runner, std::move(callback));
+      return;
+    }
+  }
+  task_runner->PostTask(std::move(callback));
+}
+
+void TaskGroup::OnTaskDone() {
+  // All but the last task leave without taking the lock.
+  size_t outstanding_tasks = outstanding_tasks_.load();
+  while (outstanding_tasks > 1) {
+    if (outstanding_tasks_.compare_exchange_weak(outstanding_tasks,
+                                                 outstanding_tasks - 1)) {
+      return;
+    }
+  }
+  ThreadPool* pool = pool_;
+  std::vector<std::pair<TaskRunner*, std::function<void()>>> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex_);
+    size_t prev_outstanding_tasks = outstanding_tasks_.fetch_sub(1);
+    PERFETTO_DCHECK(prev_outstanding_tasks > 0);
+    // A task was posted in the meantime.
+    if (prev_outstanding_tasks > 1)
+      return;
+    callbacks.swap(done_callbacks_);
+    pool->waiter_cv_.notify_all();
+  }
+  // |this| can be destroyed by Wait() returning at this point.
+  for (auto& task_runner_and_callback : callbacks)
+    task_runner_and_callback.first->PostTask(
+        std::move(task_runner_and_callback.second));
+}
+
+void ParallelFor(ThreadPool* pool,
+                 size_t begin,
+                 size_t end,
+                 std::function<void(size_t)> fn,
+                 size_t grain) {
+  TaskGroup group(pool);
+  group.ParallelFor(begin, end, std::move(fn), grain);
+  group.Wait();
+}
+
+}  // namespace base
+}  // namespace perfetto
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/base/thread_pool.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "src/base/test/test_task_runner.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+class ThreadPoolTest : public ::testing::TestWithParam<size_t> {};
+
+TEST_P(ThreadPoolTest, RunsQueuedTasksOnDestruction) {
+  std::atomic<int> count{0};
+  {
+    ThreadPool pool(GetParam());
+    EXPECT_EQ(pool.num_workers(), GetParam());
+    for (int i = 0; i < 1000; i++)
+      pool.PostTask([&count] { count++; });
+  }
+  EXPECT_EQ(count, 1000);
+}
+
+TEST_P(ThreadPoolTest, ParallelForVisitsEachIndexOnce) {
+  ThreadPool pool(GetParam());
+  for (size_t grain : {0, 1, 7, 1000}) {
+    std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[1000]());
+    ParallelFor(&pool, 10, 1000,
+                [&visits](size_t i) { visits[i]++; }, grain);
+    for (size_t i = 0; i < 1000; i++)
+      EXPECT_EQ(visits[i], i < 10 ? 0 : 1) << "grain " << grain << " i " << i;
+  }
+  ParallelFor(&pool, 5, 5, [](size_t) { ADD_FAILURE(); });
+}
+
+// Every outer index waits for an inner ParallelFor, possibly on a worker. This
+// deadlocks unless waiting threads run queued tasks.
+TEST_P(ThreadPoolTest, NestedParallelFor) {
+  ThreadPool pool(GetParam());
+  std::atomic<size_t> sum{0};
+  ParallelFor(&pool, 0, 16, [&pool, &sum](size_t i) {
+    ParallelFor(&pool, 0, 100, [&sum, i](size_t j) { sum += i * j; }, 1);
+  }, 1);
+  EXPECT_EQ(sum, (15 * 16 / 2) * (99 * 100 / 2));
+}
+
+TEST_P(ThreadPoolTest, PostWhenDone) {
+  ThreadPool pool(GetParam());
+  TestTaskRunner task_runner;
+  TaskGroup group(&pool);
+
+  auto idle = task_runner.CreateCheckpoint("idle");
+  group.PostWhenDone(&task_runner, idle);
+  task_runner.RunUntilCheckpoint("idle");
+
+  std::atomic<int> count{0};
+  for (int i = 0; i < 100; i++)
+    group.PostTask([&count] { count++; });
+  group.ParallelFor(0, 100, [&count](size_t) { count++; });
+  auto done = task_runner.CreateCheckpoint("done");
+  group.PostWhenDone(&task_runner, [&count, done] {
+    EXPECT_EQ(count, 200);
+    done();
+  });
+  // Without workers, the tasks only run while waiting.
+  if (GetParam() == 0)
+    group.Wait();
+  task_runner.RunUntilCheckpoint("done");
+}
+
+// Tasks that post more tasks to their own group, like a tree walk. The group
+// is only done once the last leaf is.
+TEST_P(ThreadPoolTest, TasksPostToTheirGroup) {
+  ThreadPool pool(GetParam());
+  TaskGroup group(&pool);
+  std::atomic<int> count{0};
+  std::function<void(int)> visit = [&group, &count, &visit](int depth) {
+    count++;
+    if (depth == 0)
+      return;
+    for (int i = 0; i < 2; i++)
+      group.PostTask([&visit, depth] { visit(depth - 1); });
+  };
+  group.PostTask([&visit] { visit(9); });
+  group.Wait();
+  EXPECT_EQ(count, (1 << 10) - 1);
+}
+
+INSTANTIATE_TEST_CASE_P(NumWorkers,
+                        ThreadPoolTest,
+                        ::testing::Values(0u, 1u, 4u));
+
+TEST(TaskGroupTest, Cancel) {
+  ThreadPool pool(2);
+  std::atomic<int> started{0};
+  std::atomic<int> finished{0};
+  {
+    TaskGroup group(&pool);
+    // Keeps the workers busy until cancelled.
+    for (int i = 0; i < 2; i++) {
+      group.PostTask([&group, &started, &finished] {
+        started++;
+        while (!group.is_cancelled())
+          std::this_thread::yield();
+        finished++;
+      });
+    }
+    while (started < 2)
+      std::this_thread::yield();
+    for (int i = 0; i < 100; i++)
+      group.PostTask([&finished] { finished++; });
+    std::atomic<size_t> indexes{0};
+    group.ParallelFor(0, 1000, [&indexes](size_t) { indexes++; });
+    group.Cancel();
+    group.Wait();
+    EXPECT_EQ(finished, 2);
+    EXPECT_EQ(indexes, 0u);
+    // The group stays cancelled, and the destructor has nothing to wait for.
+    group.PostTask([] { ADD_FAILURE(); });
+  }
+  EXPECT_EQ(started, 2);
+}
+
+// A task group blocking one worker doesn't prevent another group from making
+// progress on the other workers, or on the waiting thread.
+TEST(TaskGroupTest, IndependentGroups) {
+  ThreadPool pool(2);
+  TaskGroup slow_group(&pool);
+  std::atomic<bool> started{false};
+  std::atomic<bool> release{false};
+  slow_group.PostTask([&started, &release] {
+    started = true;
+    while (!release)
+      std::this_thread::yield();
+  });
+  // Otherwise the waiting thread could pick up the slow task itself.
+  while (!started)
+    std::this_thread::yield();
+
+  std::atomic<int> count{0};
+  ParallelFor(&pool, 0, 1000, [&count](size_t) { count++; });
+  EXPECT_EQ(count, 1000);
+  release = true;
+  slow_group.Wait();
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -16,12 +16,16 @@
 
 #include "src/perfetto_cmd/packet_writer.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <deque>
 
 #include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <zlib.h>
@@ -35,6 +39,7 @@ namespace {
 
 using protozero::proto_utils::kMessageLengthFieldSize;
 using protozero::proto_utils::MakeTagLengthDelimited;
+using protozero::proto_utils::ParseVarInt;
 using protozero::proto_utils::WriteRedundantVarInt;
 using protozero::proto_utils::WriteVarInt;
 using Preamble = std::array<char, 16>;
@@ -49,6 +54,12 @@ constexpr uint32_t kCompressedPacketsId = 50;
 const size_t kMaxPacketSize = 500 * 1024;
 // After every kPendingBytesLimit we do a Z_SYNC_FLUSH in the zlib stream.
 const size_t kPendingBytesLimit = 32 * 1024;
+// Bounds of ZipOptions::block_size. The deflate output of the largest block
+// still fits in kMaxPacketSize.
+const size_t kMinBlockSize = 4 * 1024;
+const size_t kMaxBlockSize = 448 * 1024;
+// Size of the reads done by ReadPacketsFromFile().
+const size_t kReadSize = 1024 * 1024;
 
 template <uint32_t id>
 size_t GetPreamble(size_t sz, Preamble* preamble) {
@@ -67,6 +78,7 @@ class FilePacketWriter : public PacketWriter {
   FilePacketWriter(FILE* fd);
   ~FilePacketWriter() override;
   bool WritePackets(const std::vector<TracePacket>& packets) override;
+  bool Finish() override;
 
  private:
   FILE* fd_;
@@ -77,6 +89,7 @@ class ZipPacketWriter : public PacketWriter {
   ZipPacketWriter(std::unique_ptr<PacketWriter>);
   ~ZipPacketWriter() override;
   bool WritePackets(const std::vector<TracePacket>& packets) override;
+  bool Finish() override;
 
  private:
   bool WritePacket(const TracePacket& packet);
@@ -101,6 +114,45 @@ class ZipPacketWriter : public PacketWriter {
   size_t pending_bytes_ = 0;
 };
 
+// Deflates blocks of packets on a base::ThreadPool. Blocks are written to the
+// underlying writer in order by the thread calling WritePackets(), and at most
+// two blocks per thread are in flight to bound the memory usage.
+class ParallelZipPacketWriter : public PacketWriter {
+ public:
+  ParallelZipPacketWriter(std::unique_ptr<PacketWriter>, const ZipOptions&);
+  ~ParallelZipPacketWriter() override;
+  bool WritePackets(const std::vector<TracePacket>& packets) override;
+  bool Finish() override;
+
+ private:
+  struct Block {
+    explicit Block(base::ThreadPool* pool) : compression(pool) {}
+
+    std::vector<uint8_t> data;        // Serialized |packet| fields.
+    std::vector<uint8_t> compressed;  // Deflate stream of |data|.
+    std::atomic<bool> done{false};
+    // Destroying the block drops its compression if it didn't start yet, and
+    // waits for it otherwise.
+    base::TaskGroup compression;
+  };
+
+  void SubmitBlock();
+  bool WriteCompletedBlocks(size_t max_in_flight);
+  void Compress(Block*);
+
+  std::unique_ptr<PacketWriter> writer_;
+  const int level_;
+  const size_t block_size_;
+  // Only set when ZipOptions::pool is null.
+  std::unique_ptr<base::ThreadPool> calling_thread_only_;
+  base::ThreadPool* const pool_;
+  const size_t max_in_flight_;
+  std::unique_ptr<Block> cur_block_;
+
+  // Blocks submitted and not written yet, in order.
+  std::deque<std::unique_ptr<Block>> in_flight_;
+};
+
 FilePacketWriter::FilePacketWriter(FILE* fd) : fd_(fd) {}
 
 FilePacketWriter::~FilePacketWriter() {
@@ -124,6 +176,10 @@ bool FilePacketWriter::WritePackets(const std::vector<TracePacket>& packets) {
   return true;
 }
 
+bool FilePacketWriter::Finish() {
+  return fflush(fd_) == 0 && !ferror(fd_);
+}
+
 ZipPacketWriter::ZipPacketWriter(std::unique_ptr<PacketWriter> writer)
     : writer_(std::move(writer)),
       buf_(base::PagedMemory::Allocate(kMaxPacketSize)),
@@ -143,6 +199,12 @@ bool ZipPacketWriter::WritePackets(const std::vector<TracePacket>& packets) {
   return true;
 }
 
+bool ZipPacketWriter::Finish() {
+  if (is_compressing_ && !FinalizeCompressedPacket())
+    return false;
+  return writer_->Finish();
+}
+
 bool ZipPacketWriter::WritePacket(const TracePacket& packet) {
   // If we have already written one compressed packet, check whether we should
   // flush the buffer.
@@ -236,8 +298,171 @@ void ZipPacketWriter::Deflate(const uint8_t* ptr, size_t size) {
   pending_bytes_ += size;
 }
 
+ParallelZipPacketWriter::ParallelZipPacketWriter(
+    std::unique_ptr<PacketWriter> writer,
+    const ZipOptions& options)
+    : writer_(std::move(writer)),
+      level_(options.level),
+      block_size_(
+          std::min(std::max(options.block_size, kMinBlockSize), kMaxBlockSize)),
+      calling_thread_only_(options.pool ? nullptr : new base::ThreadPool(0)),
+      pool_(options.pool ? options.pool : calling_thread_only_.get()),
+      max_in_flight_((pool_->num_workers() + 1) * 2),
+      cur_block_(new Block(pool_)) {
+  PERFETTO_CHECK(level_ >= Z_BEST_SPEED && level_ <= Z_BEST_COMPRESSION);
+}
+
+ParallelZipPacketWriter::~ParallelZipPacketWriter() = default;
+
+bool ParallelZipPacketWriter::WritePackets(
+    const std::vector<TracePacket>& packets) {
+  for (const TracePacket& packet : packets) {
+    Preamble preamble;
+    size_t preamble_size = GetPreamble<kPacketId>(packet.size(), &preamble);
+    std::vector<uint8_t>* data = &cur_block_->data;
+    // A packet larger than a block gets a block of its own.
+    if (!data->empty() &&
+        data->size() + preamble_size + packet.size() > block_size_) {
+      SubmitBlock();
+      if (!WriteCompletedBlocks(max_in_flight_))
+        return false;
+      data = &cur_block_->data;
+    }
+    if (data->empty())
+      data->reserve(block_size_);
+    data->insert(data->end(), preamble.data(), preamble.data() + preamble_size);
+    for (const Slice& slice : packet.slices()) {
+      const uint8_t* start = static_cast<const uint8_t*>(slice.start);
+      data->insert(data->end(), start, start + slice.size);
+    }
+  }
+  // Write the blocks that are ready without waiting for the others.
+  return WriteCompletedBlocks(max_in_flight_);
+}
+
+bool ParallelZipPacketWriter::Finish() {
+  if (!cur_block_->data.empty())
+    SubmitBlock();
+  if (!WriteCompletedBlocks(0))
+    return false;
+  return writer_->Finish();
+}
+
+void ParallelZipPacketWriter::SubmitBlock() {
+  Block* block = cur_block_.get();
+  in_flight_.emplace_back(std::move(cur_block_));
+  cur_block_.reset(new Block(pool_));
+  block->compression.PostTask([this, block] {
+    Compress(block);
+    block->done.store(true, std::memory_order_release);
+  });
+}
+
+// Writes the compressed blocks at the front of |in_flight_|, waiting for them
+// to complete until at most |max_in_flight| blocks are left.
+bool ParallelZipPacketWriter::WriteCompletedBlocks(size_t max_in_flight) {
+  while (!in_flight_.empty()) {
+    Block* block = in_flight_.front().get();
+    if (!block->done.load(std::memory_order_acquire) &&
+        in_flight_.size() <= max_in_flight) {
+      return true;
+    }
+    // Compresses the queued blocks on this thread while waiting.
+    block->compression.Wait();
+
+    Preamble preamble;
+    size_t preamble_size =
+        GetPreamble<kCompressedPacketsId>(block->compressed.size(), &preamble);
+    std::vector<TracePacket> out_packets(1);
+    out_packets[0].AddSlice(preamble.data(), preamble_size);
+    out_packets[0].AddSlice(block->compressed.data(), block->compressed.size());
+    bool success = writer_->WritePackets(out_packets);
+    in_flight_.pop_front();
+    if (!success)
+      return false;
+  }
+  return true;
+}
+
+void ParallelZipPacketWriter::Compress(Block* block) {
+  z_stream stream{};
+  PERFETTO_CHECK(deflateInit(&stream, level_) == Z_OK);
+  uLong bound = deflateBound(&stream, static_cast<uLong>(block->data.size()));
+  block->compressed.resize(bound);
+  stream.next_in = block->data.data();
+  stream.avail_in = static_cast<unsigned int>(block->data.size());
+  stream.next_out = block->compressed.data();
+  stream.avail_out = static_cast<unsigned int>(bound);
+  // The output buffer is large enough to finish in one call.
+  PERFETTO_CHECK(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+  block->compressed.resize(stream.total_out);
+  PERFETTO_CHECK(deflateEnd(&stream) == Z_OK);
+  std::vector<uint8_t>().swap(block->data);
+}
+
 }  // namespace
 
+bool ReadPacketsFromFile(int fd, uint64_t size, PacketWriter* writer) {
+  std::vector<uint8_t> buf(kReadSize);
+  size_t buf_used = 0;
+  uint64_t offset = 0;
+  for (;;) {
+    size_t to_read = static_cast<size_t>(
+        std::min<uint64_t>(buf.size() - buf_used, size - offset));
+    ssize_t rsize = PERFETTO_EINTR(pread(fd, buf.data() + buf_used, to_read,
+                                         static_cast<off_t>(offset)));
+    if (rsize < 0)
+      return false;
+    offset += static_cast<uint64_t>(rsize);
+    buf_used += static_cast<size_t>(rsize);
+    const bool eof = rsize == 0;
+
+    // Pass on all the whole packets in the buffer.
+    std::vector<TracePacket> packets;
+    const uint8_t* pos = buf.data();
+    const uint8_t* const end = buf.data() + buf_used;
+    while (pos < end) {
+      uint64_t tag;
+      uint64_t packet_size;
+      const uint8_t* size_pos = ParseVarInt(pos, end, &tag);
+      const uint8_t* payload = ParseVarInt(size_pos, end, &packet_size);
+      if (size_pos == pos || payload == size_pos ||
+          packet_size > static_cast<uint64_t>(end - payload)) {
+        break;  // Truncated, need more data.
+      }
+      if (tag != MakeTagLengthDelimited(kPacketId))
+        return false;
+      packets.emplace_back();
+      packets.back().AddSlice(payload, static_cast<size_t>(packet_size));
+      pos = payload + packet_size;
+    }
+    if (!writer->WritePackets(packets))
+      return false;
+
+    size_t consumed = static_cast<size_t>(pos - buf.data());
+    memmove(buf.data(), pos, buf_used - consumed);
+    buf_used -= consumed;
+    if (eof)
+      return buf_used == 0;
+    // Make room for packets larger than the buffer.
+    if (buf_used == buf.size())
+      buf.resize(buf.size() * 2);
+  }
+}
+
+bool CompressTraceFile(int fd, FILE* out, const ZipOptions& options) {
+  struct stat stat_buf {};
+  if (fstat(fd, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode))
+    return false;
+  std::unique_ptr<PacketWriter> writer =
+      CreateParallelZipPacketWriter(CreateFilePacketWriter(out), options);
+  if (!ReadPacketsFromFile(fd, static_cast<uint64_t>(stat_buf.st_size),
+                           writer.get())) {
+    return false;
+  }
+  return writer->Finish();
+}
+
 PacketWriter::PacketWriter() {}
 
 PacketWriter::~PacketWriter() {}
@@ -251,4 +476,11 @@ std::unique_ptr<PacketWriter> CreateZipPacketWriter(
   return std::unique_ptr<PacketWriter>(new ZipPacketWriter(std::move(writer)));
 }
 
+std::unique_ptr<PacketWriter> CreateParallelZipPacketWriter(
+    std::unique_ptr<PacketWriter> writer,
+    const ZipOptions& options) {
+  return std::unique_ptr<PacketWriter>(
+      new ParallelZipPacketWriter(std::move(writer), options));
+}
+
 }  // namespace perfetto
@@ -17,8 +17,13 @@
 #ifndef SRC_PERFETTO_CMD_PACKET_WRITER_H_
 #define SRC_PERFETTO_CMD_PACKET_WRITER_H_
 
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
 #include <vector>
 
+#include "perfetto/base/thread_pool.h"
 #include "perfetto/base/utils.h"
 
 namespace perfetto {
@@ -30,12 +35,52 @@ class PacketWriter {
   PacketWriter();
   virtual ~PacketWriter();
   virtual bool WritePackets(const std::vector<TracePacket>& packets) = 0;
+
+  // Writes out the packets buffered by the writer (and by the ones it wraps),
+  // if any. Must be called once after the last WritePackets(). Returns false
+  // if any of the trace could not be written.
+  virtual bool Finish() = 0;
+};
+
+// Options of the ParallelZipPacketWriter.
+struct ZipOptions {
+  // zlib compression level, from 1 (fastest) to 9 (best compression).
+  int level = 9;
+
+  // Uncompressed size of the packets deflated into each |compressed_packets|
+  // packet. Blocks are compressed independently, which costs a bit of
+  // compression ratio with small blocks. Clamped to [4 KB, 448 KB] so that
+  // compressed blocks stay under the maximum size of a packet.
+  size_t block_size = 256 * 1024;
+
+  // Pool on which the blocks are compressed, must outlive the writer. If null,
+  // the blocks are compressed on the thread that writes the packets.
+  base::ThreadPool* pool = nullptr;
 };
 
 std::unique_ptr<PacketWriter> CreateFilePacketWriter(FILE*);
 std::unique_ptr<PacketWriter> CreateZipPacketWriter(
     std::unique_ptr<PacketWriter>);
 
+// Like CreateZipPacketWriter(), but splits the packets into blocks of
+// |options.block_size| bytes which are compressed concurrently on
+// |options.pool|, and written in order to |writer|. The blocks still pending when the
+// writer is destroyed are dropped, hence Finish() must be called.
+std::unique_ptr<PacketWriter> CreateParallelZipPacketWriter(
+    std::unique_ptr<PacketWriter> writer,
+    const ZipOptions& options);
+
+// Passes the packets of the trace stored in the first |size| bytes of |fd|
+// (e.g. written by the service in write_into_file mode) to |writer|, reading
+// the file in chunks rather than all at once. Returns false if the file can't
+// be read or doesn't contain only whole packets.
+bool ReadPacketsFromFile(int fd, uint64_t size, PacketWriter* writer);
+
+// Writes to |out| the compressed form of the trace stored in |fd|, leaving
+// |fd| untouched. Returns false if |fd| can't be read or |out| written, in
+// which case |out| is left with a partial trace.
+bool CompressTraceFile(int fd, FILE* out, const ZipOptions& options);
+
 }  // namespace perfetto
 
 #endif  // SRC_PERFETTO_CMD_PACKET_WRITER_H_
@@ -278,5 +278,169 @@ TEST(PacketWriter, ZipPacketWriter_ShouldSplitPackets) {
   EXPECT_EQ(packet_count, 1000);
 }
 
+TEST(PacketWriter, ParallelZipPacketWriter) {
+  base::TempFile tmp = base::TempFile::Create();
+  FILE* f = fdopen(tmp.fd(), "wb");
+
+  std::minstd_rand0 rnd(0);
+  std::uniform_int_distribution<> dist(0, 255);
+  {
+    base::ThreadPool pool(3);
+    ZipOptions options;
+    options.level = 1;
+    options.block_size = 16 * 1024;
+    options.pool = &pool;
+    std::unique_ptr<PacketWriter> writer =
+        CreateParallelZipPacketWriter(CreateFilePacketWriter(f), options);
+
+    for (uint32_t i = 0; i < 1000; i++) {
+      std::string s(1024, 'x');
+      // Half random so that blocks don't compress to nothing.
+      for (size_t j = 0; j < s.size() / 2; j++)
+        s[j] = static_cast<char>(dist(rnd));
+      std::vector<perfetto::TracePacket> packets;
+      packets.push_back(CreateTracePacket([i, &s](TracePacketZero* msg) {
+        auto* for_testing = msg->set_for_testing();
+        for_testing->set_seq_value(i);
+        for_testing->set_str(s.data(), s.size());
+      }));
+      EXPECT_TRUE(writer->WritePackets(std::move(packets)));
+    }
+    EXPECT_TRUE(writer->Finish());
+  }
+
+  std::string s;
+  fseek(f, 0, SEEK_SET);
+  EXPECT_TRUE(base::ReadFileStream(f, &s));
+
+  protos::Trace trace;
+  EXPECT_TRUE(trace.ParseFromString(s));
+  // 1000 KB of packets in blocks of at most 16 KB.
+  EXPECT_GE(trace.packet_size(), 63);
+
+  size_t packet_count = 0;
+  for (const auto& packet : trace.packet()) {
+    const std::string& data = packet.compressed_packets();
+    protos::Trace subtrace;
+    EXPECT_TRUE(subtrace.ParseFromString(Decompress(data)));
+    EXPECT_LE(subtrace.ByteSize(), 16 * 1024);
+    for (const auto& subpacket : subtrace.packet()) {
+      EXPECT_EQ(subpacket.for_testing().seq_value(), packet_count++);
+    }
+  }
+  EXPECT_EQ(packet_count, 1000);
+}
+
+// Records the packets passed to it.
+class FakePacketWriter : public PacketWriter {
+ public:
+  bool WritePackets(const std::vector<TracePacket>& packets) override {
+    for (const TracePacket& packet : packets) {
+      std::string data;
+      for (const Slice& slice : packet.slices())
+        data.append(static_cast<const char*>(slice.start), slice.size);
+      packets_.push_back(data);
+    }
+    return true;
+  }
+
+  bool Finish() override { return true; }
+
+  std::vector<std::string> packets_;
+};
+
+TEST(PacketWriter, ReadPacketsFromFile) {
+  base::TempFile tmp = base::TempFile::Create();
+  FILE* f = fdopen(tmp.fd(), "wb");
+
+  // Enough data to need several reads, and a packet larger than a read.
+  std::vector<std::string> strs;
+  for (size_t i = 0; i < 1000; i++)
+    strs.emplace_back(1000 + i, static_cast<char>('a' + i % 26));
+  strs.emplace_back(3 * 1024 * 1024, 'z');
+  strs.emplace_back("last");
+  std::vector<std::string> expected;
+  {
+    std::unique_ptr<PacketWriter> writer = CreateFilePacketWriter(f);
+    for (const std::string& str : strs) {
+      std::vector<perfetto::TracePacket> packets;
+      packets.push_back(CreateTracePacket([&str](TracePacketZero* msg) {
+        msg->set_for_testing()->set_str(str.data(), str.size());
+      }));
+      std::string data;
+      for (const Slice& slice : packets.back().slices())
+        data.append(static_cast<const char*>(slice.start), slice.size);
+      expected.push_back(data);
+      EXPECT_TRUE(writer->WritePackets(std::move(packets)));
+    }
+  }
+  uint64_t size = static_cast<uint64_t>(ftell(f));
+
+  FakePacketWriter fake_writer;
+  EXPECT_TRUE(ReadPacketsFromFile(tmp.fd(), size, &fake_writer));
+  EXPECT_EQ(fake_writer.packets_, expected);
+
+  // A truncated trace is rejected.
+  FakePacketWriter truncated_writer;
+  EXPECT_FALSE(ReadPacketsFromFile(tmp.fd(), size - 1, &truncated_writer));
+}
+
+TEST(PacketWriter, CompressTraceFile) {
+  base::TempFile tmp = base::TempFile::Create();
+  FILE* f = fdopen(tmp.fd(), "wb");
+  {
+    std::unique_ptr<PacketWriter> writer = CreateFilePacketWriter(f);
+    for (uint32_t i = 0; i < 1000; i++) {
+      std::string str(1024, static_cast<char>('a' + i % 26));
+      std::vector<perfetto::TracePacket> packets;
+      packets.push_back(CreateTracePacket([i, &str](TracePacketZero* msg) {
+        auto* for_testing = msg->set_for_testing();
+        for_testing->set_seq_value(i);
+        for_testing->set_str(str.data(), str.size());
+      }));
+      EXPECT_TRUE(writer->WritePackets(std::move(packets)));
+    }
+    EXPECT_TRUE(writer->Finish());
+  }
+  std::string trace_data;
+  ASSERT_TRUE(base::ReadFile(tmp.path(), &trace_data));
+
+  // Without a pool, the blocks are compressed on this thread.
+  ZipOptions options;
+  options.block_size = 16 * 1024;
+  base::TempFile compressed_tmp = base::TempFile::Create();
+  base::ScopedFstream compressed_f(fdopen(dup(compressed_tmp.fd()), "wb"));
+  EXPECT_TRUE(CompressTraceFile(tmp.fd(), *compressed_f, options));
+  compressed_f.reset();
+
+  // The trace is left untouched.
+  std::string s;
+  ASSERT_TRUE(base::ReadFile(tmp.path(), &s));
+  EXPECT_EQ(s, trace_data);
+
+  std::string compressed_data;
+  ASSERT_TRUE(base::ReadFile(compressed_tmp.path(), &compressed_data));
+  protos::Trace trace;
+  EXPECT_TRUE(trace.ParseFromString(compressed_data));
+  size_t packet_count = 0;
+  for (const auto& packet : trace.packet()) {
+    const std::string& data = packet.compressed_packets();
+    protos::Trace subtrace;
+    EXPECT_TRUE(subtrace.ParseFromString(Decompress(data)));
+    for (const auto& subpacket : subtrace.packet())
+      EXPECT_EQ(subpacket.for_testing().seq_value(), packet_count++);
+  }
+  EXPECT_EQ(packet_count, 1000);
+
+  // Failing to write the compressed trace is reported.
+  base::ScopedFstream read_only_f(fopen(compressed_tmp.path().c_str(), "rb"));
+  EXPECT_FALSE(CompressTraceFile(tmp.fd(), *read_only_f, options));
+
+  // So is a truncated trace.
+  ASSERT_EQ(ftruncate(tmp.fd(), static_cast<off_t>(trace_data.size() - 1)), 0);
+  base::ScopedFstream truncated_f(fdopen(dup(compressed_tmp.fd()), "wb"));
+  EXPECT_FALSE(CompressTraceFile(tmp.fd(), *truncated_f, options));
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -25,6 +25,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <iterator>
@@ -35,6 +36,7 @@
 #include "perfetto/base/string_view.h"
 #include "perfetto/base/time.h"
 #include "perfetto/base/utils.h"
+#include "perfetto/common/trace_stats.pb.h"
 #include "perfetto/config/trace_config.pb.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/traced/traced.h"
@@ -43,6 +45,7 @@
 #include "perfetto/tracing/core/data_source_descriptor.h"
 #include "perfetto/tracing/core/trace_config.h"
 #include "perfetto/tracing/core/trace_packet.h"
+#include "perfetto/tracing/core/trace_stats.h"
 #include "src/perfetto_cmd/config.h"
 #include "src/perfetto_cmd/packet_writer.h"
 #include "src/perfetto_cmd/pbtxt_to_pb.h"
@@ -174,6 +177,10 @@ Usage: %s
   --no-guardrails          : Ignore guardrails triggered when using --dropbox (for testing).
   --txt                    : Parse config as pbtxt. Not a stable API. Not for production use.
   --reset-guardrails       : Resets the state of the guardails and exits (for testing).
+  --compression-level N    : Deflate level 1-9 when the config enables compression (default: 9).
+  --compression-block-kb N : Uncompressed KB per compressed packet (default: 256).
+  --stream-period-ms N     : Read the buffers every N ms while tracing, instead of only at the end.
+  --stream-threshold-kb N  : With --stream-period-ms, read only once N KB are unread (default: 0).
   --help           -h
 
 
@@ -216,6 +223,10 @@ int PerfettoCmd::Main(int argc, char** argv) {
     OPT_ATTACH,
     OPT_IS_DETACHED,
     OPT_STOP,
+    OPT_COMPRESSION_LEVEL,
+    OPT_COMPRESSION_BLOCK_KB,
+    OPT_STREAM_PERIOD_MS,
+    OPT_STREAM_THRESHOLD_KB,
   };
   static const struct option long_options[] = {
       {"help", no_argument, nullptr, 'h'},
@@ -238,6 +249,12 @@ int PerfettoCmd::Main(int argc, char** argv) {
       {"is_detached", required_argument, nullptr, OPT_IS_DETACHED},
       {"stop", no_argument, nullptr, OPT_STOP},
       {"app", required_argument, nullptr, OPT_ATRACE_APP},
+      {"compression-level", required_argument, nullptr, OPT_COMPRESSION_LEVEL},
+      {"compression-block-kb", required_argument, nullptr,
+       OPT_COMPRESSION_BLOCK_KB},
+      {"stream-period-ms", required_argument, nullptr, OPT_STREAM_PERIOD_MS},
+      {"stream-threshold-kb", required_argument, nullptr,
+       OPT_STREAM_THRESHOLD_KB},
       {nullptr, 0, nullptr, 0}};
 
   int option_index = 0;
@@ -391,6 +408,45 @@ int PerfettoCmd::Main(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_COMPRESSION_LEVEL) {
+      zip_options_.level = atoi(optarg);
+      if (zip_options_.level < 1 || zip_options_.level > 9) {
+        PERFETTO_ELOG("--compression-level must be between 1 and 9");
+        return 1;
+      }
+      continue;
+    }
+
+    if (option == OPT_COMPRESSION_BLOCK_KB) {
+      int block_kb = atoi(optarg);
+      if (block_kb <= 0) {
+        PERFETTO_ELOG("Invalid --compression-block-kb");
+        return 1;
+      }
+      zip_options_.block_size = static_cast<size_t>(block_kb) * 1024;
+      continue;
+    }
+
+    if (option == OPT_STREAM_PERIOD_MS) {
+      int period_ms = atoi(optarg);
+      if (period_ms <= 0) {
+        PERFETTO_ELOG("Invalid --stream-period-ms");
+        return 1;
+      }
+      stream_period_ms_ = static_cast<uint32_t>(period_ms);
+      continue;
+    }
+
+    if (option == OPT_STREAM_THRESHOLD_KB) {
+      int threshold_kb = atoi(optarg);
+      if (threshold_kb < 0) {
+        PERFETTO_ELOG("Invalid --stream-threshold-kb");
+        return 1;
+      }
+      stream_threshold_bytes_ = static_cast<uint64_t>(threshold_kb) * 1024;
+      continue;
+    }
+
     return PrintUsage(argv[0]);
   }
 
@@ -414,6 +470,11 @@ int PerfettoCmd::Main(int argc, char** argv) {
     return 1;
   }
 
+  if (stream_threshold_bytes_ && !stream_period_ms_) {
+    PERFETTO_ELOG("--stream-threshold-kb requires --stream-period-ms");
+    return 1;
+  }
+
   // Parse the trace config. It can be either:
   // 1) A proto-encoded file/stdin (-c ...).
   // 2) A proto-text file/stdin (-c ... --txt).
@@ -507,6 +568,11 @@ int PerfettoCmd::Main(int argc, char** argv) {
     PERFETTO_ELOG(
         "TraceConfig's write_into_file must be true when using --detach");
     return 1;
+  } else if (stream_period_ms_ && trace_config_->write_into_file()) {
+    // The service already drains the buffers periodically into the file, see
+    // TraceConfig's file_write_period_ms.
+    PERFETTO_ELOG("--stream-period-ms can't be used with write_into_file");
+    return 1;
   }
   if (open_out_file) {
     if (!OpenOutputFile())
@@ -556,10 +622,13 @@ int PerfettoCmd::Main(int argc, char** argv) {
 
   if (trace_config_->compression_type() ==
       perfetto::TraceConfig::COMPRESSION_TYPE_DEFLATE) {
+    thread_pool_.reset(new base::ThreadPool());
+    zip_options_.pool = thread_pool_.get();
+    // With write_into_file the trace is compressed once written, see
+    // CompressOutputFile().
     if (packet_writer_) {
-      packet_writer_ = CreateZipPacketWriter(std::move(packet_writer_));
-    } else {
-      PERFETTO_ELOG("Cannot compress when tracing directly to file.");
+      packet_writer_ = CreateParallelZipPacketWriter(std::move(packet_writer_),
+                                                     zip_options_);
     }
   }
 
@@ -623,6 +692,11 @@ void PerfettoCmd::OnConnect() {
     task_runner_.PostDelayedTask(std::bind(&PerfettoCmd::OnTimeout, this),
                                  trace_timeout);
   }
+
+  if (stream_period_ms_) {
+    task_runner_.PostDelayedTask(std::bind(&PerfettoCmd::OnStreamTimer, this),
+                                 stream_period_ms_);
+  }
 }
 
 void PerfettoCmd::OnDisconnect() {
@@ -638,27 +712,74 @@ void PerfettoCmd::OnTimeout() {
 void PerfettoCmd::OnTraceData(std::vector<TracePacket> packets, bool has_more) {
   if (!packet_writer_->WritePackets(packets)) {
     PERFETTO_ELOG("Failed to write packets");
-    FinalizeTraceAndExit();
+    return FinalizeTraceAndExit();
   }
 
-  if (!has_more)
+  if (has_more)
+    return;
+  reading_buffers_ = false;
+  if (is_final_read_ && stream_period_ms_) {
+    // Append the final stats to the trace before finalizing it, see
+    // OnTraceStats().
+    awaiting_final_stats_ = true;
+    consumer_endpoint_->GetTraceStats();
+  } else if (is_final_read_) {
     FinalizeTraceAndExit();  // Reached end of trace.
+  } else if (tracing_disabled_) {
+    // Tracing was disabled while a periodic read was in progress.
+    StartReadBuffers(/*final_read=*/true);
+  }
 }
 
 void PerfettoCmd::OnTracingDisabled() {
+  tracing_disabled_ = true;
   if (trace_config_->write_into_file()) {
     // If write_into_file == true, at this point the passed file contains
     // already all the packets.
     return FinalizeTraceAndExit();
   }
-  // This will cause a bunch of OnTraceData callbacks. The last one will
-  // save the file and exit.
+  // Otherwise the final read is issued once the periodic one is done.
+  if (!reading_buffers_)
+    StartReadBuffers(/*final_read=*/true);
+}
+
+// This will cause a bunch of OnTraceData callbacks. After the last one of a
+// final read the file is saved and the process exits.
+void PerfettoCmd::StartReadBuffers(bool final_read) {
+  PERFETTO_DCHECK(!reading_buffers_);
+  reading_buffers_ = true;
+  is_final_read_ = final_read;
   consumer_endpoint_->ReadBuffers();
 }
 
+void PerfettoCmd::OnStreamTimer() {
+  if (tracing_disabled_)
+    return;
+  task_runner_.PostDelayedTask(std::bind(&PerfettoCmd::OnStreamTimer, this),
+                               stream_period_ms_);
+  if (reading_buffers_)
+    return;  // The service hasn't caught up with the previous read yet.
+  // The read-behind lag comes from the trace stats, see OnTraceStats().
+  consumer_endpoint_->GetTraceStats();
+}
+
 void PerfettoCmd::FinalizeTraceAndExit() {
+  if (packet_writer_ && !packet_writer_->Finish())
+    PERFETTO_ELOG("Failed to write the trace");
   packet_writer_.reset();
 
+  if (trace_out_stream_ && trace_config_->write_into_file() &&
+      trace_config_->compression_type() ==
+          perfetto::TraceConfig::COMPRESSION_TYPE_DEFLATE) {
+    if (!CompressOutputFile())
+      PERFETTO_ELOG("Failed to compress the trace, leaving it uncompressed");
+  }
+
+  if (stream_period_ms_) {
+    PERFETTO_LOG("Streamed the trace, max read-behind lag: %" PRIu64 " KB",
+                 max_read_behind_bytes_ / 1024);
+  }
+
   if (trace_out_stream_) {
     fseek(*trace_out_stream_, 0, SEEK_END);
     off_t sz = ftell(*trace_out_stream_);
@@ -700,6 +821,47 @@ void PerfettoCmd::FinalizeTraceAndExit() {
   task_runner_.Quit();
 }
 
+// Compresses the trace that the service wrote into |trace_out_stream_|. The
+// compressed copy is written to a new file which replaces the trace only once
+// complete, so that a failure leaves the uncompressed trace intact. For --out
+// the new file is a sibling which is renamed over the trace, for DropBox it is
+// another unlinked file.
+bool PerfettoCmd::CompressOutputFile() {
+  base::ScopedFile fd;
+  std::string tmp_path;
+  if (!dropbox_tag_.empty()) {
+#if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
+    fd = base::OpenFile(kTempDropBoxTraceDir, O_TMPFILE | O_RDWR, 0600);
+#endif
+  } else if (!trace_out_path_.empty() && trace_out_path_ != "-") {
+    tmp_path = trace_out_path_ + ".tmp";
+    fd = base::OpenFile(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  }
+  if (!fd)
+    return false;
+  base::ScopedFstream compressed_stream(fdopen(fd.release(), "wb"));
+  PERFETTO_CHECK(compressed_stream);
+
+  const int trace_fd = fileno(*trace_out_stream_);
+  bool success = CompressTraceFile(trace_fd, *compressed_stream, zip_options_);
+  if (success && !tmp_path.empty())
+    success = rename(tmp_path.c_str(), trace_out_path_.c_str()) == 0;
+  if (!success) {
+    if (!tmp_path.empty())
+      unlink(tmp_path.c_str());
+    return false;
+  }
+
+  struct stat stat_buf {};
+  if (fstat(trace_fd, &stat_buf) == 0) {
+    PERFETTO_LOG("Compressed the trace from %" PRIu64 " to %" PRIu64 " bytes",
+                 static_cast<uint64_t>(stat_buf.st_size),
+                 static_cast<uint64_t>(ftell(*compressed_stream)));
+  }
+  trace_out_stream_ = std::move(compressed_stream);
+  return true;
+}
+
 void PerfettoCmd::SaveOutputToDropboxOrCrash() {
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
   if (bytes_written_ == 0) {
@@ -860,9 +1022,53 @@ void PerfettoCmd::OnAttach(bool success, const TraceConfig& trace_config) {
   }
 }
 
-void PerfettoCmd::OnTraceStats(bool /*success*/,
-                               const TraceStats& /*trace_config*/) {
-  // TODO(eseckler): Support GetTraceStats().
+void PerfettoCmd::OnTraceStats(bool success, const TraceStats& trace_stats) {
+  if (awaiting_final_stats_) {
+    if (success)
+      WriteStreamingStats(trace_stats);
+    return FinalizeTraceAndExit();
+  }
+  if (!success || tracing_disabled_ || reading_buffers_)
+    return;
+
+  // The read-behind lag is the amount of data in the buffers that hasn't been
+  // read yet. Overwritten data is lost, so it doesn't count.
+  uint64_t read_behind_bytes = 0;
+  for (const TraceStats::BufferStats& buf : trace_stats.buffer_stats()) {
+    uint64_t consumed = buf.bytes_read() + buf.bytes_overwritten();
+    if (buf.bytes_written() > consumed)
+      read_behind_bytes += buf.bytes_written() - consumed;
+  }
+  max_read_behind_bytes_ = std::max(max_read_behind_bytes_, read_behind_bytes);
+  PERFETTO_DLOG("Read-behind lag: %" PRIu64 " bytes", read_behind_bytes);
+
+  if (read_behind_bytes > 0 && read_behind_bytes >= stream_threshold_bytes_)
+    StartReadBuffers(/*final_read=*/false);
+}
+
+// Appends |trace_stats| to the trace, with the max. read-behind lag seen while
+// streaming it. The TracePacket is serialized by hand as perfetto_cmd doesn't
+// depend on the trace protos.
+void PerfettoCmd::WriteStreamingStats(const TraceStats& trace_stats) {
+  TraceStats stats = trace_stats;
+  stats.set_max_read_behind_bytes(max_read_behind_bytes_);
+  protos::TraceStats stats_proto;
+  stats.ToProto(&stats_proto);
+  const std::string stats_data = stats_proto.SerializeAsString();
+
+  // ID of |trace_stats| in trace_packet.proto.
+  constexpr uint32_t kTraceStatsFieldId = 35;
+  uint8_t preamble[16];
+  uint8_t* preamble_end = protozero::proto_utils::WriteVarInt(
+      protozero::proto_utils::MakeTagLengthDelimited(kTraceStatsFieldId),
+      preamble);
+  preamble_end =
+      protozero::proto_utils::WriteVarInt(stats_data.size(), preamble_end);
+  std::vector<TracePacket> packets(1);
+  packets[0].AddSlice(preamble, static_cast<size_t>(preamble_end - preamble));
+  packets[0].AddSlice(stats_data.data(), stats_data.size());
+  if (!packet_writer_->WritePackets(packets))
+    PERFETTO_ELOG("Failed to write the trace stats");
 }
 
 void PerfettoCmd::OnObservableEvents(
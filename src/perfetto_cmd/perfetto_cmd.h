@@ -29,6 +29,7 @@
 #include "perfetto/base/unix_task_runner.h"
 #include "perfetto/tracing/core/consumer.h"
 #include "perfetto/tracing/ipc/consumer_ipc_client.h"
+#include "src/perfetto_cmd/packet_writer.h"
 #include "src/perfetto_cmd/rate_limiter.h"
 
 #include "src/perfetto_cmd/perfetto_cmd_state.pb.h"
@@ -39,8 +40,6 @@
 
 namespace perfetto {
 
-class PacketWriter;
-
 // Temporary directory for DropBox traces. Note that this is automatically
 // created by the system by setting setprop persist.traced.enable=1.
 extern const char* kTempDropBoxTraceDir;
@@ -71,6 +70,10 @@ class PerfettoCmd : public Consumer {
   bool OpenOutputFile();
   void SetupCtrlCSignalHandler();
   void FinalizeTraceAndExit();
+  bool CompressOutputFile();
+  void StartReadBuffers(bool final_read);
+  void OnStreamTimer();
+  void WriteStreamingStats(const TraceStats&);
   int PrintUsage(const char* argv0);
   void OnTimeout();
   bool is_detach() const { return !detach_key_.empty(); }
@@ -83,7 +86,11 @@ class PerfettoCmd : public Consumer {
       consumer_endpoint_;
   std::unique_ptr<TraceConfig> trace_config_;
 
+  // Compresses the trace, only created with COMPRESSION_TYPE_DEFLATE. Must
+  // outlive |packet_writer_|.
+  std::unique_ptr<base::ThreadPool> thread_pool_;
   std::unique_ptr<PacketWriter> packet_writer_;
+  ZipOptions zip_options_;
   base::ScopedFstream trace_out_stream_;
 
   std::string trace_out_path_;
@@ -95,6 +102,16 @@ class PerfettoCmd : public Consumer {
   std::string attach_key_;
   bool stop_trace_once_attached_ = false;
   bool redetach_once_attached_ = false;
+
+  // Streaming mode (--stream-period-ms): the buffers are read periodically
+  // while tracing rather than only once tracing is disabled.
+  uint32_t stream_period_ms_ = 0;
+  uint64_t stream_threshold_bytes_ = 0;
+  uint64_t max_read_behind_bytes_ = 0;
+  bool tracing_disabled_ = false;
+  bool reading_buffers_ = false;
+  bool is_final_read_ = false;
+  bool awaiting_final_stats_ = false;
 };
 
 }  // namespace perfetto
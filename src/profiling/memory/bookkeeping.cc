@@ -36,12 +36,9 @@ using ::perfetto::protos::pbzero::ProfilePacket;
 uint32_t kPacketSizeThreshold = 400000;
 }
 
-GlobalCallstackTrie::Node* GlobalCallstackTrie::Node::GetOrCreateChild(
-    const Interned<Frame>& loc) {
-  Node* child = children_.Get(loc);
-  if (!child)
-    child = children_.Emplace(loc, this);
-  return child;
+HeapTracker::~HeapTracker() {
+  for (auto it = callstack_allocations_.GetIterator(); it; ++it)
+    DeleteCallstackAllocations(it.value());
 }
 
 void HeapTracker::RecordMalloc(const std::vector<FrameData>& callstack,
@@ -49,11 +46,10 @@ void HeapTracker::RecordMalloc(const std::vector<FrameData>& callstack,
                                uint64_t size,
                                uint64_t sequence_number,
                                uint64_t timestamp) {
-  auto it = allocations_.find(address);
-  if (it != allocations_.end()) {
-    Allocation& alloc = it->second;
-    PERFETTO_DCHECK(alloc.sequence_number != sequence_number);
-    if (alloc.sequence_number < sequence_number) {
+  Allocation* alloc = allocations_.Find(address);
+  if (alloc) {
+    PERFETTO_DCHECK(alloc->sequence_number != sequence_number);
+    if (alloc->sequence_number < sequence_number) {
       // As we are overwriting the previous allocation, the previous allocation
       // must have been freed.
       //
@@ -62,23 +58,28 @@ void HeapTracker::RecordMalloc(const std::vector<FrameData>& callstack,
       // already happened at committed_sequence_number_, while in fact the free
       // might not have happened until right before this operation.
 
-      if (alloc.sequence_number > committed_sequence_number_) {
+      if (alloc->sequence_number > committed_sequence_number_) {
         // Only count the previous allocation if it hasn't already been
         // committed to avoid double counting it.
-        alloc.AddToCallstackAllocations();
+        alloc->AddToCallstackAllocations();
       }
 
-      alloc.SubtractFromCallstackAllocations();
+      alloc->SubtractFromCallstackAllocations();
+      alloc->callstack_allocations->allocs--;
       GlobalCallstackTrie::Node* node = callsites_->CreateCallsite(callstack);
-      alloc.total_size = size;
-      alloc.sequence_number = sequence_number;
-      alloc.callstack_allocations = MaybeCreateCallstackAllocations(node);
+      alloc->total_size = size;
+      alloc->sequence_number = sequence_number;
+      alloc->callstack_allocations = MaybeCreateCallstackAllocations(node);
+      alloc->callstack_allocations->allocs++;
     }
   } else {
     GlobalCallstackTrie::Node* node = callsites_->CreateCallsite(callstack);
-    allocations_.emplace(address,
-                         Allocation(size, sequence_number,
-                                    MaybeCreateCallstackAllocations(node)));
+    Allocation new_alloc;
+    new_alloc.total_size = size;
+    new_alloc.sequence_number = sequence_number;
+    new_alloc.callstack_allocations = MaybeCreateCallstackAllocations(node);
+    new_alloc.callstack_allocations->allocs++;
+    allocations_.Insert(address, new_alloc);
   }
 
   RecordOperation(sequence_number, {address, timestamp});
@@ -87,7 +88,7 @@ void HeapTracker::RecordMalloc(const std::vector<FrameData>& callstack,
 void HeapTracker::RecordOperation(uint64_t sequence_number,
                                   const PendingOperation& operation) {
   if (sequence_number != committed_sequence_number_ + 1) {
-    pending_operations_.emplace(sequence_number, operation);
+    pending_operations_.Insert(sequence_number, operation);
     return;
   }
 
@@ -95,11 +96,14 @@ void HeapTracker::RecordOperation(uint64_t sequence_number,
 
   // At this point some other pending operations might be eligible to be
   // committed.
-  auto it = pending_operations_.begin();
-  while (it != pending_operations_.end() &&
-         it->first == committed_sequence_number_ + 1) {
-    CommitOperation(it->first, it->second);
-    it = pending_operations_.erase(it);
+  while (!pending_operations_.empty()) {
+    uint64_t next_sequence_number = committed_sequence_number_ + 1;
+    PendingOperation* pending = pending_operations_.Find(next_sequence_number);
+    if (!pending)
+      break;
+    PendingOperation next_operation = *pending;
+    pending_operations_.Erase(next_sequence_number);
+    CommitOperation(next_sequence_number, next_operation);
   }
 }
 
@@ -111,16 +115,16 @@ void HeapTracker::CommitOperation(uint64_t sequence_number,
   uint64_t address = operation.allocation_address;
 
   // We will see many frees for addresses we do not know about.
-  auto leaf_it = allocations_.find(address);
-  if (leaf_it == allocations_.end())
+  Allocation* value = allocations_.Find(address);
+  if (!value)
     return;
 
-  Allocation& value = leaf_it->second;
-  if (value.sequence_number == sequence_number) {
-    value.AddToCallstackAllocations();
-  } else if (value.sequence_number < sequence_number) {
-    value.SubtractFromCallstackAllocations();
-    allocations_.erase(leaf_it);
+  if (value->sequence_number == sequence_number) {
+    value->AddToCallstackAllocations();
+  } else if (value->sequence_number < sequence_number) {
+    value->SubtractFromCallstackAllocations();
+    value->callstack_allocations->allocs--;
+    allocations_.Erase(address);
   }
   // else (value.sequence_number > sequence_number:
   //  This allocation has been replaced by a newer one in RecordMalloc.
@@ -138,12 +142,16 @@ void HeapTracker::Dump(
   // * We need to remove them after the callstacks were dumped, which currently
   //   happens after the allocations are dumped.
   // * This way, we do not destroy and recreate callstacks as frequently.
-  for (auto it_and_alloc : dead_callstack_allocations_) {
-    auto& it = it_and_alloc.first;
-    uint64_t allocated = it_and_alloc.second;
-    const CallstackAllocations& alloc = it->second;
-    if (alloc.allocs == 0 && alloc.allocation_count == allocated)
-      callstack_allocations_.erase(it);
+  for (const auto& node_and_allocated : dead_callstack_allocations_) {
+    GlobalCallstackTrie::Node* node = node_and_allocated.first;
+    uint64_t allocated = node_and_allocated.second;
+    CallstackAllocations** alloc_ptr = callstack_allocations_.Find(node);
+    PERFETTO_DCHECK(alloc_ptr);
+    CallstackAllocations* alloc = *alloc_ptr;
+    if (alloc->allocs == 0 && alloc->allocation_count == allocated) {
+      callstack_allocations_.Erase(node);
+      DeleteCallstackAllocations(alloc);
+    }
   }
   dead_callstack_allocations_.clear();
 
@@ -154,26 +162,36 @@ void HeapTracker::Dump(
       dump_state->current_profile_packet->add_process_dumps();
   fill_process_header(proto);
   proto->set_timestamp(committed_timestamp_);
-  for (auto it = callstack_allocations_.begin();
-       it != callstack_allocations_.end(); ++it) {
+  proto->set_incremental(dump_state->incremental);
+  for (auto it = callstack_allocations_.GetIterator(); it; ++it) {
+    CallstackAllocations& alloc = *it.value();
+    if (alloc.allocs == 0)
+      dead_callstack_allocations_.emplace_back(alloc.node,
+                                               alloc.allocation_count);
+
+    if (dump_state->incremental &&
+        alloc.allocation_count == alloc.dumped_allocation_count &&
+        alloc.free_count == alloc.dumped_free_count) {
+      continue;
+    }
+    alloc.dumped_allocation_count = alloc.allocation_count;
+    alloc.dumped_free_count = alloc.free_count;
+
     if (dump_state->currently_written() > kPacketSizeThreshold) {
       dump_state->NewProfilePacket();
       proto = dump_state->current_profile_packet->add_process_dumps();
       fill_process_header(proto);
       proto->set_timestamp(committed_timestamp_);
+      proto->set_incremental(dump_state->incremental);
     }
 
-    const CallstackAllocations& alloc = it->second;
-    dump_state->callstacks_to_dump.emplace(alloc.node);
+    dump_state->AddCallstack(alloc.node);
     ProfilePacket::HeapSample* sample = proto->add_samples();
     sample->set_callstack_id(alloc.node->id());
     sample->set_self_allocated(alloc.allocated);
     sample->set_self_freed(alloc.freed);
     sample->set_alloc_count(alloc.allocation_count);
     sample->set_free_count(alloc.free_count);
-
-    if (alloc.allocs == 0)
-      dead_callstack_allocations_.emplace_back(it, alloc.allocation_count);
   }
 }
 
@@ -181,54 +199,172 @@ uint64_t HeapTracker::GetSizeForTesting(const std::vector<FrameData>& stack) {
   GlobalCallstackTrie::Node* node = callsites_->CreateCallsite(stack);
   // Hack to make it go away again if it wasn't used before.
   // This is only good because this is used for testing only.
-  GlobalCallstackTrie::IncrementNode(node);
-  GlobalCallstackTrie::DecrementNode(node);
-  auto it = callstack_allocations_.find(node);
-  if (it == callstack_allocations_.end()) {
+  callsites_->IncrementNode(node);
+  callsites_->DecrementNode(node);
+  CallstackAllocations** alloc = callstack_allocations_.Find(node);
+  if (!alloc)
     return 0;
+  return (*alloc)->allocated - (*alloc)->freed;
+}
+
+GlobalCallstackTrie::GlobalCallstackTrie() {
+  uint32_t root = NewNode(MakeRootFrame(), kNoNode);
+  PERFETTO_DCHECK(root == kRoot);
+}
+
+GlobalCallstackTrie::~GlobalCallstackTrie() {
+  // This also deletes the nodes that were never referenced by a HeapTracker.
+  DeleteNode(GetNode(kRoot));
+  PERFETTO_DCHECK(node_count_ == 0);
+}
+
+uint32_t GlobalCallstackTrie::NewNode(Interned<Frame> frame, uint32_t parent) {
+  uint32_t index;
+  if (!free_nodes_.empty()) {
+    index = free_nodes_.back();
+    free_nodes_.pop_back();
+  } else {
+    if ((next_node_ & (kSlabSize - 1)) == 0)
+      node_slabs_.emplace_back(new NodeSlab());
+    index = next_node_++;
+    PERFETTO_CHECK(next_node_ != 0);
+  }
+  NodeSlab* slab = node_slabs_[index >> kSlabShift].get();
+  uint32_t generation = slab->generations[index & (kSlabSize - 1)];
+  new (GetNode(index)) Node(std::move(frame), index, parent, generation);
+  node_count_++;
+  return index;
+}
+
+void GlobalCallstackTrie::DeleteNode(Node* node) {
+  // Children with a ref_count of 0 are kept until their parent is deleted.
+  for (uint32_t child : node->children_) {
+    if (child != kNoNode)
+      DeleteNode(GetNode(child));
+  }
+  if (node->overflow_children_) {
+    for (auto it = node->overflow_children_->GetIterator(); it; ++it)
+      DeleteNode(GetNode(it.value()));
   }
-  const CallstackAllocations& alloc = it->second;
-  return alloc.allocated - alloc.freed;
+
+  uint32_t index = node->index_;
+  node->~Node();
+  node_slabs_[index >> kSlabShift]->generations[index & (kSlabSize - 1)]++;
+  free_nodes_.emplace_back(index);
+  node_count_--;
+}
+
+GlobalCallstackTrie::Node* GlobalCallstackTrie::GetOrCreateChild(
+    Node* node,
+    const Interned<Frame>& loc) {
+  uint32_t* free_slot = nullptr;
+  for (uint32_t& child : node->children_) {
+    if (child == kNoNode) {
+      if (!free_slot)
+        free_slot = &child;
+    } else if (GetNode(child)->location_ == loc) {
+      return GetNode(child);
+    }
+  }
+  if (node->overflow_children_) {
+    uint32_t* child = node->overflow_children_->Find(loc.id());
+    if (child)
+      return GetNode(*child);
+  }
+
+  uint32_t parent = node->index_;
+  // This can grow the slabs, but does not move existing nodes, so |node| and
+  // |free_slot| stay valid.
+  uint32_t child = NewNode(loc, parent);
+  if (free_slot) {
+    *free_slot = child;
+  } else {
+    if (!node->overflow_children_)
+      node->overflow_children_.reset(
+          new base::FlatHashMap<InternID, uint32_t>());
+    node->overflow_children_->Insert(loc.id(), child);
+  }
+  return GetNode(child);
+}
+
+void GlobalCallstackTrie::RemoveChild(Node* node, Node* child) {
+  for (uint32_t& slot : node->children_) {
+    if (slot == child->index_) {
+      slot = kNoNode;
+      return;
+    }
+  }
+  PERFETTO_DCHECK(node->overflow_children_);
+  bool erased = node->overflow_children_->Erase(child->location_.id());
+  PERFETTO_DCHECK(erased);
+  if (node->overflow_children_->empty())
+    node->overflow_children_.reset();
+}
+
+size_t GlobalCallstackTrie::GetNodeMemoryUsage() const {
+  size_t usage = node_slabs_.size() * sizeof(NodeSlab) +
+                 free_nodes_.capacity() * sizeof(uint32_t);
+  std::vector<const Node*> to_visit{GetNode(kRoot)};
+  while (!to_visit.empty()) {
+    const Node* node = to_visit.back();
+    to_visit.pop_back();
+    for (uint32_t child : node->children_) {
+      if (child != kNoNode)
+        to_visit.emplace_back(GetNode(child));
+    }
+    if (node->overflow_children_) {
+      usage += sizeof(*node->overflow_children_) +
+               node->overflow_children_->capacity() *
+                   (sizeof(InternID) + sizeof(uint32_t) + sizeof(bool));
+      for (auto it = node->overflow_children_->GetIterator(); it; ++it)
+        to_visit.emplace_back(GetNode(it.value()));
+    }
+  }
+  return usage;
 }
 
 std::vector<Interned<Frame>> GlobalCallstackTrie::BuildCallstack(
     const Node* node) const {
   std::vector<Interned<Frame>> res;
-  while (node != &root_) {
+  while (node->index_ != kRoot) {
     res.emplace_back(node->location_);
-    node = node->parent_;
+    node = GetNode(node->parent_);
   }
   return res;
 }
 
 GlobalCallstackTrie::Node* GlobalCallstackTrie::CreateCallsite(
     const std::vector<FrameData>& callstack) {
-  Node* node = &root_;
+  Node* node = GetNode(kRoot);
   for (const FrameData& loc : callstack) {
-    node = node->GetOrCreateChild(InternCodeLocation(loc));
+    node = GetOrCreateChild(node, InternCodeLocation(loc));
   }
   return node;
 }
 
 void GlobalCallstackTrie::IncrementNode(Node* node) {
-  while (node != nullptr) {
+  for (;;) {
     node->ref_count_ += 1;
-    node = node->parent_;
+    if (node->index_ == kRoot)
+      break;
+    node = GetNode(node->parent_);
   }
 }
 
 void GlobalCallstackTrie::DecrementNode(Node* node) {
   PERFETTO_DCHECK(node->ref_count_ >= 1);
 
-  bool delete_prev = false;
   Node* prev = nullptr;
-  while (node != nullptr) {
-    if (delete_prev)
-      node->children_.Remove(*prev);
+  for (;;) {
+    if (prev && prev->ref_count_ == 0) {
+      RemoveChild(node, prev);
+      DeleteNode(prev);
+    }
     node->ref_count_ -= 1;
-    delete_prev = node->ref_count_ == 0;
+    if (node->index_ == kRoot)
+      break;
     prev = node;
-    node = node->parent_;
+    node = GetNode(node->parent_);
   }
 }
 
@@ -259,7 +395,7 @@ Interned<Frame> GlobalCallstackTrie::MakeRootFrame() {
 }
 
 void DumpState::WriteMap(const Interned<Mapping> map) {
-  auto map_it_and_inserted = dumped_mappings.emplace(map.id());
+  auto map_it_and_inserted = dumped->mappings.emplace(map.id());
   if (map_it_and_inserted.second) {
     for (const Interned<std::string>& str : map->path_components)
       WriteString(str);
@@ -285,7 +421,7 @@ void DumpState::WriteFrame(Interned<Frame> frame) {
   WriteMap(frame->mapping);
   WriteString(frame->function_name);
   bool inserted;
-  std::tie(std::ignore, inserted) = dumped_frames.emplace(frame.id());
+  std::tie(std::ignore, inserted) = dumped->frames.emplace(frame.id());
   if (inserted) {
     if (currently_written() > kPacketSizeThreshold)
       NewProfilePacket();
@@ -300,7 +436,7 @@ void DumpState::WriteFrame(Interned<Frame> frame) {
 
 void DumpState::WriteString(const Interned<std::string>& str) {
   bool inserted;
-  std::tie(std::ignore, inserted) = dumped_strings.emplace(str.id());
+  std::tie(std::ignore, inserted) = dumped->strings.emplace(str.id());
   if (inserted) {
     if (currently_written() > kPacketSizeThreshold)
       NewProfilePacket();
@@ -312,5 +448,10 @@ void DumpState::WriteString(const Interned<std::string>& str) {
   }
 }
 
+void DumpState::AddCallstack(GlobalCallstackTrie::Node* node) {
+  if (dumped->callstacks.emplace(node->id()).second)
+    callstacks_to_dump.emplace(node);
+}
+
 }  // namespace profiling
 }  // namespace perfetto
@@ -19,16 +19,20 @@
 
 #include <functional>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <type_traits>
 #include <vector>
 
-#include "perfetto/base/lookup_set.h"
+#include "perfetto/base/flat_hash_map.h"
 #include "perfetto/base/string_splitter.h"
 #include "perfetto/base/time.h"
 #include "perfetto/trace/profiling/profile_packet.pbzero.h"
 #include "perfetto/trace/trace_packet.pbzero.h"
 #include "perfetto/tracing/core/trace_writer.h"
 #include "src/profiling/memory/interner.h"
+#include "src/profiling/memory/object_pool.h"
 #include "src/profiling/memory/unwound_messages.h"
 
 // Below is an illustration of the bookkeeping system state where
@@ -139,10 +143,15 @@ struct Frame {
 
 // Graph of function callsites. This is shared between heap dumps for
 // different processes. Each call site is represented by a
-// GlobalCallstackTrie::Node that is owned by the parent (i.e. calling)
-// callsite. It has a pointer to its parent, which means the function
+// GlobalCallstackTrie::Node that is referenced by the parent (i.e. calling)
+// callsite. It has the index of its parent, which means the function
 // call-graph can be reconstructed from a GlobalCallstackTrie::Node by walking
-// down the pointers to the parents.
+// down the indices of the parents.
+//
+// The nodes are allocated out of slabs owned by the trie, and reference each
+// other by 32-bit index into the slabs rather than by pointer. Most nodes
+// have a single child, so the first children are stored inline in the node,
+// and only the ones after that go into a hash map.
 class GlobalCallstackTrie {
  public:
   // Node in a tree of function traces that resulted in an allocation. For
@@ -157,7 +166,7 @@ class GlobalCallstackTrie {
   //                       |
   //                   libc_init
   //                       |
-  //                    [root_]
+  //                    [root]
   //
   // allocations_ will hold a map from the pointers returned from malloc to
   // alloc_buf to the leafs of this tree.
@@ -166,32 +175,77 @@ class GlobalCallstackTrie {
     // This is opaque except to GlobalCallstackTrie.
     friend class GlobalCallstackTrie;
 
-    Node(Interned<Frame> frame) : Node(std::move(frame), nullptr) {}
-    Node(Interned<Frame> frame, Node* parent)
-        : parent_(parent), location_(std::move(frame)) {}
-
-    uintptr_t id() const { return reinterpret_cast<uintptr_t>(this); }
+    Node(Interned<Frame> frame,
+         uint32_t index,
+         uint32_t parent,
+         uint32_t generation)
+        : location_(std::move(frame)),
+          index_(index),
+          parent_(parent),
+          generation_(generation) {}
+
+    // Unique for the lifetime of the GlobalCallstackTrie, even after the node
+    // is destroyed. This allows to refer to callstacks written in previous
+    // dumps.
+    uint64_t id() const {
+      return (static_cast<uint64_t>(generation_) << 32) | index_;
+    }
 
    private:
-    Node* GetOrCreateChild(const Interned<Frame>& loc);
+    static constexpr size_t kInlineChildren = 2;
 
-    uint64_t ref_count_ = 0;
-    Node* const parent_;
     const Interned<Frame> location_;
-    base::LookupSet<Node, const Interned<Frame>, &Node::location_> children_;
+    // Children that did not fit in |children_|, by frame id. Only allocated
+    // for the few nodes that have more than kInlineChildren children.
+    std::unique_ptr<base::FlatHashMap<InternID, uint32_t>> overflow_children_;
+    const uint32_t index_;
+    const uint32_t parent_;
+    const uint32_t generation_;
+    uint32_t ref_count_ = 0;
+    // Indices of the children, kNoNode for unused entries.
+    uint32_t children_[kInlineChildren] = {};
   };
 
-  GlobalCallstackTrie() = default;
+  GlobalCallstackTrie();
+  ~GlobalCallstackTrie();
   GlobalCallstackTrie(const GlobalCallstackTrie&) = delete;
   GlobalCallstackTrie& operator=(const GlobalCallstackTrie&) = delete;
 
   Node* CreateCallsite(const std::vector<FrameData>& locs);
-  static void DecrementNode(Node* node);
-  static void IncrementNode(Node* node);
+  void DecrementNode(Node* node);
+  void IncrementNode(Node* node);
 
   std::vector<Interned<Frame>> BuildCallstack(const Node* node) const;
 
+  // Number of nodes, including the root.
+  size_t node_count() const { return node_count_; }
+  // Bytes used by the nodes. This does not include the interned frames.
+  size_t GetNodeMemoryUsage() const;
+
  private:
+  static constexpr uint32_t kRoot = 0;
+  // The root is never the child of another node.
+  static constexpr uint32_t kNoNode = kRoot;
+  static constexpr uint32_t kSlabShift = 12;
+  static constexpr uint32_t kSlabSize = 1 << kSlabShift;
+
+  struct NodeSlab {
+    typename std::aligned_storage<sizeof(Node), alignof(Node)>::type
+        nodes[kSlabSize];
+    // Incremented every time a slot is reused, to derive unique node ids.
+    uint32_t generations[kSlabSize] = {};
+  };
+
+  Node* GetNode(uint32_t index) const {
+    return reinterpret_cast<Node*>(
+        &node_slabs_[index >> kSlabShift]->nodes[index & (kSlabSize - 1)]);
+  }
+  uint32_t NewNode(Interned<Frame> frame, uint32_t parent);
+  void DeleteNode(Node* node);
+
+  Node* GetOrCreateChild(Node* node, const Interned<Frame>& loc);
+  void RemoveChild(Node* node, Node* child);
+
   Interned<Frame> InternCodeLocation(const FrameData& loc);
   Interned<Frame> MakeRootFrame();
 
@@ -199,11 +253,34 @@ class GlobalCallstackTrie {
   Interner<Mapping> mapping_interner_;
   Interner<Frame> frame_interner_;
 
-  Node root_{MakeRootFrame()};
+  std::vector<std::unique_ptr<NodeSlab>> node_slabs_;
+  // Indices of the slots of deleted nodes, reused before the slabs grow.
+  std::vector<uint32_t> free_nodes_;
+  uint32_t next_node_ = 0;
+  size_t node_count_ = 0;
+};
+
+// The interned data and callstacks that were written to the trace. For
+// incremental dumps, this outlives the DumpState so that each of them is only
+// written once per trace.
+struct DumpedInternedData {
+  std::set<InternID> strings;
+  std::set<InternID> frames;
+  std::set<InternID> mappings;
+  std::set<uint64_t> callstacks;
 };
 
 struct DumpState {
-  DumpState(TraceWriter* tw, uint64_t* ni) : trace_writer(tw), next_index(ni) {
+  // If |incremental_data| is not null, only the callstacks and interned data
+  // that are not in it are written, and HeapTracker only writes the callsites
+  // that changed since its previous dump.
+  DumpState(TraceWriter* tw,
+            uint64_t* ni,
+            DumpedInternedData* incremental_data = nullptr)
+      : incremental(incremental_data != nullptr),
+        dumped(incremental_data ? incremental_data : &dumped_in_this_dump),
+        trace_writer(tw),
+        next_index(ni) {
     last_written = trace_writer->written();
 
     current_trace_packet = trace_writer->NewTracePacket();
@@ -223,10 +300,11 @@ struct DumpState {
   void WriteMap(const Interned<Mapping> map);
   void WriteFrame(const Interned<Frame> frame);
   void WriteString(const Interned<std::string>& str);
+  void AddCallstack(GlobalCallstackTrie::Node* node);
 
-  std::set<InternID> dumped_strings;
-  std::set<InternID> dumped_frames;
-  std::set<InternID> dumped_mappings;
+  const bool incremental;
+  DumpedInternedData dumped_in_this_dump;
+  DumpedInternedData* const dumped;
 
   std::set<GlobalCallstackTrie::Node*> callstacks_to_dump;
 
@@ -264,6 +342,10 @@ class HeapTracker {
   // Caller needs to ensure that callsites outlives the HeapTracker.
   explicit HeapTracker(GlobalCallstackTrie* callsites)
       : callsites_(callsites) {}
+  ~HeapTracker();
+
+  HeapTracker(const HeapTracker&) = delete;
+  HeapTracker& operator=(const HeapTracker&) = delete;
 
   void RecordMalloc(const std::vector<FrameData>& stack,
                     uint64_t address,
@@ -288,6 +370,7 @@ class HeapTracker {
   struct CallstackAllocations {
     CallstackAllocations(GlobalCallstackTrie::Node* n) : node(n) {}
 
+    // Number of live Allocations referencing this.
     uint64_t allocs = 0;
 
     uint64_t allocated = 0;
@@ -295,30 +378,18 @@ class HeapTracker {
     uint64_t allocation_count = 0;
     uint64_t free_count = 0;
 
-    GlobalCallstackTrie::Node* const node;
-
-    ~CallstackAllocations() { GlobalCallstackTrie::DecrementNode(node); }
+    // Counts at the previous dump. The byte counters only change together
+    // with these.
+    uint64_t dumped_allocation_count = 0;
+    uint64_t dumped_free_count = 0;
 
-    bool operator<(const CallstackAllocations& other) const {
-      return node < other.node;
-    }
+    GlobalCallstackTrie::Node* const node;
   };
 
+  // Stored by value in |allocations_|, so this needs to stay small and
+  // trivially movable. The reference from |callstack_allocations| is counted
+  // in CallstackAllocations::allocs by HeapTracker.
   struct Allocation {
-    Allocation(uint64_t size, uint64_t seq, CallstackAllocations* csa)
-        : total_size(size), sequence_number(seq), callstack_allocations(csa) {
-      callstack_allocations->allocs++;
-    }
-
-    Allocation() = default;
-    Allocation(const Allocation&) = delete;
-    Allocation(Allocation&& other) noexcept {
-      total_size = other.total_size;
-      sequence_number = other.sequence_number;
-      callstack_allocations = other.callstack_allocations;
-      other.callstack_allocations = nullptr;
-    }
-
     void AddToCallstackAllocations() {
       callstack_allocations->allocation_count++;
       callstack_allocations->allocated += total_size;
@@ -329,32 +400,27 @@ class HeapTracker {
       callstack_allocations->freed += total_size;
     }
 
-    ~Allocation() {
-      if (callstack_allocations)
-        callstack_allocations->allocs--;
-    }
-
-    uint64_t total_size;
-    uint64_t sequence_number;
-    CallstackAllocations* callstack_allocations;
+    uint64_t total_size = 0;
+    uint64_t sequence_number = 0;
+    CallstackAllocations* callstack_allocations = nullptr;
   };
 
   struct PendingOperation {
-    uint64_t allocation_address;
-    uint64_t timestamp;
+    uint64_t allocation_address = 0;
+    uint64_t timestamp = 0;
   };
 
   CallstackAllocations* MaybeCreateCallstackAllocations(
       GlobalCallstackTrie::Node* node) {
-    auto callstack_allocations_it = callstack_allocations_.find(node);
-    if (callstack_allocations_it == callstack_allocations_.end()) {
-      GlobalCallstackTrie::IncrementNode(node);
-      bool inserted;
-      std::tie(callstack_allocations_it, inserted) =
-          callstack_allocations_.emplace(node, node);
-      PERFETTO_DCHECK(inserted);
-    }
-    return &callstack_allocations_it->second;
+    CallstackAllocations** callstack_allocations =
+        callstack_allocations_.Find(node);
+    if (callstack_allocations)
+      return *callstack_allocations;
+    callsites_->IncrementNode(node);
+    CallstackAllocations* new_callstack_allocations =
+        callstack_allocations_pool_.New(node);
+    callstack_allocations_.Insert(node, new_callstack_allocations);
+    return new_callstack_allocations;
   }
 
   void RecordOperation(uint64_t sequence_number,
@@ -371,16 +437,26 @@ class HeapTracker {
   void CommitOperation(uint64_t sequence_number,
                        const PendingOperation& operation);
 
+  void DeleteCallstackAllocations(CallstackAllocations* callstack_allocations) {
+    callsites_->DecrementNode(callstack_allocations->node);
+    callstack_allocations_pool_.Delete(callstack_allocations);
+  }
+
   // We cannot use an interner here, because after the last allocation goes
   // away, we still need to keep the CallstackAllocations around until the next
   // dump.
-  std::map<GlobalCallstackTrie::Node*, CallstackAllocations>
+  // The CallstackAllocations are owned by |callstack_allocations_pool_|, so
+  // that Allocations can point to them while |callstack_allocations_| grows.
+  base::FlatHashMap<GlobalCallstackTrie::Node*, CallstackAllocations*>
       callstack_allocations_;
+  ObjectPool<CallstackAllocations> callstack_allocations_pool_;
 
-  std::vector<std::pair<decltype(callstack_allocations_)::iterator, uint64_t>>
+  // Callstacks that had no live allocations at the last dump, along with their
+  // allocation_count at that time.
+  std::vector<std::pair<GlobalCallstackTrie::Node*, uint64_t>>
       dead_callstack_allocations_;
 
-  std::map<uint64_t /* allocation address */, Allocation> allocations_;
+  base::FlatHashMap<uint64_t /* allocation address */, Allocation> allocations_;
 
   // An operation is either a commit of an allocation or freeing of an
   // allocation. An operation is a free if its seq_id is larger than
@@ -389,7 +465,10 @@ class HeapTracker {
   //
   // If its seq_id is less than the sequence_number of the corresponding
   // allocation it could be either, but is ignored either way.
-  std::map<uint64_t /* seq_id */, PendingOperation /* allocation address */>
+  //
+  // Operations are committed in seq_id order, by looking up
+  // committed_sequence_number_ + 1.
+  base::FlatHashMap<uint64_t /* seq_id */, PendingOperation>
       pending_operations_;
 
   uint64_t committed_timestamp_ = 0;
@@ -0,0 +1,158 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "src/profiling/memory/bookkeeping.h"
+
+namespace {
+
+using perfetto::profiling::FrameData;
+using perfetto::profiling::GlobalCallstackTrie;
+using perfetto::profiling::HeapTracker;
+
+constexpr size_t kNumCallstacks = 64;
+constexpr size_t kCallstackDepth = 16;
+constexpr uint64_t kAllocSize = 32;
+
+// Callstacks sharing a common prefix, as they would in a real process.
+std::vector<std::vector<FrameData>> MakeCallstacks() {
+  std::vector<std::vector<FrameData>> callstacks(kNumCallstacks);
+  for (size_t i = 0; i < kNumCallstacks; i++) {
+    for (size_t depth = 0; depth < kCallstackDepth; depth++) {
+      unwindstack::FrameData frame{};
+      // The outermost frames are shared, the innermost ones are not.
+      size_t fn = depth < kCallstackDepth / 2 ? depth : i * kCallstackDepth +
+                                                            depth;
+      frame.function_name = "fun_" + std::to_string(fn);
+      frame.map_name = "/system/lib64/libfoo.so";
+      frame.rel_pc = 0x1000 + fn * 0x10;
+      callstacks[i].emplace_back(frame, "build_id");
+    }
+  }
+  return callstacks;
+}
+
+// Deep callstacks forming a bushy tree: each one diverges from the previous
+// one at a random depth.
+std::vector<std::vector<FrameData>> MakeDiverseCallstacks(size_t n) {
+  constexpr size_t kDepth = 32;
+  constexpr size_t kMinSharedDepth = 4;
+  std::minstd_rand rng(42);
+  std::uniform_int_distribution<size_t> diverge_at(kMinSharedDepth,
+                                                   kDepth - 1);
+  std::vector<std::vector<FrameData>> callstacks;
+  std::vector<FrameData> callstack;
+  size_t next_fn = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t depth = i == 0 ? 0 : diverge_at(rng);
+    callstack.erase(callstack.begin() + static_cast<ptrdiff_t>(depth),
+                    callstack.end());
+    for (; depth < kDepth; depth++) {
+      unwindstack::FrameData frame{};
+      size_t fn = depth < kMinSharedDepth ? depth : next_fn++;
+      frame.function_name = "fun_" + std::to_string(fn);
+      frame.map_name = "/system/lib64/libfoo.so";
+      frame.rel_pc = 0x1000 + fn * 0x10;
+      callstack.emplace_back(frame, "build_id");
+    }
+    callstacks.emplace_back(callstack);
+  }
+  return callstacks;
+}
+
+// Malloc addresses are 16-byte aligned but not sequential.
+uint64_t AllocAddress(uint64_t i) {
+  return 0x7000000000ULL + ((i * 2654435761ULL) & 0xffffffffULL) * 16;
+}
+
+// Keeps |state.range(0)| allocations live: every iteration frees the oldest
+// allocation and makes a new one.
+void BM_HeapTrackerMallocFree(benchmark::State& state, bool in_order) {
+  const uint64_t live_allocs = static_cast<uint64_t>(state.range(0));
+  std::vector<std::vector<FrameData>> callstacks = MakeCallstacks();
+  GlobalCallstackTrie callsites;
+  HeapTracker tracker(&callsites);
+
+  uint64_t seq = 0;
+  uint64_t next = 0;
+  for (; next < live_allocs; next++) {
+    seq++;
+    tracker.RecordMalloc(callstacks[next % kNumCallstacks], AllocAddress(next),
+                         kAllocSize, seq, seq);
+  }
+
+  for (auto _ : state) {
+    const std::vector<FrameData>& callstack = callstacks[next % kNumCallstacks];
+    if (in_order) {
+      tracker.RecordFree(AllocAddress(next - live_allocs), seq + 1, seq + 1);
+      tracker.RecordMalloc(callstack, AllocAddress(next), kAllocSize, seq + 2,
+                           seq + 2);
+    } else {
+      // The free and malloc come from different threads of the client and
+      // are received out of order, so the malloc is kept pending.
+      tracker.RecordMalloc(callstack, AllocAddress(next), kAllocSize, seq + 2,
+                           seq + 2);
+      tracker.RecordFree(AllocAddress(next - live_allocs), seq + 1, seq + 1);
+    }
+    seq += 2;
+    next++;
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * 2);
+}
+
+}  // namespace
+
+// Creates |state.range(0)| callsites and reports the memory used by the trie
+// nodes (not including the interned frames).
+static void BM_GlobalCallstackTrieCreateCallsite(benchmark::State& state) {
+  std::vector<std::vector<FrameData>> callstacks =
+      MakeDiverseCallstacks(static_cast<size_t>(state.range(0)));
+  size_t node_memory = 0;
+  size_t nodes = 0;
+  for (auto _ : state) {
+    GlobalCallstackTrie callsites;
+    std::vector<GlobalCallstackTrie::Node*> leaves;
+    leaves.reserve(callstacks.size());
+    for (const std::vector<FrameData>& callstack : callstacks) {
+      leaves.emplace_back(callsites.CreateCallsite(callstack));
+      callsites.IncrementNode(leaves.back());
+    }
+    node_memory = callsites.GetNodeMemoryUsage();
+    nodes = callsites.node_count();
+    for (GlobalCallstackTrie::Node* leaf : leaves)
+      callsites.DecrementNode(leaf);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          state.range(0));
+  state.counters["bytes_per_callsite"] = benchmark::Counter(
+      static_cast<double>(node_memory) / static_cast<double>(state.range(0)));
+  state.counters["bytes_per_node"] = benchmark::Counter(
+      static_cast<double>(node_memory) / static_cast<double>(nodes));
+}
+BENCHMARK(BM_GlobalCallstackTrieCreateCallsite)->Arg(1024)->Arg(16 * 1024);
+
+static void BM_HeapTrackerInOrder(benchmark::State& state) {
+  BM_HeapTrackerMallocFree(state, /*in_order=*/true);
+}
+BENCHMARK(BM_HeapTrackerInOrder)->Arg(1024)->Arg(1024 * 1024);
+
+static void BM_HeapTrackerOutOfOrder(benchmark::State& state) {
+  BM_HeapTrackerMallocFree(state, /*in_order=*/false);
+}
+BENCHMARK(BM_HeapTrackerOutOfOrder)->Arg(1024)->Arg(1024 * 1024);
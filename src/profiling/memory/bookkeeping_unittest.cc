@@ -18,6 +18,7 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "src/tracing/core/trace_writer_for_testing.h"
 
 namespace perfetto {
 namespace profiling {
@@ -187,6 +188,103 @@ TEST(BookkeepingTest, ArbitraryOrder) {
   } while (std::next_permutation(std::begin(operations), std::end(operations)));
 }
 
+TEST(BookkeepingTest, NodeIdsAreNotReused) {
+  GlobalCallstackTrie c;
+  GlobalCallstackTrie::Node* node = c.CreateCallsite(stack());
+  c.IncrementNode(node);
+  uint64_t id = node->id();
+  c.DecrementNode(node);
+
+  GlobalCallstackTrie::Node* new_node = c.CreateCallsite(stack());
+  EXPECT_NE(new_node->id(), id);
+}
+
+TEST(BookkeepingTest, ManyChildren) {
+  GlobalCallstackTrie c;
+  // More children of the same node than fit inline.
+  std::vector<std::vector<FrameData>> callstacks;
+  for (size_t i = 0; i < 10; ++i) {
+    std::vector<FrameData> callstack = stack();
+    unwindstack::FrameData data{};
+    data.function_name = "leaf" + std::to_string(i);
+    data.map_name = "map1";
+    callstack.emplace_back(std::move(data), "dummy_buildid");
+    callstacks.emplace_back(std::move(callstack));
+  }
+
+  std::vector<GlobalCallstackTrie::Node*> nodes;
+  for (const auto& callstack : callstacks) {
+    nodes.emplace_back(c.CreateCallsite(callstack));
+    c.IncrementNode(nodes.back());
+  }
+  // Root, the two frames of stack() and the leaves.
+  EXPECT_EQ(c.node_count(), 3u + callstacks.size());
+  for (size_t i = 0; i < callstacks.size(); ++i) {
+    EXPECT_EQ(c.CreateCallsite(callstacks[i]), nodes[i]);
+    EXPECT_EQ(c.BuildCallstack(nodes[i]).size(), 3u);
+  }
+
+  for (size_t i = 0; i < callstacks.size(); i += 2)
+    c.DecrementNode(nodes[i]);
+  EXPECT_EQ(c.node_count(), 3u + callstacks.size() / 2);
+  for (size_t i = 1; i < callstacks.size(); i += 2)
+    EXPECT_EQ(c.CreateCallsite(callstacks[i]), nodes[i]);
+
+  for (size_t i = 1; i < callstacks.size(); i += 2)
+    c.DecrementNode(nodes[i]);
+  EXPECT_EQ(c.node_count(), 1u);
+}
+
+TEST(BookkeepingTest, IncrementalDump) {
+  GlobalCallstackTrie c;
+  HeapTracker hd(&c);
+  TraceWriterForTesting writer;
+  uint64_t next_index = 0;
+  DumpedInternedData dumped;
+  auto fill_header = [](protos::pbzero::ProfilePacket::ProcessHeapSamples* p) {
+    p->set_pid(1);
+  };
+
+  hd.RecordMalloc(stack(), 0x1, 5, 1, 100);
+  hd.RecordMalloc(stack2(), 0x2, 2, 2, 200);
+  {
+    DumpState dump_state(&writer, &next_index, &dumped);
+    hd.Dump(fill_header, &dump_state);
+    EXPECT_EQ(dump_state.callstacks_to_dump.size(), 2u);
+    dump_state.current_trace_packet->Finalize();
+  }
+
+  hd.RecordFree(0x2, 3, 300);
+  {
+    DumpState dump_state(&writer, &next_index, &dumped);
+    hd.Dump(fill_header, &dump_state);
+    // The callstack was already written by the previous dump.
+    EXPECT_TRUE(dump_state.callstacks_to_dump.empty());
+    dump_state.current_trace_packet->Finalize();
+  }
+
+  std::vector<protos::TracePacket> packets = writer.GetAllTracePackets();
+  ASSERT_EQ(packets.size(), 2u);
+
+  const auto& first = packets[0].profile_packet();
+  ASSERT_EQ(first.process_dumps_size(), 1);
+  EXPECT_TRUE(first.process_dumps(0).incremental());
+  EXPECT_EQ(first.process_dumps(0).samples_size(), 2);
+
+  // Only the callsite whose allocation was freed is written again, with its
+  // absolute values.
+  const auto& second = packets[1].profile_packet();
+  ASSERT_EQ(second.process_dumps_size(), 1);
+  EXPECT_TRUE(second.process_dumps(0).incremental());
+  EXPECT_EQ(second.process_dumps(0).timestamp(), 300u);
+  ASSERT_EQ(second.process_dumps(0).samples_size(), 1);
+  const auto& sample = second.process_dumps(0).samples(0);
+  EXPECT_EQ(sample.self_allocated(), 2u);
+  EXPECT_EQ(sample.self_freed(), 2u);
+  EXPECT_EQ(sample.alloc_count(), 1u);
+  EXPECT_EQ(sample.free_count(), 1u);
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
@@ -39,7 +39,6 @@
 #include "perfetto/base/time.h"
 #include "perfetto/base/unix_socket.h"
 #include "perfetto/base/utils.h"
-#include "src/profiling/memory/sampler.h"
 #include "src/profiling/memory/scoped_spinlock.h"
 #include "src/profiling/memory/wire_protocol.h"
 
@@ -206,22 +205,18 @@ std::shared_ptr<Client> Client::CreateAndHandshake(
   // This is so that without block_client, we get the old behaviour that rate
   // limits using the blocking socket. We do not want to change that for Q.
   sock.SetBlocking(!client_config.block_client);
-  Sampler sampler{client_config.interval};
   // note: the shared_ptr will retain a copy of the unhooked_allocator
   return std::allocate_shared<Client>(unhooked_allocator, std::move(sock),
                                       client_config, std::move(shmem.value()),
-                                      std::move(sampler), getpid(),
-                                      FindMainThreadStack());
+                                      getpid(), FindMainThreadStack());
 }
 
 Client::Client(base::UnixSocketRaw sock,
                ClientConfiguration client_config,
                SharedRingBuffer shmem,
-               Sampler sampler,
                pid_t pid_at_creation,
                const char* main_thread_stack_base)
     : client_config_(client_config),
-      sampler_(std::move(sampler)),
       sock_(std::move(sock)),
       main_thread_stack_base_(main_thread_stack_base),
       shmem_(std::move(shmem)),
@@ -269,11 +264,14 @@ bool Client::RecordMalloc(uint64_t alloc_size,
   }
 
   uint64_t stack_size = static_cast<uint64_t>(stackbase - stacktop);
+  uint32_t tid = static_cast<uint32_t>(base::GetThreadId());
   metadata.total_size = total_size;
   metadata.alloc_size = alloc_size;
   metadata.alloc_address = alloc_address;
   metadata.stack_pointer = reinterpret_cast<uint64_t>(stacktop);
   metadata.stack_pointer_offset = sizeof(AllocMetadata);
+  metadata.stack_size = stack_size;
+  metadata.tid = tid;
   metadata.arch = unwindstack::Regs::CurrentArch();
   metadata.sequence_number =
       1 + sequence_number_.fetch_add(1, std::memory_order_acq_rel);
@@ -286,11 +284,20 @@ bool Client::RecordMalloc(uint64_t alloc_size,
     metadata.clock_monotonic_coarse_timestamp = 0;
   }
 
+  // Only send as much of the stack as heapprofd told us it needs for this
+  // thread. Until it has unwound a sample of the thread, there is no hint.
+  uint64_t copy_size = stack_size;
+  if (client_config_.adaptive_stack_copy) {
+    uint32_t limit = shmem_.GetReaderHint(tid);
+    if (limit && limit < copy_size)
+      copy_size = limit;
+  }
+
   WireMessage msg{};
   msg.record_type = RecordType::Malloc;
   msg.alloc_header = &metadata;
   msg.payload = const_cast<char*>(stacktop);
-  msg.payload_size = static_cast<size_t>(stack_size);
+  msg.payload_size = static_cast<size_t>(copy_size);
 
   if (!SendWireMessageWithRetriesIfBlocking(msg))
     return false;
@@ -26,7 +26,6 @@
 #include <vector>
 
 #include "perfetto/base/unix_socket.h"
-#include "src/profiling/memory/sampler.h"
 #include "src/profiling/memory/shared_ring_buffer.h"
 #include "src/profiling/memory/unhooked_allocator.h"
 #include "src/profiling/memory/wire_protocol.h"
@@ -72,22 +71,15 @@ class Client {
   // Add address to buffer of deallocations. Flushes the buffer if necessary.
   bool RecordFree(uint64_t alloc_address);
 
-  // Returns the number of bytes to assign to an allocation with the given
-  // |alloc_size|, based on the current sampling rate. A return value of zero
-  // means that the allocation should not be recorded. Not idempotent, each
-  // invocation mutates the sampler state.
-  //
-  // Not thread-safe.
-  size_t GetSampleSizeLocked(size_t alloc_size) {
-    return sampler_.SampleSize(alloc_size);
-  }
+  // Sampling interval requested by heapprofd. Sampling decisions are made by
+  // the caller, using a Sampler per thread.
+  uint64_t sampling_interval() const { return client_config_.interval; }
 
   // Public for std::allocate_shared. Use CreateAndHandshake() to create
   // instances instead.
   Client(base::UnixSocketRaw sock,
          ClientConfiguration client_config,
          SharedRingBuffer shmem,
-         Sampler sampler,
          pid_t pid_at_creation,
          const char* main_thread_stack_base);
 
@@ -105,8 +97,6 @@ class Client {
   bool IsConnected();
 
   ClientConfiguration client_config_;
-  // sampler_ operations are not thread-safe.
-  Sampler sampler_;
   base::UnixSocketRaw sock_;
 
   // Protected by free_batch_lock_.
@@ -22,6 +22,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <tuple>
+
 #include "perfetto/base/file_utils.h"
 #include "perfetto/base/string_utils.h"
 #include "perfetto/base/thread_task_runner.h"
@@ -36,7 +38,6 @@ namespace {
 using ::perfetto::protos::pbzero::ProfilePacket;
 
 constexpr char kHeapprofdDataSource[] = "android.heapprofd";
-constexpr size_t kUnwinderThreads = 5;
 constexpr int kHeapprofdSignal = 36;
 
 constexpr uint32_t kInitialConnectionBackoffMs = 100;
@@ -47,13 +48,28 @@ constexpr uint32_t kChildModeWatchdogPeriodMs = 10 * 1000;
 constexpr uint64_t kDefaultShmemSize = 8 * 1048576;  // ~8 MB
 constexpr uint64_t kMaxShmemSize = 500 * 1048576;    // ~500 MB
 
+constexpr uint32_t kLoadBalancingPeriodMs = 1000;
+// Clients are only moved away from unwinders that were at least this busy
+// during the last period.
+constexpr uint64_t kMigrationMinUtilizationPercent = 75;
+
 ClientConfiguration MakeClientConfiguration(const DataSourceConfig& cfg) {
   ClientConfiguration client_config;
   client_config.interval = cfg.heapprofd_config().sampling_interval_bytes();
   client_config.block_client = cfg.heapprofd_config().block_client();
+  client_config.adaptive_stack_copy =
+      cfg.heapprofd_config().adaptive_stack_copy();
   return client_config;
 }
 
+size_t GetDefaultUnwinderThreads(HeapprofdMode mode) {
+  // A child heapprofd only ever has one client.
+  if (mode == HeapprofdMode::kChild)
+    return 1;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? static_cast<size_t>(cpus) : 1;
+}
+
 std::vector<UnwindingWorker> MakeUnwindingWorkers(HeapprofdProducer* delegate,
                                                   size_t n) {
   std::vector<UnwindingWorker> ret;
@@ -118,13 +134,79 @@ size_t LogHistogram::GetBucket(uint64_t value) {
   return hibit;
 }
 
-// We create kUnwinderThreads unwinding threads. Bookkeeping is done on the main
-// thread.
+size_t PickUnwinderForNewClient(const std::vector<UnwinderState>& unwinders) {
+  size_t best = 0;
+  for (size_t i = 1; i < unwinders.size(); ++i) {
+    const UnwinderState& state = unwinders[i];
+    const UnwinderState& best_state = unwinders[best];
+    if (state.clients < best_state.clients ||
+        (state.clients == best_state.clients &&
+         state.utilization_percent < best_state.utilization_percent)) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+// Clients are assigned to the unwinder with the fewest clients when they
+// connect, but their sampling rates can differ by orders of magnitude. Every
+// period, move one client from the busiest unwinder to the least busy one if
+// that reduces the load of the busiest one. The load of a client is the time
+// spent unwinding its samples, which the unwinders report in the AllocRecords.
+base::Optional<ClientMigration> PickClientToMigrate(
+    const std::vector<uint64_t>& unwinder_load_us,
+    const std::vector<ClientLoad>& clients,
+    uint64_t period_us) {
+  if (unwinder_load_us.empty() || period_us == 0)
+    return base::nullopt;
+  size_t busiest = 0;
+  size_t idlest = 0;
+  for (size_t i = 0; i < unwinder_load_us.size(); ++i) {
+    if (unwinder_load_us[i] > unwinder_load_us[busiest])
+      busiest = i;
+    if (unwinder_load_us[i] < unwinder_load_us[idlest])
+      idlest = i;
+  }
+  if (unwinder_load_us[busiest] * 100 / period_us <
+      kMigrationMinUtilizationPercent) {
+    return base::nullopt;
+  }
+
+  // Moving a client with a load in (0, imbalance_us) strictly reduces the
+  // maximum load of the two unwinders. The closer it is to half of the
+  // imbalance, the more even they end up.
+  uint64_t imbalance_us = unwinder_load_us[busiest] - unwinder_load_us[idlest];
+  base::Optional<ClientMigration> migration;
+  uint64_t best_remaining_imbalance_us = imbalance_us;
+  for (size_t i = 0; i < clients.size(); ++i) {
+    const ClientLoad& client = clients[i];
+    if (client.unwinder != busiest || !client.can_migrate ||
+        client.load_us == 0 || client.load_us >= imbalance_us) {
+      continue;
+    }
+    uint64_t remaining_imbalance_us =
+        client.load_us * 2 > imbalance_us ? client.load_us * 2 - imbalance_us
+                                          : imbalance_us - client.load_us * 2;
+    if (remaining_imbalance_us < best_remaining_imbalance_us) {
+      best_remaining_imbalance_us = remaining_imbalance_us;
+      migration = ClientMigration{i, busiest, idlest};
+    }
+  }
+  return migration;
+}
+
+// We create unwinder_threads unwinding threads. Bookkeeping is done on the
+// main thread.
 HeapprofdProducer::HeapprofdProducer(HeapprofdMode mode,
-                                     base::TaskRunner* task_runner)
+                                     base::TaskRunner* task_runner,
+                                     size_t unwinder_threads)
     : task_runner_(task_runner),
       mode_(mode),
-      unwinding_workers_(MakeUnwindingWorkers(this, kUnwinderThreads)),
+      unwinding_workers_(MakeUnwindingWorkers(
+          this,
+          unwinder_threads ? unwinder_threads
+                           : GetDefaultUnwinderThreads(mode))),
+      unwinder_states_(unwinding_workers_.size()),
       socket_delegate_(this),
       weak_factory_(this) {
   if (mode == HeapprofdMode::kCentral) {
@@ -259,10 +341,11 @@ void HeapprofdProducer::Restart() {
   HeapprofdMode mode = mode_;
   base::TaskRunner* task_runner = task_runner_;
   const char* socket_name = producer_sock_name_;
+  size_t unwinder_threads = unwinding_workers_.size();
 
   // Invoke destructor and then the constructor again.
   this->~HeapprofdProducer();
-  new (this) HeapprofdProducer(mode, task_runner);
+  new (this) HeapprofdProducer(mode, task_runner, unwinder_threads);
 
   ConnectWithRetries(socket_name);
 }
@@ -465,11 +548,85 @@ void HeapprofdProducer::StartDataSource(DataSourceInstanceID id,
         },
         continuous_dump_config.dump_phase_ms());
   }
+  if (!load_balancing_scheduled_)
+    ScheduleLoadBalancing();
   PERFETTO_DLOG("Started DataSource");
 }
 
-UnwindingWorker& HeapprofdProducer::UnwinderForPID(pid_t pid) {
-  return unwinding_workers_[static_cast<uint64_t>(pid) % kUnwinderThreads];
+size_t HeapprofdProducer::AssignUnwinderToNewClient() {
+  size_t unwinder = PickUnwinderForNewClient(unwinder_states_);
+  unwinder_states_[unwinder].clients++;
+  return unwinder;
+}
+
+void HeapprofdProducer::ReleaseUnwinder(ProcessState* process_state) {
+  if (process_state->disconnected)
+    return;
+  PERFETTO_DCHECK(unwinder_states_[process_state->unwinder].clients > 0);
+  unwinder_states_[process_state->unwinder].clients--;
+}
+
+void HeapprofdProducer::ScheduleLoadBalancing() {
+  load_balancing_scheduled_ = true;
+  last_load_balancing_ms_ =
+      static_cast<uint64_t>(base::GetWallTimeMs().count());
+  auto weak_producer = weak_factory_.GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      [weak_producer] {
+        if (!weak_producer)
+          return;
+        weak_producer->BalanceUnwinderLoad();
+      },
+      kLoadBalancingPeriodMs);
+}
+
+void HeapprofdProducer::BalanceUnwinderLoad() {
+  load_balancing_scheduled_ = false;
+  uint64_t now_ms = static_cast<uint64_t>(base::GetWallTimeMs().count());
+  uint64_t period_us = std::max<uint64_t>(now_ms - last_load_balancing_ms_, 1) *
+                       1000;
+
+  std::vector<uint64_t> load_us(unwinder_states_.size());
+  std::vector<ClientLoad> clients;
+  std::vector<std::pair<pid_t, ProcessState*>> client_processes;
+  for (auto& id_and_data_source : data_sources_) {
+    for (auto& pid_and_process_state :
+         id_and_data_source.second.process_states) {
+      ProcessState& process_state = pid_and_process_state.second;
+      uint64_t client_load_us = process_state.total_unwinding_time_us -
+                                process_state.balanced_unwinding_time_us;
+      process_state.balanced_unwinding_time_us =
+          process_state.total_unwinding_time_us;
+      load_us[process_state.unwinder] += client_load_us;
+      clients.push_back(
+          {process_state.unwinder, client_load_us,
+           !process_state.disconnected && !process_state.migrating});
+      client_processes.emplace_back(pid_and_process_state.first,
+                                    &process_state);
+    }
+  }
+
+  for (size_t i = 0; i < unwinder_states_.size(); ++i) {
+    UnwinderState& state = unwinder_states_[i];
+    state.busy_time_us += load_us[i];
+    state.utilization_percent =
+        static_cast<uint32_t>(std::min<uint64_t>(load_us[i] * 100 / period_us,
+                                                 100));
+  }
+
+  base::Optional<ClientMigration> migration =
+      PickClientToMigrate(load_us, clients, period_us);
+  if (migration) {
+    pid_t pid = client_processes[migration->client].first;
+    PERFETTO_DLOG("%d: Migrating from unwinder %zu to %zu.", pid,
+                  migration->from_unwinder, migration->to_unwinder);
+    client_processes[migration->client].second->migrating = true;
+    unwinding_workers_[migration->from_unwinder].PostMigrateClient(
+        pid, migration->to_unwinder);
+  }
+
+  if (!data_sources_.empty())
+    ScheduleLoadBalancing();
 }
 
 void HeapprofdProducer::StopDataSource(DataSourceInstanceID id) {
@@ -481,9 +638,12 @@ void HeapprofdProducer::StopDataSource(DataSourceInstanceID id) {
   }
 
   DataSource& data_source = it->second;
-  for (const auto& pid_and_process_state : data_source.process_states) {
+  for (auto& pid_and_process_state : data_source.process_states) {
     pid_t pid = pid_and_process_state.first;
-    UnwinderForPID(pid).PostDisconnectSocket(pid);
+    ProcessState& process_state = pid_and_process_state.second;
+    // A migrating client is dropped once it reaches HandleClientMigrated.
+    unwinding_workers_[process_state.unwinder].PostDisconnectSocket(pid);
+    ReleaseUnwinder(&process_state);
   }
 
   data_sources_.erase(it);
@@ -517,8 +677,21 @@ bool HeapprofdProducer::Dump(DataSourceInstanceID id,
   }
   DataSource& data_source = it->second;
 
-  DumpState dump_state(data_source.trace_writer.get(),
-                       &data_source.next_index_);
+  bool incremental = data_source.config.continuous_dump_config().incremental();
+  DumpState dump_state(
+      data_source.trace_writer.get(), &data_source.next_index_,
+      incremental ? &data_source.dumped_interned_data : nullptr);
+
+  for (size_t i = 0; i < unwinder_states_.size(); ++i) {
+    const UnwinderState& state = unwinder_states_[i];
+    ProfilePacket::UnwinderStats* proto =
+        dump_state.current_profile_packet->add_unwinder_stats();
+    proto->set_id(static_cast<uint32_t>(i));
+    proto->set_clients(state.clients);
+    proto->set_busy_time_us(state.busy_time_us);
+    proto->set_utilization_percent(state.utilization_percent);
+    proto->set_migrated_clients(state.migrated_clients);
+  }
 
   for (pid_t rejected_pid : data_source.rejected_pids) {
     ProfilePacket::ProcessHeapSamples* proto =
@@ -546,6 +719,7 @@ bool HeapprofdProducer::Dump(DataSourceInstanceID id,
       stats->set_heap_samples(process_state.heap_samples);
       stats->set_map_reparses(process_state.map_reparses);
       stats->set_total_unwinding_time_us(process_state.total_unwinding_time_us);
+      stats->set_unwinding_cache_hits(process_state.unwinding_cache_hits);
       auto* unwinding_hist = stats->set_unwinding_time_us();
       for (const auto& p : process_state.unwinding_time_us.GetData()) {
         auto* bucket = unwinding_hist->add_buckets();
@@ -666,8 +840,10 @@ void HeapprofdProducer::SocketDelegate::OnDataAvailable(
     }
 
     DataSource& data_source = ds_it->second;
-    data_source.process_states.emplace(self->peer_pid(),
-                                       &producer_->callsites_);
+    size_t unwinder = producer_->AssignUnwinderToNewClient();
+    data_source.process_states.emplace(
+        std::piecewise_construct, std::forward_as_tuple(self->peer_pid()),
+        std::forward_as_tuple(&producer_->callsites_, unwinder));
 
     PERFETTO_DLOG("%d: Received FDs.", self->peer_pid());
     int raw_fd = pending_process.shmem.fd();
@@ -685,8 +861,8 @@ void HeapprofdProducer::SocketDelegate::OnDataAvailable(
     handoff_data.shmem = std::move(pending_process.shmem);
     handoff_data.client_config = data_source.client_configuration;
 
-    producer_->UnwinderForPID(self->peer_pid())
-        .PostHandoffSocket(std::move(handoff_data));
+    producer_->unwinding_workers_[unwinder].PostHandoffSocket(
+        std::move(handoff_data));
     producer_->pending_processes_.erase(it);
   } else if (fds[kHandshakeMaps] || fds[kHandshakeMem]) {
     PERFETTO_DFATAL("%d: Received partial FDs.", self->peer_pid());
@@ -783,6 +959,23 @@ void HeapprofdProducer::PostSocketDisconnected(DataSourceInstanceID ds_id,
   });
 }
 
+void HeapprofdProducer::PostClientMigrated(
+    size_t target_worker,
+    pid_t pid,
+    UnwindingWorker::HandoffData handoff_data) {
+  // Once we can use C++14, this should be std::moved into the lambda instead.
+  auto* raw_handoff_data =
+      new UnwindingWorker::HandoffData(std::move(handoff_data));
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->PostTask([weak_this, target_worker, pid, raw_handoff_data] {
+    if (weak_this) {
+      weak_this->HandleClientMigrated(target_worker, pid,
+                                      std::move(*raw_handoff_data));
+    }
+    delete raw_handoff_data;
+  });
+}
+
 void HeapprofdProducer::HandleAllocRecord(AllocRecord alloc_rec) {
   const AllocMetadata& alloc_metadata = alloc_rec.alloc_metadata;
   auto it = data_sources_.find(alloc_rec.data_source_instance_id);
@@ -818,6 +1011,8 @@ void HeapprofdProducer::HandleAllocRecord(AllocRecord alloc_rec) {
     process_state.unwinding_errors++;
   if (alloc_rec.reparsed_map)
     process_state.map_reparses++;
+  if (alloc_rec.unwinding_cache_hit)
+    process_state.unwinding_cache_hits++;
   process_state.heap_samples++;
   process_state.unwinding_time_us.Add(alloc_rec.unwinding_time_us);
   process_state.total_unwinding_time_us += alloc_rec.unwinding_time_us;
@@ -872,6 +1067,7 @@ void HeapprofdProducer::HandleSocketDisconnected(
   if (process_state_it == ds.process_states.end())
     return;
   ProcessState& process_state = process_state_it->second;
+  ReleaseUnwinder(&process_state);
   process_state.disconnected = true;
   process_state.buffer_overran = stats.num_writes_overflow > 0;
   process_state.buffer_corrupted =
@@ -882,5 +1078,29 @@ void HeapprofdProducer::HandleSocketDisconnected(
   // after the process disconnected.
 }
 
+void HeapprofdProducer::HandleClientMigrated(
+    size_t target_worker,
+    pid_t pid,
+    UnwindingWorker::HandoffData handoff_data) {
+  // If the data source was stopped in the meantime, dropping |handoff_data|
+  // disconnects the client.
+  auto it = data_sources_.find(handoff_data.data_source_instance_id);
+  if (it == data_sources_.end())
+    return;
+  DataSource& ds = it->second;
+
+  auto process_state_it = ds.process_states.find(pid);
+  if (process_state_it == ds.process_states.end())
+    return;
+  ProcessState& process_state = process_state_it->second;
+  PERFETTO_DCHECK(process_state.migrating && !process_state.disconnected);
+  unwinder_states_[process_state.unwinder].clients--;
+  unwinder_states_[process_state.unwinder].migrated_clients++;
+  unwinder_states_[target_worker].clients++;
+  process_state.unwinder = target_worker;
+  process_state.migrating = false;
+  unwinding_workers_[target_worker].PostHandoffSocket(std::move(handoff_data));
+}
+
 }  // namespace profiling
 }  // namespace perfetto
@@ -58,6 +58,40 @@ class LogHistogram {
   std::array<uint64_t, kBuckets> values_ = {};
 };
 
+// Load of an UnwindingWorker, as seen by the load balancing.
+struct UnwinderState {
+  size_t clients = 0;
+  uint64_t busy_time_us = 0;
+  uint32_t utilization_percent = 0;
+  uint64_t migrated_clients = 0;
+};
+
+// Load of a client during the last load balancing period.
+struct ClientLoad {
+  size_t unwinder;
+  uint64_t load_us;
+  // False for the clients that are disconnected or already being migrated.
+  bool can_migrate;
+};
+
+struct ClientMigration {
+  size_t client;  // Index in the ClientLoads.
+  size_t from_unwinder;
+  size_t to_unwinder;
+};
+
+// Returns the unwinder a new client is assigned to: the one with the fewest
+// clients, and the least utilized of those.
+size_t PickUnwinderForNewClient(const std::vector<UnwinderState>& unwinders);
+
+// Returns the client to move from the busiest unwinder to the least busy one,
+// if any. |unwinder_load_us| is the load of each unwinder during the last
+// |period_us|, including the clients that can't migrate.
+base::Optional<ClientMigration> PickClientToMigrate(
+    const std::vector<uint64_t>& unwinder_load_us,
+    const std::vector<ClientLoad>& clients,
+    uint64_t period_us);
+
 // TODO(rsavitski): central daemon can do less work if it knows that the global
 // operating mode is fork-based, as it then will not be interacting with the
 // clients. This can be implemented as an additional mode here.
@@ -102,7 +136,11 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
     HeapprofdProducer* producer_;
   };
 
-  HeapprofdProducer(HeapprofdMode mode, base::TaskRunner* task_runner);
+  // If |unwinder_threads| is 0, one unwinding thread per online CPU is used in
+  // central mode, and a single one in child mode.
+  HeapprofdProducer(HeapprofdMode mode,
+                    base::TaskRunner* task_runner,
+                    size_t unwinder_threads = 0);
   ~HeapprofdProducer() override;
 
   // Producer Impl:
@@ -128,12 +166,18 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
   void PostSocketDisconnected(DataSourceInstanceID,
                               pid_t,
                               SharedRingBuffer::Stats) override;
+  void PostClientMigrated(size_t target_worker,
+                          pid_t,
+                          UnwindingWorker::HandoffData) override;
 
   void HandleAllocRecord(AllocRecord);
   void HandleFreeRecord(FreeRecord);
   void HandleSocketDisconnected(DataSourceInstanceID,
                                 pid_t,
                                 SharedRingBuffer::Stats);
+  void HandleClientMigrated(size_t target_worker,
+                            pid_t,
+                            UnwindingWorker::HandoffData);
 
   // Valid only if mode_ == kChild.
   void SetTargetProcess(pid_t target_pid,
@@ -159,13 +203,22 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
   };
 
   struct ProcessState {
-    ProcessState(GlobalCallstackTrie* callsites) : heap_tracker(callsites) {}
+    ProcessState(GlobalCallstackTrie* callsites, size_t unwinder_idx)
+        : unwinder(unwinder_idx), heap_tracker(callsites) {}
     bool disconnected = false;
     bool buffer_overran = false;
     bool buffer_corrupted = false;
 
+    // Index of the UnwindingWorker handling this process.
+    size_t unwinder;
+    // Set while the process is moved to another UnwindingWorker.
+    bool migrating = false;
+    // Value of total_unwinding_time_us at the last load balancing.
+    uint64_t balanced_unwinding_time_us = 0;
+
     uint64_t heap_samples = 0;
     uint64_t map_reparses = 0;
+    uint64_t unwinding_cache_hits = 0;
     uint64_t unwinding_errors = 0;
 
     uint64_t total_unwinding_time_us = 0;
@@ -184,6 +237,8 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
     std::map<pid_t, ProcessState> process_states;
     std::vector<std::string> normalized_cmdlines;
     uint64_t next_index_ = 0;
+    // Only used for incremental continuous dumps.
+    DumpedInternedData dumped_interned_data;
   };
 
   struct PendingProcess {
@@ -206,7 +261,10 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
             bool has_flush_id);
   void DoContinuousDump(DataSourceInstanceID id, uint32_t dump_interval);
 
-  UnwindingWorker& UnwinderForPID(pid_t);
+  size_t AssignUnwinderToNewClient();
+  void ReleaseUnwinder(ProcessState* process_state);
+  void ScheduleLoadBalancing();
+  void BalanceUnwinderLoad();
   bool IsPidProfiled(pid_t);
   DataSource* GetDataSourceForProcess(const Process& proc);
   void RecordOtherSourcesAsRejected(DataSource* active_ds, const Process& proc);
@@ -253,6 +311,9 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
   std::map<FlushRequestID, size_t> flushes_in_progress_;
   std::map<DataSourceInstanceID, DataSource> data_sources_;
   std::vector<UnwindingWorker> unwinding_workers_;
+  std::vector<UnwinderState> unwinder_states_;
+  bool load_balancing_scheduled_ = false;
+  uint64_t last_load_balancing_ms_ = 0;
 
   // Specific to mode_ == kCentral
   std::unique_ptr<base::UnixSocket> listening_socket_;
@@ -79,5 +79,85 @@ TEST(HeapprofdProducerTest, ExposesDataSource) {
   producer.OnConnect();
 }
 
+TEST(UnwinderLoadBalancingTest, NewClientGoesToFewestClients) {
+  std::vector<UnwinderState> unwinders(3);
+  unwinders[0].clients = 2;
+  unwinders[1].clients = 1;
+  unwinders[1].utilization_percent = 90;
+  unwinders[2].clients = 1;
+  unwinders[2].utilization_percent = 10;
+  EXPECT_EQ(PickUnwinderForNewClient(unwinders), 2u);
+
+  unwinders[2].clients = 3;
+  EXPECT_EQ(PickUnwinderForNewClient(unwinders), 1u);
+}
+
+TEST(UnwinderLoadBalancingTest, NoMigrationBelowThreshold) {
+  // The busiest unwinder is 74% utilized.
+  std::vector<ClientLoad> clients = {{0, 400, true}, {0, 340, true}};
+  EXPECT_FALSE(PickClientToMigrate({740, 0}, clients, 1000));
+}
+
+TEST(UnwinderLoadBalancingTest, MigrationAtThreshold) {
+  std::vector<ClientLoad> clients = {{0, 400, true}, {0, 350, true}};
+  auto migration = PickClientToMigrate({750, 0}, clients, 1000);
+  ASSERT_TRUE(migration);
+  EXPECT_EQ(migration->from_unwinder, 0u);
+  EXPECT_EQ(migration->to_unwinder, 1u);
+}
+
+TEST(UnwinderLoadBalancingTest, PicksClientClosestToHalfTheImbalance) {
+  // The imbalance is 900us between unwinder 1 and 2, the client with the
+  // closest load to 450us moves from 1 to 2.
+  std::vector<ClientLoad> clients = {
+      {1, 100, true}, {1, 500, true}, {1, 300, true}, {0, 400, true}};
+  auto migration = PickClientToMigrate({400, 900, 0}, clients, 1000);
+  ASSERT_TRUE(migration);
+  EXPECT_EQ(migration->client, 1u);
+  EXPECT_EQ(migration->from_unwinder, 1u);
+  EXPECT_EQ(migration->to_unwinder, 2u);
+}
+
+TEST(UnwinderLoadBalancingTest, SkipsClientsThatCantMigrate) {
+  std::vector<ClientLoad> clients = {{0, 450, false}, {0, 200, true}};
+  auto migration = PickClientToMigrate({900, 0}, clients, 1000);
+  ASSERT_TRUE(migration);
+  EXPECT_EQ(migration->client, 1u);
+
+  clients[1].can_migrate = false;
+  EXPECT_FALSE(PickClientToMigrate({900, 0}, clients, 1000));
+}
+
+TEST(UnwinderLoadBalancingTest, NoMigrationIfItDoesntReduceTheMaximum) {
+  // Moving the only client would just move the load to the other unwinder.
+  std::vector<ClientLoad> clients = {{0, 900, true}};
+  EXPECT_FALSE(PickClientToMigrate({900, 0}, clients, 1000));
+}
+
+TEST(UnwinderLoadBalancingTest, ConvergesWithoutBouncing) {
+  std::vector<ClientLoad> clients = {{0, 600, true},
+                                     {0, 300, true},
+                                     {0, 200, true},
+                                     {1, 100, true}};
+  size_t migrations = 0;
+  for (int period = 0; period < 10; period++) {
+    std::vector<uint64_t> load_us(2);
+    for (const ClientLoad& client : clients)
+      load_us[client.unwinder] += client.load_us;
+    auto migration = PickClientToMigrate(load_us, clients, 800);
+    if (!migration)
+      continue;
+    ClientLoad& client = clients[migration->client];
+    EXPECT_EQ(client.unwinder, migration->from_unwinder);
+    client.unwinder = migration->to_unwinder;
+    migrations++;
+  }
+  // 1100us vs 100us: the 600us client moves, which leaves 500us vs 700us. Then
+  // the 100us client moves, and the unwinders stay balanced at 600us.
+  EXPECT_EQ(migrations, 2u);
+  EXPECT_EQ(clients[0].unwinder, 1u);
+  EXPECT_EQ(clients[3].unwinder, 0u);
+}
+
 }  // namespace profiling
 }  // namespace perfetto
@@ -42,8 +42,9 @@ namespace {
 
 int StartChildHeapprofd(pid_t target_pid,
                         std::string target_cmdline,
-                        base::ScopedFile inherited_sock_fd);
-int StartCentralHeapprofd();
+                        base::ScopedFile inherited_sock_fd,
+                        size_t unwinder_threads);
+int StartCentralHeapprofd(size_t unwinder_threads);
 
 base::Event* g_dump_evt = nullptr;
 
@@ -52,13 +53,22 @@ int HeapprofdMain(int argc, char** argv) {
   pid_t target_pid = base::kInvalidPid;
   std::string target_cmdline;
   base::ScopedFile inherited_sock_fd;
-
-  enum { kCleanupCrash = 256, kTargetPid, kTargetCmd, kInheritFd };
+  // 0 picks the default for the mode.
+  size_t unwinder_threads = 0;
+
+  enum {
+    kCleanupCrash = 256,
+    kTargetPid,
+    kTargetCmd,
+    kInheritFd,
+    kUnwinderThreads
+  };
   static struct option long_options[] = {
       {"cleanup-after-crash", no_argument, nullptr, kCleanupCrash},
       {"exclusive-for-pid", required_argument, nullptr, kTargetPid},
       {"exclusive-for-cmdline", required_argument, nullptr, kTargetCmd},
       {"inherit-socket-fd", required_argument, nullptr, kInheritFd},
+      {"unwinder-threads", required_argument, nullptr, kUnwinderThreads},
       {nullptr, 0, nullptr, 0}};
   int option_index;
   int c;
@@ -82,8 +92,19 @@ int HeapprofdMain(int argc, char** argv) {
           PERFETTO_FATAL("Duplicate inherit-socket-fd");
         inherited_sock_fd = base::ScopedFile(atoi(optarg));
         break;
+      case kUnwinderThreads: {
+        int threads = atoi(optarg);
+        if (threads <= 0) {
+          PERFETTO_ELOG("Invalid --unwinder-threads %s", optarg);
+          return 1;
+        }
+        unwinder_threads = static_cast<size_t>(threads);
+        break;
+      }
       default:
-        PERFETTO_ELOG("Usage: %s [--cleanup-after-crash]", argv[0]);
+        PERFETTO_ELOG(
+            "Usage: %s [--cleanup-after-crash] [--unwinder-threads N]",
+            argv[0]);
         return 1;
     }
   }
@@ -115,19 +136,21 @@ int HeapprofdMain(int argc, char** argv) {
     }
 
     return StartChildHeapprofd(target_pid, target_cmdline,
-                               std::move(inherited_sock_fd));
+                               std::move(inherited_sock_fd), unwinder_threads);
   }
 
   // Otherwise start as a central daemon.
-  return StartCentralHeapprofd();
+  return StartCentralHeapprofd(unwinder_threads);
 }
 
 int StartChildHeapprofd(pid_t target_pid,
                         std::string target_cmdline,
-                        base::ScopedFile inherited_sock_fd) {
+                        base::ScopedFile inherited_sock_fd,
+                        size_t unwinder_threads) {
   base::UnixTaskRunner task_runner;
   base::Watchdog::GetInstance()->Start();  // crash on exceedingly long tasks
-  HeapprofdProducer producer(HeapprofdMode::kChild, &task_runner);
+  HeapprofdProducer producer(HeapprofdMode::kChild, &task_runner,
+                             unwinder_threads);
   producer.SetTargetProcess(target_pid, target_cmdline,
                             std::move(inherited_sock_fd));
   producer.ConnectWithRetries(GetProducerSocket());
@@ -136,14 +159,15 @@ int StartChildHeapprofd(pid_t target_pid,
   return 0;
 }
 
-int StartCentralHeapprofd() {
+int StartCentralHeapprofd(size_t unwinder_threads) {
   // We set this up before launching any threads, so we do not have to use a
   // std::atomic for g_dump_evt.
   g_dump_evt = new base::Event();
 
   base::UnixTaskRunner task_runner;
   base::Watchdog::GetInstance()->Start();  // crash on exceedingly long tasks
-  HeapprofdProducer producer(HeapprofdMode::kCentral, &task_runner);
+  HeapprofdProducer producer(HeapprofdMode::kCentral, &task_runner,
+                             unwinder_threads);
 
   struct sigaction action = {};
   action.sa_handler = [](int) { g_dump_evt->Notify(); };
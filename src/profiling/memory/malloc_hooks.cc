@@ -28,18 +28,22 @@
 
 #include <atomic>
 #include <tuple>
+#include <type_traits>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/no_destructor.h"
+#include "perfetto/base/thread_utils.h"
 #include "perfetto/base/unix_socket.h"
 #include "perfetto/base/utils.h"
 #include "src/profiling/memory/client.h"
 #include "src/profiling/memory/proc_utils.h"
+#include "src/profiling/memory/sampler.h"
 #include "src/profiling/memory/scoped_spinlock.h"
 #include "src/profiling/memory/unhooked_allocator.h"
 #include "src/profiling/memory/wire_protocol.h"
 
+using perfetto::profiling::Sampler;
 using perfetto::profiling::ScopedSpinlock;
 using perfetto::profiling::UnhookedAllocator;
 
@@ -130,14 +134,44 @@ std::atomic<const MallocDispatch*> g_dispatch{nullptr};
 perfetto::base::NoDestructor<std::shared_ptr<perfetto::profiling::Client>>
     g_client;
 
-// Protects g_client, and serves as an external lock for sampling decisions (see
-// perfetto::profiling::Sampler).
+// Protects g_client and g_next_session_id. Sampling decisions do not need it,
+// see g_thread_sampling_state.
 //
 // We rely on this atomic's destuction being a nop, as it is possible for the
 // hooks to attempt to acquire the spinlock after its destructor should have run
 // (technically a use-after-destruct scenario).
 std::atomic<bool> g_client_lock{false};
 
+// Identifies the profiling session of the client in g_client, or is zero if
+// there is none. Only written with g_client_lock held, together with g_client,
+// but read without it by the hooks: this lets them skip the lock altogether
+// when not profiling, and tells them when the thread-local sampler below was
+// set up for a previous session.
+std::atomic<uint64_t> g_client_session_id{0};
+
+// Protected by g_client_lock.
+uint64_t g_next_session_id = 1;
+
+// Sampling state of the calling thread. Each thread samples its allocations
+// independently, with the interval of the current session, so unsampled
+// allocations never touch g_client_lock. The Poisson process is memoryless,
+// so splitting it across threads does not change the expected number of
+// samples.
+//
+// Must stay trivially destructible: a TLS destructor would be registered
+// through __cxa_thread_atexit, which allocates. Must also be constant-
+// initialized: with emulated TLS, a dynamic initializer runs on the first
+// access of each thread, i.e. from within the hooks.
+struct ThreadSamplingState {
+  uint64_t session_id = 0;
+  Sampler sampler;
+};
+static_assert(std::is_trivially_destructible<ThreadSamplingState>::value,
+              "ThreadSamplingState must not need a TLS destructor");
+static_assert(ThreadSamplingState().session_id == 0,
+              "ThreadSamplingState must be constant-initialized");
+thread_local ThreadSamplingState g_thread_sampling_state;
+
 constexpr char kHeapprofdBinPath[] = "/system/bin/heapprofd";
 
 const MallocDispatch* GetDispatch() {
@@ -344,6 +378,7 @@ void ShutdownLazy() {
 
   // Clear primary shared pointer, such that later hook invocations become nops.
   g_client.ref().reset();
+  g_client_session_id.store(0, std::memory_order_relaxed);
 
   if (!android_mallopt(M_RESET_HOOKS, nullptr, 0))
     PERFETTO_PLOG("Unpatching heapprofd hooks failed.");
@@ -383,6 +418,7 @@ bool HEAPPROFD_ADD_PREFIX(_initialize)(const MallocDispatch* malloc_dispatch,
     }
     old_client = g_client.ref();
     g_client.ref().reset();
+    g_client_session_id.store(0, std::memory_order_relaxed);
   }
 
   old_client.reset();
@@ -413,6 +449,7 @@ bool HEAPPROFD_ADD_PREFIX(_initialize)(const MallocDispatch* malloc_dispatch,
     // calls to this function, as Bionic uses atomics to guard against that.
     PERFETTO_DCHECK(g_client.ref() == nullptr);
     g_client.ref() = std::move(client);
+    g_client_session_id.store(g_next_session_id++, std::memory_order_relaxed);
   }
   return true;
 }
@@ -422,34 +459,79 @@ void HEAPPROFD_ADD_PREFIX(_finalize)() {
   // any specific action to take, and cleanup can be left to the OS.
 }
 
+// Returns an owning copy of the client of the profiling session |session_id|,
+// or nullptr if that session is over.
+static std::shared_ptr<perfetto::profiling::Client> GetClientForSession(
+    uint64_t session_id) {
+  ScopedSpinlock s(&g_client_lock, ScopedSpinlock::Mode::Try);
+  if (PERFETTO_UNLIKELY(!s.locked()))
+    AbortOnSpinlockTimeout();
+
+  if (g_client_session_id.load(std::memory_order_relaxed) != session_id)
+    return nullptr;
+  return g_client.ref();
+}
+
+// Slow path of GetSampleSize: sets up the sampler of the calling thread for
+// the profiling session |session_id|. Taken once per thread and session.
+static __attribute__((noinline)) bool ResetThreadSampler(
+    ThreadSamplingState* state,
+    uint64_t session_id) {
+  uint64_t sampling_interval;
+  {
+    ScopedSpinlock s(&g_client_lock, ScopedSpinlock::Mode::Try);
+    if (PERFETTO_UNLIKELY(!s.locked()))
+      AbortOnSpinlockTimeout();
+
+    if (g_client_session_id.load(std::memory_order_relaxed) != session_id)
+      return false;
+    sampling_interval = g_client.ref()->sampling_interval();
+  }
+  // Seed with the tid, otherwise all threads would sample in lockstep.
+  state->sampler = Sampler(
+      sampling_interval,
+      static_cast<uint64_t>(perfetto::base::GetThreadId()) + session_id);
+  state->session_id = session_id;
+  return true;
+}
+
+// Returns the number of bytes to attribute to an allocation of |size| in the
+// profiling session |session_id|, or zero if it should not be sampled. Only
+// accesses thread-local state, unless this is the first allocation of the
+// calling thread in the session.
+static inline size_t GetSampleSize(uint64_t session_id, size_t size) {
+  ThreadSamplingState* state = &g_thread_sampling_state;
+  if (PERFETTO_UNLIKELY(state->session_id != session_id) &&
+      !ResetThreadSampler(state, session_id)) {
+    return 0;
+  }
+  return state->sampler.SampleSize(size);
+}
+
 // Decides whether an allocation with the given address and size needs to be
-// sampled, and if so, records it. Performs the necessary synchronization (holds
-// |g_client_lock| spinlock) while accessing the shared sampler, and obtaining a
-// profiling client handle (shared_ptr).
+// sampled, and if so, records it. The sampling decision is taken without any
+// synchronization, using the sampler of the calling thread. Only sampled
+// allocations take |g_client_lock|, to obtain a profiling client handle
+// (shared_ptr).
 //
-// If the allocation is to be sampled, the recording is done without holding
-// |g_client_lock|. The client handle is guaranteed to not be invalidated while
-// the allocation is being recorded.
+// The recording is done without holding |g_client_lock|. The client handle is
+// guaranteed to not be invalidated while the allocation is being recorded.
 //
 // If the attempt to record the allocation fails, initiates lazy shutdown of the
 // client & hooks.
 static void MaybeSampleAllocation(size_t size, void* addr) {
-  size_t sampled_alloc_sz = 0;
-  std::shared_ptr<perfetto::profiling::Client> client;
-  {
-    ScopedSpinlock s(&g_client_lock, ScopedSpinlock::Mode::Try);
-    if (PERFETTO_UNLIKELY(!s.locked()))
-      AbortOnSpinlockTimeout();
-
-    if (!g_client.ref())  // no active client (most likely shutting down)
-      return;
+  uint64_t session_id = g_client_session_id.load(std::memory_order_relaxed);
+  if (session_id == 0)  // no active client (most likely shutting down)
+    return;
 
-    sampled_alloc_sz = g_client.ref()->GetSampleSizeLocked(size);
-    if (sampled_alloc_sz == 0)  // not sampling
-      return;
+  size_t sampled_alloc_sz = GetSampleSize(session_id, size);
+  if (sampled_alloc_sz == 0)  // not sampling
+    return;
 
-    client = g_client.ref();  // owning copy
-  }                           // unlock
+  std::shared_ptr<perfetto::profiling::Client> client =
+      GetClientForSession(session_id);
+  if (!client)
+    return;
 
   if (!client->RecordMalloc(size, sampled_alloc_sz,
                             reinterpret_cast<uint64_t>(addr))) {
@@ -514,13 +596,9 @@ void HEAPPROFD_ADD_PREFIX(_free)(void* pointer) {
 
   const MallocDispatch* dispatch = GetDispatch();
   std::shared_ptr<perfetto::profiling::Client> client;
-  {
-    ScopedSpinlock s(&g_client_lock, ScopedSpinlock::Mode::Try);
-    if (PERFETTO_UNLIKELY(!s.locked()))
-      AbortOnSpinlockTimeout();
-
-    client = g_client.ref();  // owning copy (or empty)
-  }
+  uint64_t session_id = g_client_session_id.load(std::memory_order_relaxed);
+  if (session_id != 0)
+    client = GetClientForSession(session_id);
 
   if (client) {
     if (!client->RecordFree(reinterpret_cast<uint64_t>(pointer)))
@@ -529,10 +607,10 @@ void HEAPPROFD_ADD_PREFIX(_free)(void* pointer) {
   return dispatch->free(pointer);
 }
 
-// Approach to recording realloc: under the initial lock, get a safe copy of the
-// client, and make the sampling decision in advance. Then record the
-// deallocation, call the real realloc, and finally record the sample if one is
-// necessary.
+// Approach to recording realloc: make the sampling decision in advance and,
+// if there is a deallocation or a sample to record, get a safe copy of the
+// client. Then record the deallocation, call the real realloc, and finally
+// record the sample if one is necessary.
 //
 // As with the free, we record the deallocation before calling the backing
 // implementation to make sure the address is still exclusive while we're
@@ -540,20 +618,16 @@ void HEAPPROFD_ADD_PREFIX(_free)(void* pointer) {
 void* HEAPPROFD_ADD_PREFIX(_realloc)(void* pointer, size_t size) {
   const MallocDispatch* dispatch = GetDispatch();
 
+  // If there is no active client, we still want to reach the backing realloc,
+  // so keep going.
   size_t sampled_alloc_sz = 0;
   std::shared_ptr<perfetto::profiling::Client> client;
-  {
-    ScopedSpinlock s(&g_client_lock, ScopedSpinlock::Mode::Try);
-    if (PERFETTO_UNLIKELY(!s.locked()))
-      AbortOnSpinlockTimeout();
-
-    // If there is no active client, we still want to reach the backing realloc,
-    // so keep going.
-    if (g_client.ref()) {
-      client = g_client.ref();  // owning copy
-      sampled_alloc_sz = g_client.ref()->GetSampleSizeLocked(size);
-    }
-  }  // unlock
+  uint64_t session_id = g_client_session_id.load(std::memory_order_relaxed);
+  if (session_id != 0) {
+    sampled_alloc_sz = GetSampleSize(session_id, size);
+    if (pointer || sampled_alloc_sz)
+      client = GetClientForSession(session_id);
+  }
 
   if (client && pointer) {
     if (!client->RecordFree(reinterpret_cast<uint64_t>(pointer)))
@@ -561,7 +635,7 @@ void* HEAPPROFD_ADD_PREFIX(_realloc)(void* pointer, size_t size) {
   }
   void* addr = dispatch->realloc(pointer, size);
 
-  if (size == 0 || sampled_alloc_sz == 0)
+  if (size == 0 || sampled_alloc_sz == 0 || !client)
     return addr;
 
   if (!client->RecordMalloc(size, sampled_alloc_sz,
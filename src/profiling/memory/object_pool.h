@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_MEMORY_OBJECT_POOL_H_
+#define SRC_PROFILING_MEMORY_OBJECT_POOL_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Allocates objects of type T out of slabs of kSlabSize objects. The slots of
+// deleted objects are recycled through a free list. Objects never move, so
+// unlike values stored in a FlatHashMap, pointers to them stay valid until
+// Delete().
+// Memory is only returned to the system when the pool is destroyed.
+template <typename T, size_t kSlabSize = 1024>
+class ObjectPool {
+ public:
+  ObjectPool() = default;
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool& operator=(const ObjectPool&) = delete;
+
+  ~ObjectPool() { PERFETTO_DCHECK(size_ == 0); }
+
+  template <typename... Args>
+  T* New(Args&&... args) {
+    Slot* slot = free_list_;
+    if (slot) {
+      free_list_ = slot->next_free;
+    } else {
+      if (slabs_.empty() || next_in_slab_ == kSlabSize) {
+        slabs_.emplace_back(new Slot[kSlabSize]);
+        next_in_slab_ = 0;
+      }
+      slot = &slabs_.back()[next_in_slab_++];
+    }
+    size_++;
+    return new (&slot->storage) T(std::forward<Args>(args)...);
+  }
+
+  void Delete(T* obj) {
+    PERFETTO_DCHECK(size_ > 0);
+    obj->~T();
+    Slot* slot = reinterpret_cast<Slot*>(obj);
+    slot->next_free = free_list_;
+    free_list_ = slot;
+    size_--;
+  }
+
+  // Number of live objects.
+  size_t size() const { return size_; }
+
+ private:
+  union Slot {
+    Slot() {}
+    Slot* next_free;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  std::vector<std::unique_ptr<Slot[]>> slabs_;
+  Slot* free_list_ = nullptr;
+  size_t next_in_slab_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_MEMORY_OBJECT_POOL_H_
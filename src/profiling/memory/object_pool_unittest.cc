@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/memory/object_pool.h"
+
+#include <set>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+struct Tracked {
+  Tracked(int* live, uint64_t v) : live_count(live), value(v) {
+    (*live_count)++;
+  }
+  ~Tracked() { (*live_count)--; }
+
+  int* live_count;
+  uint64_t value;
+};
+
+TEST(ObjectPoolTest, NewDelete) {
+  int live = 0;
+  ObjectPool<Tracked, 4> pool;
+  std::vector<Tracked*> objs;
+  for (uint64_t i = 0; i < 10; i++)
+    objs.push_back(pool.New(&live, i));
+  EXPECT_EQ(live, 10);
+  EXPECT_EQ(pool.size(), 10u);
+  for (uint64_t i = 0; i < 10; i++)
+    EXPECT_EQ(objs[i]->value, i);
+  for (Tracked* obj : objs)
+    pool.Delete(obj);
+  EXPECT_EQ(live, 0);
+  EXPECT_EQ(pool.size(), 0u);
+}
+
+TEST(ObjectPoolTest, ReusesSlots) {
+  int live = 0;
+  ObjectPool<Tracked, 4> pool;
+  std::set<Tracked*> first_round;
+  for (uint64_t i = 0; i < 8; i++)
+    first_round.insert(pool.New(&live, i));
+  for (Tracked* obj : first_round)
+    pool.Delete(obj);
+
+  std::vector<Tracked*> second_round;
+  for (uint64_t i = 0; i < 8; i++) {
+    Tracked* obj = pool.New(&live, i);
+    EXPECT_EQ(first_round.count(obj), 1u);
+    second_round.push_back(obj);
+  }
+  for (Tracked* obj : second_round)
+    pool.Delete(obj);
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
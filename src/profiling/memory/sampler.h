@@ -21,6 +21,7 @@
 
 #include <atomic>
 #include <random>
+#include <type_traits>
 
 #include "perfetto/base/utils.h"
 
@@ -37,13 +38,51 @@ constexpr uint64_t kSamplerSeed = 1;
 // https://cs.chromium.org/search/?q=f:cc+symbol:AllocatorShimLogAlloc+package:%5Echromium$&type=cs
 // Googlers: see go/chrome-shp for more details.
 //
-// NB: not thread-safe, requires external synchronization.
+// NB: not thread-safe, requires external synchronization. The heapprofd
+// client keeps one instance per thread (see malloc_hooks.cc), so that the
+// sampling decision does not need any shared state.
+//
+// Trivially destructible and constant-initialized when default constructed, so
+// that it can be used as a thread_local from within the malloc hooks: neither
+// a TLS destructor nor a dynamic initializer must run, as both allocate (the
+// latter under emulated TLS) and would re-enter the hooks.
 class Sampler {
  public:
-  Sampler(uint64_t sampling_interval)
+  // Same sequence as std::minstd_rand0 (the std::default_random_engine of both
+  // libc++ and libstdc++), whose default constructor is not constexpr.
+  class RandomEngine {
+   public:
+    using result_type = uint32_t;
+
+    constexpr RandomEngine() : state_(1) {}
+    explicit constexpr RandomEngine(uint64_t seed)
+        : state_(seed % kModulus == 0 ? 1
+                                      : static_cast<uint32_t>(seed % kModulus)) {
+    }
+
+    static constexpr result_type min() { return 1; }
+    static constexpr result_type max() { return kModulus - 1; }
+
+    result_type operator()() {
+      state_ = static_cast<uint32_t>(uint64_t{state_} * kMultiplier % kModulus);
+      return state_;
+    }
+
+   private:
+    static constexpr uint32_t kMultiplier = 16807;
+    static constexpr uint32_t kModulus = 2147483647;
+
+    uint32_t state_;
+  };
+
+  // Creates a disabled sampler. SampleSize() must not be called before it is
+  // replaced by an instance with a valid sampling interval.
+  constexpr Sampler() {}
+
+  explicit Sampler(uint64_t sampling_interval, uint64_t seed = kSamplerSeed)
       : sampling_interval_(sampling_interval),
         sampling_rate_(1.0 / static_cast<double>(sampling_interval)),
-        random_engine_(kSamplerSeed),
+        random_engine_(seed),
         interval_to_next_sample_(NextSampleInterval()) {}
 
   // Returns number of bytes that should be be attributed to the sample.
@@ -57,6 +96,8 @@ class Sampler {
     return sampling_interval_ * NumberOfSamples(alloc_sz);
   }
 
+  constexpr uint64_t sampling_interval() const { return sampling_interval_; }
+
  private:
   int64_t NextSampleInterval() {
     std::exponential_distribution<double> dist(sampling_rate_);
@@ -78,12 +119,17 @@ class Sampler {
     return num_samples;
   }
 
-  uint64_t sampling_interval_;
-  double sampling_rate_;
-  std::default_random_engine random_engine_;
-  int64_t interval_to_next_sample_;
+  uint64_t sampling_interval_ = 0;
+  double sampling_rate_ = 0;
+  RandomEngine random_engine_;
+  int64_t interval_to_next_sample_ = 0;
 };
 
+static_assert(std::is_trivially_destructible<Sampler>::value,
+              "Sampler is used as a thread_local in the malloc hooks");
+static_assert(Sampler().sampling_interval() == 0,
+              "A default constructed Sampler must be constant-initialized");
+
 }  // namespace profiling
 }  // namespace perfetto
 
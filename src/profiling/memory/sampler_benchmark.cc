@@ -0,0 +1,88 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <atomic>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/thread_utils.h"
+#include "src/profiling/memory/sampler.h"
+#include "src/profiling/memory/scoped_spinlock.h"
+
+// Compares the sampling decision of the malloc hooks with one Sampler shared
+// by all threads behind a spinlock (how the hooks used to work) against one
+// Sampler per thread (see malloc_hooks.cc). Each iteration is a malloc + free
+// pair, as most allocations are not sampled.
+
+namespace {
+
+using perfetto::profiling::Sampler;
+using perfetto::profiling::ScopedSpinlock;
+
+constexpr uint64_t kSamplingInterval = 4096;
+constexpr size_t kAllocSize = 64;
+
+std::atomic<bool> g_lock{false};
+Sampler g_shared_sampler(kSamplingInterval);
+
+struct ThreadSamplingState {
+  uint64_t session_id = 0;
+  Sampler sampler;
+};
+thread_local ThreadSamplingState g_thread_sampling_state;
+
+size_t SampleSizeShared(size_t size) {
+  ScopedSpinlock s(&g_lock, ScopedSpinlock::Mode::Try);
+  PERFETTO_CHECK(s.locked());
+  return g_shared_sampler.SampleSize(size);
+}
+
+size_t SampleSizeThreadLocal(size_t size) {
+  ThreadSamplingState* state = &g_thread_sampling_state;
+  if (PERFETTO_UNLIKELY(state->session_id != 1)) {
+    state->sampler = Sampler(
+        kSamplingInterval,
+        static_cast<uint64_t>(perfetto::base::GetThreadId()) + 1);
+    state->session_id = 1;
+  }
+  return state->sampler.SampleSize(size);
+}
+
+template <size_t (*SampleSize)(size_t)>
+void BM_MallocSampling(benchmark::State& state) {
+  uint64_t sampled = 0;
+  for (auto _ : state) {
+    void* addr = malloc(kAllocSize);
+    benchmark::DoNotOptimize(addr);
+    sampled += SampleSize(kAllocSize);
+    free(addr);
+  }
+  benchmark::DoNotOptimize(sampled);
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+}  // namespace
+
+static void BM_MallocSamplingShared(benchmark::State& state) {
+  BM_MallocSampling<SampleSizeShared>(state);
+}
+BENCHMARK(BM_MallocSamplingShared)->Threads(1)->Threads(8)->Threads(64);
+
+static void BM_MallocSamplingThreadLocal(benchmark::State& state) {
+  BM_MallocSampling<SampleSizeThreadLocal>(state);
+}
+BENCHMARK(BM_MallocSamplingThreadLocal)->Threads(1)->Threads(8)->Threads(64);
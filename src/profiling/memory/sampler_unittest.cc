@@ -18,6 +18,7 @@
 
 #include "gtest/gtest.h"
 
+#include <random>
 #include <thread>
 
 namespace perfetto {
@@ -41,6 +42,18 @@ TEST(SamplerTest, TestSequence) {
   EXPECT_EQ(sampler.SampleSize(5), 5);
 }
 
+TEST(SamplerTest, RandomEngineMatchesMinstdRand0) {
+  for (uint64_t seed : {0ul, 1ul, 42ul, 2147483647ul, 2147483648ul}) {
+    Sampler::RandomEngine engine(seed);
+    std::minstd_rand0 reference(static_cast<uint32_t>(seed));
+    for (int i = 0; i < 100; i++)
+      ASSERT_EQ(engine(), reference()) << "seed " << seed;
+  }
+  Sampler::RandomEngine engine;
+  std::minstd_rand0 reference;
+  EXPECT_EQ(engine(), reference());
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
@@ -20,6 +20,7 @@
 #include <type_traits>
 
 #include <errno.h>
+#include <string.h>
 #include <inttypes.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -28,7 +29,6 @@
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/scoped_file.h"
 #include "perfetto/base/temp_file.h"
-#include "src/profiling/memory/scoped_spinlock.h"
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
 #include <linux/memfd.h>
@@ -48,8 +48,18 @@ constexpr auto kGuardSize = base::kPageSize * 1024 * 16;  // 64 MB.
 constexpr auto kFDSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
 #endif
 
-}  // namespace
+// Header of each record. Both fields are zero until EndWrite(), which sets
+// |committed| once the payload and |size| have been written. EndRead() clears
+// them again.
+struct RecordHeader {
+  std::atomic<uint32_t> size;
+  std::atomic<uint32_t> committed;
+};
+
+static_assert(sizeof(RecordHeader) == kHeaderSize,
+              "RecordHeader must fill the record header");
 
+}  // namespace
 
 SharedRingBuffer::SharedRingBuffer(CreateFlag, size_t size) {
   size_t size_with_meta = size + kMetaPageSize;
@@ -99,6 +109,8 @@ SharedRingBuffer::~SharedRingBuffer() {
                 "MetadataPage must be trivially constructible");
   static_assert(std::is_trivially_destructible<MetadataPage>::value,
                 "MetadataPage must be trivially destructible");
+  static_assert(sizeof(MetadataPage) <= kMetaPageSize,
+                "MetadataPage must fit in the metadata page");
 
   if (is_valid()) {
     size_t outer_size = kMetaPageSize + size_ * 2 + kGuardSize;
@@ -168,20 +180,9 @@ void SharedRingBuffer::Initialize(base::ScopedFile mem_fd) {
   mem_fd_ = std::move(mem_fd);
 }
 
-SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
-    const ScopedSpinlock& spinlock,
-    size_t size) {
-  PERFETTO_DCHECK(spinlock.locked());
+SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(size_t size) {
   Buffer result;
 
-  base::Optional<PointerPositions> opt_pos = GetPointerPositions(spinlock);
-  if (!opt_pos) {
-    meta_->stats.num_writes_corrupt++;
-    errno = EBADF;
-    return result;
-  }
-  auto pos = opt_pos.value();
-
   const uint64_t size_with_header =
       base::AlignUp<kAlignment>(size + kHeaderSize);
 
@@ -191,23 +192,34 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
     return result;
   }
 
-  if (size_with_header > write_avail(pos)) {
-    meta_->stats.num_writes_overflow++;
-    errno = EAGAIN;
-    return result;
-  }
+  // Reserve the space by advancing write_pos. The bounds check is redone
+  // whenever another writer got there first.
+  PointerPositions pos;
+  do {
+    base::Optional<PointerPositions> opt_pos = GetPointerPositions();
+    if (!opt_pos) {
+      meta_->num_writes_corrupt.fetch_add(1, std::memory_order_relaxed);
+      errno = EBADF;
+      return result;
+    }
+    pos = opt_pos.value();
+
+    if (size_with_header > write_avail(pos)) {
+      meta_->num_writes_overflow.fetch_add(1, std::memory_order_relaxed);
+      errno = EAGAIN;
+      return result;
+    }
+  } while (!meta_->write_pos.compare_exchange_weak(
+      pos.write_pos, pos.write_pos + size_with_header,
+      std::memory_order_acquire, std::memory_order_relaxed));
 
-  uint8_t* wr_ptr = at(pos.write_pos);
+  meta_->bytes_written.fetch_add(size, std::memory_order_relaxed);
+  meta_->num_writes_succeeded.fetch_add(1, std::memory_order_relaxed);
 
+  // The header is still zero (see EndRead), so the reader will not consume
+  // the record until EndWrite.
   result.size = size;
-  result.data = wr_ptr + kHeaderSize;
-  meta_->write_pos += size_with_header;
-  meta_->stats.bytes_written += size;
-  meta_->stats.num_writes_succeeded++;
-  // By making this a release store, we can save grabbing the spinlock in
-  // EndWrite.
-  reinterpret_cast<std::atomic<uint32_t>*>(wr_ptr)->store(
-      0, std::memory_order_release);
+  result.data = at(pos.write_pos) + kHeaderSize;
   return result;
 }
 
@@ -216,16 +228,16 @@ void SharedRingBuffer::EndWrite(Buffer buf) {
     return;
   uint8_t* wr_ptr = buf.data - kHeaderSize;
   PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(wr_ptr) % kAlignment == 0);
-  reinterpret_cast<std::atomic<uint32_t>*>(wr_ptr)->store(
-      static_cast<uint32_t>(buf.size), std::memory_order_release);
+  auto* header = reinterpret_cast<RecordHeader*>(wr_ptr);
+  header->size.store(static_cast<uint32_t>(buf.size),
+                     std::memory_order_relaxed);
+  header->committed.store(1, std::memory_order_release);
 }
 
 SharedRingBuffer::Buffer SharedRingBuffer::BeginRead() {
-  ScopedSpinlock spinlock(&meta_->spinlock, ScopedSpinlock::Mode::Blocking);
-
-  base::Optional<PointerPositions> opt_pos = GetPointerPositions(spinlock);
+  base::Optional<PointerPositions> opt_pos = GetPointerPositions();
   if (!opt_pos) {
-    meta_->stats.num_reads_corrupt++;
+    meta_->num_reads_corrupt++;
     errno = EBADF;
     return Buffer();
   }
@@ -234,20 +246,21 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginRead() {
   size_t avail_read = read_avail(pos);
 
   if (avail_read < kHeaderSize) {
-    meta_->stats.num_reads_nodata++;
+    meta_->num_reads_nodata++;
     errno = EAGAIN;
     return Buffer();  // No data
   }
 
   uint8_t* rd_ptr = at(pos.read_pos);
   PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(rd_ptr) % kAlignment == 0);
-  const size_t size = reinterpret_cast<std::atomic<uint32_t>*>(rd_ptr)->load(
-      std::memory_order_acquire);
-  if (size == 0) {
-    meta_->stats.num_reads_nodata++;
+  auto* header = reinterpret_cast<RecordHeader*>(rd_ptr);
+  // The oldest record has been reserved, but its writer has not finished yet.
+  if (header->committed.load(std::memory_order_acquire) == 0) {
+    meta_->num_reads_nodata++;
     errno = EAGAIN;
     return Buffer();
   }
+  const size_t size = header->size.load(std::memory_order_relaxed);
   const size_t size_with_header = base::AlignUp<kAlignment>(size + kHeaderSize);
 
   if (size_with_header > avail_read) {
@@ -255,7 +268,7 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginRead() {
         "Corrupted header detected, size=%zu"
         ", read_avail=%zu, rd=%" PRIu64 ", wr=%" PRIu64,
         size, avail_read, pos.read_pos, pos.write_pos);
-    meta_->stats.num_reads_corrupt++;
+    meta_->num_reads_corrupt++;
     errno = EBADF;
     return Buffer();
   }
@@ -268,10 +281,31 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginRead() {
 void SharedRingBuffer::EndRead(Buffer buf) {
   if (!buf)
     return;
-  ScopedSpinlock spinlock(&meta_->spinlock, ScopedSpinlock::Mode::Blocking);
   size_t size_with_header = base::AlignUp<kAlignment>(buf.size + kHeaderSize);
-  meta_->read_pos += size_with_header;
-  meta_->stats.num_reads_succeeded++;
+  // Clear the whole record, not just its header: the header of a later record
+  // might end up anywhere in this space, and must not look committed before
+  // its writer is done. BeginRead has checked that the record is in bounds.
+  memset(buf.data - kHeaderSize, 0, size_with_header);
+  // Release, so that writers see the cleared space before reusing it.
+  meta_->read_pos.store(
+      meta_->read_pos.load(std::memory_order_relaxed) + size_with_header,
+      std::memory_order_release);
+  meta_->num_reads_succeeded++;
+}
+
+SharedRingBuffer::Stats SharedRingBuffer::GetStats() {
+  Stats stats = {};
+  stats.bytes_written = meta_->bytes_written.load(std::memory_order_relaxed);
+  stats.num_writes_succeeded =
+      meta_->num_writes_succeeded.load(std::memory_order_relaxed);
+  stats.num_writes_corrupt =
+      meta_->num_writes_corrupt.load(std::memory_order_relaxed);
+  stats.num_writes_overflow =
+      meta_->num_writes_overflow.load(std::memory_order_relaxed);
+  stats.num_reads_succeeded = meta_->num_reads_succeeded;
+  stats.num_reads_corrupt = meta_->num_reads_corrupt;
+  stats.num_reads_nodata = meta_->num_reads_nodata;
+  return stats;
 }
 
 bool SharedRingBuffer::IsCorrupt(const PointerPositions& pos) {
@@ -285,6 +319,23 @@ bool SharedRingBuffer::IsCorrupt(const PointerPositions& pos) {
   return false;
 }
 
+void SharedRingBuffer::SetReaderHint(uint32_t key, uint32_t value) {
+  PERFETTO_DCHECK(value != 0);
+  std::atomic<uint64_t>& entry = meta_->reader_hints[key % kNumReaderHints];
+  uint64_t packed = static_cast<uint64_t>(key) << 32 | value;
+  // Avoid dirtying the cache line the writers read from if nothing changed.
+  if (entry.load(std::memory_order_relaxed) != packed)
+    entry.store(packed, std::memory_order_relaxed);
+}
+
+uint32_t SharedRingBuffer::GetReaderHint(uint32_t key) {
+  uint64_t packed = meta_->reader_hints[key % kNumReaderHints].load(
+      std::memory_order_relaxed);
+  if (packed >> 32 != key)
+    return 0;
+  return static_cast<uint32_t>(packed);
+}
+
 SharedRingBuffer::SharedRingBuffer(SharedRingBuffer&& other) noexcept {
   *this = std::move(other);
 }
@@ -20,7 +20,6 @@
 #include "perfetto/base/optional.h"
 #include "perfetto/base/unix_socket.h"
 #include "perfetto/base/utils.h"
-#include "src/profiling/memory/scoped_spinlock.h"
 
 #include <atomic>
 #include <map>
@@ -39,18 +38,23 @@ namespace profiling {
 // - New writes are discarded if the buffer is full.
 // - If a write succeeds, the reader is guaranteed to see the whole buffer.
 // - Reads are atomic, no fragmentation.
-// - The reader sees writes in write order (% discarding).
+// - The reader sees writes in reservation order (% discarding).
+//
+// Writers don't take any lock: BeginWrite() reserves space by advancing
+// |write_pos| with a compare-and-swap, and EndWrite() publishes the record by
+// setting the commit flag in its header. The reader stops at the first
+// reserved record that has not been committed yet. A plain fetch-add is not
+// enough for the reservation, as a write that doesn't fit could not be rolled
+// back once other writers have reserved space after it.
+// The reader zeroes the records it consumes before handing the space back to
+// the writers, so a header is only ever seen as committed after EndWrite().
 //
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 // *IMPORTANT*: The ring buffer must be written under the assumption that the
-// other end modifies arbitrary shared memory without holding the spin-lock.
-// This means we must make local copies of read and write pointers for doing
-// bounds checks followed by reads / writes, as they might change in the
-// meantime.
+// other end modifies arbitrary shared memory at any time. This means we must
+// make local copies of read and write pointers for doing bounds checks
+// followed by reads / writes, as they might change in the meantime.
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-//
-// TODO:
-// - Write a benchmark.
 class SharedRingBuffer {
  public:
   class Buffer {
@@ -79,9 +83,6 @@ class SharedRingBuffer {
     uint64_t num_reads_succeeded;
     uint64_t num_reads_corrupt;
     uint64_t num_reads_nodata;
-
-    // Fields below get set by GetStats as copies of atomics in MetadataPage.
-    uint64_t failed_spinlocks;
   };
 
   static base::Optional<SharedRingBuffer> Create(size_t);
@@ -97,41 +98,56 @@ class SharedRingBuffer {
   size_t size() const { return size_; }
   int fd() const { return *mem_fd_; }
 
-  Buffer BeginWrite(const ScopedSpinlock& spinlock, size_t size);
+  // Thread-safe. Returns an invalid Buffer and sets errno if there is not
+  // enough space or the buffer is corrupt.
+  Buffer BeginWrite(size_t size);
   void EndWrite(Buffer buf);
 
+  // Only one thread may read at a time. The contents of the returned Buffer
+  // are cleared by EndRead, so they must not be accessed afterwards.
   Buffer BeginRead();
   void EndRead(Buffer);
 
-  Stats GetStats(ScopedSpinlock& spinlock) {
-    PERFETTO_DCHECK(spinlock.locked());
-    Stats stats = meta_->stats;
-    stats.failed_spinlocks =
-        meta_->failed_spinlocks.load(std::memory_order_relaxed);
-    return stats;
-  }
+  // The stats are updated without synchronization between fields, so they
+  // might not be consistent with each other while writes are in progress.
+  Stats GetStats();
 
-  // This is used by the caller to be able to hold the SpinLock after
-  // BeginWrite has returned. This is so that additional bookkeeping can be
-  // done under the lock. This will be used to increment the sequence_number.
-  ScopedSpinlock AcquireLock(ScopedSpinlock::Mode mode) {
-    auto lock = ScopedSpinlock(&meta_->spinlock, mode);
-    if (PERFETTO_UNLIKELY(!lock.locked()))
-      meta_->failed_spinlocks.fetch_add(1, std::memory_order_relaxed);
-    return lock;
-  }
+  // Hints are 32-bit values that the reader publishes for the writers, keyed
+  // by 32-bit integers (e.g. thread ids). The table is direct mapped, so
+  // setting a hint can evict the one of another key, and writers must not
+  // rely on them for correctness.
+  // Only called by the reader. |value| must not be 0.
+  void SetReaderHint(uint32_t key, uint32_t value);
+  // Thread-safe. Returns 0 if there is no hint for |key|.
+  uint32_t GetReaderHint(uint32_t key);
+
+  static constexpr size_t kCacheLineSize = 64;
+  static constexpr size_t kNumReaderHints = 256;
 
   // Exposed for fuzzers.
   struct MetadataPage {
-    alignas(uint64_t) std::atomic<bool> spinlock;
-    uint64_t read_pos;
-    uint64_t write_pos;
+    // Positions are only ever increased. The writers and the reader each get
+    // their own cache line, so that they don't contend on it.
+    alignas(kCacheLineSize) std::atomic<uint64_t> read_pos;
+    alignas(kCacheLineSize) std::atomic<uint64_t> write_pos;
+
+    alignas(kCacheLineSize) std::atomic<uint64_t> bytes_written;
+    std::atomic<uint64_t> num_writes_succeeded;
+    std::atomic<uint64_t> num_writes_corrupt;
+    std::atomic<uint64_t> num_writes_overflow;
+
+    // Only written by the reader.
+    alignas(kCacheLineSize) uint64_t num_reads_succeeded;
+    uint64_t num_reads_corrupt;
+    uint64_t num_reads_nodata;
 
-    std::atomic<uint64_t> failed_spinlocks;
-    Stats stats;
+    // Written by the reader. Each entry is key << 32 | value, or 0 if unset.
+    alignas(kCacheLineSize) std::atomic<uint64_t> reader_hints[kNumReaderHints];
   };
 
  private:
+  static constexpr int kMaxPositionsAttempts = 1000;
+
   struct PointerPositions {
     uint64_t read_pos;
     uint64_t write_pos;
@@ -149,13 +165,22 @@ class SharedRingBuffer {
   void Initialize(base::ScopedFile mem_fd);
   bool IsCorrupt(const PointerPositions& pos);
 
-  inline base::Optional<PointerPositions> GetPointerPositions(
-      const ScopedSpinlock& lock) {
-    PERFETTO_DCHECK(lock.locked());
-
+  inline base::Optional<PointerPositions> GetPointerPositions() {
+    // Both positions only ever increase, and read_pos never overtakes
+    // write_pos. Loading write_pos first thus guarantees that the snapshot
+    // never shows more than size_ bytes in use, even if the reader makes
+    // progress in between. If the reader consumed past the loaded write_pos
+    // in the meantime, the snapshot is stale and has to be taken again.
+    // Attempts are bounded, as the other end might not play by the rules.
     PointerPositions pos;
-    pos.read_pos = meta_->read_pos;
-    pos.write_pos = meta_->write_pos;
+    for (int attempt = 0;; attempt++) {
+      pos.write_pos = meta_->write_pos.load(std::memory_order_acquire);
+      pos.read_pos = meta_->read_pos.load(std::memory_order_acquire);
+      if (PERFETTO_LIKELY(pos.read_pos <= pos.write_pos) ||
+          attempt == kMaxPositionsAttempts) {
+        break;
+      }
+    }
 
     base::Optional<PointerPositions> result;
     if (IsCorrupt(pos))
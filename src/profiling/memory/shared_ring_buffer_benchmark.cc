@@ -0,0 +1,103 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/optional.h"
+#include "perfetto/base/utils.h"
+#include "src/profiling/memory/shared_ring_buffer.h"
+
+namespace {
+
+using perfetto::profiling::SharedRingBuffer;
+
+// Same size as the buffer used by heapprofd by default.
+constexpr size_t kBufferSize = 8 * 1024 * 1024;
+
+perfetto::base::Optional<SharedRingBuffer> g_buffer;
+std::atomic<bool> g_reader_stop{false};
+std::thread* g_reader = nullptr;
+
+// Stands in for the unwinder: drains the buffer until told to stop.
+void ReaderMain() {
+  for (;;) {
+    SharedRingBuffer::Buffer buf = g_buffer->BeginRead();
+    if (!buf) {
+      if (g_reader_stop.load(std::memory_order_relaxed))
+        return;
+      std::this_thread::yield();
+      continue;
+    }
+    benchmark::DoNotOptimize(buf.data[0]);
+    g_buffer->EndRead(std::move(buf));
+  }
+}
+
+// Each benchmark thread is a writer in the profiled process. Only successful
+// writes are counted: when the buffer is full, writers yield to the reader.
+void BM_SharedRingBufferWrite(benchmark::State& state) {
+  const size_t size = static_cast<size_t>(state.range(0));
+  if (state.thread_index == 0) {
+    g_buffer = SharedRingBuffer::Create(kBufferSize);
+    PERFETTO_CHECK(g_buffer);
+    g_reader_stop.store(false);
+    g_reader = new std::thread(ReaderMain);
+  }
+
+  uint8_t payload[64 * 1024];
+  PERFETTO_CHECK(size <= sizeof(payload));
+  memset(payload, 'x', size);
+  int64_t overflows = 0;
+  for (auto _ : state) {
+    for (;;) {
+      SharedRingBuffer::Buffer buf = g_buffer->BeginWrite(size);
+      if (buf) {
+        memcpy(buf.data, payload, size);
+        g_buffer->EndWrite(std::move(buf));
+        break;
+      }
+      overflows++;
+      std::this_thread::yield();
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(size));
+  state.counters["overflows"] =
+      benchmark::Counter(static_cast<double>(overflows));
+
+  if (state.thread_index == 0) {
+    g_reader_stop.store(true);
+    g_reader->join();
+    delete g_reader;
+    g_reader = nullptr;
+    g_buffer = perfetto::base::nullopt;
+  }
+}
+
+}  // namespace
+
+BENCHMARK(BM_SharedRingBufferWrite)
+    ->Arg(64)
+    ->Arg(4096)
+    ->Threads(1)
+    ->Threads(2)
+    ->Threads(4)
+    ->Threads(8)
+    ->UseRealTime();
@@ -59,11 +59,8 @@ int FuzzRingBuffer(const uint8_t* data, size_t size) {
   // for the metadata.
   size_t total_size_pages = 1 + RoundToPow2(payload_size_pages);
 
-  // Clear spinlock field, as otherwise the read will wait indefinitely (it
-  // defaults to indefinite blocking mode).
   SharedRingBuffer::MetadataPage header = {};
   memcpy(&header, data, sizeof(header));
-  header.spinlock = 0;
 
   PERFETTO_CHECK(ftruncate(*fd, static_cast<off_t>(total_size_pages *
                                                    base::kPageSize)) == 0);
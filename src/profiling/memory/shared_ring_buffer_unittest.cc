@@ -35,13 +35,7 @@ std::string ToString(const SharedRingBuffer::Buffer& buf_and_size) {
 }
 
 bool TryWrite(SharedRingBuffer* wr, const char* src, size_t size) {
-  SharedRingBuffer::Buffer buf;
-  {
-    auto lock = wr->AcquireLock(ScopedSpinlock::Mode::Try);
-    if (!lock.locked())
-      return false;
-    buf = wr->BeginWrite(lock, size);
-  }
+  SharedRingBuffer::Buffer buf = wr->BeginWrite(size);
   if (!buf)
     return false;
   memcpy(buf.data, src, size);
@@ -162,11 +156,7 @@ TEST(SharedRingBufferTest, WriteShutdown) {
   ASSERT_TRUE(rd);
   SharedRingBuffer wr =
       *SharedRingBuffer::Attach(base::ScopedFile(dup(rd->fd())));
-  SharedRingBuffer::Buffer buf;
-  {
-    auto lock = wr.AcquireLock(ScopedSpinlock::Mode::Blocking);
-    buf = wr.BeginWrite(lock, 10);
-  }
+  SharedRingBuffer::Buffer buf = wr.BeginWrite(10);
   rd = base::nullopt;
   memset(buf.data, 0, buf.size);
   wr.EndWrite(std::move(buf));
@@ -265,14 +255,91 @@ TEST(SharedRingBufferTest, EmptyWrite) {
   constexpr auto kBufSize = base::kPageSize * 4;
   base::Optional<SharedRingBuffer> wr = SharedRingBuffer::Create(kBufSize);
   ASSERT_TRUE(wr);
-  SharedRingBuffer::Buffer buf;
-  {
-    auto lock = wr->AcquireLock(ScopedSpinlock::Mode::Try);
-    ASSERT_TRUE(lock.locked());
-    buf = wr->BeginWrite(lock, 0);
-  }
+  SharedRingBuffer::Buffer buf = wr->BeginWrite(0);
   EXPECT_TRUE(buf);
   wr->EndWrite(std::move(buf));
+
+  // Empty records are committed like any other.
+  auto read_buf = wr->BeginRead();
+  EXPECT_TRUE(read_buf);
+  EXPECT_EQ(read_buf.size, 0u);
+  wr->EndRead(std::move(read_buf));
+}
+
+TEST(SharedRingBufferTest, UncommittedWriteBlocksReader) {
+  constexpr auto kBufSize = base::kPageSize * 4;
+  base::Optional<SharedRingBuffer> buf = SharedRingBuffer::Create(kBufSize);
+  ASSERT_TRUE(buf);
+
+  SharedRingBuffer::Buffer first = buf->BeginWrite(4);
+  ASSERT_TRUE(first);
+  ASSERT_TRUE(TryWrite(&*buf, "bar", 4));
+
+  // Records are read in reservation order, so the second one has to wait for
+  // the first to be committed.
+  EXPECT_FALSE(buf->BeginRead());
+  memcpy(first.data, "foo", 4);
+  buf->EndWrite(std::move(first));
+
+  for (const char* expected : {"foo", "bar"}) {
+    auto read_buf = buf->BeginRead();
+    ASSERT_TRUE(read_buf);
+    EXPECT_STREQ(reinterpret_cast<const char*>(read_buf.data), expected);
+    buf->EndRead(std::move(read_buf));
+  }
+  EXPECT_FALSE(buf->BeginRead());
+
+  SharedRingBuffer::Stats stats = buf->GetStats();
+  EXPECT_EQ(stats.num_writes_succeeded, 2u);
+  EXPECT_EQ(stats.bytes_written, 8u);
+  EXPECT_EQ(stats.num_reads_succeeded, 2u);
+}
+
+TEST(SharedRingBufferTest, ReusedSpaceIsNotCommitted) {
+  constexpr auto kBufSize = base::kPageSize * 4;
+  base::Optional<SharedRingBuffer> buf = SharedRingBuffer::Create(kBufSize);
+  ASSERT_TRUE(buf);
+
+  // Fill the buffer with a payload that looks like committed headers.
+  std::string data(kBufSize - sizeof(uint64_t), '\x01');
+  ASSERT_TRUE(TryWrite(&*buf, data.data(), data.size()));
+  auto read_buf = buf->BeginRead();
+  ASSERT_TRUE(read_buf);
+  buf->EndRead(std::move(read_buf));
+
+  // A reserved record over that space must not be visible before EndWrite.
+  SharedRingBuffer::Buffer wr_buf = buf->BeginWrite(16);
+  ASSERT_TRUE(wr_buf);
+  EXPECT_FALSE(buf->BeginRead());
+  memset(wr_buf.data, 0, wr_buf.size);
+  buf->EndWrite(std::move(wr_buf));
+  read_buf = buf->BeginRead();
+  ASSERT_TRUE(read_buf);
+  EXPECT_EQ(read_buf.size, 16u);
+  buf->EndRead(std::move(read_buf));
+}
+
+TEST(SharedRingBufferTest, ReaderHints) {
+  constexpr auto kBufSize = base::kPageSize * 4;
+  base::Optional<SharedRingBuffer> rd = SharedRingBuffer::Create(kBufSize);
+  ASSERT_TRUE(rd);
+  base::Optional<SharedRingBuffer> wr =
+      SharedRingBuffer::Attach(base::ScopedFile(dup(rd->fd())));
+  ASSERT_TRUE(wr);
+
+  EXPECT_EQ(wr->GetReaderHint(1), 0u);
+  rd->SetReaderHint(1, 4096);
+  rd->SetReaderHint(2, 8192);
+  EXPECT_EQ(wr->GetReaderHint(1), 4096u);
+  EXPECT_EQ(wr->GetReaderHint(2), 8192u);
+
+  // A key that maps to the same entry evicts the previous one.
+  uint32_t colliding_key = 1 + SharedRingBuffer::kNumReaderHints;
+  EXPECT_EQ(wr->GetReaderHint(colliding_key), 0u);
+  rd->SetReaderHint(colliding_key, 16384);
+  EXPECT_EQ(wr->GetReaderHint(colliding_key), 16384u);
+  EXPECT_EQ(wr->GetReaderHint(1), 0u);
+  EXPECT_EQ(wr->GetReaderHint(2), 8192u);
 }
 
 }  // namespace
@@ -16,9 +16,16 @@
 
 #include "src/profiling/memory/unwinding.h"
 
+#include <errno.h>
+#include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
 #include <unwindstack/MachineArm.h>
 #include <unwindstack/MachineArm64.h>
 #include <unwindstack/MachineMips.h>
@@ -63,6 +70,19 @@ constexpr size_t kMaxFrames = 1000;
 // saturates this thread.
 constexpr size_t kUnwindBatchSize = 1000;
 
+// Upper bound for the number of registers of the supported architectures.
+constexpr size_t kMaxRegisters = 64;
+
+// Clients are never asked to send less than this many bytes of stack, so
+// threads with shallow stacks are never truncated.
+constexpr uint64_t kMinStackCopyLimit = 8 * 1024;
+// Threads come and go, so the limits are forgotten once there are too many.
+constexpr size_t kMaxStackCopyLimits = 4096;
+
+// Cleared the first time process_vm_readv fails with EPERM or ENOSYS. Read by
+// all the unwinding workers.
+std::atomic<bool> g_process_vm_readv_permitted{true};
+
 #pragma GCC diagnostic push
 // We do not care about deterministic destructor order.
 #pragma GCC diagnostic ignored "-Wglobal-constructors"
@@ -100,6 +120,66 @@ std::unique_ptr<unwindstack::Regs> CreateFromRawData(unwindstack::ArchEnum arch,
   return ret;
 }
 
+// Size in bytes of a pointer (and of a stack slot) on |arch|.
+size_t GetWordSize(unwindstack::ArchEnum arch) {
+  switch (arch) {
+    case unwindstack::ARCH_ARM:
+    case unwindstack::ARCH_X86:
+    case unwindstack::ARCH_MIPS:
+      return 4;
+    case unwindstack::ARCH_ARM64:
+    case unwindstack::ARCH_X86_64:
+    case unwindstack::ARCH_MIPS64:
+    case unwindstack::ARCH_UNKNOWN:
+      return 8;
+  }
+  return 8;
+}
+
+uint64_t ComputeFingerprint(const UnwindingCache& cache,
+                            unwindstack::Regs* regs,
+                            unwindstack::ArchEnum arch,
+                            uint64_t sp,
+                            const uint8_t* stack,
+                            size_t stack_size) {
+  uint64_t reg_values[kMaxRegisters];
+  size_t num_regs = 0;
+  regs->IterateRegisters([&reg_values, &num_regs](const char*, uint64_t value) {
+    if (num_regs < kMaxRegisters)
+      reg_values[num_regs++] = value;
+  });
+  return cache.Fingerprint(regs->pc(), sp, reg_values, num_regs, stack,
+                           stack_size, GetWordSize(arch));
+}
+
+// Learns how much stack the client needs to send for the thread |tid|, from
+// an unwinding that read up to |read_end| of the |copied_size| bytes it got.
+// The limit leaves room for the thread to go twice as deep as it was seen
+// before; if it goes deeper than that, the truncated unwinding doubles it.
+void UpdateStackCopyLimit(UnwindingMetadata* metadata,
+                          uint32_t tid,
+                          uint64_t copied_size,
+                          uint64_t read_end,
+                          bool truncated) {
+  uint32_t* current = metadata->stack_copy_limits.Find(tid);
+  uint64_t limit;
+  if (truncated) {
+    limit = std::max(2 * copied_size, kMinStackCopyLimit);
+  } else {
+    limit = std::max(2 * read_end, kMinStackCopyLimit);
+    if (current)
+      limit = std::max<uint64_t>(limit, *current);
+  }
+  limit = std::min<uint64_t>(limit, std::numeric_limits<uint32_t>::max());
+  if (current) {
+    *current = static_cast<uint32_t>(limit);
+    return;
+  }
+  if (metadata->stack_copy_limits.size() >= kMaxStackCopyLimits)
+    metadata->stack_copy_limits.Clear();
+  metadata->stack_copy_limits.Insert(tid, static_cast<uint32_t>(limit));
+}
+
 // Behaves as a pread64, emulating it if not already exposed by the standard
 // library. Safe to use on 32bit platforms for addresses with the top bit set.
 // Clobbers the |fd| seek position if emulating.
@@ -121,22 +201,51 @@ ssize_t ReadAtOffsetClobberSeekPos(int fd,
 StackOverlayMemory::StackOverlayMemory(std::shared_ptr<unwindstack::Memory> mem,
                                        uint64_t sp,
                                        uint8_t* stack,
-                                       size_t size)
-    : mem_(std::move(mem)), sp_(sp), stack_end_(sp + size), stack_(stack) {}
+                                       size_t size,
+                                       uint64_t full_size)
+    : mem_(std::move(mem)),
+      sp_(sp),
+      stack_end_(sp + size),
+      full_stack_end_(sp + std::max<uint64_t>(size, full_size)),
+      stack_(stack) {}
 
 size_t StackOverlayMemory::Read(uint64_t addr, void* dst, size_t size) {
   if (addr >= sp_ && addr + size <= stack_end_ && addr + size > sp_) {
     size_t offset = static_cast<size_t>(addr - sp_);
     memcpy(dst, stack_ + offset, size);
+    max_read_end_ = std::max<uint64_t>(max_read_end_, offset + size);
     return size;
   }
 
+  if (addr < full_stack_end_ && addr + size > stack_end_) {
+    truncated_ = true;
+    return 0;
+  }
+
   return mem_->Read(addr, dst, size);
 }
 
-FDMemory::FDMemory(base::ScopedFile mem_fd) : mem_fd_(std::move(mem_fd)) {}
+FDMemory::FDMemory(base::ScopedFile mem_fd, pid_t pid)
+    : mem_fd_(std::move(mem_fd)), pid_(pid) {}
 
 size_t FDMemory::Read(uint64_t addr, void* dst, size_t size) {
+  if (pid_ != base::kInvalidPid && addr <= UINTPTR_MAX &&
+      g_process_vm_readv_permitted.load(std::memory_order_relaxed)) {
+    struct iovec local = {dst, size};
+    struct iovec remote = {
+        reinterpret_cast<void*>(static_cast<uintptr_t>(addr)), size};
+    ssize_t rd = process_vm_readv(pid_, &local, 1, &remote, 1, 0);
+    if (rd != -1)
+      return static_cast<size_t>(rd);
+    if (errno != EPERM && errno != ENOSYS)
+      return 0;
+    // We were given the fd to /proc/[pid]/mem, but might not be allowed to
+    // ptrace the process. This is a property of the daemon (its capabilities
+    // and SELinux domain) rather than of the client, so stop trying for all
+    // clients.
+    if (g_process_vm_readv_permitted.exchange(false))
+      PERFETTO_DLOG("process_vm_readv not permitted, using /proc/[pid]/mem");
+  }
   ssize_t rd = ReadAtOffsetClobberSeekPos(*mem_fd_, dst, size, addr);
   if (rd == -1) {
     PERFETTO_DPLOG("read of %zu at offset %" PRIu64, size, addr);
@@ -145,6 +254,142 @@ size_t FDMemory::Read(uint64_t addr, void* dst, size_t size) {
   return static_cast<size_t>(rd);
 }
 
+PageCachedMemory::PageCachedMemory(std::shared_ptr<unwindstack::Memory> mem)
+    : mem_(std::move(mem)) {}
+
+void PageCachedMemory::Reset(unwindstack::Maps* maps) {
+  DropPages();
+
+  cacheable_ranges_.clear();
+  for (size_t i = 0; i < maps->Total(); ++i) {
+    const unwindstack::MapInfo* map = maps->Get(i);
+    if (!(map->flags & PROT_READ) || (map->flags & PROT_WRITE) ||
+        (map->flags & unwindstack::MAPS_FLAGS_DEVICE_MAP)) {
+      continue;
+    }
+    // /proc/pid/maps is sorted, so only adjacent mappings need merging.
+    if (!cacheable_ranges_.empty() &&
+        cacheable_ranges_.back().second == map->start) {
+      cacheable_ranges_.back().second = map->end;
+    } else {
+      cacheable_ranges_.emplace_back(map->start, map->end);
+    }
+  }
+}
+
+void PageCachedMemory::DropPages() {
+  pages_.clear();
+  page_slots_.Clear();
+  lru_head_ = lru_tail_ = kNoPage;
+}
+
+bool PageCachedMemory::IsCacheable(uint64_t addr, size_t size) const {
+  auto it = std::upper_bound(
+      cacheable_ranges_.begin(), cacheable_ranges_.end(), addr,
+      [](uint64_t a, const std::pair<uint64_t, uint64_t>& range) {
+        return a < range.first;
+      });
+  if (it == cacheable_ranges_.begin())
+    return false;
+  --it;
+  return addr + size >= addr && addr + size <= it->second;
+}
+
+size_t PageCachedMemory::Read(uint64_t addr, void* dst, size_t size) {
+  if (!IsCacheable(addr, size)) {
+    stats_.underlying_reads++;
+    return mem_->Read(addr, dst, size);
+  }
+
+  uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+  uint64_t end = addr + size;
+  size_t rd = 0;
+  while (addr < end) {
+    uint64_t page_addr = addr & ~static_cast<uint64_t>(kPageSize - 1);
+    uint32_t slot = GetPage(page_addr, end);
+    if (slot == kNoPage)
+      break;
+    size_t offset = static_cast<size_t>(addr - page_addr);
+    size_t len = static_cast<size_t>(
+        std::min<uint64_t>(end - addr, kPageSize - offset));
+    memcpy(out + rd, pages_[slot]->data + offset, len);
+    rd += len;
+    addr += len;
+  }
+  return rd;
+}
+
+uint32_t PageCachedMemory::GetPage(uint64_t page_addr, uint64_t end) {
+  uint32_t* cached_slot = page_slots_.Find(page_addr);
+  if (cached_slot) {
+    stats_.page_hits++;
+    uint32_t slot = *cached_slot;
+    if (slot != lru_head_) {
+      Unlink(slot);
+      PushFront(slot);
+    }
+    return slot;
+  }
+
+  // Read the run of missing pages that the caller needs in one go.
+  size_t num_pages = 1;
+  for (uint64_t next = page_addr + kPageSize;
+       next < end && num_pages < kMaxPages && !page_slots_.Find(next);
+       next += kPageSize) {
+    num_pages++;
+  }
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[num_pages * kPageSize]);
+  size_t rd = mem_->Read(page_addr, buf.get(), num_pages * kPageSize);
+  stats_.underlying_reads++;
+
+  uint32_t first_slot = kNoPage;
+  // Insert in reverse order, so the page needed first ends up most recent.
+  for (size_t i = rd / kPageSize; i-- > 0;) {
+    uint32_t slot = AllocatePage();
+    Page* page = pages_[slot].get();
+    page->addr = page_addr + i * kPageSize;
+    memcpy(page->data, buf.get() + i * kPageSize, kPageSize);
+    page_slots_.Insert(page->addr, slot);
+    PushFront(slot);
+    first_slot = slot;
+  }
+  return first_slot;
+}
+
+uint32_t PageCachedMemory::AllocatePage() {
+  if (pages_.size() < kMaxPages) {
+    pages_.emplace_back(new Page);
+    return static_cast<uint32_t>(pages_.size() - 1);
+  }
+  uint32_t slot = lru_tail_;
+  Unlink(slot);
+  page_slots_.Erase(pages_[slot]->addr);
+  return slot;
+}
+
+void PageCachedMemory::Unlink(uint32_t slot) {
+  Page* page = pages_[slot].get();
+  if (page->prev == kNoPage)
+    lru_head_ = page->next;
+  else
+    pages_[page->prev]->next = page->next;
+  if (page->next == kNoPage)
+    lru_tail_ = page->prev;
+  else
+    pages_[page->next]->prev = page->prev;
+}
+
+void PageCachedMemory::PushFront(uint32_t slot) {
+  Page* page = pages_[slot].get();
+  page->prev = kNoPage;
+  page->next = lru_head_;
+  if (lru_head_ != kNoPage)
+    pages_[lru_head_]->prev = slot;
+  lru_head_ = slot;
+  if (lru_tail_ == kNoPage)
+    lru_tail_ = slot;
+}
+
 FileDescriptorMaps::FileDescriptorMaps(base::ScopedFile fd)
     : fd_(std::move(fd)) {}
 
@@ -191,12 +436,24 @@ bool DoUnwind(WireMessage* msg, UnwindingMetadata* metadata, AllocRecord* out) {
     return false;
   }
   uint8_t* stack = reinterpret_cast<uint8_t*>(msg->payload);
-  std::shared_ptr<unwindstack::Memory> mems =
-      std::make_shared<StackOverlayMemory>(metadata->fd_mem,
-                                           alloc_metadata->stack_pointer, stack,
-                                           msg->payload_size);
+  UnwindingCache& cache = metadata->unwinding_cache;
+  uint64_t fingerprint =
+      ComputeFingerprint(cache, regs.get(), alloc_metadata->arch,
+                         alloc_metadata->stack_pointer, stack, msg->payload_size);
+  const std::vector<FrameData>* cached_frames = cache.Find(fingerprint);
+  if (cached_frames) {
+    out->frames = *cached_frames;
+    out->unwinding_cache_hit = true;
+    return true;
+  }
+
+  std::shared_ptr<StackOverlayMemory> stack_memory =
+      std::make_shared<StackOverlayMemory>(
+          metadata->fd_mem, alloc_metadata->stack_pointer, stack,
+          msg->payload_size, alloc_metadata->stack_size);
 
-  unwindstack::Unwinder unwinder(kMaxFrames, &metadata->maps, regs.get(), mems);
+  unwindstack::Unwinder unwinder(kMaxFrames, &metadata->maps, regs.get(),
+                                 stack_memory);
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
   unwinder.SetJitDebug(metadata->jit_debug.get(), regs->Arch());
   unwinder.SetDexFiles(metadata->dex_files.get(), regs->Arch());
@@ -231,14 +488,31 @@ bool DoUnwind(WireMessage* msg, UnwindingMetadata* metadata, AllocRecord* out) {
     out->frames.emplace_back(std::move(fd), std::move(build_id));
   }
 
-  if (error_code != 0) {
+  UpdateStackCopyLimit(metadata, alloc_metadata->tid, msg->payload_size,
+                       stack_memory->max_read_end(), stack_memory->truncated());
+
+  if (stack_memory->truncated()) {
+    PERFETTO_DLOG("Unwinding needed more of the stack than was sent.");
+    unwindstack::FrameData frame_data{};
+    frame_data.function_name = "ERROR TRUNCATED STACK";
+    frame_data.map_name = "ERROR";
+
+    out->frames.emplace_back(frame_data, "");
+    out->error = true;
+  } else if (error_code != 0) {
     PERFETTO_DLOG("Unwinding error %" PRIu8, error_code);
+    // A cached page that went stale without a change of the maps we know
+    // about could be the cause, don't let it fail the next unwinds too.
+    metadata->fd_mem->DropPages();
     unwindstack::FrameData frame_data{};
     frame_data.function_name = "ERROR " + std::to_string(error_code);
     frame_data.map_name = "ERROR";
 
     out->frames.emplace_back(frame_data, "");
     out->error = true;
+  } else if (!out->reparsed_map && UnwindingCache::IsCacheable(out->frames)) {
+    // After a reparse, |fingerprint| was computed against the old maps.
+    cache.Insert(fingerprint, out->frames);
   }
   return true;
 }
@@ -263,14 +537,7 @@ void UnwindingWorker::OnDisconnect(base::UnixSocket* self) {
   // allow us to free the bookkeeping data earlier for processes that exit
   // during the session. See TODO in
   // HeapprofdProducer::HandleSocketDisconnected.
-  SharedRingBuffer::Stats stats = {};
-  {
-    auto lock = shmem.AcquireLock(ScopedSpinlock::Mode::Try);
-    if (lock.locked())
-      stats = shmem.GetStats(lock);
-    else
-      PERFETTO_ELOG("Failed to log shmem to get stats.");
-  }
+  SharedRingBuffer::Stats stats = shmem.GetStats();
   DataSourceInstanceID ds_id = client_data.data_source_instance_id;
   pid_t peer_pid = self->peer_pid();
   client_data_.erase(it);
@@ -303,14 +570,15 @@ void UnwindingWorker::HandleUnwindBatch(pid_t peer_pid) {
   bool repost_task = false;
   for (i = 0; i < kUnwindBatchSize; ++i) {
     uint64_t reparses_before = client_data.metadata.reparses;
-    // TODO(fmayer): Allow spinlock acquisition to fail and repost Task if it
-    // did.
+    // Lock-free: this never blocks on the client, and returns an empty buffer
+    // when there is nothing to read.
     buf = shmem.BeginRead();
     if (!buf)
       break;
-    HandleBuffer(buf, &client_data.metadata,
-                 client_data.data_source_instance_id,
-                 client_data.sock->peer_pid(), delegate_);
+    HandleBuffer(
+        buf, &client_data.metadata, client_data.data_source_instance_id,
+        client_data.sock->peer_pid(), delegate_,
+        client_data.client_config.adaptive_stack_copy ? &shmem : nullptr);
     shmem.EndRead(std::move(buf));
     // Reparsing takes time, so process the rest in a new batch to avoid timing
     // out.
@@ -337,7 +605,8 @@ void UnwindingWorker::HandleBuffer(const SharedRingBuffer::Buffer& buf,
                                    UnwindingMetadata* unwinding_metadata,
                                    DataSourceInstanceID data_source_instance_id,
                                    pid_t peer_pid,
-                                   Delegate* delegate) {
+                                   Delegate* delegate,
+                                   SharedRingBuffer* hints_shmem) {
   WireMessage msg;
   // TODO(fmayer): standardise on char* or uint8_t*.
   // char* has stronger guarantees regarding aliasing.
@@ -356,6 +625,12 @@ void UnwindingWorker::HandleBuffer(const SharedRingBuffer::Buffer& buf,
     DoUnwind(&msg, unwinding_metadata, &rec);
     rec.unwinding_time_us = static_cast<uint64_t>(
         ((base::GetWallTimeNs() / 1000) - start_time_us).count());
+    if (hints_shmem) {
+      uint32_t tid = rec.alloc_metadata.tid;
+      const uint32_t* limit = unwinding_metadata->stack_copy_limits.Find(tid);
+      if (limit)
+        hints_shmem->SetReaderHint(tid, *limit);
+    }
     delegate->PostAllocRecord(std::move(rec));
   } else if (msg.record_type == RecordType::Free) {
     FreeRecord rec;
@@ -388,17 +663,26 @@ void UnwindingWorker::HandleHandoffSocket(HandoffData handoff_data) {
       base::SockType::kStream);
   pid_t peer_pid = sock->peer_pid();
 
-  UnwindingMetadata metadata(peer_pid,
-                             std::move(handoff_data.fds[kHandshakeMaps]),
-                             std::move(handoff_data.fds[kHandshakeMem]));
+  bool migrated = handoff_data.metadata != nullptr;
+  if (!migrated) {
+    handoff_data.metadata.reset(
+        new UnwindingMetadata(peer_pid,
+                              std::move(handoff_data.fds[kHandshakeMaps]),
+                              std::move(handoff_data.fds[kHandshakeMem])));
+  }
   ClientData client_data{
       handoff_data.data_source_instance_id,
       std::move(sock),
-      std::move(metadata),
+      std::move(*handoff_data.metadata),
       std::move(handoff_data.shmem),
       std::move(handoff_data.client_config),
   };
   client_data_.emplace(peer_pid, std::move(client_data));
+
+  // The notifications for the data that was left in the buffer were consumed
+  // by the previous worker.
+  if (migrated)
+    HandleUnwindBatch(peer_pid);
 }
 
 void UnwindingWorker::PostDisconnectSocket(pid_t pid) {
@@ -412,6 +696,34 @@ void UnwindingWorker::HandleDisconnectSocket(pid_t pid) {
   client_data_.erase(pid);
 }
 
+void UnwindingWorker::PostMigrateClient(pid_t pid, size_t target_worker) {
+  // We do not need to use a WeakPtr here because the task runner will not
+  // outlive its UnwindingWorker.
+  thread_task_runner_.get()->PostTask([this, pid, target_worker] {
+    HandleMigrateClient(pid, target_worker);
+  });
+}
+
+void UnwindingWorker::HandleMigrateClient(pid_t pid, size_t target_worker) {
+  auto it = client_data_.find(pid);
+  if (it == client_data_.end()) {
+    // The client disconnected in the meantime.
+    PERFETTO_DLOG("%d: Not migrating disconnected client.", pid);
+    return;
+  }
+  ClientData& client_data = it->second;
+
+  HandoffData handoff_data;
+  handoff_data.data_source_instance_id = client_data.data_source_instance_id;
+  handoff_data.sock = client_data.sock->ReleaseSocket();
+  handoff_data.shmem = std::move(client_data.shmem);
+  handoff_data.client_config = client_data.client_config;
+  handoff_data.metadata.reset(
+      new UnwindingMetadata(std::move(client_data.metadata)));
+  client_data_.erase(it);
+  delegate_->PostClientMigrated(target_worker, pid, std::move(handoff_data));
+}
+
 UnwindingWorker::Delegate::~Delegate() = default;
 
 }  // namespace profiling
@@ -27,10 +27,13 @@
 #include <unwindstack/JitDebug.h>
 #endif
 
+#include "perfetto/base/flat_hash_map.h"
 #include "perfetto/base/scoped_file.h"
 #include "perfetto/base/thread_task_runner.h"
+#include "perfetto/base/utils.h"
 #include "perfetto/tracing/core/basic_types.h"
 #include "src/profiling/memory/bookkeeping.h"
+#include "src/profiling/memory/unwinding_cache.h"
 #include "src/profiling/memory/unwound_messages.h"
 #include "src/profiling/memory/wire_protocol.h"
 
@@ -66,38 +69,120 @@ class FileDescriptorMaps : public unwindstack::Maps {
   base::ScopedFile fd_;
 };
 
+// Reads the memory of a process through its /proc/[pid]/mem. If pid is given,
+// process_vm_readv is used instead, which saves the lseek of the fallback on
+// platforms without pread64. Whether process_vm_readv is permitted is probed
+// once per process (of the daemon), not per client.
 class FDMemory : public unwindstack::Memory {
  public:
-  FDMemory(base::ScopedFile mem_fd);
+  FDMemory(base::ScopedFile mem_fd, pid_t pid = base::kInvalidPid);
   size_t Read(uint64_t addr, void* dst, size_t size) override;
 
  private:
   base::ScopedFile mem_fd_;
+  pid_t pid_;
+};
+
+// LRU cache of pages of another Memory. libunwindstack issues many small reads
+// (ELF headers, .eh_frame, .debug_frame) per unwinding, which would otherwise
+// each be a syscall.
+// Only pages of mappings that are neither writable nor device maps are
+// cached. Reads of other addresses go straight to the underlying Memory.
+// Cached pages can still go stale if the process changes a read-only mapping
+// without us reparsing its maps, e.g. dlclose() followed by a dlopen() at the
+// same address, or mprotect() to write and back. The pages are dropped on
+// every maps reparse (see UnwindingMetadata::ReparseMaps) and after every
+// failed unwinding (see DoUnwind), so a stale page cannot keep breaking
+// unwinds.
+class PageCachedMemory : public unwindstack::Memory {
+ public:
+  static constexpr size_t kPageSize = 4096;
+  static constexpr size_t kMaxPages = 256;
+
+  struct Stats {
+    // Page lookups that were served from the cache.
+    uint64_t page_hits = 0;
+    // Reads issued to the underlying Memory, i.e. syscalls for FDMemory.
+    uint64_t underlying_reads = 0;
+  };
+
+  explicit PageCachedMemory(std::shared_ptr<unwindstack::Memory> mem);
+
+  // Drops all cached pages, and recomputes the cacheable ranges from |maps|.
+  void Reset(unwindstack::Maps* maps);
+  // Drops all cached pages, keeping the cacheable ranges.
+  void DropPages();
+  size_t Read(uint64_t addr, void* dst, size_t size) override;
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  static constexpr uint32_t kNoPage = static_cast<uint32_t>(-1);
+
+  struct Page {
+    uint64_t addr;
+    // Neighbours in the LRU list.
+    uint32_t prev;
+    uint32_t next;
+    uint8_t data[kPageSize];
+  };
+
+  bool IsCacheable(uint64_t addr, size_t size) const;
+  // Returns the slot holding |page_addr|, reading it (and the uncached pages
+  // that follow it, up to |end|) from mem_ if needed. Returns kNoPage if the
+  // page could not be read.
+  uint32_t GetPage(uint64_t page_addr, uint64_t end);
+  uint32_t AllocatePage();
+  void Unlink(uint32_t slot);
+  void PushFront(uint32_t slot);
+
+  std::shared_ptr<unwindstack::Memory> mem_;
+  // Sorted, non-overlapping [start, end) ranges of the cacheable mappings.
+  std::vector<std::pair<uint64_t, uint64_t>> cacheable_ranges_;
+  std::vector<std::unique_ptr<Page>> pages_;
+  base::FlatHashMap<uint64_t, uint32_t> page_slots_;
+  // Most recently used first.
+  uint32_t lru_head_ = kNoPage;
+  uint32_t lru_tail_ = kNoPage;
+  Stats stats_;
 };
 
 // Overlays size bytes pointed to by stack for addresses in [sp, sp + size).
 // Addresses outside of that range are read from mem_fd, which should be an fd
 // that opened /proc/[pid]/mem.
+// If the client only sent the first size of the full_size bytes of its stack,
+// reads of [sp + size, sp + full_size) fail, as that part of the stack has
+// most likely changed since the sample was taken.
 class StackOverlayMemory : public unwindstack::Memory {
  public:
   StackOverlayMemory(std::shared_ptr<unwindstack::Memory> mem,
                      uint64_t sp,
                      uint8_t* stack,
-                     size_t size);
+                     size_t size,
+                     uint64_t full_size = 0);
   size_t Read(uint64_t addr, void* dst, size_t size) override;
 
+  // End of the furthest read of the overlaid stack, relative to sp.
+  uint64_t max_read_end() const { return max_read_end_; }
+  // Whether a read failed because the stack was not sent in full.
+  bool truncated() const { return truncated_; }
+
  private:
   std::shared_ptr<unwindstack::Memory> mem_;
   uint64_t sp_;
   uint64_t stack_end_;
+  uint64_t full_stack_end_;
   uint8_t* stack_;
+  uint64_t max_read_end_ = 0;
+  bool truncated_ = false;
 };
 
 struct UnwindingMetadata {
   UnwindingMetadata(pid_t p, base::ScopedFile maps_fd, base::ScopedFile mem)
       : pid(p),
         maps(std::move(maps_fd)),
-        fd_mem(std::make_shared<FDMemory>(std::move(mem)))
+        fd_mem(std::make_shared<PageCachedMemory>(
+            std::make_shared<FDMemory>(std::move(mem), p)))
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
         ,
         jit_debug(std::unique_ptr<unwindstack::JitDebug>(
@@ -107,11 +192,16 @@ struct UnwindingMetadata {
 #endif
   {
     PERFETTO_CHECK(maps.Parse());
+    fd_mem->Reset(&maps);
+    unwinding_cache.Reset(&maps);
   }
   void ReparseMaps() {
     reparses++;
     maps.Reset();
     maps.Parse();
+    // The cached pages may belong to mappings that have since been replaced.
+    fd_mem->Reset(&maps);
+    unwinding_cache.Reset(&maps);
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
     jit_debug = std::unique_ptr<unwindstack::JitDebug>(
         new unwindstack::JitDebug(fd_mem));
@@ -122,8 +212,12 @@ struct UnwindingMetadata {
   pid_t pid;
   FileDescriptorMaps maps;
   // The API of libunwindstack expects shared_ptr for Memory.
-  std::shared_ptr<unwindstack::Memory> fd_mem;
+  std::shared_ptr<PageCachedMemory> fd_mem;
   uint64_t reparses = 0;
+  UnwindingCache unwinding_cache;
+  // Number of stack bytes the client needs to send for the samples of each
+  // thread, by tid. Learned from the unwindings of previous samples.
+  base::FlatHashMap<uint32_t, uint32_t> stack_copy_limits;
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
   std::unique_ptr<unwindstack::JitDebug> jit_debug;
   std::unique_ptr<unwindstack::DexFiles> dex_files;
@@ -134,6 +228,17 @@ bool DoUnwind(WireMessage*, UnwindingMetadata* metadata, AllocRecord* out);
 
 class UnwindingWorker : public base::UnixSocket::EventListener {
  public:
+  struct HandoffData {
+    DataSourceInstanceID data_source_instance_id;
+    base::UnixSocketRaw sock;
+    base::ScopedFile fds[kHandshakeSize];
+    SharedRingBuffer shmem;
+    ClientConfiguration client_config;
+    // Only set for clients migrated from another worker, in which case fds
+    // are not used.
+    std::unique_ptr<UnwindingMetadata> metadata;
+  };
+
   class Delegate {
    public:
     virtual void PostAllocRecord(AllocRecord) = 0;
@@ -141,17 +246,15 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
     virtual void PostSocketDisconnected(DataSourceInstanceID,
                                         pid_t pid,
                                         SharedRingBuffer::Stats stats) = 0;
+    // Called with the state of the client |pid| after it was removed from this
+    // worker in response to PostMigrateClient. The delegate is expected to
+    // hand it off to |target_worker|.
+    virtual void PostClientMigrated(size_t target_worker,
+                                    pid_t pid,
+                                    HandoffData handoff_data) = 0;
     virtual ~Delegate();
   };
 
-  struct HandoffData {
-    DataSourceInstanceID data_source_instance_id;
-    base::UnixSocketRaw sock;
-    base::ScopedFile fds[kHandshakeSize];
-    SharedRingBuffer shmem;
-    ClientConfiguration client_config;
-  };
-
   UnwindingWorker(Delegate* delegate, base::ThreadTaskRunner thread_task_runner)
       : thread_task_runner_(std::move(thread_task_runner)),
         delegate_(delegate) {}
@@ -159,6 +262,9 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
   // Public API safe to call from other threads.
   void PostDisconnectSocket(pid_t pid);
   void PostHandoffSocket(HandoffData);
+  // Stops unwinding for |pid| on this worker, and passes its state to
+  // Delegate::PostClientMigrated, so it can continue on |target_worker|.
+  void PostMigrateClient(pid_t pid, size_t target_worker);
 
   // Implementation of UnixSocket::EventListener.
   // Do not call explicitly.
@@ -171,15 +277,19 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
 
  public:
   // static and public for testing/fuzzing
+  // If |hints_shmem| is not null, the stack copy limit of the thread of the
+  // sample is published to the client through it.
   static void HandleBuffer(const SharedRingBuffer::Buffer& buf,
                            UnwindingMetadata* unwinding_metadata,
                            DataSourceInstanceID data_source_instance_id,
                            pid_t peer_pid,
-                           Delegate* delegate);
+                           Delegate* delegate,
+                           SharedRingBuffer* hints_shmem);
 
  private:
   void HandleHandoffSocket(HandoffData data);
   void HandleDisconnectSocket(pid_t pid);
+  void HandleMigrateClient(pid_t pid, size_t target_worker);
 
   void HandleUnwindBatch(pid_t);
 
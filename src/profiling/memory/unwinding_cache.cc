@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/memory/unwinding_cache.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "perfetto/base/hash.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/string_utils.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr char kRegisterTag = 'r';
+constexpr char kStackTag = 's';
+
+// Maps whose contents can change without the maps being reparsed.
+const char* const kUncacheableMapPrefixes[] = {"/dev/", "/memfd:"};
+
+// Frames in these files are interpreted dex frames. They are found through
+// the interpreter state, which is not part of the fingerprint.
+const char* const kUncacheableMapSuffixes[] = {".apk", ".dex", ".jar",
+                                               ".vdex"};
+
+}  // namespace
+
+void UnwindingCache::Reset(unwindstack::Maps* maps) {
+  entries_.Clear();
+
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  for (size_t i = 0; i < maps->Total(); ++i) {
+    const unwindstack::MapInfo* map = maps->Get(i);
+    if (map->flags & PROT_EXEC)
+      ranges.emplace_back(map->start, map->end);
+  }
+  // /proc/pid/maps is already sorted.
+  if (!std::is_sorted(ranges.begin(), ranges.end()))
+    std::sort(ranges.begin(), ranges.end());
+
+  exec_ranges_.clear();
+  for (const auto& range : ranges) {
+    if (!exec_ranges_.empty() && exec_ranges_.back().second >= range.first) {
+      exec_ranges_.back().second =
+          std::max(exec_ranges_.back().second, range.second);
+    } else {
+      exec_ranges_.emplace_back(range);
+    }
+  }
+}
+
+bool UnwindingCache::IsExecutable(uint64_t addr) const {
+  // Most stack words are small integers or heap pointers, reject them before
+  // the binary search.
+  if (exec_ranges_.empty() || addr < exec_ranges_.front().first ||
+      addr >= exec_ranges_.back().second) {
+    return false;
+  }
+  auto it = std::upper_bound(
+      exec_ranges_.begin(), exec_ranges_.end(), addr,
+      [](uint64_t a, const std::pair<uint64_t, uint64_t>& range) {
+        return a < range.first;
+      });
+  PERFETTO_DCHECK(it != exec_ranges_.begin());
+  return addr < (--it)->second;
+}
+
+uint64_t UnwindingCache::Fingerprint(uint64_t pc,
+                                     uint64_t sp,
+                                     const uint64_t* regs,
+                                     size_t num_regs,
+                                     const uint8_t* stack,
+                                     size_t stack_size,
+                                     size_t word_size) const {
+  PERFETTO_DCHECK(word_size == 4 || word_size == 8);
+  base::Hash hash;
+  hash.Update(pc);
+  auto add_value = [this, &hash, sp, stack_size](char tag, uint64_t slot,
+                                                 uint64_t value) {
+    if (value - sp < stack_size) {
+      // Stack addresses only matter relative to sp.
+      hash.Update(tag);
+      hash.Update(slot);
+      hash.Update(kStackTag);
+      hash.Update(value - sp);
+    } else if (IsExecutable(value)) {
+      hash.Update(tag);
+      hash.Update(slot);
+      hash.Update(value);
+    }
+  };
+
+  for (size_t i = 0; i < num_regs; ++i)
+    add_value(kRegisterTag, i, regs[i]);
+
+  for (size_t offset = 0; offset + word_size <= stack_size;
+       offset += word_size) {
+    uint64_t value = 0;
+    if (word_size == 8) {
+      memcpy(&value, stack + offset, sizeof(uint64_t));
+    } else {
+      uint32_t value32;
+      memcpy(&value32, stack + offset, sizeof(uint32_t));
+      value = value32;
+    }
+    add_value(kStackTag, offset, value);
+  }
+  return hash.digest();
+}
+
+const std::vector<FrameData>* UnwindingCache::Find(uint64_t fingerprint) {
+  const std::vector<FrameData>* frames = entries_.Find(fingerprint);
+  if (frames)
+    stats_.hits++;
+  else
+    stats_.misses++;
+  return frames;
+}
+
+// static
+bool UnwindingCache::IsCacheable(const std::vector<FrameData>& frames) {
+  for (const FrameData& frame_data : frames) {
+    const std::string& map_name = frame_data.frame.map_name;
+    if (map_name.empty() || map_name[0] != '/')
+      return false;
+    for (const char* prefix : kUncacheableMapPrefixes) {
+      if (base::StartsWith(map_name, prefix))
+        return false;
+    }
+    for (const char* suffix : kUncacheableMapSuffixes) {
+      if (base::EndsWith(map_name, suffix))
+        return false;
+    }
+  }
+  return true;
+}
+
+void UnwindingCache::Insert(uint64_t fingerprint,
+                            std::vector<FrameData> frames) {
+  // Callsites are expected to be far fewer than this in the steady state, so
+  // there is no point in a more refined eviction policy.
+  if (entries_.size() >= kMaxEntries)
+    entries_.Clear();
+  entries_.Insert(fingerprint, std::move(frames));
+}
+
+}  // namespace profiling
+}  // namespace perfetto
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_MEMORY_UNWINDING_CACHE_H_
+#define SRC_PROFILING_MEMORY_UNWINDING_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include <unwindstack/Maps.h>
+
+#include "perfetto/base/flat_hash_map.h"
+#include "src/profiling/memory/unwound_messages.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Caches unwound callstacks of a process, so that the unwinder only runs once
+// per distinct callsite in the steady state.
+//
+// The key is a fingerprint of the values the unwinder depends on: the pc, and
+// every register and stack word that either points into an executable mapping
+// (return addresses) or into the stack itself (frame pointers, CFAs), together
+// with its position relative to sp. Other stack contents (locals, spilled
+// data) are ignored, which is what makes samples from the same callsite hit.
+//
+// The fingerprint depends on the executable mappings, so the cache needs to be
+// reset with the new maps whenever they are reparsed.
+class UnwindingCache {
+ public:
+  static constexpr size_t kMaxEntries = 16 * 1024;
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
+  UnwindingCache() = default;
+
+  // Drops all the cached callstacks, and recomputes the executable ranges from
+  // |maps|.
+  void Reset(unwindstack::Maps* maps);
+
+  // |regs| are the values of the general purpose registers. |stack| is the
+  // copy of |stack_size| bytes of the stack starting at |sp|, made of words of
+  // |word_size| bytes (4 or 8).
+  uint64_t Fingerprint(uint64_t pc,
+                       uint64_t sp,
+                       const uint64_t* regs,
+                       size_t num_regs,
+                       const uint8_t* stack,
+                       size_t stack_size,
+                       size_t word_size) const;
+
+  // Returns nullptr on a miss. Updates the stats.
+  const std::vector<FrameData>* Find(uint64_t fingerprint);
+
+  // Returns whether the result of an unwinding can be cached. Frames that
+  // depend on state that is not covered by the fingerprint or by map reparses
+  // (JIT code, interpreted dex frames) cannot.
+  static bool IsCacheable(const std::vector<FrameData>& frames);
+
+  void Insert(uint64_t fingerprint, std::vector<FrameData> frames);
+
+  size_t size() const { return entries_.size(); }
+  const Stats& stats() const { return stats_; }
+
+ private:
+  bool IsExecutable(uint64_t addr) const;
+
+  // Sorted, non-overlapping [start, end) ranges of the executable mappings.
+  std::vector<std::pair<uint64_t, uint64_t>> exec_ranges_;
+  base::FlatHashMap<uint64_t, std::vector<FrameData>> entries_;
+  Stats stats_;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_MEMORY_UNWINDING_CACHE_H_
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/memory/unwinding_cache.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr uint64_t kCodeStart = 0x1000;
+constexpr uint64_t kCodeEnd = 0x5000;
+constexpr uint64_t kOtherCodeStart = 0x8000;
+constexpr uint64_t kOtherCodeEnd = 0x9000;
+constexpr uint64_t kSp = 0x7fff0000;
+
+class FakeMaps : public unwindstack::Maps {
+ public:
+  explicit FakeMaps(bool map_other_code = true) {
+    AddMap(kCodeStart, kCodeEnd, PROT_READ | PROT_EXEC, "/system/lib64/a.so");
+    AddMap(kCodeEnd, 0x6000, PROT_READ | PROT_WRITE, "/system/lib64/a.so");
+    if (map_other_code) {
+      AddMap(kOtherCodeStart, kOtherCodeEnd, PROT_READ | PROT_EXEC,
+             "/system/lib64/b.so");
+    }
+  }
+
+  void AddMap(uint64_t start, uint64_t end, uint16_t flags, const char* name) {
+    maps_.emplace_back(
+        new unwindstack::MapInfo(nullptr, start, end, 0, flags, name));
+  }
+};
+
+struct FakeStack {
+  void Set(size_t idx, uint64_t value) {
+    memcpy(data + idx * sizeof(uint64_t), &value, sizeof(value));
+  }
+
+  uint8_t data[8 * sizeof(uint64_t)] = {};
+};
+
+uint64_t Fingerprint(const UnwindingCache& cache,
+                     const FakeStack& stack,
+                     uint64_t reg = 0) {
+  return cache.Fingerprint(kCodeStart + 0x10, kSp, &reg, 1, stack.data,
+                           sizeof(stack.data), sizeof(uint64_t));
+}
+
+std::vector<FrameData> MakeFrames(const char* map_name) {
+  unwindstack::FrameData frame{};
+  frame.map_name = map_name;
+  std::vector<FrameData> frames;
+  frames.emplace_back(frame, "");
+  return frames;
+}
+
+TEST(UnwindingCacheTest, IgnoresDataWords) {
+  FakeMaps maps;
+  UnwindingCache cache;
+  cache.Reset(&maps);
+
+  FakeStack stack;
+  stack.Set(1, kCodeStart + 0x200);
+  stack.Set(2, kSp + 0x30);
+  stack.Set(3, 1234);
+  FakeStack other_stack = stack;
+  other_stack.Set(3, 0x12345678);
+  other_stack.Set(4, 0xdeadbeef);
+
+  EXPECT_EQ(Fingerprint(cache, stack, 42), Fingerprint(cache, other_stack, 43));
+}
+
+TEST(UnwindingCacheTest, DependsOnCodePointers) {
+  FakeMaps maps;
+  UnwindingCache cache;
+  cache.Reset(&maps);
+
+  FakeStack stack;
+  stack.Set(1, kCodeStart + 0x200);
+  FakeStack other_value = stack;
+  other_value.Set(1, kOtherCodeStart + 0x200);
+  FakeStack other_slot;
+  other_slot.Set(2, kCodeStart + 0x200);
+
+  EXPECT_NE(Fingerprint(cache, stack), Fingerprint(cache, other_value));
+  EXPECT_NE(Fingerprint(cache, stack), Fingerprint(cache, other_slot));
+  EXPECT_NE(Fingerprint(cache, stack, 0),
+            Fingerprint(cache, stack, kOtherCodeStart));
+}
+
+TEST(UnwindingCacheTest, DependsOnStackPointers) {
+  FakeMaps maps;
+  UnwindingCache cache;
+  cache.Reset(&maps);
+
+  FakeStack stack;
+  stack.Set(0, kSp + 0x20);
+  FakeStack other_stack;
+  other_stack.Set(0, kSp + 0x30);
+
+  EXPECT_NE(Fingerprint(cache, stack), Fingerprint(cache, other_stack));
+  EXPECT_NE(Fingerprint(cache, stack, 0), Fingerprint(cache, stack, kSp));
+}
+
+TEST(UnwindingCacheTest, FourByteWords) {
+  FakeMaps maps;
+  UnwindingCache cache;
+  cache.Reset(&maps);
+
+  uint32_t stack[4] = {1, static_cast<uint32_t>(kCodeStart + 0x10), 2, 3};
+  uint32_t other_stack[4] = {4, static_cast<uint32_t>(kCodeStart + 0x10), 5,
+                             6};
+  uint32_t third_stack[4] = {1, 2, static_cast<uint32_t>(kCodeStart + 0x10),
+                             3};
+  auto fingerprint = [&cache](const uint32_t* data) {
+    return cache.Fingerprint(kCodeStart, kSp, nullptr, 0,
+                             reinterpret_cast<const uint8_t*>(data),
+                             4 * sizeof(uint32_t), sizeof(uint32_t));
+  };
+
+  EXPECT_EQ(fingerprint(stack), fingerprint(other_stack));
+  EXPECT_NE(fingerprint(stack), fingerprint(third_stack));
+}
+
+TEST(UnwindingCacheTest, FindInsert) {
+  FakeMaps maps;
+  UnwindingCache cache;
+  cache.Reset(&maps);
+
+  EXPECT_EQ(cache.Find(1), nullptr);
+  cache.Insert(1, MakeFrames("/system/lib64/a.so"));
+  const std::vector<FrameData>* frames = cache.Find(1);
+  ASSERT_NE(frames, nullptr);
+  ASSERT_EQ(frames->size(), 1u);
+  EXPECT_EQ((*frames)[0].frame.map_name, "/system/lib64/a.so");
+  EXPECT_EQ(cache.Find(2), nullptr);
+
+  EXPECT_EQ(cache.stats().hits, 1u);
+  EXPECT_EQ(cache.stats().misses, 2u);
+}
+
+TEST(UnwindingCacheTest, ResetDropsEntries) {
+  FakeMaps maps;
+  UnwindingCache cache;
+  cache.Reset(&maps);
+
+  FakeStack stack;
+  stack.Set(1, kOtherCodeStart + 0x10);
+  uint64_t fingerprint = Fingerprint(cache, stack);
+  cache.Insert(fingerprint, MakeFrames("/system/lib64/b.so"));
+  EXPECT_EQ(cache.size(), 1u);
+
+  // After b.so is unmapped, its address is not a code pointer anymore.
+  FakeMaps new_maps(/*map_other_code=*/false);
+  cache.Reset(&new_maps);
+  EXPECT_EQ(cache.size(), 0u);
+  EXPECT_EQ(cache.Find(fingerprint), nullptr);
+  EXPECT_NE(Fingerprint(cache, stack), fingerprint);
+}
+
+TEST(UnwindingCacheTest, IsCacheable) {
+  EXPECT_TRUE(UnwindingCache::IsCacheable(MakeFrames("/system/lib64/a.so")));
+  EXPECT_TRUE(UnwindingCache::IsCacheable({}));
+  EXPECT_FALSE(UnwindingCache::IsCacheable(MakeFrames("")));
+  EXPECT_FALSE(UnwindingCache::IsCacheable(MakeFrames("[anon:dalvik-jit]")));
+  EXPECT_FALSE(UnwindingCache::IsCacheable(MakeFrames("/memfd:jit-cache")));
+  EXPECT_FALSE(UnwindingCache::IsCacheable(MakeFrames("/dev/ashmem/foo")));
+  EXPECT_FALSE(
+      UnwindingCache::IsCacheable(MakeFrames("/system/framework/foo.jar")));
+  EXPECT_FALSE(UnwindingCache::IsCacheable(MakeFrames("/data/app/base.apk")));
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -33,6 +33,9 @@ class NopDelegate : public UnwindingWorker::Delegate {
   void PostSocketDisconnected(DataSourceInstanceID,
                               pid_t,
                               SharedRingBuffer::Stats) override {}
+  void PostClientMigrated(size_t,
+                          pid_t,
+                          UnwindingWorker::HandoffData) override {}
 };
 
 int FuzzUnwinding(const uint8_t* data, size_t size) {
@@ -45,7 +48,8 @@ int FuzzUnwinding(const uint8_t* data, size_t size) {
                              base::OpenFile("/proc/self/mem", O_RDONLY));
 
   NopDelegate nop_delegate;
-  UnwindingWorker::HandleBuffer(buf, &metadata, id, self_pid, &nop_delegate);
+  UnwindingWorker::HandleBuffer(buf, &metadata, id, self_pid, &nop_delegate,
+                                /*hints_shmem=*/nullptr);
   return 0;
 }
 
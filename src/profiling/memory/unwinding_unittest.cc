@@ -16,6 +16,8 @@
 
 #include "src/profiling/memory/unwinding.h"
 #include "perfetto/base/scoped_file.h"
+#include "perfetto/base/thread_utils.h"
+#include "src/base/test/test_task_runner.h"
 #include "src/profiling/memory/client.h"
 #include "src/profiling/memory/wire_protocol.h"
 
@@ -24,9 +26,12 @@
 
 #include <cxxabi.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <tuple>
+
 #include <unwindstack/RegsGetLocal.h>
 
 namespace perfetto {
@@ -59,6 +64,199 @@ TEST(UnwindingTest, StackOverlayMemoryNonOverlay) {
   ASSERT_EQ(buf[0], value);
 }
 
+TEST(UnwindingTest, FDMemoryProcessVmReadv) {
+  uint64_t value = 0x1234567890;
+
+  base::ScopedFile proc_mem(base::OpenFile("/proc/self/mem", O_RDONLY));
+  ASSERT_TRUE(proc_mem);
+  FDMemory memory(std::move(proc_mem), getpid());
+  uint64_t buf = 0;
+  ASSERT_EQ(memory.Read(reinterpret_cast<uint64_t>(&value), &buf, sizeof(buf)),
+            sizeof(buf));
+  ASSERT_EQ(buf, value);
+}
+
+// Serves reads from a buffer standing in for the memory at [kStart, kEnd).
+class CountingMemory : public unwindstack::Memory {
+ public:
+  static constexpr uint64_t kStart = 0x10000;
+  static constexpr size_t kPages = PageCachedMemory::kMaxPages + 8;
+  static constexpr uint64_t kEnd =
+      kStart + kPages * PageCachedMemory::kPageSize;
+
+  CountingMemory() : data_(kPages * PageCachedMemory::kPageSize) {
+    for (size_t i = 0; i < data_.size(); ++i)
+      data_[i] = static_cast<uint8_t>(i * 7);
+  }
+
+  size_t Read(uint64_t addr, void* dst, size_t size) override {
+    reads_++;
+    if (addr < kStart || addr >= kEnd)
+      return 0;
+    size_t len = static_cast<size_t>(std::min<uint64_t>(size, kEnd - addr));
+    memcpy(dst, &data_[static_cast<size_t>(addr - kStart)], len);
+    return len;
+  }
+
+  uint8_t At(uint64_t addr) const {
+    return data_[static_cast<size_t>(addr - kStart)];
+  }
+
+  size_t reads() const { return reads_; }
+  void Set(uint64_t addr, uint8_t value) {
+    data_[static_cast<size_t>(addr - kStart)] = value;
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+  size_t reads_ = 0;
+};
+
+// [kStart, kEnd) is read-only, except for the last page.
+class CountingMemoryMaps : public unwindstack::Maps {
+ public:
+  CountingMemoryMaps() {
+    uint64_t writable_start =
+        CountingMemory::kEnd - PageCachedMemory::kPageSize;
+    maps_.emplace_back(new unwindstack::MapInfo(
+        nullptr, CountingMemory::kStart, writable_start, 0, PROT_READ,
+        "/system/lib64/libfoo.so"));
+    maps_.emplace_back(new unwindstack::MapInfo(
+        nullptr, writable_start, CountingMemory::kEnd, 0,
+        PROT_READ | PROT_WRITE, "/system/lib64/libfoo.so"));
+  }
+};
+
+TEST(UnwindingTest, PageCachedMemoryCachesReadOnlyPages) {
+  auto mem = std::make_shared<CountingMemory>();
+  CountingMemoryMaps maps;
+  PageCachedMemory cached(mem);
+  cached.Reset(&maps);
+
+  uint64_t addr = CountingMemory::kStart + 10;
+  uint8_t buf[16];
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_EQ(cached.Read(addr + static_cast<uint64_t>(i), buf, sizeof(buf)),
+              sizeof(buf));
+    EXPECT_EQ(buf[0], mem->At(addr + static_cast<uint64_t>(i)));
+  }
+  EXPECT_EQ(mem->reads(), 1u);
+  EXPECT_EQ(cached.stats().page_hits, 9u);
+}
+
+TEST(UnwindingTest, PageCachedMemoryReadsRunsOfPagesAtOnce) {
+  auto mem = std::make_shared<CountingMemory>();
+  CountingMemoryMaps maps;
+  PageCachedMemory cached(mem);
+  cached.Reset(&maps);
+
+  uint64_t addr = CountingMemory::kStart + 100;
+  std::vector<uint8_t> buf(3 * PageCachedMemory::kPageSize);
+  ASSERT_EQ(cached.Read(addr, buf.data(), buf.size()), buf.size());
+  for (size_t i = 0; i < buf.size(); ++i)
+    ASSERT_EQ(buf[i], mem->At(addr + i));
+  EXPECT_EQ(mem->reads(), 1u);
+
+  ASSERT_EQ(cached.Read(addr, buf.data(), buf.size()), buf.size());
+  EXPECT_EQ(mem->reads(), 1u);
+}
+
+TEST(UnwindingTest, PageCachedMemoryDoesNotCacheWritablePages) {
+  auto mem = std::make_shared<CountingMemory>();
+  CountingMemoryMaps maps;
+  PageCachedMemory cached(mem);
+  cached.Reset(&maps);
+
+  uint64_t addr = CountingMemory::kEnd - 8;
+  uint8_t value = 0;
+  ASSERT_EQ(cached.Read(addr, &value, 1), 1u);
+  mem->Set(addr, 42);
+  ASSERT_EQ(cached.Read(addr, &value, 1), 1u);
+  EXPECT_EQ(value, 42);
+  EXPECT_EQ(mem->reads(), 2u);
+}
+
+TEST(UnwindingTest, PageCachedMemoryReset) {
+  auto mem = std::make_shared<CountingMemory>();
+  CountingMemoryMaps maps;
+  PageCachedMemory cached(mem);
+  cached.Reset(&maps);
+
+  uint64_t addr = CountingMemory::kStart;
+  uint8_t value = 0;
+  ASSERT_EQ(cached.Read(addr, &value, 1), 1u);
+  mem->Set(addr, 42);
+  cached.Reset(&maps);
+  ASSERT_EQ(cached.Read(addr, &value, 1), 1u);
+  EXPECT_EQ(value, 42);
+  EXPECT_EQ(mem->reads(), 2u);
+}
+
+TEST(UnwindingTest, PageCachedMemoryDropPages) {
+  auto mem = std::make_shared<CountingMemory>();
+  CountingMemoryMaps maps;
+  PageCachedMemory cached(mem);
+  cached.Reset(&maps);
+
+  uint64_t addr = CountingMemory::kStart;
+  uint8_t value = 0;
+  ASSERT_EQ(cached.Read(addr, &value, 1), 1u);
+  mem->Set(addr, 42);
+  cached.DropPages();
+  ASSERT_EQ(cached.Read(addr, &value, 1), 1u);
+  EXPECT_EQ(value, 42);
+  ASSERT_EQ(cached.Read(addr, &value, 1), 1u);
+  EXPECT_EQ(mem->reads(), 2u);
+}
+
+TEST(UnwindingTest, PageCachedMemoryEvictsLeastRecentlyUsed) {
+  auto mem = std::make_shared<CountingMemory>();
+  CountingMemoryMaps maps;
+  PageCachedMemory cached(mem);
+  cached.Reset(&maps);
+
+  auto page = [](size_t i) {
+    return CountingMemory::kStart + i * PageCachedMemory::kPageSize;
+  };
+  uint8_t value;
+  for (size_t i = 0; i < PageCachedMemory::kMaxPages; ++i)
+    ASSERT_EQ(cached.Read(page(i), &value, 1), 1u);
+  EXPECT_EQ(mem->reads(), PageCachedMemory::kMaxPages);
+
+  // Make page 0 the most recently used, so page 1 gets evicted.
+  ASSERT_EQ(cached.Read(page(0), &value, 1), 1u);
+  ASSERT_EQ(cached.Read(page(PageCachedMemory::kMaxPages), &value, 1), 1u);
+  EXPECT_EQ(mem->reads(), PageCachedMemory::kMaxPages + 1);
+
+  ASSERT_EQ(cached.Read(page(0), &value, 1), 1u);
+  EXPECT_EQ(mem->reads(), PageCachedMemory::kMaxPages + 1);
+  ASSERT_EQ(cached.Read(page(1), &value, 1), 1u);
+  EXPECT_EQ(mem->reads(), PageCachedMemory::kMaxPages + 2);
+}
+
+TEST(UnwindingTest, StackOverlayMemoryTruncated) {
+  auto mem = std::make_shared<CountingMemory>();
+  uint8_t fake_stack[16] = {};
+  fake_stack[15] = 120;
+  StackOverlayMemory memory(mem, CountingMemory::kStart, fake_stack,
+                            sizeof(fake_stack), 64);
+  uint64_t buf;
+  ASSERT_EQ(memory.Read(CountingMemory::kStart + 8, &buf, sizeof(buf)), 8u);
+  EXPECT_EQ(memory.max_read_end(), 16u);
+  EXPECT_FALSE(memory.truncated());
+
+  // Reads of the part of the stack that was not sent fail, rather than
+  // reading the current contents of the stack of the process.
+  EXPECT_EQ(memory.Read(CountingMemory::kStart + 12, &buf, sizeof(buf)), 0u);
+  EXPECT_EQ(memory.Read(CountingMemory::kStart + 32, &buf, sizeof(buf)), 0u);
+  EXPECT_TRUE(memory.truncated());
+  EXPECT_EQ(mem->reads(), 0u);
+
+  ASSERT_EQ(memory.Read(CountingMemory::kStart + 64, &buf, sizeof(buf)), 8u);
+  EXPECT_EQ(mem->reads(), 1u);
+  EXPECT_EQ(memory.max_read_end(), 16u);
+}
+
 TEST(UnwindingTest, FileDescriptorMapsParse) {
   base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
   ASSERT_TRUE(proc_maps);
@@ -104,6 +302,8 @@ RecordMemory __attribute__((noinline)) GetRecord(WireMessage* msg) {
   metadata->alloc_address = 0x10;
   metadata->stack_pointer = reinterpret_cast<uint64_t>(stacktop);
   metadata->stack_pointer_offset = sizeof(AllocMetadata);
+  metadata->stack_size = stack_size;
+  metadata->tid = static_cast<uint32_t>(base::GetThreadId());
   metadata->arch = unwindstack::Regs::CurrentArch();
   metadata->sequence_number = 1;
 
@@ -143,6 +343,142 @@ TEST(UnwindingTest, MAYBE_DoUnwind) {
                "namespace)::GetRecord(perfetto::profiling::WireMessage*)");
 }
 
+TEST(UnwindingTest, MAYBE_DoUnwindLearnsStackCopyLimit) {
+  base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
+  base::ScopedFile proc_mem(base::OpenFile("/proc/self/mem", O_RDONLY));
+  UnwindingMetadata metadata(getpid(), std::move(proc_maps),
+                             std::move(proc_mem));
+  WireMessage msg;
+  auto record = GetRecord(&msg);
+  uint32_t tid = record.metadata->tid;
+  AllocRecord out;
+  ASSERT_TRUE(DoUnwind(&msg, &metadata, &out));
+  ASSERT_FALSE(out.error);
+  uint32_t* limit = metadata.stack_copy_limits.Find(tid);
+  ASSERT_NE(limit, nullptr);
+  uint32_t full_limit = *limit;
+  EXPECT_GE(full_limit, 8u * 1024u);
+
+  // Pretend the client only sent the first 64 bytes of its stack.
+  msg.payload_size = 64;
+  AllocRecord truncated_out;
+  ASSERT_TRUE(DoUnwind(&msg, &metadata, &truncated_out));
+  EXPECT_TRUE(truncated_out.error);
+  EXPECT_EQ(truncated_out.frames.back().frame.function_name,
+            "ERROR TRUNCATED STACK");
+  limit = metadata.stack_copy_limits.Find(tid);
+  ASSERT_NE(limit, nullptr);
+  EXPECT_EQ(*limit, 8u * 1024u);
+}
+
+class MigrationDelegate : public UnwindingWorker::Delegate {
+ public:
+  MigrationDelegate(base::TestTaskRunner* task_runner,
+                    std::function<void()> on_migrated)
+      : task_runner_(task_runner), on_migrated_(std::move(on_migrated)) {}
+
+  void PostAllocRecord(AllocRecord) override {}
+  void PostFreeRecord(FreeRecord) override {}
+  void PostSocketDisconnected(DataSourceInstanceID,
+                              pid_t,
+                              SharedRingBuffer::Stats) override {}
+  void PostClientMigrated(size_t target_worker,
+                          pid_t pid,
+                          UnwindingWorker::HandoffData handoff_data) override {
+    target_worker_ = target_worker;
+    pid_ = pid;
+    handoff_data_ = std::move(handoff_data);
+    task_runner_->PostTask(on_migrated_);
+  }
+
+  size_t target_worker_ = 0;
+  pid_t pid_ = 0;
+  UnwindingWorker::HandoffData handoff_data_;
+
+ private:
+  base::TestTaskRunner* task_runner_;
+  std::function<void()> on_migrated_;
+};
+
+TEST(UnwindingWorkerTest, MigrateClient) {
+  base::TestTaskRunner task_runner;
+  MigrationDelegate delegate(&task_runner,
+                             task_runner.CreateCheckpoint("migrated"));
+  UnwindingWorker worker(&delegate, base::ThreadTaskRunner::CreateAndStart());
+
+  base::UnixSocketRaw client_sock;
+  base::UnixSocketRaw worker_sock;
+  std::tie(client_sock, worker_sock) =
+      base::UnixSocketRaw::CreatePair(base::SockType::kStream);
+  auto shmem = SharedRingBuffer::Create(8 * 4096);
+  ASSERT_TRUE(shmem);
+
+  UnwindingWorker::HandoffData handoff_data;
+  handoff_data.data_source_instance_id = 1;
+  handoff_data.sock = std::move(worker_sock);
+  handoff_data.fds[kHandshakeMaps] =
+      base::OpenFile("/proc/self/maps", O_RDONLY);
+  handoff_data.fds[kHandshakeMem] = base::OpenFile("/proc/self/mem", O_RDONLY);
+  handoff_data.shmem = std::move(*shmem);
+  worker.PostHandoffSocket(std::move(handoff_data));
+  worker.PostMigrateClient(getpid(), 3);
+  task_runner.RunUntilCheckpoint("migrated");
+
+  EXPECT_EQ(delegate.target_worker_, 3u);
+  EXPECT_EQ(delegate.pid_, getpid());
+  EXPECT_EQ(delegate.handoff_data_.data_source_instance_id, 1u);
+  EXPECT_TRUE(delegate.handoff_data_.sock);
+  EXPECT_TRUE(delegate.handoff_data_.shmem.is_valid());
+  ASSERT_NE(delegate.handoff_data_.metadata, nullptr);
+  EXPECT_EQ(delegate.handoff_data_.metadata->pid, getpid());
+}
+
+class RecordingDelegate : public UnwindingWorker::Delegate {
+ public:
+  void PostAllocRecord(AllocRecord rec) override {
+    alloc_records_.emplace_back(std::move(rec));
+  }
+  void PostFreeRecord(FreeRecord) override {}
+  void PostSocketDisconnected(DataSourceInstanceID,
+                              pid_t,
+                              SharedRingBuffer::Stats) override {}
+  void PostClientMigrated(size_t,
+                          pid_t,
+                          UnwindingWorker::HandoffData) override {}
+
+  std::vector<AllocRecord> alloc_records_;
+};
+
+TEST(UnwindingWorkerTest, MAYBE_HandleBufferPublishesStackCopyLimit) {
+  base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
+  base::ScopedFile proc_mem(base::OpenFile("/proc/self/mem", O_RDONLY));
+  UnwindingMetadata metadata(getpid(), std::move(proc_maps),
+                             std::move(proc_mem));
+  base::Optional<SharedRingBuffer> shmem =
+      SharedRingBuffer::Create(8 * 1024 * 1024);
+  ASSERT_TRUE(shmem);
+
+  WireMessage msg;
+  auto record = GetRecord(&msg);
+  uint32_t tid = record.metadata->tid;
+  msg.record_type = RecordType::Malloc;
+  ASSERT_TRUE(SendWireMessage(&*shmem, msg));
+  EXPECT_EQ(shmem->GetReaderHint(tid), 0u);
+
+  RecordingDelegate delegate;
+  SharedRingBuffer::Buffer buf = shmem->BeginRead();
+  ASSERT_TRUE(buf);
+  UnwindingWorker::HandleBuffer(buf, &metadata, 1, getpid(), &delegate,
+                                &*shmem);
+  shmem->EndRead(std::move(buf));
+
+  ASSERT_EQ(delegate.alloc_records_.size(), 1u);
+  EXPECT_FALSE(delegate.alloc_records_[0].error);
+  uint32_t* limit = metadata.stack_copy_limits.Find(tid);
+  ASSERT_NE(limit, nullptr);
+  EXPECT_EQ(shmem->GetReaderHint(tid), *limit);
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
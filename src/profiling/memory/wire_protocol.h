@@ -45,6 +45,9 @@ struct ClientConfiguration {
   // Must be >= 1.
   uint64_t interval;
   bool block_client;
+  // Cap the number of stack bytes sent per sample to the reader hint that
+  // heapprofd publishes in the shared memory for the sampled thread.
+  bool adaptive_stack_copy;
 };
 
 // Types needed for the wire format used for communication between the client
@@ -98,6 +101,12 @@ struct AllocMetadata {
   // Offset of the data at stack_pointer from the start of this record.
   uint64_t stack_pointer_offset;
   uint64_t clock_monotonic_coarse_timestamp;
+  // Size of the stack of the thread, from stack_pointer to its base. The raw
+  // stack that follows the record can be shorter than this, if the client
+  // capped it.
+  uint64_t stack_size;
+  // Thread that made the allocation.
+  uint32_t tid;
   alignas(uint64_t) char register_data[kMaxRegisterDataSize];
   // CPU architecture of the client. This determines the size of the
   // register data that follows this struct.
@@ -98,12 +98,13 @@ TEST(WireProtocolTest, AllocMessage) {
   WireMessage recv_msg;
   ASSERT_TRUE(ReceiveWireMessage(reinterpret_cast<char*>(buf.data), buf.size,
                                  &recv_msg));
-  shmem_server->EndRead(std::move(buf));
 
+  // |recv_msg| points into the buffer, which is only valid until EndRead.
   ASSERT_EQ(recv_msg.record_type, msg.record_type);
   ASSERT_EQ(*recv_msg.alloc_header, *msg.alloc_header);
   ASSERT_EQ(recv_msg.payload_size, msg.payload_size);
   ASSERT_STREQ(recv_msg.payload, msg.payload);
+  shmem_server->EndRead(std::move(buf));
 }
 
 TEST(WireProtocolTest, FreeMessage) {
@@ -129,11 +130,11 @@ TEST(WireProtocolTest, FreeMessage) {
   WireMessage recv_msg;
   ASSERT_TRUE(ReceiveWireMessage(reinterpret_cast<char*>(buf.data), buf.size,
                                  &recv_msg));
-  shmem_server->EndRead(std::move(buf));
 
   ASSERT_EQ(recv_msg.record_type, msg.record_type);
   ASSERT_EQ(*recv_msg.free_header, *msg.free_header);
   ASSERT_EQ(recv_msg.payload_size, msg.payload_size);
+  shmem_server->EndRead(std::move(buf));
 }
 
 }  // namespace
@@ -31,6 +31,7 @@ namespace protozero {
 
 // static
 constexpr uint32_t Message::kMaxNestingDepth;
+constexpr size_t Message::kPackedBatchSize;
 
 // Do NOT put any code in the constructor or use default initialization.
 // Use the Reset() method below instead. See the header for the reason why.
@@ -208,6 +208,36 @@ TEST_F(MessageTest, NestedMessagesSimple) {
   ASSERT_EQ("2803", GetNextSerializedBytes(2));
 }
 
+TEST_F(MessageTest, ReservedWrite) {
+  Message* msg = NewMessage();
+  msg->AppendVarInt(1 /* field_id */, 1);
+
+  // 14 bytes are left in the first chunk.
+  ReservedFieldWriter writer = msg->BeginReservedWrite(14);
+  ASSERT_TRUE(writer);
+  writer.AppendVarInt(2 /* field_id */, 300);
+  writer.AppendSignedVarInt(3 /* field_id */, -21);
+  writer.AppendFixed(4 /* field_id */, 3.1415f /* float */);
+  writer.AppendBytes(5 /* field_id */, "ab", 2);
+  EXPECT_EQ(14u, writer.size());
+  msg->EndReservedWrite(writer);
+
+  // The next reservation would straddle two chunks.
+  msg->AppendVarInt(6 /* field_id */, 6);
+  EXPECT_FALSE(msg->BeginReservedWrite(kChunkSize - 1));
+  msg->AppendVarInt(7 /* field_id */, 7);
+
+  EXPECT_EQ(20u, msg->Finalize());
+  EXPECT_EQ(20u, GetNumSerializedBytes());
+  ASSERT_EQ("0801", GetNextSerializedBytes(2));
+  ASSERT_EQ("10AC02", GetNextSerializedBytes(3));
+  ASSERT_EQ("1829", GetNextSerializedBytes(2));
+  ASSERT_EQ("25560E4940", GetNextSerializedBytes(5));
+  ASSERT_EQ("2A026162", GetNextSerializedBytes(4));
+  ASSERT_EQ("3006", GetNextSerializedBytes(2));
+  ASSERT_EQ("3807", GetNextSerializedBytes(2));
+}
+
 // Tests using a AppendScatteredBytes to append raw bytes to
 // a message using multiple individual buffers.
 TEST_F(MessageTest, AppendScatteredBytes) {
@@ -0,0 +1,121 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/protozero/message.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/protozero/scattered_stream_null_delegate.h"
+#include "perfetto/protozero/scattered_stream_writer.h"
+
+namespace {
+
+using protozero::proto_utils::ProtoWireType;
+
+constexpr uint32_t kFieldId = 1;
+constexpr size_t kNumIds = 1000;
+
+// Interned ids, e.g. the frame ids of a callstack, are small but not tiny.
+std::vector<uint64_t> MakeIds() {
+  std::minstd_rand rnd(0);
+  std::uniform_int_distribution<uint64_t> dist(0, 1 << 18);
+  std::vector<uint64_t> ids(kNumIds);
+  for (uint64_t& id : ids)
+    id = dist(rnd);
+  return ids;
+}
+
+void AppendIds(protozero::Message* msg,
+               const std::vector<uint64_t>& ids,
+               bool packed) {
+  if (packed) {
+    msg->AppendPackedVarInts(kFieldId, ids.data(), ids.size());
+    return;
+  }
+  for (uint64_t id : ids)
+    msg->AppendVarInt(kFieldId, id);
+}
+
+std::vector<uint8_t> Serialize(const std::vector<uint64_t>& ids, bool packed) {
+  protozero::HeapBuffered<protozero::Message> msg;
+  AppendIds(msg.get(), ids, packed);
+  msg->Finalize();
+  return msg.SerializeAsArray();
+}
+
+void BenchmarkWrite(benchmark::State& state, bool packed) {
+  const std::vector<uint64_t> ids = MakeIds();
+  protozero::ScatteredStreamWriterNullDelegate delegate(4096);
+  protozero::ScatteredStreamWriter writer(&delegate);
+  protozero::Message msg;
+  for (auto _ : state) {
+    msg.Reset(&writer);
+    AppendIds(&msg, ids, packed);
+    benchmark::DoNotOptimize(msg.Finalize());
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kNumIds));
+  state.counters["bytes_per_element"] =
+      static_cast<double>(Serialize(ids, packed).size()) / kNumIds;
+}
+
+void BM_ProtozeroWriteRepeatedVarInts(benchmark::State& state) {
+  BenchmarkWrite(state, /*packed=*/false);
+}
+BENCHMARK(BM_ProtozeroWriteRepeatedVarInts);
+
+void BM_ProtozeroWritePackedVarInts(benchmark::State& state) {
+  BenchmarkWrite(state, /*packed=*/true);
+}
+BENCHMARK(BM_ProtozeroWritePackedVarInts);
+
+void BM_ProtozeroDecodeRepeatedVarInts(benchmark::State& state) {
+  const std::vector<uint8_t> buf = Serialize(MakeIds(), /*packed=*/false);
+  for (auto _ : state) {
+    // 1000 values don't fit in the on-stack storage, so this also measures
+    // the expansion to the heap.
+    protozero::TypedProtoDecoder<kFieldId, true> decoder(buf.data(),
+                                                         buf.size());
+    uint64_t sum = 0;
+    for (auto it = decoder.GetRepeated(kFieldId); it; ++it)
+      sum += it->as_uint64();
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kNumIds));
+}
+BENCHMARK(BM_ProtozeroDecodeRepeatedVarInts);
+
+void BM_ProtozeroDecodePackedVarInts(benchmark::State& state) {
+  const std::vector<uint8_t> buf = Serialize(MakeIds(), /*packed=*/true);
+  for (auto _ : state) {
+    protozero::TypedProtoDecoder<kFieldId, true> decoder(buf.data(),
+                                                         buf.size());
+    bool parse_error = false;
+    uint64_t sum = 0;
+    for (auto it = decoder.GetPackedRepeated<ProtoWireType::kVarInt, uint64_t>(
+             kFieldId, &parse_error);
+         it; ++it) {
+      sum += *it;
+    }
+    benchmark::DoNotOptimize(sum);
+    benchmark::DoNotOptimize(parse_error);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kNumIds));
+}
+BENCHMARK(BM_ProtozeroDecodePackedVarInts);
+
+}  // namespace
@@ -216,4 +216,27 @@ void TypedProtoDecoderBase::ExpandHeapStorage() {
   capacity_ = new_capacity;
 }
 
+Field LazyProtoDecoderBase::Get(uint32_t id) {
+  if (PERFETTO_UNLIKELY(id >= num_fields_))
+    return Field{};
+  if (IsFound(id))
+    return fields_[id];
+
+  for (;;) {
+    ParseFieldResult res = ParseOneField(scan_ptr_, end_);
+    if (res.next == scan_ptr_)
+      return Field{};
+    PERFETTO_DCHECK(res.field.valid());
+    scan_ptr_ = res.next;
+
+    uint32_t field_id = res.field.id();
+    if (PERFETTO_UNLIKELY(field_id >= num_fields_) || IsFound(field_id))
+      continue;
+    fields_[field_id] = res.field;
+    found_bitmap_[field_id / 64] |= uint64_t(1) << (field_id % 64);
+    if (field_id == id)
+      return res.field;
+  }
+}
+
 }  // namespace protozero
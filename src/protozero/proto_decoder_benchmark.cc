@@ -0,0 +1,169 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+
+#include "perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "perfetto/trace/ftrace/sched.pbzero.h"
+
+namespace {
+
+using perfetto::protos::pbzero::FtraceEvent;
+using perfetto::protos::pbzero::FtraceEventBundle;
+using perfetto::protos::pbzero::SchedSwitchFtraceEvent;
+using protozero::proto_utils::ProtoWireType;
+
+// Roughly what traced_probes emits for a 4 KB ftrace page of sched_switch.
+constexpr uint32_t kNumEvents = 64;
+
+std::vector<uint8_t> MakeSchedSwitchBundle() {
+  static const char* const kComms[] = {"swapper/0", "surfaceflinger",
+                                       "RenderThread", "kworker/u16:3"};
+  protozero::HeapBuffered<FtraceEventBundle> bundle;
+  bundle->set_cpu(0);
+  uint64_t timestamp = 608934535133;
+  for (uint32_t i = 0; i < kNumEvents; i++) {
+    const int32_t prev_pid = static_cast<int32_t>(i % 4 == 0 ? 0 : 1000 + i);
+    const int32_t next_pid =
+        static_cast<int32_t>((i + 1) % 4 == 0 ? 0 : 1001 + i);
+    timestamp += 20000 + (i * 7919) % 30000;
+    FtraceEvent* event = bundle->add_event();
+    event->set_timestamp(timestamp);
+    event->set_pid(static_cast<uint32_t>(prev_pid));
+    SchedSwitchFtraceEvent* sched_switch = event->set_sched_switch();
+    sched_switch->set_prev_comm(kComms[i % 4]);
+    sched_switch->set_prev_pid(prev_pid);
+    sched_switch->set_prev_prio(120);
+    sched_switch->set_prev_state(i % 3 == 0 ? 0 : 1);
+    sched_switch->set_next_comm(kComms[(i + 1) % 4]);
+    sched_switch->set_next_pid(next_pid);
+    sched_switch->set_next_prio(120);
+  }
+  bundle->Finalize();
+  return bundle.SerializeAsArray();
+}
+
+// Appends to |out| all the varints (tags, lengths and values) of the fields of
+// the message in [data, data + size), and of the messages nested in it up to
+// |depth| levels, in the order the decoders meet them.
+void CollectVarInts(const uint8_t* data,
+                    size_t size,
+                    int depth,
+                    std::vector<uint8_t>* out) {
+  using protozero::proto_utils::WriteVarInt;
+  uint8_t buf[protozero::proto_utils::kMaxVarIntEncodedSize];
+  auto append = [out, &buf](uint64_t value) {
+    out->insert(out->end(), buf, WriteVarInt(value, buf));
+  };
+  protozero::ProtoDecoder decoder(data, size);
+  for (auto field = decoder.ReadField(); field.valid();
+       field = decoder.ReadField()) {
+    append(static_cast<uint32_t>(field.id()) << 3 |
+           static_cast<uint32_t>(field.type()));
+    if (field.type() == ProtoWireType::kVarInt) {
+      append(field.as_uint64());
+    } else if (field.type() == ProtoWireType::kLengthDelimited) {
+      append(field.size());
+      if (depth > 0)
+        CollectVarInts(field.data(), field.size(), depth - 1, out);
+    }
+  }
+}
+
+// Decodes one event the way trace_processor does. Shared by the eager and lazy
+// bundle benchmarks so that they differ only in how the bundle is decoded.
+inline uint64_t DecodeSchedSwitchEvent(const protozero::Field& field) {
+  FtraceEvent::Decoder event(field.data(), field.size());
+  protozero::ConstBytes payload = event.sched_switch();
+  SchedSwitchFtraceEvent::Decoder sched_switch(payload.data, payload.size);
+  return event.timestamp() + static_cast<uint64_t>(sched_switch.prev_pid()) +
+         static_cast<uint64_t>(sched_switch.next_pid());
+}
+
+void BM_ProtozeroDecodeBundleFullOfSchedSwitch(benchmark::State& state) {
+  const std::vector<uint8_t> bundle = MakeSchedSwitchBundle();
+  for (auto _ : state) {
+    FtraceEventBundle::Decoder decoder(bundle.data(), bundle.size());
+    uint64_t sum = 0;
+    for (auto it = decoder.event(); it; ++it)
+      sum += DecodeSchedSwitchEvent(*it);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * kNumEvents));
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(bundle.size()));
+}
+BENCHMARK(BM_ProtozeroDecodeBundleFullOfSchedSwitch);
+
+// Same as above, but the events are streamed by LazyProtoDecoder instead of
+// being stored up front.
+void BM_ProtozeroLazyDecodeBundleFullOfSchedSwitch(benchmark::State& state) {
+  const std::vector<uint8_t> bundle = MakeSchedSwitchBundle();
+  for (auto _ : state) {
+    protozero::LazyProtoDecoder<FtraceEventBundle::kEventFieldNumber> decoder(
+        bundle.data(), bundle.size());
+    uint64_t sum = 0;
+    for (auto it = decoder.GetRepeated(FtraceEventBundle::kEventFieldNumber);
+         it; ++it) {
+      sum += DecodeSchedSwitchEvent(*it);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * kNumEvents));
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(bundle.size()));
+}
+BENCHMARK(BM_ProtozeroLazyDecodeBundleFullOfSchedSwitch);
+
+// Compares the varint decoders on the varints of the bundle above (the events
+// and their payloads are nested two levels deep).
+template <const uint8_t* (*ParseVarIntFn)(const uint8_t*,
+                                          const uint8_t*,
+                                          uint64_t*)>
+void BM_ProtozeroParseVarIntsOfSchedSwitchBundle(benchmark::State& state) {
+  const std::vector<uint8_t> bundle = MakeSchedSwitchBundle();
+  std::vector<uint8_t> varints;
+  CollectVarInts(bundle.data(), bundle.size(), 2, &varints);
+  const uint8_t* const end = varints.data() + varints.size();
+  int64_t num_varints = 0;
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (const uint8_t* pos = varints.data(); pos < end; num_varints++) {
+      uint64_t value;
+      pos = ParseVarIntFn(pos, end, &value);
+      sum += value;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(num_varints);
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(varints.size()));
+}
+BENCHMARK_TEMPLATE(BM_ProtozeroParseVarIntsOfSchedSwitchBundle,
+                   protozero::proto_utils::ParseVarIntSlow);
+BENCHMARK_TEMPLATE(BM_ProtozeroParseVarIntsOfSchedSwitchBundle,
+                   protozero::proto_utils::ParseVarInt);
+
+}  // namespace
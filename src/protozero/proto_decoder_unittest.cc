@@ -225,6 +225,135 @@ TEST(ProtoDecoderTest, FixedData) {
   EXPECT_DOUBLE_EQ(decoder.Get(2).as_double(), -1000.25);
 }
 
+TEST(ProtoDecoderTest, PackedRepeatedVarInts) {
+  HeapBuffered<Message> message;
+  std::vector<uint64_t> values;
+  for (uint64_t i = 0; i < 2000; i++)
+    values.push_back(i * i * i * i * i);
+  message->AppendPackedVarInts(/*field_id=*/1, values.data(), values.size());
+  message->AppendVarInt(/*field_id=*/2, 42);
+  message->Finalize();
+  std::vector<uint8_t> proto = message.SerializeAsArray();
+
+  TypedProtoDecoder<2, true> tpd(proto.data(), proto.size());
+  bool parse_error = false;
+  std::vector<uint64_t> decoded;
+  for (auto it = tpd.GetPackedRepeated<ProtoWireType::kVarInt, uint64_t>(
+           /*field_id=*/1, &parse_error);
+       it; ++it) {
+    decoded.push_back(*it);
+  }
+  EXPECT_FALSE(parse_error);
+  EXPECT_EQ(decoded, values);
+  EXPECT_EQ(tpd.Get(2).as_int32(), 42);
+}
+
+TEST(ProtoDecoderTest, PackedRepeatedFixed) {
+  HeapBuffered<Message> message;
+  const float values[] = {1.25f, -1000.25f, 0};
+  message->AppendPackedFixed(/*field_id=*/1, values, 3);
+  message->Finalize();
+  std::vector<uint8_t> proto = message.SerializeAsArray();
+
+  TypedProtoDecoder<1, true> tpd(proto.data(), proto.size());
+  bool parse_error = false;
+  auto it = tpd.GetPackedRepeated<ProtoWireType::kFixed32, float>(
+      /*field_id=*/1, &parse_error);
+  for (float value : values) {
+    ASSERT_TRUE(it);
+    EXPECT_FLOAT_EQ(*it, value);
+    ++it;
+  }
+  EXPECT_FALSE(it);
+  EXPECT_FALSE(parse_error);
+}
+
+TEST(ProtoDecoderTest, PackedRepeatedFieldErrors) {
+  // A truncated varint after the first value.
+  const uint8_t truncated_varint[] = {0x0a, 0x02, 0x01, 0x80};
+  TypedProtoDecoder<1, true> varint_decoder(truncated_varint,
+                                            sizeof(truncated_varint));
+  bool parse_error = false;
+  auto varint_it =
+      varint_decoder.GetPackedRepeated<ProtoWireType::kVarInt, int32_t>(
+          /*field_id=*/1, &parse_error);
+  ASSERT_TRUE(varint_it);
+  EXPECT_EQ(*varint_it, 1);
+  EXPECT_FALSE(parse_error);
+  EXPECT_FALSE(++varint_it);
+  EXPECT_TRUE(parse_error);
+
+  // A payload that is not a multiple of the size of the values.
+  const uint8_t truncated_fixed[] = {0x0a, 0x05, 0x01, 0x00, 0x00, 0x00, 0x02};
+  TypedProtoDecoder<1, true> fixed_decoder(truncated_fixed,
+                                           sizeof(truncated_fixed));
+  parse_error = false;
+  auto fixed_it =
+      fixed_decoder.GetPackedRepeated<ProtoWireType::kFixed32, uint32_t>(
+          /*field_id=*/1, &parse_error);
+  ASSERT_TRUE(fixed_it);
+  EXPECT_EQ(*fixed_it, 1u);
+  EXPECT_FALSE(++fixed_it);
+  EXPECT_TRUE(parse_error);
+
+  // A fixed32 occurrence of a packed varint field.
+  const uint8_t wrong_type[] = {0x0a, 0x01, 0x01, 0x0d, 0x02, 0x00, 0x00, 0x00,
+                                0x08, 0x03};
+  TypedProtoDecoder<1, true> wrong_type_decoder(wrong_type, sizeof(wrong_type));
+  parse_error = false;
+  auto wrong_type_it =
+      wrong_type_decoder.GetPackedRepeated<ProtoWireType::kVarInt, int32_t>(
+          /*field_id=*/1, &parse_error);
+  ASSERT_TRUE(wrong_type_it);
+  EXPECT_EQ(*wrong_type_it, 1);
+  EXPECT_FALSE(++wrong_type_it);
+  EXPECT_TRUE(parse_error);
+}
+
+// Parsers must accept both encodings for packed fields, and concatenate all
+// the occurrences of the field.
+TEST(ProtoDecoderTest, PackedRepeatedMixedEncodings) {
+  HeapBuffered<Message> message;
+  const uint64_t run1[] = {1, 2, 300};
+  const uint64_t run2[] = {5};
+  message->AppendPackedVarInts(/*field_id=*/1, run1, 3);
+  message->AppendVarInt(/*field_id=*/2, 42);
+  message->AppendVarInt(/*field_id=*/1, 4);
+  message->AppendPackedVarInts(/*field_id=*/1, run2, 1);
+  message->AppendPackedVarInts<uint64_t>(/*field_id=*/1, nullptr, 0);
+  message->AppendVarInt(/*field_id=*/1, 6);
+  message->Finalize();
+  std::vector<uint8_t> proto = message.SerializeAsArray();
+
+  TypedProtoDecoder<2, true> tpd(proto.data(), proto.size());
+  bool parse_error = false;
+  std::vector<uint64_t> decoded;
+  for (auto it = tpd.GetPackedRepeated<ProtoWireType::kVarInt, uint64_t>(
+           /*field_id=*/1, &parse_error);
+       it; ++it) {
+    decoded.push_back(*it);
+  }
+  EXPECT_FALSE(parse_error);
+  EXPECT_EQ(decoded, (std::vector<uint64_t>{1, 2, 300, 4, 5, 6}));
+
+  HeapBuffered<Message> fixed_message;
+  const float fixed_run[] = {1.25f, -2.5f};
+  fixed_message->AppendFixed(/*field_id=*/1, 0.5f);
+  fixed_message->AppendPackedFixed(/*field_id=*/1, fixed_run, 2);
+  fixed_message->Finalize();
+  proto = fixed_message.SerializeAsArray();
+
+  TypedProtoDecoder<1, true> fixed_decoder(proto.data(), proto.size());
+  std::vector<float> fixed_decoded;
+  for (auto it = fixed_decoder.GetPackedRepeated<ProtoWireType::kFixed32, float>(
+           /*field_id=*/1, &parse_error);
+       it; ++it) {
+    fixed_decoded.push_back(*it);
+  }
+  EXPECT_FALSE(parse_error);
+  EXPECT_EQ(fixed_decoded, (std::vector<float>{0.5f, 1.25f, -2.5f}));
+}
+
 TEST(ProtoDecoderTest, FindField) {
   uint8_t buf[] = {0x08, 0x00};  // field_id 1, varint value 0.
   ProtoDecoder pd(buf, 2);
@@ -237,5 +366,51 @@ TEST(ProtoDecoderTest, FindField) {
   EXPECT_FALSE(field2);
 }
 
+TEST(ProtoDecoderTest, LazyDecoder) {
+  HeapBuffered<Message> message;
+  message->AppendVarInt(/*field_id=*/1, 10);
+  message->AppendString(/*field_id=*/3, "foo");
+  message->AppendVarInt(/*field_id=*/2, 11);
+  message->AppendVarInt(/*field_id=*/1, 12);
+  message->AppendVarInt(/*field_id=*/5, 13);
+  message->AppendVarInt(/*field_id=*/2, 14);
+  std::vector<uint8_t> proto = message.SerializeAsArray();
+
+  LazyProtoDecoder<4> decoder(proto.data(), proto.size());
+  // Fields are returned out of order, and repeated fields return their first
+  // occurrence.
+  EXPECT_EQ(decoder.Get(2).as_uint32(), 11u);
+  EXPECT_EQ(decoder.Get(1).as_uint32(), 10u);
+  EXPECT_EQ(decoder.at<3>().as_std_string(), "foo");
+  EXPECT_FALSE(decoder.Get(4));
+  EXPECT_FALSE(decoder.Get(5));  // Greater than MAX_FIELD_ID.
+  EXPECT_EQ(decoder.Get(2).as_uint32(), 11u);
+
+  std::vector<uint32_t> values;
+  for (auto it = decoder.GetRepeated(2); it; ++it)
+    values.push_back(it->as_uint32());
+  EXPECT_THAT(values, ::testing::ElementsAre(11u, 14u));
+  values.clear();
+  for (auto it = decoder.GetRepeated(5); it; ++it)
+    values.push_back(it->as_uint32());
+  EXPECT_THAT(values, ::testing::ElementsAre(13u));
+  EXPECT_FALSE(decoder.GetRepeated(4));
+}
+
+TEST(ProtoDecoderTest, LazyDecoderStopsAtRequestedField) {
+  // Field 1 is followed by a truncated varint field, which is never tokenized
+  // unless a field that is not found before it is requested.
+  const uint8_t buf[] = {0x08, 0x2a, 0x10, 0x80};
+  LazyProtoDecoder<2> decoder(buf, sizeof(buf));
+  EXPECT_EQ(decoder.Get(1).as_int32(), 42);
+  EXPECT_FALSE(decoder.Get(2));
+  EXPECT_EQ(decoder.Get(1).as_int32(), 42);
+
+  std::vector<int32_t> values;
+  for (auto it = decoder.GetRepeated(1); it; ++it)
+    values.push_back(it->as_int32());
+  EXPECT_THAT(values, ::testing::ElementsAre(42));
+}
+
 }  // namespace
 }  // namespace protozero
@@ -17,6 +17,7 @@
 #include "perfetto/protozero/proto_utils.h"
 
 #include <limits>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "perfetto/base/logging.h"
@@ -196,6 +197,31 @@ TEST(ProtoUtilsTest, VarIntDecodingOutOfBounds) {
   }
 }
 
+// The fast path of ParseVarInt() kicks in only with at least 8 bytes left in
+// the buffer, check that it agrees with the byte-by-byte loop at all sizes.
+TEST(ProtoUtilsTest, VarIntDecodingFastPath) {
+  for (size_t i = 0; i < ArraySize(kVarIntExpectations); ++i) {
+    const VarIntExpectation& exp = kVarIntExpectations[i];
+    for (size_t padding = 0; padding < 10; ++padding) {
+      std::vector<uint8_t> buf(exp.encoded, exp.encoded + exp.encoded_size);
+      buf.resize(buf.size() + padding, 0xff);
+      for (size_t size = 0; size <= buf.size(); ++size) {
+        uint64_t value = 42;
+        uint64_t slow_value = 42;
+        const uint8_t* res = ParseVarInt(buf.data(), buf.data() + size, &value);
+        const uint8_t* slow_res =
+            ParseVarIntSlow(buf.data(), buf.data() + size, &slow_value);
+        ASSERT_EQ(slow_res, res);
+        ASSERT_EQ(slow_value, value);
+        if (size >= exp.encoded_size) {
+          ASSERT_EQ(buf.data() + exp.encoded_size, res);
+          ASSERT_EQ(exp.int_value, value);
+        }
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace proto_utils
 }  // namespace protozero
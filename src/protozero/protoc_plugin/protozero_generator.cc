@@ -166,6 +166,22 @@ class GeneratorJob {
     return true;
   }
 
+  // The encoding of each value of a packed field.
+  std::string GetPackedWireType(const FieldDescriptor* field) {
+    const FieldDescriptor::Type type = field->type();
+    if (type == FieldDescriptor::TYPE_FIXED32 ||
+        type == FieldDescriptor::TYPE_SFIXED32 ||
+        type == FieldDescriptor::TYPE_FLOAT) {
+      return "::protozero::proto_utils::ProtoWireType::kFixed32";
+    }
+    if (type == FieldDescriptor::TYPE_FIXED64 ||
+        type == FieldDescriptor::TYPE_SFIXED64 ||
+        type == FieldDescriptor::TYPE_DOUBLE) {
+      return "::protozero::proto_utils::ProtoWireType::kFixed64";
+    }
+    return "::protozero::proto_utils::ProtoWireType::kVarInt";
+  }
+
   void CollectDescriptors() {
     // Collect message descriptors in DFS order.
     std::vector<const Descriptor*> stack;
@@ -437,6 +453,24 @@ class GeneratorJob {
     }
     setter["appender"] = appender;
     setter["cpp_type"] = cpp_type;
+
+    // Packed fields are written in one go, as a length-delimited field.
+    if (field->is_packed()) {
+      if (field->type() == FieldDescriptor::TYPE_SINT32 ||
+          field->type() == FieldDescriptor::TYPE_SINT64) {
+        Abort("Packed sint fields are not supported.");
+        return;
+      }
+      setter["appender"] = appender == "AppendFixed" ? "AppendPackedFixed"
+                                                     : "AppendPackedVarInts";
+      stub_h_->Print(setter,
+                     "void set_$name$(const $cpp_type$* values, size_t count) "
+                     "{\n"
+                     "  $appender$($id$, values, count);\n"
+                     "}\n");
+      return;
+    }
+
     stub_h_->Print(setter,
                    "void $action$_$name$($cpp_type$ value) {\n"
                    "  $appender$($id$, value);\n"
@@ -490,11 +524,6 @@ class GeneratorJob {
 
     for (int i = 0; i < message->field_count(); ++i) {
       const FieldDescriptor* field = message->field(i);
-      if (field->is_packed()) {
-        Abort("Packed repeated fields are not supported.");
-        return;
-      }
-
       if (field->number() > max_field_id) {
         stub_h_->Print("// field $name$ omitted because its id is too high\n",
                        "name", field->name());
@@ -558,7 +587,15 @@ class GeneratorJob {
                      "name", field->name(), "id",
                      std::to_string(field->number()));
 
-      if (field->is_repeated()) {
+      if (field->is_packed()) {
+        stub_h_->Print(
+            "::protozero::PackedRepeatedFieldIterator<$wire_type$, $cpp_type$> "
+            "$name$(bool* parse_error_ptr) const { return "
+            "GetPackedRepeated<$wire_type$, $cpp_type$>($id$, "
+            "parse_error_ptr); }\n",
+            "name", field->name(), "id", std::to_string(field->number()),
+            "cpp_type", cpp_type, "wire_type", GetPackedWireType(field));
+      } else if (field->is_repeated()) {
         stub_h_->Print(
             "::protozero::RepeatedFieldIterator $name$() const { return "
             "GetRepeated($id$); }\n",
@@ -635,10 +672,6 @@ class GeneratorJob {
     // Field descriptors.
     for (int i = 0; i < message->field_count(); ++i) {
       const FieldDescriptor* field = message->field(i);
-      if (field->is_packed()) {
-        Abort("Packed repeated fields are not supported.");
-        return;
-      }
       if (field->type() != FieldDescriptor::TYPE_MESSAGE) {
         GenerateSimpleFieldDescriptor(field);
       } else {
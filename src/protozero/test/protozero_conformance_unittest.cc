@@ -14,12 +14,15 @@
  * limitations under the License.
  */
 
+#include <iterator>
 #include <limits>
 #include <memory>
 #include <vector>
 
 #include "gtest/gtest.h"
+#include "perfetto/base/utils.h"
 #include "perfetto/protozero/message_handle.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/protozero/test/fake_scattered_buffer.h"
 
 // Autogenerated headers in out/*/gen/
@@ -157,6 +160,119 @@ TEST_F(ProtoZeroConformanceTest, NestedMessages) {
   EXPECT_EQ(1000, gold_msg_a.super_nested().value_c());
 }
 
+TEST(ProtoZeroTest, PackedRepeatedFields) {
+  // The fixture's buffer cannot be used here: it doesn't skip the bytes left
+  // at the end of a chunk by the size field reservation of the packed fields.
+  HeapBuffered<pbtest::PackedRepeatedFields> msg;
+
+  const int32_t int32s[] = {1, -1, 100, 2000000};
+  const int64_t int64s[] = {-333123456789ll, 0};
+  const uint32_t uint32s[] = {600};
+  const uint64_t uint64s[] = {333123456789ll, 1, 127, 128};
+  const uint32_t fixed32s[] = {12345, 0xffffffff};
+  const uint64_t fixed64s[] = {444123450000ll};
+  const float floats[] = {3.14f, -1.5f};
+  const double doubles[] = {0.5555};
+  const bool bools[] = {true, false, true};
+  const pbtest::BigEnum big_enums[] = {pbtest::BigEnum::END,
+                                       pbtest::BigEnum::BEGIN};
+  msg->set_field_int32(int32s, perfetto::base::ArraySize(int32s));
+  msg->set_field_int64(int64s, perfetto::base::ArraySize(int64s));
+  msg->set_field_uint32(uint32s, perfetto::base::ArraySize(uint32s));
+  msg->set_field_uint64(uint64s, perfetto::base::ArraySize(uint64s));
+  msg->set_field_fixed32(fixed32s, perfetto::base::ArraySize(fixed32s));
+  msg->set_field_fixed64(fixed64s, perfetto::base::ArraySize(fixed64s));
+  msg->set_field_float(floats, perfetto::base::ArraySize(floats));
+  msg->set_field_double(doubles, 0);
+  msg->set_field_double(doubles, perfetto::base::ArraySize(doubles));
+  msg->set_field_bool(bools, perfetto::base::ArraySize(bools));
+  msg->set_big_enum(big_enums, perfetto::base::ArraySize(big_enums));
+  msg->Finalize();
+
+  pbgold::PackedRepeatedFields gold_msg;
+  ASSERT_TRUE(gold_msg.ParseFromString(msg.SerializeAsString()));
+  EXPECT_EQ(std::vector<int32_t>(std::begin(int32s), std::end(int32s)),
+            std::vector<int32_t>(gold_msg.field_int32().begin(),
+                                 gold_msg.field_int32().end()));
+  EXPECT_EQ(std::vector<int64_t>(std::begin(int64s), std::end(int64s)),
+            std::vector<int64_t>(gold_msg.field_int64().begin(),
+                                 gold_msg.field_int64().end()));
+  ASSERT_EQ(1, gold_msg.field_uint32_size());
+  EXPECT_EQ(600u, gold_msg.field_uint32(0));
+  EXPECT_EQ(std::vector<uint64_t>(std::begin(uint64s), std::end(uint64s)),
+            std::vector<uint64_t>(gold_msg.field_uint64().begin(),
+                                  gold_msg.field_uint64().end()));
+  EXPECT_EQ(std::vector<uint32_t>(std::begin(fixed32s), std::end(fixed32s)),
+            std::vector<uint32_t>(gold_msg.field_fixed32().begin(),
+                                  gold_msg.field_fixed32().end()));
+  ASSERT_EQ(1, gold_msg.field_fixed64_size());
+  EXPECT_EQ(444123450000ull, gold_msg.field_fixed64(0));
+  ASSERT_EQ(2, gold_msg.field_float_size());
+  EXPECT_FLOAT_EQ(3.14f, gold_msg.field_float(0));
+  EXPECT_FLOAT_EQ(-1.5f, gold_msg.field_float(1));
+  ASSERT_EQ(1, gold_msg.field_double_size());
+  EXPECT_DOUBLE_EQ(0.5555, gold_msg.field_double(0));
+  EXPECT_EQ(std::vector<bool>(std::begin(bools), std::end(bools)),
+            std::vector<bool>(gold_msg.field_bool().begin(),
+                              gold_msg.field_bool().end()));
+  ASSERT_EQ(2, gold_msg.big_enum_size());
+  EXPECT_EQ(pbgold::BigEnum::END, gold_msg.big_enum(0));
+  EXPECT_EQ(pbgold::BigEnum::BEGIN, gold_msg.big_enum(1));
+}
+
+TEST(ProtoZeroTest, PackedRepeatedFieldsDecoder) {
+  pbgold::PackedRepeatedFields gold_msg;
+  gold_msg.add_field_int32(-1);
+  gold_msg.add_field_int32(2000000);
+  gold_msg.add_field_uint64(333123456789ull);
+  gold_msg.add_field_fixed32(12345);
+  gold_msg.add_field_fixed32(0xffffffff);
+  gold_msg.add_field_double(0.5555);
+  gold_msg.add_field_bool(true);
+  gold_msg.add_field_bool(false);
+  gold_msg.add_big_enum(pbgold::BigEnum::END);
+  std::string serialized = gold_msg.SerializeAsString();
+
+  pbtest::PackedRepeatedFields::Decoder decoder(
+      reinterpret_cast<const uint8_t*>(serialized.data()), serialized.size());
+  bool parse_error = false;
+
+  auto int32_it = decoder.field_int32(&parse_error);
+  ASSERT_TRUE(int32_it);
+  EXPECT_EQ(-1, *int32_it);
+  ASSERT_TRUE(++int32_it);
+  EXPECT_EQ(2000000, *int32_it);
+  EXPECT_FALSE(++int32_it);
+
+  auto uint64_it = decoder.field_uint64(&parse_error);
+  ASSERT_TRUE(uint64_it);
+  EXPECT_EQ(333123456789ull, *uint64_it);
+  EXPECT_FALSE(++uint64_it);
+
+  std::vector<uint32_t> fixed32s;
+  for (auto it = decoder.field_fixed32(&parse_error); it; ++it)
+    fixed32s.push_back(*it);
+  EXPECT_EQ(fixed32s, std::vector<uint32_t>({12345, 0xffffffff}));
+
+  auto double_it = decoder.field_double(&parse_error);
+  ASSERT_TRUE(double_it);
+  EXPECT_DOUBLE_EQ(0.5555, *double_it);
+  EXPECT_FALSE(++double_it);
+
+  std::vector<bool> bools;
+  for (auto it = decoder.field_bool(&parse_error); it; ++it)
+    bools.push_back(*it);
+  EXPECT_EQ(bools, std::vector<bool>({true, false}));
+
+  auto enum_it = decoder.big_enum(&parse_error);
+  ASSERT_TRUE(enum_it);
+  EXPECT_EQ(pbtest::BigEnum::END, *enum_it);
+
+  EXPECT_FALSE(decoder.field_int64(&parse_error));
+  EXPECT_FALSE(decoder.field_float(&parse_error));
+  EXPECT_FALSE(parse_error);
+}
+
 TEST(ProtoZeroTest, Simple) {
   // Test the includes for indirect public import: library.pbzero.h ->
   // library_internals/galaxies.pbzero.h -> upper_import.pbzero.h .
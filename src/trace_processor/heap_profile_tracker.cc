@@ -159,14 +159,57 @@ void HeapProfileTracker::AddAllocation(ProfileIndex pidx,
   context_->storage->mutable_heap_profile_allocations()->Insert(free_row);
 }
 
+HeapProfileTracker::ProfileIndex HeapProfileTracker::GetProfileIndex(
+    uint32_t seq_id) {
+  auto it = current_profile_index_.find(seq_id);
+  if (it == current_profile_index_.end())
+    it = current_profile_index_.emplace(seq_id, next_profile_index_++).first;
+  return it->second;
+}
+
+void HeapProfileTracker::FinalizeProfile(uint32_t seq_id) {
+  ApplyAllAllocations();
+  ProfileIndex pidx = GetProfileIndex(seq_id);
+  if (incremental_profiles_.count(pidx) == 0)
+    current_profile_index_[seq_id] = next_profile_index_++;
+}
+
 void HeapProfileTracker::StoreAllocation(ProfileIndex pidx,
                                          SourceAllocation alloc) {
   pending_allocs_.emplace_back(pidx, std::move(alloc));
 }
 
+void HeapProfileTracker::StoreIncrementalDump(ProfileIndex pidx,
+                                              uint64_t pid,
+                                              uint64_t timestamp) {
+  incremental_profiles_.insert(pidx);
+  pending_incremental_dumps_[{pidx, pid}] = timestamp;
+}
+
 void HeapProfileTracker::ApplyAllAllocations() {
-  for (const auto& p : pending_allocs_)
+  for (const auto& p : pending_allocs_) {
     AddAllocation(p.first, p.second);
+    auto key = std::make_pair(p.first, p.second.pid);
+    if (pending_incremental_dumps_.count(key))
+      last_allocations_[key][p.second.callstack_id] = p.second;
+  }
+
+  for (const auto& dump : pending_incremental_dumps_) {
+    ProfileIndex pidx = dump.first.first;
+    uint64_t timestamp = dump.second;
+    for (auto& callstack_and_alloc : last_allocations_[dump.first]) {
+      SourceAllocation& alloc = callstack_and_alloc.second;
+      // Rows at this timestamp were either just added or, if the process did
+      // not make progress since the previous dump, already exist.
+      if (alloc.timestamp == timestamp)
+        continue;
+      alloc.timestamp = timestamp;
+      AddAllocation(pidx, alloc);
+    }
+  }
+
+  pending_allocs_.clear();
+  pending_incremental_dumps_.clear();
 }
 
 int64_t HeapProfileTracker::GetDatabaseFrameIdForTesting(
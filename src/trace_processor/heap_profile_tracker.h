@@ -18,6 +18,9 @@
 #define SRC_TRACE_PROCESSOR_HEAP_PROFILE_TRACKER_H_
 
 #include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
 
 #include "perfetto/trace/profiling/profile_packet.pbzero.h"
 #include "src/trace_processor/trace_storage.h"
@@ -55,9 +58,8 @@ class TraceProcessorContext;
 
 class HeapProfileTracker {
  public:
-  // Not the same as ProfilePacket.index. This gets only gets incremented when
-  // encountering a ProfilePacket that is not continued.
-  // This namespaces all other Source*Ids.
+  // Not the same as ProfilePacket.index. Namespaces all other Source*Ids, see
+  // GetProfileIndex().
   using ProfileIndex = uint64_t;
 
   using SourceStringId = uint64_t;
@@ -99,7 +101,20 @@ class HeapProfileTracker {
   void AddFrame(ProfileIndex, SourceFrameId, const SourceFrame&);
   void AddCallstack(ProfileIndex, SourceCallstackId, const SourceCallstack&);
 
+  // Returns the ProfileIndex of the dump currently written on the packet
+  // sequence |seq_id|. Each dump (a ProfilePacket that is not continued, with
+  // the continued ones before it) gets a new one, unless the sequence writes
+  // incremental dumps: their Source*Ids stay valid for the rest of the
+  // sequence, so they all share the index of the first one.
+  ProfileIndex GetProfileIndex(uint32_t seq_id);
+  // Called at the end of each dump on the packet sequence |seq_id|.
+  void FinalizeProfile(uint32_t seq_id);
+
   void StoreAllocation(ProfileIndex, SourceAllocation);
+  // The samples stored for |pid| since the last ApplyAllAllocations only
+  // contain the callstacks that changed since its previous dump. The other
+  // callstacks are carried over from that dump to |timestamp|.
+  void StoreIncrementalDump(ProfileIndex, uint64_t pid, uint64_t timestamp);
   void ApplyAllAllocations();
 
   int64_t GetDatabaseFrameIdForTesting(ProfileIndex, SourceFrameId);
@@ -127,7 +142,20 @@ class HeapProfileTracker {
   std::unordered_map<TraceStorage::HeapProfileCallsites::Row, int64_t>
       callsite_idx_;
 
+  std::map<uint32_t /* seq_id */, ProfileIndex> current_profile_index_;
+  ProfileIndex next_profile_index_ = 0;
+  // Indexes of the sequences that write incremental dumps.
+  std::set<ProfileIndex> incremental_profiles_;
+
   std::vector<std::pair<ProfileIndex, SourceAllocation>> pending_allocs_;
+  std::map<std::pair<ProfileIndex, uint64_t /* pid */>, uint64_t /* ts */>
+      pending_incremental_dumps_;
+
+  // Latest absolute values of each callstack of the processes that are dumped
+  // incrementally.
+  std::map<std::pair<ProfileIndex, uint64_t /* pid */>,
+           std::unordered_map<SourceCallstackId, SourceAllocation>>
+      last_allocations_;
 
   TraceProcessorContext* const context_;
   const StringId empty_;
@@ -197,6 +197,72 @@ int64_t FindCallstack(const TraceStorage& storage,
   return -1;
 }
 
+// Callstacks that are not in an incremental dump keep the values of the
+// previous dump.
+TEST_F(HeapProfileTrackerDupTest, IncrementalDump) {
+  InsertCallsite();
+  context.heap_profile_tracker->AddCallstack(kFirstPacket, 1,
+                                             {kFirstPacketFrameId});
+
+  HeapProfileTracker::SourceAllocation alloc;
+  alloc.pid = 1;
+  alloc.timestamp = 100;
+  alloc.callstack_id = 0;
+  alloc.self_allocated = 10;
+  alloc.alloc_count = 1;
+  HeapProfileTracker::SourceAllocation other_alloc = alloc;
+  other_alloc.callstack_id = 1;
+  other_alloc.self_allocated = 20;
+  context.heap_profile_tracker->StoreAllocation(kFirstPacket, alloc);
+  context.heap_profile_tracker->StoreAllocation(kFirstPacket, other_alloc);
+  context.heap_profile_tracker->StoreIncrementalDump(kFirstPacket, 1, 100);
+  context.heap_profile_tracker->ApplyAllAllocations();
+
+  alloc.timestamp = 200;
+  alloc.self_allocated = 15;
+  alloc.alloc_count = 2;
+  context.heap_profile_tracker->StoreAllocation(kFirstPacket, alloc);
+  context.heap_profile_tracker->StoreIncrementalDump(kFirstPacket, 1, 200);
+  context.heap_profile_tracker->ApplyAllAllocations();
+
+  // The process did not make progress, nothing changes.
+  context.heap_profile_tracker->StoreIncrementalDump(kFirstPacket, 1, 200);
+  context.heap_profile_tracker->ApplyAllAllocations();
+
+  const auto& allocs = context.storage->heap_profile_allocations();
+  EXPECT_THAT(allocs.timestamps(),
+              ElementsAre(100, 100, 100, 100, 200, 200, 200, 200));
+  EXPECT_THAT(allocs.sizes(), ElementsAre(10, 0, 20, 0, 15, 0, 20, 0));
+  EXPECT_THAT(allocs.counts(), ElementsAre(1, 0, 1, 0, 2, 0, 1, 0));
+}
+
+// The Source*Ids of incremental dumps stay valid for the rest of their packet
+// sequence, other dumps each get their own namespace.
+TEST(HeapProfileTrackerTest, ProfileIndexOfIncrementalDumps) {
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  context.heap_profile_tracker.reset(new HeapProfileTracker(&context));
+  HeapProfileTracker* hpt = context.heap_profile_tracker.get();
+
+  constexpr uint32_t kIncrementalSeq = 1;
+  constexpr uint32_t kOtherSeq = 2;
+  auto incremental_idx = hpt->GetProfileIndex(kIncrementalSeq);
+  auto other_idx = hpt->GetProfileIndex(kOtherSeq);
+  EXPECT_NE(incremental_idx, other_idx);
+
+  hpt->StoreIncrementalDump(incremental_idx, 1, 100);
+  hpt->FinalizeProfile(kIncrementalSeq);
+  hpt->FinalizeProfile(kOtherSeq);
+  EXPECT_EQ(hpt->GetProfileIndex(kIncrementalSeq), incremental_idx);
+  auto next_other_idx = hpt->GetProfileIndex(kOtherSeq);
+  EXPECT_NE(next_other_idx, other_idx);
+  EXPECT_NE(next_other_idx, incremental_idx);
+
+  // Even a dump without any process does not end the namespace.
+  hpt->FinalizeProfile(kIncrementalSeq);
+  EXPECT_EQ(hpt->GetProfileIndex(kIncrementalSeq), incremental_idx);
+}
+
 // Insert multiple mappings, frames and callstacks and check result.
 TEST(HeapProfileTrackerTest, Functional) {
   TraceProcessorContext context;
@@ -19,6 +19,7 @@
 #include <inttypes.h>
 #include <string.h>
 
+#include <algorithm>
 #include <string>
 
 #include "perfetto/base/logging.h"
@@ -319,7 +320,8 @@ void ProtoTraceParser::ParseTracePacket(
     ParseAndroidLogPacket(packet.android_log());
 
   if (packet.has_profile_packet())
-    ParseProfilePacket(packet.profile_packet());
+    ParseProfilePacket(packet.trusted_packet_sequence_id(),
+                       packet.profile_packet());
 
   if (packet.has_system_info())
     ParseSystemInfo(packet.system_info());
@@ -1097,22 +1099,48 @@ void ProtoTraceParser::ParseClockSnapshot(ConstBytes blob) {
 
 void ProtoTraceParser::ParseAndroidLogPacket(ConstBytes blob) {
   protos::pbzero::AndroidLogPacket::Decoder packet(blob.data, blob.size);
+
+  // Tags are interned within the scope of the packet. The producer emits
+  // them sorted by iid, sort anyway as the lookup relies on that.
+  std::vector<std::pair<uint32_t, StringId>> interned_tags;
+  for (auto it = packet.interned_tags(); it; ++it) {
+    protos::pbzero::AndroidLogPacket::InternedTag::Decoder tag(it->data(),
+                                                               it->size());
+    interned_tags.emplace_back(tag.iid(),
+                               context_->storage->InternString(tag.name()));
+  }
+  std::sort(interned_tags.begin(), interned_tags.end());
+
   for (auto it = packet.events(); it; ++it)
-    ParseAndroidLogEvent(it->as_bytes());
+    ParseAndroidLogEvent(it->as_bytes(), interned_tags);
 
   if (packet.has_stats())
     ParseAndroidLogStats(packet.stats());
 }
 
-void ProtoTraceParser::ParseAndroidLogEvent(ConstBytes blob) {
+void ProtoTraceParser::ParseAndroidLogEvent(
+    ConstBytes blob,
+    const std::vector<std::pair<uint32_t, StringId>>& interned_tags) {
   // TODO(primiano): Add events and non-stringified fields to the "raw" table.
   protos::pbzero::AndroidLogPacket::LogEvent::Decoder evt(blob.data, blob.size);
   int64_t ts = static_cast<int64_t>(evt.timestamp());
   uint32_t pid = static_cast<uint32_t>(evt.pid());
   uint32_t tid = static_cast<uint32_t>(evt.tid());
   uint8_t prio = static_cast<uint8_t>(evt.prio());
-  StringId tag_id = context_->storage->InternString(
-      evt.has_tag() ? evt.tag() : base::StringView());
+  base::Optional<StringId> tag_id;
+  if (evt.has_tag_iid()) {
+    auto it = std::lower_bound(
+        interned_tags.begin(), interned_tags.end(), evt.tag_iid(),
+        [](const std::pair<uint32_t, StringId>& tag, uint32_t iid) {
+          return tag.first < iid;
+        });
+    if (it != interned_tags.end() && it->first == evt.tag_iid())
+      tag_id = it->second;
+  }
+  if (!tag_id) {
+    tag_id = context_->storage->InternString(
+        evt.has_tag() ? evt.tag() : base::StringView());
+  }
   StringId msg_id = context_->storage->InternString(
       evt.has_message() ? evt.message() : base::StringView());
 
@@ -1159,7 +1187,7 @@ void ProtoTraceParser::ParseAndroidLogEvent(ConstBytes blob) {
   // Log events are NOT required to be sorted by trace_time. The virtual table
   // will take care of sorting on-demand.
   context_->storage->mutable_android_log()->AddLogEvent(
-      opt_trace_time.value(), utid, prio, tag_id, msg_id);
+      opt_trace_time.value(), utid, prio, *tag_id, msg_id);
 }
 
 void ProtoTraceParser::ParseAndroidLogStats(ConstBytes blob) {
@@ -1197,6 +1225,8 @@ void ProtoTraceParser::ParseTraceStats(ConstBytes blob) {
                     static_cast<int64_t>(evt.chunks_discarded()));
   storage->SetStats(stats::traced_patches_discarded,
                     static_cast<int64_t>(evt.patches_discarded()));
+  storage->SetStats(stats::traced_max_read_behind_bytes,
+                    static_cast<int64_t>(evt.max_read_behind_bytes()));
 
   int buf_num = 0;
   for (auto it = evt.buffer_stats(); it; ++it, ++buf_num) {
@@ -1289,8 +1319,8 @@ void ProtoTraceParser::ParseFtraceStats(ConstBytes blob) {
   }
 }
 
-void ProtoTraceParser::ParseProfilePacket(ConstBytes blob) {
-  uint64_t index = 0;
+void ProtoTraceParser::ParseProfilePacket(uint32_t seq_id, ConstBytes blob) {
+  uint64_t index = context_->heap_profile_tracker->GetProfileIndex(seq_id);
   protos::pbzero::ProfilePacket::Decoder packet(blob.data, blob.size);
 
   for (auto it = packet.strings(); it; ++it) {
@@ -1355,6 +1385,10 @@ void ProtoTraceParser::ParseProfilePacket(ConstBytes blob) {
     if (entry.rejected_concurrent())
       context_->storage->IncrementIndexedStats(
           stats::heapprofd_rejected_concurrent, pid);
+    if (entry.incremental()) {
+      context_->heap_profile_tracker->StoreIncrementalDump(
+          index, entry.pid(), entry.timestamp());
+    }
 
     for (auto sample_it = entry.samples(); sample_it; ++sample_it) {
       protos::pbzero::ProfilePacket::HeapSample::Decoder sample(
@@ -1362,7 +1396,9 @@ void ProtoTraceParser::ParseProfilePacket(ConstBytes blob) {
 
       HeapProfileTracker::SourceAllocation src_allocation;
       src_allocation.pid = entry.pid();
-      src_allocation.timestamp = sample.timestamp();
+      // heapprofd only sets the timestamp of the whole process dump.
+      src_allocation.timestamp =
+          sample.has_timestamp() ? sample.timestamp() : entry.timestamp();
       src_allocation.callstack_id = sample.callstack_id();
       src_allocation.self_allocated = sample.self_allocated();
       src_allocation.self_freed = sample.self_freed();
@@ -1372,10 +1408,8 @@ void ProtoTraceParser::ParseProfilePacket(ConstBytes blob) {
       context_->heap_profile_tracker->StoreAllocation(index, src_allocation);
     }
   }
-  if (!packet.continued()) {
-    context_->heap_profile_tracker->ApplyAllAllocations();
-    index++;
-  }
+  if (!packet.continued())
+    context_->heap_profile_tracker->FinalizeProfile(seq_id);
 }
 
 void ProtoTraceParser::ParseSystemInfo(ConstBytes blob) {
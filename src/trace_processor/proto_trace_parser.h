@@ -21,6 +21,8 @@
 
 #include <array>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "perfetto/base/string_view.h"
 #include "perfetto/protozero/field.h"
@@ -95,7 +97,9 @@ class ProtoTraceParser : public TraceParser {
   void ParseSysEvent(int64_t ts, uint32_t pid, bool is_enter, ConstBytes);
   void ParseClockSnapshot(ConstBytes);
   void ParseAndroidLogPacket(ConstBytes);
-  void ParseAndroidLogEvent(ConstBytes);
+  void ParseAndroidLogEvent(
+      ConstBytes,
+      const std::vector<std::pair<uint32_t, StringId>>& interned_tags);
   void ParseAndroidLogStats(ConstBytes);
   void ParseGenericFtrace(int64_t timestamp,
                           uint32_t cpu,
@@ -108,7 +112,7 @@ class ProtoTraceParser : public TraceParser {
                              ConstBytes view);
   void ParseTraceStats(ConstBytes);
   void ParseFtraceStats(ConstBytes);
-  void ParseProfilePacket(ConstBytes);
+  void ParseProfilePacket(uint32_t seq_id, ConstBytes);
   void ParseSystemInfo(ConstBytes);
   void ParseTrackEvent(int64_t ts,
                        int64_t tts,
@@ -21,6 +21,7 @@
 #include "perfetto/base/string_view.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/trace_processor/args_tracker.h"
+#include "src/trace_processor/clock_tracker.h"
 #include "src/trace_processor/event_tracker.h"
 #include "src/trace_processor/process_tracker.h"
 #include "src/trace_processor/proto_trace_parser.h"
@@ -28,6 +29,7 @@
 #include "src/trace_processor/trace_sorter.h"
 
 #include "perfetto/common/sys_stats_counters.pbzero.h"
+#include "perfetto/trace/android/android_log.pbzero.h"
 #include "perfetto/trace/ftrace/ftrace.pbzero.h"
 #include "perfetto/trace/ftrace/ftrace_event.pbzero.h"
 #include "perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
@@ -531,6 +533,50 @@ TEST_F(ProtoTraceParserTest, LoadThreadPacket) {
   Tokenize();
 }
 
+TEST_F(ProtoTraceParserTest, LoadAndroidLogInternedTags) {
+  InitStorage();
+  context_.clock_tracker.reset(new ClockTracker(&context_));
+  context_.clock_tracker->SyncClocks(ClockDomain::kRealTime, 0, 0);
+
+  auto* log = trace_.add_packet()->set_android_log();
+  auto* evt = log->add_events();
+  evt->set_timestamp(1000);
+  evt->set_tag_iid(1);
+  evt->set_message("msg1");
+  evt = log->add_events();
+  evt->set_timestamp(2000);
+  evt->set_tag("raw_tag");
+  evt->set_message("msg2");
+  evt = log->add_events();
+  evt->set_timestamp(3000);
+  evt->set_tag_iid(1);
+  evt->set_message("msg3");
+  auto* interned_tag = log->add_interned_tags();
+  interned_tag->set_iid(1);
+  interned_tag->set_name("interned_tag");
+
+  EXPECT_CALL(*storage_, InternString(base::StringView("interned_tag")))
+      .WillOnce(Return(1));
+  EXPECT_CALL(*storage_, InternString(base::StringView("raw_tag")))
+      .WillOnce(Return(2));
+  EXPECT_CALL(*storage_, InternString(base::StringView("msg1")))
+      .WillOnce(Return(3));
+  EXPECT_CALL(*storage_, InternString(base::StringView("msg2")))
+      .WillOnce(Return(4));
+  EXPECT_CALL(*storage_, InternString(base::StringView("msg3")))
+      .WillOnce(Return(5));
+  Tokenize();
+
+  const auto& logs = storage_->android_logs();
+  ASSERT_EQ(logs.size(), 3u);
+  EXPECT_EQ(logs.tag_ids()[0], 1u);
+  EXPECT_EQ(logs.msg_ids()[0], 3u);
+  EXPECT_EQ(logs.tag_ids()[1], 2u);
+  EXPECT_EQ(logs.msg_ids()[1], 4u);
+  EXPECT_EQ(logs.tag_ids()[2], 1u);
+  EXPECT_EQ(logs.msg_ids()[2], 5u);
+}
+
 TEST_F(ProtoTraceParserTest, TrackEventWithoutInternedData) {
   InitStorage();
   context_.sorter.reset(new TraceSorter(
@@ -397,22 +397,26 @@ void ProtoTraceTokenizer::ParseTrackEventPacket(
 
 PERFETTO_ALWAYS_INLINE
 void ProtoTraceTokenizer::ParseFtraceBundle(TraceBlobView bundle) {
-  protos::pbzero::FtraceEventBundle::Decoder decoder(bundle.data(),
-                                                     bundle.length());
+  using protos::pbzero::FtraceEventBundle;
+  // Bundles hold thousands of events: stream them instead of storing them.
+  protozero::LazyProtoDecoder<FtraceEventBundle::kEventFieldNumber> decoder(
+      bundle.data(), bundle.length());
 
-  if (PERFETTO_UNLIKELY(!decoder.has_cpu())) {
+  auto cpu_field = decoder.at<FtraceEventBundle::kCpuFieldNumber>();
+  if (PERFETTO_UNLIKELY(!cpu_field)) {
     PERFETTO_ELOG("CPU field not found in FtraceEventBundle");
     context_->storage->IncrementStats(stats::ftrace_bundle_tokenizer_errors);
     return;
   }
 
-  uint32_t cpu = decoder.cpu();
+  uint32_t cpu = cpu_field.as_uint32();
   if (PERFETTO_UNLIKELY(cpu > base::kMaxCpus)) {
     PERFETTO_ELOG("CPU larger than kMaxCpus (%u > %zu)", cpu, base::kMaxCpus);
     return;
   }
 
-  for (auto it = decoder.event(); it; ++it) {
+  for (auto it = decoder.GetRepeated(FtraceEventBundle::kEventFieldNumber); it;
+       ++it) {
     size_t off = bundle.offset_of(it->data());
     ParseFtraceEvent(cpu, bundle.slice(off, it->size()));
   }
@@ -83,6 +83,7 @@ namespace stats {
   F(traced_chunks_discarded,                    kSingle,  kInfo,  kTrace),    \
   F(traced_data_sources_registered,             kSingle,  kInfo,  kTrace),    \
   F(traced_data_sources_seen,                   kSingle,  kInfo,  kTrace),    \
+  F(traced_max_read_behind_bytes,               kSingle,  kInfo,  kTrace),    \
   F(traced_patches_discarded,                   kSingle,  kInfo,  kTrace),    \
   F(traced_producers_connected,                 kSingle,  kInfo,  kTrace),    \
   F(traced_producers_seen,                      kSingle,  kInfo,  kTrace),    \
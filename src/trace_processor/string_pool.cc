@@ -21,8 +21,9 @@
 namespace perfetto {
 namespace trace_processor {
 
-StringPool::StringPool() {
-  blocks_.emplace_back();
+StringPool::StringPool(int alloc_flags, int numa_node)
+    : alloc_flags_(alloc_flags), numa_node_(numa_node) {
+  blocks_.emplace_back(alloc_flags_, numa_node_);
 
   // Reserve a slot for the null string.
   PERFETTO_CHECK(blocks_.back().TryInsert(NullTermStringView()));
@@ -47,7 +48,7 @@ StringPool::Id StringPool::InsertString(base::StringView str, uint64_t hash) {
     PERFETTO_CHECK(sizeof(uint8_t*) == 4);
 
     // Add a new block to store the data.
-    blocks_.emplace_back();
+    blocks_.emplace_back(alloc_flags_, numa_node_);
 
     // Try and reserve space again - this time we should definitely succeed.
     ptr = blocks_.back().TryInsert(str);
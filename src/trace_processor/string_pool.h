@@ -53,7 +53,12 @@ class StringPool {
     uint32_t block_offset_ = 0;
   };
 
-  StringPool();
+  // The blocks are allocated with the base::PagedMemory |alloc_flags| and
+  // |numa_node|. Transparent huge pages reduce the TLB misses of queries that
+  // look up strings all over the pool.
+  explicit StringPool(
+      int alloc_flags = base::PagedMemory::kHugePages,
+      int numa_node = base::PagedMemory::kAnyNumaNode);
   ~StringPool();
 
   // Allow std::move().
@@ -90,7 +95,10 @@ class StringPool {
  private:
   using StringHash = uint64_t;
   struct Block {
-    Block() : mem_(base::PagedMemory::Allocate(kBlockSize)) {}
+    Block(int alloc_flags, int numa_node)
+        : mem_(base::PagedMemory::Allocate(kBlockSize,
+                                           alloc_flags,
+                                           numa_node)) {}
     ~Block() = default;
 
     // Allow std::move().
@@ -181,6 +189,8 @@ class StringPool {
 
   // The actual memory storing the strings.
   std::vector<Block> blocks_;
+  int alloc_flags_;
+  int numa_node_;
 
   // Maps hashes of strings to the Id in the string pool.
   // TODO(lalitm): At some point we should benchmark just using a static
@@ -17,6 +17,8 @@
 #include "src/trace_processor/string_pool.h"
 
 #include <random>
+#include <string>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -45,6 +47,16 @@ TEST(StringPoolTest, InternAndRetrieve) {
   ASSERT_EQ(id, pool.InternString(kString));
 }
 
+TEST(StringPoolTest, AllocationOptions) {
+  StringPool pool(base::PagedMemory::kHugeTlb, /*numa_node=*/0);
+  std::vector<StringPool::Id> ids;
+  for (int i = 0; i < 1000; i++)
+    ids.push_back(pool.InternString(base::StringView(std::to_string(i))));
+  for (int i = 0; i < 1000; i++)
+    ASSERT_EQ(pool.Get(ids[static_cast<size_t>(i)]).ToStdString(),
+              std::to_string(i));
+}
+
 TEST(StringPoolTest, NullPointerHandling) {
   StringPool pool;
 
@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/symbolizer.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/thread_pool.h"
+#include "src/trace_processor/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+// Subdirectories of the symbol directory deeper than this are not searched.
+constexpr int kMaxDirectoryDepth = 16;
+
+constexpr uint8_t kElfMagic[] = {0x7f, 'E', 'L', 'F'};
+constexpr size_t kEiClass = 4;
+constexpr size_t kEiData = 5;
+constexpr uint8_t kElfClass32 = 1;
+constexpr uint8_t kElfClass64 = 2;
+constexpr uint8_t kElfDataLittleEndian = 1;
+
+constexpr uint32_t kShtSymtab = 2;
+constexpr uint32_t kShtNote = 7;
+constexpr uint32_t kShtDynsym = 11;
+constexpr uint32_t kNtGnuBuildId = 3;
+constexpr uint8_t kSttFunc = 2;
+constexpr uint16_t kEmArm = 40;
+
+// Only the fields that are needed are named. The layouts match Elf32_* and
+// Elf64_* of <elf.h>, which is not available on all the host platforms.
+struct Elf32 {
+  using Addr = uint32_t;
+  using Off = uint32_t;
+  using Word = uint32_t;
+
+  struct Ehdr {
+    uint8_t e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    Addr e_entry;
+    Off e_phoff;
+    Off e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+  };
+
+  struct Shdr {
+    uint32_t sh_name;
+    uint32_t sh_type;
+    Word sh_flags;
+    Addr sh_addr;
+    Off sh_offset;
+    Word sh_size;
+    uint32_t sh_link;
+    uint32_t sh_info;
+    Word sh_addralign;
+    Word sh_entsize;
+  };
+
+  struct Sym {
+    uint32_t st_name;
+    Addr st_value;
+    Word st_size;
+    uint8_t st_info;
+    uint8_t st_other;
+    uint16_t st_shndx;
+  };
+};
+
+struct Elf64 {
+  using Addr = uint64_t;
+  using Off = uint64_t;
+  using Word = uint64_t;
+
+  struct Ehdr {
+    uint8_t e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    Addr e_entry;
+    Off e_phoff;
+    Off e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+  };
+
+  struct Shdr {
+    uint32_t sh_name;
+    uint32_t sh_type;
+    Word sh_flags;
+    Addr sh_addr;
+    Off sh_offset;
+    Word sh_size;
+    uint32_t sh_link;
+    uint32_t sh_info;
+    Word sh_addralign;
+    Word sh_entsize;
+  };
+
+  struct Sym {
+    uint32_t st_name;
+    uint8_t st_info;
+    uint8_t st_other;
+    uint16_t st_shndx;
+    Addr st_value;
+    Word st_size;
+  };
+};
+
+struct NoteHeader {
+  uint32_t namesz;
+  uint32_t descsz;
+  uint32_t type;
+};
+
+// An open ELF file. All the offsets and sizes in it are untrusted, ReadAt()
+// checks them against |size| before allocating anything for them.
+struct ElfFile {
+  int fd;
+  uint64_t size;
+};
+
+struct Function {
+  uint64_t addr;
+  uint64_t size;
+  std::string name;
+
+  bool operator<(const Function& other) const { return addr < other.addr; }
+};
+
+bool ReadAt(const ElfFile& file,
+            uint64_t offset,
+            uint64_t size,
+            std::string* out) {
+  if (offset > file.size || size > file.size - offset ||
+      size > std::numeric_limits<size_t>::max()) {
+    return false;
+  }
+  out->resize(static_cast<size_t>(size));
+  size_t rd = 0;
+  while (rd < size) {
+    ssize_t res = pread(file.fd, &(*out)[rd], static_cast<size_t>(size) - rd,
+                        static_cast<off_t>(offset + rd));
+    if (res <= 0)
+      return false;
+    rd += static_cast<size_t>(res);
+  }
+  return true;
+}
+
+template <typename T>
+bool ReadStructAt(const ElfFile& file, uint64_t offset, T* out) {
+  std::string buf;
+  if (!ReadAt(file, offset, sizeof(T), &buf))
+    return false;
+  memcpy(out, buf.data(), sizeof(T));
+  return true;
+}
+
+uint64_t Align4(uint64_t value) {
+  return (value + 3) & ~uint64_t(3);
+}
+
+// Reads the ELF class of |file|. Returns 0 if it is not a little-endian ELF.
+uint8_t GetElfClass(const ElfFile& file) {
+  uint8_t ident[16];
+  if (!ReadStructAt(file, 0, &ident) ||
+      memcmp(ident, kElfMagic, sizeof(kElfMagic)) != 0 ||
+      ident[kEiData] != kElfDataLittleEndian) {
+    return 0;
+  }
+  return ident[kEiClass];
+}
+
+template <typename E>
+bool ReadSectionHeaders(const ElfFile& file,
+                        typename E::Ehdr* ehdr,
+                        std::vector<typename E::Shdr>* sections) {
+  if (!ReadStructAt(file, 0, ehdr) || ehdr->e_shoff == 0 ||
+      ehdr->e_shentsize != sizeof(typename E::Shdr)) {
+    return false;
+  }
+  std::string buf;
+  if (!ReadAt(file, ehdr->e_shoff,
+              uint64_t{ehdr->e_shnum} * sizeof(typename E::Shdr), &buf)) {
+    return false;
+  }
+  sections->resize(ehdr->e_shnum);
+  memcpy(sections->data(), buf.data(), buf.size());
+  return true;
+}
+
+template <typename E>
+std::string ReadBuildId(const ElfFile& file) {
+  typename E::Ehdr ehdr;
+  std::vector<typename E::Shdr> sections;
+  if (!ReadSectionHeaders<E>(file, &ehdr, &sections))
+    return "";
+  for (const typename E::Shdr& section : sections) {
+    if (section.sh_type != kShtNote)
+      continue;
+    std::string notes;
+    if (!ReadAt(file, section.sh_offset, section.sh_size, &notes))
+      continue;
+    for (uint64_t offset = 0; offset + sizeof(NoteHeader) <= notes.size();) {
+      NoteHeader header;
+      memcpy(&header, &notes[offset], sizeof(header));
+      uint64_t name_offset = offset + sizeof(NoteHeader);
+      uint64_t desc_offset = name_offset + Align4(header.namesz);
+      uint64_t end = desc_offset + Align4(header.descsz);
+      if (end > notes.size())
+        break;
+      if (header.type == kNtGnuBuildId && header.namesz == 4 &&
+          memcmp(&notes[name_offset], "GNU", 4) == 0) {
+        return notes.substr(desc_offset, header.descsz);
+      }
+      offset = end;
+    }
+  }
+  return "";
+}
+
+// Returns the functions of the symbol table of |file|, sorted by address. Uses
+// .symtab if there is one, .dynsym otherwise.
+template <typename E>
+std::vector<Function> ReadFunctions(const ElfFile& file) {
+  std::vector<Function> functions;
+  typename E::Ehdr ehdr;
+  std::vector<typename E::Shdr> sections;
+  if (!ReadSectionHeaders<E>(file, &ehdr, &sections))
+    return functions;
+  // On ARM, bit 0 of the address of a function is set if it is Thumb code.
+  // It is not part of the address of its instructions.
+  uint64_t addr_mask = ehdr.e_machine == kEmArm ? ~uint64_t(1) : ~uint64_t(0);
+
+  const typename E::Shdr* symtab = nullptr;
+  for (const typename E::Shdr& section : sections) {
+    if (section.sh_type == kShtSymtab ||
+        (section.sh_type == kShtDynsym && !symtab)) {
+      symtab = &section;
+    }
+  }
+  if (!symtab || symtab->sh_link >= sections.size())
+    return functions;
+  const typename E::Shdr& strtab = sections[symtab->sh_link];
+
+  std::string syms;
+  std::string strs;
+  if (!ReadAt(file, symtab->sh_offset, symtab->sh_size, &syms) ||
+      !ReadAt(file, strtab.sh_offset, strtab.sh_size, &strs)) {
+    return functions;
+  }
+
+  size_t num_syms = syms.size() / sizeof(typename E::Sym);
+  for (size_t i = 0; i < num_syms; ++i) {
+    typename E::Sym sym;
+    memcpy(&sym, &syms[i * sizeof(sym)], sizeof(sym));
+    if ((sym.st_info & 0xf) != kSttFunc || sym.st_value == 0 ||
+        sym.st_name >= strs.size()) {
+      continue;
+    }
+    functions.push_back({sym.st_value & addr_mask, sym.st_size,
+                         std::string(strs.c_str() + sym.st_name)});
+  }
+  std::sort(functions.begin(), functions.end());
+  return functions;
+}
+
+const std::string* FindFunction(const std::vector<Function>& functions,
+                                uint64_t addr) {
+  auto it = std::upper_bound(
+      functions.begin(), functions.end(), addr,
+      [](uint64_t a, const Function& function) { return a < function.addr; });
+  if (it == functions.begin())
+    return nullptr;
+  --it;
+  // Symbols without a size extend to the next symbol.
+  if (it->size != 0 && addr >= it->addr + it->size)
+    return nullptr;
+  return &it->name;
+}
+
+}  // namespace
+
+Symbolizer::~Symbolizer() = default;
+
+LocalSymbolizer::LocalSymbolizer(const std::string& root) {
+  IndexDirectory(root, 0);
+}
+
+LocalSymbolizer::~LocalSymbolizer() = default;
+
+void LocalSymbolizer::IndexDirectory(const std::string& dir, int depth) {
+  base::ScopedDir dirp(opendir(dir.c_str()));
+  if (!dirp) {
+    PERFETTO_PLOG("Failed to open %s", dir.c_str());
+    return;
+  }
+  while (struct dirent* entry = readdir(*dirp)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    std::string path = dir + "/" + entry->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+      continue;
+    if (S_ISDIR(st.st_mode)) {
+      if (depth < kMaxDirectoryDepth)
+        IndexDirectory(path, depth + 1);
+      continue;
+    }
+    if (!S_ISREG(st.st_mode))
+      continue;
+
+    base::ScopedFile fd(base::OpenFile(path, O_RDONLY));
+    if (!fd || fstat(*fd, &st) != 0)
+      continue;
+    ElfFile file{*fd, static_cast<uint64_t>(st.st_size)};
+    std::string build_id;
+    switch (GetElfClass(file)) {
+      case kElfClass32:
+        build_id = ReadBuildId<Elf32>(file);
+        break;
+      case kElfClass64:
+        build_id = ReadBuildId<Elf64>(file);
+        break;
+    }
+    if (!build_id.empty())
+      binaries_.emplace(std::move(build_id), std::move(path));
+  }
+}
+
+std::vector<std::string> LocalSymbolizer::Symbolize(
+    const std::string& build_id,
+    const std::vector<uint64_t>& addresses) {
+  std::vector<std::string> names;
+  auto it = binaries_.find(build_id);
+  if (it == binaries_.end())
+    return names;
+  base::ScopedFile fd(base::OpenFile(it->second, O_RDONLY));
+  struct stat st;
+  if (!fd || fstat(*fd, &st) != 0)
+    return names;
+
+  ElfFile file{*fd, static_cast<uint64_t>(st.st_size)};
+  std::vector<Function> functions;
+  switch (GetElfClass(file)) {
+    case kElfClass32:
+      functions = ReadFunctions<Elf32>(file);
+      break;
+    case kElfClass64:
+      functions = ReadFunctions<Elf64>(file);
+      break;
+  }
+
+  names.reserve(addresses.size());
+  for (uint64_t addr : addresses) {
+    const std::string* name = FindFunction(functions, addr);
+    names.emplace_back(name ? *name : "");
+  }
+  return names;
+}
+
+size_t SymbolizeHeapProfileFrames(TraceStorage* storage,
+                                  Symbolizer* symbolizer,
+                                  size_t num_threads) {
+  struct Binary {
+    std::string build_id;
+    std::vector<uint32_t> frame_rows;
+    std::vector<uint64_t> addresses;
+    std::vector<std::string> names;
+  };
+
+  // Group the frames without a name by the binary they are in, so that each
+  // binary is only read once.
+  const TraceStorage::HeapProfileFrames& frames =
+      storage->heap_profile_frames();
+  const TraceStorage::HeapProfileMappings& mappings =
+      storage->heap_profile_mappings();
+  std::vector<Binary> binaries;
+  std::map<StringId, size_t> binary_for_build_id;
+  for (uint32_t row = 0; row < frames.names().size(); ++row) {
+    if (!storage->GetString(frames.names()[row]).empty())
+      continue;
+    size_t mapping_row = static_cast<size_t>(frames.mappings()[row]);
+    StringId build_id = mappings.build_ids()[mapping_row];
+    if (storage->GetString(build_id).empty())
+      continue;
+
+    auto it = binary_for_build_id.find(build_id);
+    if (it == binary_for_build_id.end()) {
+      it = binary_for_build_id.emplace(build_id, binaries.size()).first;
+      binaries.emplace_back();
+      binaries.back().build_id = storage->GetString(build_id).ToStdString();
+    }
+    Binary& binary = binaries[it->second];
+    binary.frame_rows.push_back(row);
+    // rel_pc is relative to the load bias of the ELF.
+    binary.addresses.push_back(
+        static_cast<uint64_t>(frames.rel_pcs()[row]) +
+        static_cast<uint64_t>(mappings.load_biases()[mapping_row]));
+  }
+
+  // Only use as many threads as there are binaries, counting this one.
+  size_t num_workers = std::min(num_threads, binaries.size());
+  num_workers = num_workers > 0 ? num_workers - 1 : 0;
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  num_workers = 0;
+#endif
+  base::ThreadPool pool(num_workers);
+  base::ParallelFor(&pool, 0, binaries.size(),
+                    [symbolizer, &binaries](size_t i) {
+                      binaries[i].names = symbolizer->Symbolize(
+                          binaries[i].build_id, binaries[i].addresses);
+                    },
+                    /*grain=*/1);
+
+  // The string pool is not thread-safe, so the names are only interned here.
+  size_t symbolized = 0;
+  TraceStorage::HeapProfileFrames* mutable_frames =
+      storage->mutable_heap_profile_frames();
+  for (const Binary& binary : binaries) {
+    for (size_t i = 0; i < binary.names.size(); ++i) {
+      if (binary.names[i].empty())
+        continue;
+      mutable_frames->SetName(binary.frame_rows[i],
+                              storage->InternString(base::StringView(
+                                  binary.names[i])));
+      symbolized++;
+    }
+  }
+  return symbolized;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SYMBOLIZER_H_
+#define SRC_TRACE_PROCESSOR_SYMBOLIZER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceStorage;
+
+// Resolves addresses in binaries to the names of their functions.
+class Symbolizer {
+ public:
+  virtual ~Symbolizer();
+
+  // Returns the names of the functions that contain |addresses|, which are
+  // virtual addresses of the ELF file with |build_id| (raw bytes, as in the
+  // heap profile mappings). Addresses that are not in any function get an
+  // empty name. Returns an empty vector if the binary is not known.
+  // Called concurrently for different binaries.
+  virtual std::vector<std::string> Symbolize(
+      const std::string& build_id,
+      const std::vector<uint64_t>& addresses) = 0;
+};
+
+// Symbolizes using unstripped ELF files from a local directory, which is
+// searched recursively and indexed by the GNU build id of the files.
+// The symbol table of a binary is read once per Symbolize() call, so the
+// addresses of a binary should be passed in one batch.
+class LocalSymbolizer : public Symbolizer {
+ public:
+  explicit LocalSymbolizer(const std::string& root);
+  ~LocalSymbolizer() override;
+
+  std::vector<std::string> Symbolize(
+      const std::string& build_id,
+      const std::vector<uint64_t>& addresses) override;
+
+  size_t num_binaries() const { return binaries_.size(); }
+
+ private:
+  void IndexDirectory(const std::string& dir, int depth);
+
+  // Build id -> path of the binary.
+  std::map<std::string, std::string> binaries_;
+};
+
+// Fills in the names of the heap profile frames that have none. The frames are
+// grouped by binary, and the binaries are symbolized in parallel on up to
+// |num_threads| threads. Returns the number of frames that got a name.
+size_t SymbolizeHeapProfileFrames(TraceStorage* storage,
+                                  Symbolizer* symbolizer,
+                                  size_t num_threads);
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SYMBOLIZER_H_
@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/symbolizer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mutex>
+
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/temp_file.h"
+#include "src/trace_processor/trace_storage.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+
+// Names every address after its binary and value, and records the calls.
+class FakeSymbolizer : public Symbolizer {
+ public:
+  std::vector<std::string> Symbolize(
+      const std::string& build_id,
+      const std::vector<uint64_t>& addresses) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    calls_[build_id]++;
+    std::vector<std::string> names;
+    if (build_id == "unknown")
+      return names;
+    for (uint64_t addr : addresses)
+      names.emplace_back(build_id + ":" + std::to_string(addr));
+    return names;
+  }
+
+  std::map<std::string, int> calls() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return calls_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<std::string, int> calls_;
+};
+
+class HeapProfileFramesTest : public ::testing::Test {
+ protected:
+  int64_t AddMapping(const char* build_id, int64_t load_bias) {
+    TraceStorage::HeapProfileMappings::Row row{};
+    row.build_id = storage_.InternString(build_id);
+    row.load_bias = load_bias;
+    return storage_.mutable_heap_profile_mappings()->Insert(row);
+  }
+
+  void AddFrame(const char* name, int64_t mapping_row, int64_t rel_pc) {
+    storage_.mutable_heap_profile_frames()->Insert(
+        {storage_.InternString(name), mapping_row, rel_pc});
+  }
+
+  std::string FrameName(size_t row) {
+    return storage_.GetString(storage_.heap_profile_frames().names()[row])
+        .ToStdString();
+  }
+
+  TraceStorage storage_;
+};
+
+TEST_F(HeapProfileFramesTest, NamesUnnamedFrames) {
+  int64_t a = AddMapping("a", 0x1000);
+  int64_t b = AddMapping("b", 0);
+  int64_t no_build_id = AddMapping("", 0);
+  int64_t unknown = AddMapping("unknown", 0);
+  AddFrame("", a, 0x10);
+  AddFrame("named", a, 0x20);
+  AddFrame("", b, 0x30);
+  AddFrame("", a, 0x40);
+  AddFrame("", no_build_id, 0x50);
+  AddFrame("", unknown, 0x60);
+
+  FakeSymbolizer symbolizer;
+  EXPECT_EQ(SymbolizeHeapProfileFrames(&storage_, &symbolizer, 4), 3u);
+
+  EXPECT_EQ(FrameName(0), "a:" + std::to_string(0x1010));
+  EXPECT_EQ(FrameName(1), "named");
+  EXPECT_EQ(FrameName(2), "b:" + std::to_string(0x30));
+  EXPECT_EQ(FrameName(3), "a:" + std::to_string(0x1040));
+  EXPECT_EQ(FrameName(4), "");
+  EXPECT_EQ(FrameName(5), "");
+  // One batch per binary.
+  EXPECT_EQ(symbolizer.calls(),
+            (std::map<std::string, int>{{"a", 1}, {"b", 1}, {"unknown", 1}}));
+}
+
+template <typename T>
+void Append(std::string* buf, T value) {
+  buf->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendSym(std::string* buf,
+               uint32_t name,
+               uint8_t info,
+               uint64_t value,
+               uint64_t size) {
+  Append<uint32_t>(buf, name);
+  Append<uint8_t>(buf, info);
+  Append<uint8_t>(buf, 0);   // st_other
+  Append<uint16_t>(buf, 1);  // st_shndx
+  Append<uint64_t>(buf, value);
+  Append<uint64_t>(buf, size);
+}
+
+void AppendSection(std::string* buf,
+                   uint32_t type,
+                   uint64_t offset,
+                   uint64_t size,
+                   uint32_t link,
+                   uint64_t entsize) {
+  Append<uint32_t>(buf, 0);  // sh_name
+  Append<uint32_t>(buf, type);
+  Append<uint64_t>(buf, 0);  // sh_flags
+  Append<uint64_t>(buf, 0);  // sh_addr
+  Append<uint64_t>(buf, offset);
+  Append<uint64_t>(buf, size);
+  Append<uint32_t>(buf, link);
+  Append<uint32_t>(buf, 0);  // sh_info
+  Append<uint64_t>(buf, 8);  // sh_addralign
+  Append<uint64_t>(buf, entsize);
+}
+
+// Returns a little-endian ELF64 file with only a build id note, and a symbol
+// table with the functions foo at [0x1000, 0x1100), bar at [0x1200, 0x1300),
+// and baz at 0x2000 without a size, and the object qux at 0x3000, which does
+// not end baz. If |thumb|, the addresses of the functions have bit 0 set, as
+// for Thumb code on ARM.
+std::string MakeElf(const std::string& build_id,
+                    uint16_t machine = 0xb7 /* EM_AARCH64 */,
+                    bool thumb = false) {
+  constexpr uint64_t kEhdrSize = 64;
+  constexpr uint64_t kShdrSize = 64;
+  constexpr uint64_t kSymSize = 24;
+  constexpr uint8_t kFunc = 2;
+  constexpr uint8_t kObject = 1;
+
+  std::string note;
+  Append<uint32_t>(&note, 4);  // namesz
+  Append<uint32_t>(&note, static_cast<uint32_t>(build_id.size()));
+  Append<uint32_t>(&note, 3);  // NT_GNU_BUILD_ID
+  note.append("GNU", 4);
+  note.append(build_id);
+  note.resize((note.size() + 7) & ~size_t(7));
+
+  std::string strtab("\0foo\0bar\0baz\0qux\0", 17);
+  strtab.resize((strtab.size() + 7) & ~size_t(7));
+
+  std::string symtab;
+  AppendSym(&symtab, 0, 0, 0, 0);
+  uint64_t thumb_bit = thumb ? 1 : 0;
+  AppendSym(&symtab, 1, kFunc, 0x1000 | thumb_bit, 0x100);
+  AppendSym(&symtab, 5, kFunc, 0x1200 | thumb_bit, 0x100);
+  AppendSym(&symtab, 9, kFunc, 0x2000 | thumb_bit, 0);
+  AppendSym(&symtab, 13, kObject, 0x3000, 0x10);
+
+  uint64_t note_offset = kEhdrSize;
+  uint64_t strtab_offset = note_offset + note.size();
+  uint64_t symtab_offset = strtab_offset + strtab.size();
+  uint64_t shdrs_offset = symtab_offset + symtab.size();
+
+  std::string elf("\x7f" "ELF", 4);
+  Append<uint8_t>(&elf, 2);  // ELFCLASS64
+  Append<uint8_t>(&elf, 1);  // ELFDATA2LSB
+  Append<uint8_t>(&elf, 1);  // EV_CURRENT
+  elf.resize(16);
+  Append<uint16_t>(&elf, 3);     // ET_DYN
+  Append<uint16_t>(&elf, machine);
+  Append<uint32_t>(&elf, 1);     // e_version
+  Append<uint64_t>(&elf, 0);     // e_entry
+  Append<uint64_t>(&elf, 0);     // e_phoff
+  Append<uint64_t>(&elf, shdrs_offset);
+  Append<uint32_t>(&elf, 0);  // e_flags
+  Append<uint16_t>(&elf, kEhdrSize);
+  Append<uint16_t>(&elf, 0);  // e_phentsize
+  Append<uint16_t>(&elf, 0);  // e_phnum
+  Append<uint16_t>(&elf, kShdrSize);
+  Append<uint16_t>(&elf, 4);  // e_shnum
+  Append<uint16_t>(&elf, 0);  // e_shstrndx
+  EXPECT_EQ(elf.size(), kEhdrSize);
+
+  elf += note + strtab + symtab;
+  AppendSection(&elf, 0, 0, 0, 0, 0);
+  AppendSection(&elf, 7 /* SHT_NOTE */, note_offset, note.size(), 0, 0);
+  AppendSection(&elf, 2 /* SHT_SYMTAB */, symtab_offset, symtab.size(), 3,
+                kSymSize);
+  AppendSection(&elf, 3 /* SHT_STRTAB */, strtab_offset, strtab.size(), 0, 0);
+  return elf;
+}
+
+void WriteFile(const std::string& path, const std::string& data) {
+  base::ScopedFile fd(base::OpenFile(path, O_WRONLY | O_CREAT | O_TRUNC, 0600));
+  ASSERT_TRUE(fd);
+  ASSERT_EQ(write(*fd, data.data(), data.size()),
+            static_cast<ssize_t>(data.size()));
+}
+
+TEST(LocalSymbolizerTest, Symbolize) {
+  const std::string build_id("\x01\x23\x45\x67\x89\xab\xcd\xef", 8);
+  base::TempDir dir = base::TempDir::Create();
+  std::string subdir = dir.path() + "/lib64";
+  ASSERT_EQ(mkdir(subdir.c_str(), 0700), 0);
+  std::string elf_path = subdir + "/libfoo.so";
+  std::string other_path = dir.path() + "/README";
+  WriteFile(elf_path, MakeElf(build_id));
+  WriteFile(other_path, "not an ELF file");
+
+  LocalSymbolizer symbolizer(dir.path());
+  EXPECT_EQ(symbolizer.num_binaries(), 1u);
+  EXPECT_THAT(symbolizer.Symbolize(
+                  build_id, {0x1000, 0x10ff, 0x1100, 0x1250, 0x2345, 0x3000}),
+              ElementsAre("foo", "foo", "", "bar", "baz", "baz"));
+  EXPECT_THAT(symbolizer.Symbolize("other", {0x1000}), ElementsAre());
+
+  unlink(elf_path.c_str());
+  unlink(other_path.c_str());
+  rmdir(subdir.c_str());
+}
+
+TEST(LocalSymbolizerTest, ClearsThumbBit) {
+  const std::string build_id("\x01\x23\x45\x67\x89\xab\xcd\xef", 8);
+  base::TempDir dir = base::TempDir::Create();
+  std::string elf_path = dir.path() + "/libfoo.so";
+  WriteFile(elf_path, MakeElf(build_id, 40 /* EM_ARM */, /*thumb=*/true));
+
+  LocalSymbolizer symbolizer(dir.path());
+  EXPECT_THAT(symbolizer.Symbolize(build_id, {0x1000, 0x10ff, 0x1100, 0x1200}),
+              ElementsAre("foo", "foo", "", "bar"));
+  unlink(elf_path.c_str());
+}
+
+// Offsets and sizes out of the bounds of the file must be rejected before
+// anything is allocated for them.
+TEST(LocalSymbolizerTest, MalformedElf) {
+  const std::string build_id("\x01\x23\x45\x67\x89\xab\xcd\xef", 8);
+  base::TempDir dir = base::TempDir::Create();
+  std::string elf_path = dir.path() + "/libfoo.so";
+  std::string elf = MakeElf(build_id);
+
+  // Fields of the symtab section header, the third of the table at the end.
+  constexpr size_t kShdrSize = 64;
+  size_t symtab_shdr = elf.size() - 2 * kShdrSize;
+  size_t sh_offset = symtab_shdr + 24;
+  size_t sh_size = symtab_shdr + 32;
+
+  const uint64_t kHuge = uint64_t(1) << 62;
+  for (size_t field : {sh_offset, sh_size}) {
+    std::string bad_elf = elf;
+    memcpy(&bad_elf[field], &kHuge, sizeof(kHuge));
+    WriteFile(elf_path, bad_elf);
+    LocalSymbolizer symbolizer(dir.path());
+    ASSERT_EQ(symbolizer.num_binaries(), 1u);
+    EXPECT_THAT(symbolizer.Symbolize(build_id, {0x1000}), ElementsAre(""));
+  }
+
+  // Section header table out of the file.
+  std::string bad_elf = elf;
+  memcpy(&bad_elf[40] /* e_shoff */, &kHuge, sizeof(kHuge));
+  WriteFile(elf_path, bad_elf);
+  LocalSymbolizer symbolizer(dir.path());
+  EXPECT_EQ(symbolizer.num_binaries(), 0u);
+  unlink(elf_path.c_str());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
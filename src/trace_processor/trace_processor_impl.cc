@@ -19,6 +19,7 @@
 #include <inttypes.h>
 #include <algorithm>
 #include <functional>
+#include <thread>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/string_utils.h"
@@ -49,6 +50,7 @@
 #include "src/trace_processor/sqlite3_str_split.h"
 #include "src/trace_processor/stats_table.h"
 #include "src/trace_processor/string_table.h"
+#include "src/trace_processor/symbolizer.h"
 #include "src/trace_processor/syscall_tracker.h"
 #include "src/trace_processor/table.h"
 #include "src/trace_processor/thread_table.h"
@@ -319,6 +321,15 @@ void TraceProcessorImpl::NotifyEndOfFile() {
   context_.sorter->ExtractEventsForced();
   context_.event_tracker->FlushPendingEvents();
   BuildBoundsTable(*db_, context_.storage->GetTraceTimestampBoundsNs());
+
+  if (!cfg_.symbol_dir.empty()) {
+    LocalSymbolizer symbolizer(cfg_.symbol_dir);
+    size_t symbolized = SymbolizeHeapProfileFrames(
+        context_.storage.get(), &symbolizer,
+        std::max(1u, std::thread::hardware_concurrency()));
+    PERFETTO_DLOG("Symbolized %zu frames using %zu binaries", symbolized,
+                  symbolizer.num_binaries());
+  }
 }
 
 TraceProcessor::Iterator TraceProcessorImpl::ExecuteQuery(
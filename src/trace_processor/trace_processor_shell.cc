@@ -457,7 +457,9 @@ void PrintUsage(char** argv) {
       " -q FILE              Read and execute an SQL query from a file.\n"
       " -e FILE              Export the trace into a SQLite database.\n"
       " --run-metrics x,y,z   Runs a comma separated list of metrics and "
-      "prints the result as a TraceMetrics proto to stdout.\n",
+      "prints the result as a TraceMetrics proto to stdout.\n"
+      " --symbol-dir DIR     Symbolizes heap profile frames using the "
+      "unstripped binaries in DIR.\n",
       argv[0]);
 }
 
@@ -470,6 +472,7 @@ int TraceProcessorMain(int argc, char** argv) {
   const char* query_file_path = nullptr;
   const char* sqlite_file_path = nullptr;
   const char* metric_names = nullptr;
+  const char* symbol_dir = nullptr;
   bool launch_shell = true;
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--version") == 0) {
@@ -502,6 +505,13 @@ int TraceProcessorMain(int argc, char** argv) {
       }
       metric_names = argv[i];
       continue;
+    } else if (strcmp(argv[i], "--symbol-dir") == 0) {
+      if (++i == argc) {
+        PrintUsage(argv);
+        return 1;
+      }
+      symbol_dir = argv[i];
+      continue;
     } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
       PrintUsage(argv);
       return 0;
@@ -519,6 +529,8 @@ int TraceProcessorMain(int argc, char** argv) {
 
   // Load the trace file into the trace processor.
   Config config;
+  if (symbol_dir)
+    config.symbol_dir = symbol_dir;
   std::unique_ptr<TraceProcessor> tp = TraceProcessor::CreateInstance(config);
   base::ScopedFile fd(base::OpenFile(trace_file_path, O_RDONLY));
   if (!fd) {
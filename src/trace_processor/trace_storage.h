@@ -606,6 +606,8 @@ class TraceStorage {
       return static_cast<int64_t>(names_.size()) - 1;
     }
 
+    void SetName(uint32_t row, StringId name_id) { names_[row] = name_id; }
+
     const std::deque<StringId>& names() const { return names_; }
     const std::deque<int64_t>& mappings() const { return mappings_; }
     const std::deque<int64_t>& rel_pcs() const { return rel_pcs_; }
@@ -16,7 +16,12 @@
 
 #include "src/traced/probes/android_log/android_log_data_source.h"
 
+#include <string.h>
+#include <sys/socket.h>
+
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/file_utils.h"
+#include "perfetto/base/hash.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/optional.h"
 #include "perfetto/base/scoped_file.h"
@@ -35,7 +40,14 @@ namespace perfetto {
 
 namespace {
 
-constexpr size_t kBufSize = base::kPageSize;
+// logd never sends entries larger than LOGGER_ENTRY_MAX_LEN (5 KB) and in
+// practice they are way smaller than a page.
+constexpr size_t kRecvSlotSize = base::kPageSize;
+
+// Don't hold the message loop for too long. If there are more than this many
+// bytes in the socket, stop and parse the remaining ones in another task.
+constexpr size_t kMaxBytesPerTask = 512 * 1024;
+
 const char kLogTagsPath[] = "/system/etc/event-log-tags";
 const char kLogdrSocket[] = "/dev/socket/logdr";
 
@@ -127,7 +139,7 @@ AndroidLogDataSource::AndroidLogDataSource(DataSourceConfig ds_config,
     filter_tags_.emplace(&filter_tags_strbuf_[it.first], it.second);
 
   min_prio_ = cfg.min_prio();
-  buf_ = base::PagedMemory::Allocate(kBufSize);
+  buf_ = base::PagedMemory::Allocate(kRecvSlotSize * kNumRecvSlots);
 }
 
 AndroidLogDataSource::~AndroidLogDataSource() {
@@ -207,82 +219,92 @@ void AndroidLogDataSource::ReadLogSocket() {
   TraceWriter::TracePacketHandle packet;
   protos::pbzero::AndroidLogPacket* log_packet = nullptr;
   size_t num_events = 0;
-  bool stop = false;
-  ssize_t rsize;
-  while (!stop && (rsize = logdr_sock_.Receive(buf_.Get(), kBufSize)) > 0) {
-    num_events++;
-    stats_.num_total++;
-    // Don't hold the message loop for too long. If there are so many events
-    // in the queue, stop at some point and parse the remaining ones in another
-    // task (posted after this while loop).
-    if (num_events > 500) {
-      stop = true;
-      auto weak_this = weak_factory_.GetWeakPtr();
-      task_runner_->PostTask([weak_this] {
-        if (weak_this)
-          weak_this->ReadLogSocket();
-      });
-    }
-    char* buf = reinterpret_cast<char*>(buf_.Get());
-    PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(buf) % 16 == 0);
-    size_t payload_size = reinterpret_cast<logger_entry_v4*>(buf)->len;
-    size_t hdr_size = reinterpret_cast<logger_entry_v4*>(buf)->hdr_size;
-    if (payload_size + hdr_size > static_cast<size_t>(rsize)) {
-      PERFETTO_DLOG(
-          "Invalid Android log frame (hdr: %zu, payload: %zu, rsize: %zd)",
-          hdr_size, payload_size, rsize);
-      stats_.num_failed++;
-      continue;
-    }
-    char* const end = buf + hdr_size + payload_size;
-
-    // In older versions of Android the logger_entry struct can contain less
-    // fields. Copy that in a temporary struct, so that unset fields are
-    // always zero-initialized.
-    logger_entry_v4 entry{};
-    memcpy(&entry, buf, std::min(hdr_size, sizeof(entry)));
-    buf += hdr_size;
-
-    if (!packet) {
-      // Lazily add the packet on the first event. This is to avoid creating
-      // empty packets if there are no events in a task.
-      packet = writer_->NewTracePacket();
-      packet->set_timestamp(
-          static_cast<uint64_t>(base::GetBootTimeNs().count()));
-      log_packet = packet->set_android_log();
-    }
-
-    protos::pbzero::AndroidLogPacket::LogEvent* evt = nullptr;
-
-    if (entry.lid == AndroidLogConfig::AndroidLogId::LID_EVENTS) {
-      // Entries in the EVENTS buffer are special, they are binary encoded.
-      // See https://developer.android.com/reference/android/util/EventLog.
-      if (!ParseBinaryEvent(buf, end, log_packet, &evt)) {
-        PERFETTO_DLOG("Failed to parse Android log binary event");
+  size_t bytes_read = 0;
+  size_t num_msgs;
+  while (bytes_read < kMaxBytesPerTask && (num_msgs = ReceiveBatch()) > 0) {
+    for (size_t i = 0; i < num_msgs; i++) {
+      const size_t rsize = recv_sizes_[i];
+      num_events++;
+      stats_.num_total++;
+      bytes_read += rsize;
+      char* buf = reinterpret_cast<char*>(buf_.Get()) + i * kRecvSlotSize;
+      PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(buf) % 16 == 0);
+      if (rsize < sizeof(uint16_t) * 2) {
         stats_.num_failed++;
         continue;
       }
-    } else {
-      if (!ParseTextEvent(buf, end, log_packet, &evt)) {
-        PERFETTO_DLOG("Failed to parse Android log text event");
+      size_t payload_size = reinterpret_cast<logger_entry_v4*>(buf)->len;
+      size_t hdr_size = reinterpret_cast<logger_entry_v4*>(buf)->hdr_size;
+      if (payload_size + hdr_size > rsize) {
+        PERFETTO_DLOG(
+            "Invalid Android log frame (hdr: %zu, payload: %zu, rsize: %zu)",
+            hdr_size, payload_size, rsize);
         stats_.num_failed++;
         continue;
       }
-    }
-    if (!evt) {
-      // Parsing succeeded but the event was skipped due to filters.
-      stats_.num_skipped++;
-      continue;
-    }
+      char* const end = buf + hdr_size + payload_size;
+
+      // In older versions of Android the logger_entry struct can contain less
+      // fields. Copy that in a temporary struct, so that unset fields are
+      // always zero-initialized.
+      logger_entry_v4 entry{};
+      memcpy(&entry, buf, std::min(hdr_size, sizeof(entry)));
+      buf += hdr_size;
+
+      if (!packet) {
+        // Lazily add the packet on the first event. This is to avoid creating
+        // empty packets if there are no events in a task.
+        packet = writer_->NewTracePacket();
+        packet->set_timestamp(
+            static_cast<uint64_t>(base::GetBootTimeNs().count()));
+        log_packet = packet->set_android_log();
+      }
+
+      protos::pbzero::AndroidLogPacket::LogEvent* evt = nullptr;
+
+      if (entry.lid == AndroidLogConfig::AndroidLogId::LID_EVENTS) {
+        // Entries in the EVENTS buffer are special, they are binary encoded.
+        // See https://developer.android.com/reference/android/util/EventLog.
+        if (!ParseBinaryEvent(buf, end, log_packet, &evt)) {
+          PERFETTO_DLOG("Failed to parse Android log binary event");
+          stats_.num_failed++;
+          continue;
+        }
+      } else {
+        if (!ParseTextEvent(buf, end, log_packet, &evt)) {
+          PERFETTO_DLOG("Failed to parse Android log text event");
+          stats_.num_failed++;
+          continue;
+        }
+      }
+      if (!evt) {
+        // Parsing succeeded but the event was skipped due to filters.
+        stats_.num_skipped++;
+        continue;
+      }
 
-    // Add the common fields to the event.
-    uint64_t ts = entry.sec * 1000000000ULL + entry.nsec;
-    evt->set_timestamp(ts);
-    evt->set_log_id(static_cast<protos::pbzero::AndroidLogId>(entry.lid));
-    evt->set_pid(entry.pid);
-    evt->set_tid(static_cast<int32_t>(entry.tid));
-    evt->set_uid(static_cast<int32_t>(entry.uid));
-  }  // while(logdr_sock_.Receive())
+      // Add the common fields to the event.
+      uint64_t ts = entry.sec * 1000000000ULL + entry.nsec;
+      evt->set_timestamp(ts);
+      evt->set_log_id(static_cast<protos::pbzero::AndroidLogId>(entry.lid));
+      evt->set_pid(entry.pid);
+      evt->set_tid(static_cast<int32_t>(entry.tid));
+      evt->set_uid(static_cast<int32_t>(entry.uid));
+    }  // for (msgs)
+  }    // while(ReceiveBatch())
+
+  if (log_packet)
+    EmitInternedTags(log_packet);
+
+  if (bytes_read >= kMaxBytesPerTask) {
+    // There might be more data in the socket. Yield to other tasks and
+    // continue from where we left in a new task.
+    auto weak_this = weak_factory_.GetWeakPtr();
+    task_runner_->PostTask([weak_this] {
+      if (weak_this)
+        weak_this->ReadLogSocket();
+    });
+  }
 
   // Only print the log message if we have seen a bunch of events. This is to
   // avoid that we keep re-triggering the log socket by writing into the log
@@ -291,6 +313,83 @@ void AndroidLogDataSource::ReadLogSocket() {
     PERFETTO_DLOG("Seen %zu Android log events", num_events);
 }
 
+size_t AndroidLogDataSource::ReceiveBatch() {
+  char* buf = reinterpret_cast<char*>(buf_.Get());
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  // Each entry is a separate datagram, recvmmsg() saves a syscall per entry.
+  struct mmsghdr msgs[kNumRecvSlots];
+  struct iovec iovs[kNumRecvSlots];
+  memset(msgs, 0, sizeof(msgs));
+  for (size_t i = 0; i < kNumRecvSlots; i++) {
+    iovs[i].iov_base = buf + i * kRecvSlotSize;
+    iovs[i].iov_len = kRecvSlotSize;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  int res = PERFETTO_EINTR(
+      recvmmsg(logdr_sock_.fd(), msgs, kNumRecvSlots, MSG_DONTWAIT, nullptr));
+  if (res <= 0)
+    return 0;
+  const size_t num_msgs = static_cast<size_t>(res);
+  for (size_t i = 0; i < num_msgs; i++) {
+    // Truncated entries are reported as empty, so they are counted as failed.
+    bool truncated = msgs[i].msg_hdr.msg_flags & MSG_TRUNC;
+    recv_sizes_[i] = truncated ? 0 : msgs[i].msg_len;
+  }
+  return num_msgs;
+#else
+  size_t num_msgs = 0;
+  for (; num_msgs < kNumRecvSlots; num_msgs++) {
+    ssize_t rsize =
+        logdr_sock_.Receive(buf + num_msgs * kRecvSlotSize, kRecvSlotSize);
+    if (rsize <= 0)
+      break;
+    recv_sizes_[num_msgs] = static_cast<size_t>(rsize);
+  }
+  return num_msgs;
+#endif
+}
+
+void AndroidLogDataSource::SetInternedTag(
+    protos::pbzero::AndroidLogPacket::LogEvent* evt,
+    const char* tag,
+    size_t tag_len) {
+  base::Hash hash;
+  hash.Update(tag, tag_len);
+  auto it_and_inserted = interned_tag_ids_.emplace(
+      hash.digest(), static_cast<uint32_t>(interned_tags_.size() + 1));
+  uint32_t iid = it_and_inserted.first->second;
+  if (it_and_inserted.second) {
+    interned_tags_.emplace_back(
+        static_cast<uint32_t>(interned_tags_strbuf_.size()),
+        static_cast<uint32_t>(tag_len));
+    interned_tags_strbuf_.append(tag, tag_len);
+  } else {
+    const auto& interned = interned_tags_[iid - 1];
+    if (interned.second != tag_len ||
+        memcmp(&interned_tags_strbuf_[interned.first], tag, tag_len) != 0) {
+      // Hash collision.
+      evt->set_tag(tag, tag_len);
+      return;
+    }
+  }
+  evt->set_tag_iid(iid);
+}
+
+void AndroidLogDataSource::EmitInternedTags(
+    protos::pbzero::AndroidLogPacket* packet) {
+  for (size_t i = 0; i < interned_tags_.size(); i++) {
+    auto* interned_tag = packet->add_interned_tags();
+    interned_tag->set_iid(static_cast<uint32_t>(i + 1));
+    interned_tag->set_name(&interned_tags_strbuf_[interned_tags_[i].first],
+                           interned_tags_[i].second);
+  }
+  interned_tag_ids_.clear();
+  interned_tags_.clear();
+  interned_tags_strbuf_.clear();
+}
+
 bool AndroidLogDataSource::ParseTextEvent(
     const char* start,
     const char* end,
@@ -313,10 +412,9 @@ bool AndroidLogDataSource::ParseTextEvent(
     return true;
 
   // Find the null terminator that separates |tag| from |message|.
-  const char* str_end;
-  for (str_end = buf; str_end < end && *str_end; str_end++) {
-  }
-  if (str_end >= end - 2)
+  const char* str_end = static_cast<const char*>(
+      memchr(buf, '\0', static_cast<size_t>(end - buf)));
+  if (!str_end || str_end >= end - 2)
     return false;
 
   auto tag = base::StringView(buf, static_cast<size_t>(str_end - buf));
@@ -326,7 +424,7 @@ bool AndroidLogDataSource::ParseTextEvent(
   auto* evt = packet->add_events();
   *out_evt = evt;
   evt->set_prio(static_cast<protos::pbzero::AndroidLogPriority>(prio));
-  evt->set_tag(tag.data(), tag.size());
+  SetInternedTag(evt, tag.data(), tag.size());
 
   buf = str_end + 1;  // Move |buf| to the start of the message.
   size_t msg_len = static_cast<size_t>(end - buf);
@@ -367,20 +465,20 @@ bool AndroidLogDataSource::ParseBinaryEvent(
 
   auto* evt = packet->add_events();
   *out_evt = evt;
-  evt->set_tag(fmt->name.c_str());
+  SetInternedTag(evt, fmt->name.data(), fmt->name.size());
   size_t field_num = 0;
   while (buf < end) {
     char type = *(buf++);
     if (field_num >= fmt->fields.size())
       return true;
-    const char* field_name = fmt->fields[field_num].c_str();
+    const std::string& field_name = fmt->fields[field_num];
     switch (type) {
       case EVENT_TYPE_INT: {
         int32_t value;
         if (!ReadAndAdvance(&buf, end, &value))
           return false;
         auto* arg = evt->add_args();
-        arg->set_name(field_name);
+        arg->set_name(field_name.data(), field_name.size());
         arg->set_int_value(value);
         field_num++;
         break;
@@ -390,7 +488,7 @@ bool AndroidLogDataSource::ParseBinaryEvent(
         if (!ReadAndAdvance(&buf, end, &value))
           return false;
         auto* arg = evt->add_args();
-        arg->set_name(field_name);
+        arg->set_name(field_name.data(), field_name.size());
         arg->set_int_value(value);
         field_num++;
         break;
@@ -400,7 +498,7 @@ bool AndroidLogDataSource::ParseBinaryEvent(
         if (!ReadAndAdvance(&buf, end, &value))
           return false;
         auto* arg = evt->add_args();
-        arg->set_name(field_name);
+        arg->set_name(field_name.data(), field_name.size());
         arg->set_float_value(value);
         field_num++;
         break;
@@ -410,7 +508,7 @@ bool AndroidLogDataSource::ParseBinaryEvent(
         if (!ReadAndAdvance(&buf, end, &len) || buf + len > end)
           return false;
         auto* arg = evt->add_args();
-        arg->set_name(field_name);
+        arg->set_name(field_name.data(), field_name.size());
         arg->set_string_value(buf, len);
         buf += len;
         field_num++;
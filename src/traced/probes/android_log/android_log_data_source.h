@@ -17,6 +17,8 @@
 #ifndef SRC_TRACED_PROBES_ANDROID_LOG_ANDROID_LOG_DATA_SOURCE_H_
 #define SRC_TRACED_PROBES_ANDROID_LOG_ANDROID_LOG_DATA_SOURCE_H_
 
+#include <array>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -83,10 +85,28 @@ class AndroidLogDataSource : public ProbesDataSource {
   base::WeakPtr<AndroidLogDataSource> GetWeakPtr() const;
 
  private:
+  // Max number of log entries received with a single syscall.
+  static constexpr size_t kNumRecvSlots = 32;
+
   void EnableSocketWatchTask(bool);
   void OnSocketDataAvailable();
   void ReadLogSocket();
 
+  // Drains up to kNumRecvSlots messages from the logdr socket, one per slot of
+  // |buf_|, and stores their sizes into |recv_sizes_|. Returns the number of
+  // messages received, 0 if the socket is empty.
+  size_t ReceiveBatch();
+
+  // Sets the tag of |evt| to the iid of |tag|, interning it in the current
+  // packet if not seen before. See AndroidLogPacket.interned_tags.
+  void SetInternedTag(protos::pbzero::AndroidLogPacket_LogEvent* evt,
+                      const char* tag,
+                      size_t tag_len);
+
+  // Appends the tags interned since the last call to |packet| and clears the
+  // interning state, so that the next packet starts from scratch.
+  void EmitInternedTags(protos::pbzero::AndroidLogPacket* packet);
+
   // Parses one line of /system/etc/event-log-tags.
   bool ParseEventLogDefinitionLine(char* line, size_t len);
 
@@ -128,9 +148,21 @@ class AndroidLogDataSource : public ProbesDataSource {
   // /system/etc/event-log-tags when starting.
   std::unordered_map<int, EventFormat> event_formats_;
 
-  // Buffer used for parsing. It's safer (read: fails sooner) than using the
-  // stack, due to red zones around the boundaries.
+  // Buffer used for receiving and parsing, split into kNumRecvSlots slots of
+  // one page each. Each slot holds one log entry. It's safer (read: fails
+  // sooner) than using the stack, due to red zones around the boundaries.
   base::PagedMemory buf_;
+  std::array<size_t, kNumRecvSlots> recv_sizes_{};
+
+  // Tags interned in the packet being written. Tags are keyed by their hash;
+  // on the (unlikely) event of a collision the tag is just not interned.
+  // iids are 1-based indexes into |interned_tags_|, which in turn point into
+  // |interned_tags_strbuf_| (the tags can't point into |buf_|, as that gets
+  // overwritten by the next ReceiveBatch()).
+  std::unordered_map<uint64_t, uint32_t> interned_tag_ids_;
+  std::vector<std::pair<uint32_t, uint32_t>> interned_tags_;  // offset, size.
+  std::string interned_tags_strbuf_;
+
   Stats stats_;
   bool fd_watch_task_enabled_ = false;
 
@@ -0,0 +1,191 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/unix_socket.h"
+#include "perfetto/base/utils.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/traced/probes/android_log/android_log_data_source.h"
+#include "src/tracing/core/null_trace_writer.h"
+
+namespace {
+
+using perfetto::AndroidLogDataSource;
+using perfetto::DataSourceConfig;
+using perfetto::NullTraceWriter;
+
+// Number of entries queued in the fake logdr socket for each iteration. Kept
+// well below what fits in the default socket send buffer.
+constexpr size_t kEventsPerIteration = 128;
+
+constexpr uint32_t kLidDefault = 0;
+constexpr uint32_t kLidEvents = 2;
+
+const char kEventLogTags[] =
+    "30023 am_kill (User|1|5),(PID|1|5),(Process Name|3),(OomAdj|1|5),"
+    "(Reason|3)\n"
+    "30053 am_uid_stopped (UID|1|5)\n";
+
+const char* const kTags[] = {"ActivityManager", "libprocessgroup", "Zygote",
+                             "chatty", "WindowManager", "PackageManager",
+                             "InputReader", "SurfaceFlinger"};
+
+// Mirrors logger_entry_v4 in android_log_data_source.cc.
+struct LogEntryHeader {
+  uint16_t len;
+  uint16_t hdr_size;
+  int32_t pid;
+  uint32_t tid;
+  uint32_t sec;
+  uint32_t nsec;
+  uint32_t lid;
+  uint32_t uid;
+};
+
+std::vector<uint8_t> MakeEntry(uint32_t lid, const std::string& payload) {
+  LogEntryHeader hdr{};
+  hdr.len = static_cast<uint16_t>(payload.size());
+  hdr.hdr_size = sizeof(hdr);
+  hdr.pid = 1234;
+  hdr.tid = 1235;
+  hdr.sec = 1546125239;
+  hdr.nsec = 679172326;
+  hdr.lid = lid;
+  hdr.uid = 1000;
+  std::vector<uint8_t> entry(sizeof(hdr) + payload.size());
+  memcpy(entry.data(), &hdr, sizeof(hdr));
+  memcpy(entry.data() + sizeof(hdr), payload.data(), payload.size());
+  return entry;
+}
+
+std::vector<uint8_t> MakeTextEntry(const char* tag, const std::string& msg) {
+  std::string payload;
+  payload.push_back(4);  // PRIO_INFO.
+  payload.append(tag);
+  payload.push_back('\0');
+  payload.append(msg);
+  payload.push_back('\0');
+  return MakeEntry(kLidDefault, payload);
+}
+
+template <typename T>
+void AppendBinary(std::string* payload, T value) {
+  payload->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// An am_kill event: [0,31730,android.process.acore,985,empty #17].
+std::vector<uint8_t> MakeBinaryEntry() {
+  static const char kProcName[] = "android.process.acore";
+  static const char kReason[] = "empty #17";
+  std::string payload;
+  AppendBinary<int32_t>(&payload, 30023);  // Event id.
+  AppendBinary<uint8_t>(&payload, 3);      // EVENT_TYPE_LIST.
+  AppendBinary<uint8_t>(&payload, 5);      // List size.
+  AppendBinary<uint8_t>(&payload, 0);      // EVENT_TYPE_INT.
+  AppendBinary<int32_t>(&payload, 0);
+  AppendBinary<uint8_t>(&payload, 0);
+  AppendBinary<int32_t>(&payload, 31730);
+  AppendBinary<uint8_t>(&payload, 2);  // EVENT_TYPE_STRING.
+  AppendBinary<uint32_t>(&payload, sizeof(kProcName) - 1);
+  payload.append(kProcName, sizeof(kProcName) - 1);
+  AppendBinary<uint8_t>(&payload, 0);
+  AppendBinary<int32_t>(&payload, 985);
+  AppendBinary<uint8_t>(&payload, 2);
+  AppendBinary<uint32_t>(&payload, sizeof(kReason) - 1);
+  payload.append(kReason, sizeof(kReason) - 1);
+  return MakeEntry(kLidEvents, payload);
+}
+
+// Feeds the data source through one end of a socketpair, standing in for
+// /dev/socket/logdr.
+class FakeLogdDataSource : public AndroidLogDataSource {
+ public:
+  FakeLogdDataSource(perfetto::base::TaskRunner* task_runner,
+                     perfetto::base::UnixSocketRaw logdr_sock)
+      : AndroidLogDataSource(
+            DataSourceConfig(),
+            task_runner,
+            0,
+            std::unique_ptr<NullTraceWriter>(new NullTraceWriter())),
+        logdr_sock_(std::move(logdr_sock)) {}
+
+  std::string ReadEventLogDefinitions() override { return kEventLogTags; }
+
+  perfetto::base::UnixSocketRaw ConnectLogdrSocket() override {
+    return std::move(logdr_sock_);
+  }
+
+ private:
+  perfetto::base::UnixSocketRaw logdr_sock_;
+};
+
+void BM_AndroidLogRead(benchmark::State& state, bool binary) {
+  perfetto::base::UnixSocketRaw send_sock;
+  perfetto::base::UnixSocketRaw recv_sock;
+  std::tie(send_sock, recv_sock) =
+      perfetto::base::UnixSocketRaw::CreatePair(perfetto::base::SockType::kDgram);
+  PERFETTO_CHECK(send_sock && recv_sock);
+
+  perfetto::base::TestTaskRunner task_runner;
+  FakeLogdDataSource data_source(&task_runner, std::move(recv_sock));
+  data_source.Start();
+  char cmd[64];
+  PERFETTO_CHECK(send_sock.Receive(cmd, sizeof(cmd)) > 0);
+
+  std::vector<std::vector<uint8_t>> entries;
+  for (size_t i = 0; i < kEventsPerIteration; i++) {
+    if (binary) {
+      entries.emplace_back(MakeBinaryEntry());
+    } else {
+      const char* tag = kTags[i % perfetto::base::ArraySize(kTags)];
+      entries.emplace_back(MakeTextEntry(
+          tag, "Killing 11660:com.google.android.videos/u0a168 (adj 985): "
+               "empty #" + std::to_string(i)));
+    }
+  }
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (const auto& entry : entries)
+      PERFETTO_CHECK(send_sock.Send(entry.data(), entry.size()) > 0);
+    state.ResumeTiming();
+
+    data_source.Flush(1, [] {});
+  }
+  PERFETTO_CHECK(data_source.stats().num_failed == 0);
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(kEventsPerIteration));
+}
+
+}  // namespace
+
+static void BM_AndroidLogReadTextEvents(benchmark::State& state) {
+  BM_AndroidLogRead(state, /*binary=*/false);
+}
+BENCHMARK(BM_AndroidLogReadTextEvents);
+
+static void BM_AndroidLogReadBinaryEvents(benchmark::State& state) {
+  BM_AndroidLogRead(state, /*binary=*/true);
+}
+BENCHMARK(BM_AndroidLogReadBinaryEvents);
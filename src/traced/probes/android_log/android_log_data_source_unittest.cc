@@ -85,6 +85,19 @@ class AndroidLogDataSourceTest : public ::testing::Test {
     task_runner_.RunUntilCheckpoint("on_flush");
   }
 
+  // Returns the tag of the |index|-th event of |log|, resolving interned tags.
+  static std::string GetTag(const protos::AndroidLogPacket& log, int index) {
+    const auto& evt = log.events(index);
+    if (!evt.has_tag_iid())
+      return evt.tag();
+    for (const auto& interned_tag : log.interned_tags()) {
+      if (interned_tag.iid() == evt.tag_iid())
+        return interned_tag.name();
+    }
+    ADD_FAILURE() << "Unknown tag iid " << evt.tag_iid();
+    return "";
+  }
+
   base::TestTaskRunner task_runner_;
   std::unique_ptr<TestAndroidLogDataSource> data_source_;
   TraceWriterForTesting* writer_raw_;
@@ -225,7 +238,7 @@ TEST_F(AndroidLogDataSourceTest, TextEvents) {
   EXPECT_EQ(decoded.Get(0).uid(), 1000);
   EXPECT_EQ(decoded.Get(0).prio(), protos::AndroidLogPriority::PRIO_INFO);
   EXPECT_EQ(decoded.Get(0).timestamp(), 1546125239679172326LL);
-  EXPECT_EQ(decoded.Get(0).tag(), "ActivityManager");
+  EXPECT_EQ(GetTag(packet->android_log(), 0), "ActivityManager");
   EXPECT_EQ(
       decoded.Get(0).message(),
       "Killing 11660:com.google.android.videos/u0a168 (adj 985): empty #17");
@@ -236,7 +249,7 @@ TEST_F(AndroidLogDataSourceTest, TextEvents) {
   EXPECT_EQ(decoded.Get(1).uid(), 1000);
   EXPECT_EQ(decoded.Get(1).prio(), protos::AndroidLogPriority::PRIO_WARN);
   EXPECT_EQ(decoded.Get(1).timestamp(), 1546125239683537170LL);
-  EXPECT_EQ(decoded.Get(1).tag(), "libprocessgroup");
+  EXPECT_EQ(GetTag(packet->android_log(), 1), "libprocessgroup");
   EXPECT_EQ(decoded.Get(1).message(),
             "kill(-11660, 9) failed: No such process");
 
@@ -246,10 +259,45 @@ TEST_F(AndroidLogDataSourceTest, TextEvents) {
   EXPECT_EQ(decoded.Get(2).uid(), 0);
   EXPECT_EQ(decoded.Get(2).prio(), protos::AndroidLogPriority::PRIO_INFO);
   EXPECT_EQ(decoded.Get(2).timestamp(), 1546125239719458684LL);
-  EXPECT_EQ(decoded.Get(2).tag(), "Zygote");
+  EXPECT_EQ(GetTag(packet->android_log(), 2), "Zygote");
   EXPECT_EQ(decoded.Get(2).message(), "Process 11660 exited due to signal (9)");
 }
 
+TEST_F(AndroidLogDataSourceTest, TextEventsInternedTags) {
+  DataSourceConfig cfg;
+  CreateInstance(cfg);
+  EXPECT_CALL(*data_source_, ReadEventLogDefinitions()).WillOnce(Return(""));
+
+  // Send enough events to need more than one batched receive.
+  std::vector<std::vector<uint8_t>> events;
+  for (int i = 0; i < 30; i++)
+    events.insert(events.end(), kValidTextEvents.begin(),
+                  kValidTextEvents.end());
+  StartAndSimulateLogd(events);
+
+  auto packet = writer_raw_->ParseProto();
+  ASSERT_TRUE(packet);
+  ASSERT_TRUE(packet->has_android_log());
+  const auto& log = packet->android_log();
+  ASSERT_EQ(log.events_size(), 90);
+
+  // Each tag is emitted only once, regardless of the number of events.
+  ASSERT_EQ(log.interned_tags_size(), 3);
+  for (int i = 0; i < log.events_size(); i++) {
+    EXPECT_TRUE(log.events(i).has_tag_iid());
+    EXPECT_FALSE(log.events(i).has_tag());
+  }
+  EXPECT_EQ(GetTag(log, 0), "ActivityManager");
+  EXPECT_EQ(GetTag(log, 1), "libprocessgroup");
+  EXPECT_EQ(GetTag(log, 2), "Zygote");
+  EXPECT_EQ(GetTag(log, 87), "ActivityManager");
+  EXPECT_EQ(GetTag(log, 88), "libprocessgroup");
+  EXPECT_EQ(GetTag(log, 89), "Zygote");
+  EXPECT_EQ(log.events(89).message(), "Process 11660 exited due to signal (9)");
+  EXPECT_EQ(data_source_->stats().num_total, 90u);
+  EXPECT_EQ(data_source_->stats().num_failed, 0u);
+}
+
 TEST_F(AndroidLogDataSourceTest, TextEventsWithTagFiltering) {
   DataSourceConfig cfg;
   *cfg.mutable_android_log_config()->add_filter_tags() = "Zygote";
@@ -266,9 +314,8 @@ TEST_F(AndroidLogDataSourceTest, TextEventsWithTagFiltering) {
   ASSERT_TRUE(packet->has_android_log());
   EXPECT_EQ(packet->android_log().events_size(), 2);
 
-  const auto& decoded = packet->android_log().events();
-  EXPECT_EQ(decoded.Get(0).tag(), "ActivityManager");
-  EXPECT_EQ(decoded.Get(1).tag(), "Zygote");
+  EXPECT_EQ(GetTag(packet->android_log(), 0), "ActivityManager");
+  EXPECT_EQ(GetTag(packet->android_log(), 1), "Zygote");
 }
 
 TEST_F(AndroidLogDataSourceTest, TextEventsWithPrioFiltering) {
@@ -285,8 +332,7 @@ TEST_F(AndroidLogDataSourceTest, TextEventsWithPrioFiltering) {
   ASSERT_TRUE(packet->has_android_log());
   EXPECT_EQ(packet->android_log().events_size(), 1);
 
-  const auto& decoded = packet->android_log().events();
-  EXPECT_EQ(decoded.Get(0).tag(), "libprocessgroup");
+  EXPECT_EQ(GetTag(packet->android_log(), 0), "libprocessgroup");
 }
 
 TEST_F(AndroidLogDataSourceTest, BinaryEvents) {
@@ -314,7 +360,7 @@ TEST_F(AndroidLogDataSourceTest, BinaryEvents) {
   EXPECT_EQ(decoded.Get(0).tid(), 30962);
   EXPECT_EQ(decoded.Get(0).uid(), 1000);
   EXPECT_EQ(decoded.Get(0).timestamp(), 1546165328914257883LL);
-  EXPECT_EQ(decoded.Get(0).tag(), "am_kill");
+  EXPECT_EQ(GetTag(packet->android_log(), 0), "am_kill");
   ASSERT_EQ(decoded.Get(0).args_size(), 5);
   EXPECT_EQ(decoded.Get(0).args(0).name(), "User");
   EXPECT_EQ(decoded.Get(0).args(0).int_value(), 0);
@@ -332,7 +378,7 @@ TEST_F(AndroidLogDataSourceTest, BinaryEvents) {
   EXPECT_EQ(decoded.Get(1).tid(), 30962);
   EXPECT_EQ(decoded.Get(1).uid(), 1000);
   EXPECT_EQ(decoded.Get(1).timestamp(), 1546165328946231844LL);
-  EXPECT_EQ(decoded.Get(1).tag(), "am_uid_stopped");
+  EXPECT_EQ(GetTag(packet->android_log(), 1), "am_uid_stopped");
   ASSERT_EQ(decoded.Get(1).args_size(), 1);
   EXPECT_EQ(decoded.Get(1).args(0).name(), "UID");
   EXPECT_EQ(decoded.Get(1).args(0).int_value(), 10018);
@@ -342,7 +388,7 @@ TEST_F(AndroidLogDataSourceTest, BinaryEvents) {
   EXPECT_EQ(decoded.Get(2).tid(), 29998);
   EXPECT_EQ(decoded.Get(2).uid(), 1000);
   EXPECT_EQ(decoded.Get(2).timestamp(), 1546165328960813044LL);
-  EXPECT_EQ(decoded.Get(2).tag(), "am_pss");
+  EXPECT_EQ(GetTag(packet->android_log(), 2), "am_pss");
   ASSERT_EQ(decoded.Get(2).args_size(), 10);
   EXPECT_EQ(decoded.Get(2).args(0).name(), "Pid");
   EXPECT_EQ(decoded.Get(2).args(0).int_value(), 1417);
@@ -389,7 +435,7 @@ TEST_F(AndroidLogDataSourceTest, BinaryEventsWithTagFiltering) {
 
   const auto& decoded = packet->android_log().events();
   EXPECT_EQ(decoded.Get(0).timestamp(), 1546165328946231844LL);
-  EXPECT_EQ(decoded.Get(0).tag(), "am_uid_stopped");
+  EXPECT_EQ(GetTag(packet->android_log(), 0), "am_uid_stopped");
 }
 
 }  // namespace
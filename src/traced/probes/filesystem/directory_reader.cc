@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/directory_reader.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/utils.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <sys/syscall.h>
+#define PERFETTO_USE_GETDENTS64 1
+#endif
+
+namespace perfetto {
+namespace {
+
+inline bool IsDotOrDotDot(const char* name) {
+  return name[0] == '.' &&
+         (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+#if defined(PERFETTO_USE_GETDENTS64)
+// Not exposed by all the libcs we build against (e.g. older bionic).
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+// Large enough to list most directories with a single syscall.
+constexpr size_t kGetdentsBufSize = 32 * 1024;
+#endif
+
+}  // namespace
+
+DirectoryReader::DirectoryReader() = default;
+DirectoryReader::~DirectoryReader() = default;
+
+#if defined(PERFETTO_USE_GETDENTS64)
+
+bool DirectoryReader::Open(const std::string& path) {
+  fd_ = base::OpenFile(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  buf_len_ = 0;
+  buf_pos_ = 0;
+  if (!fd_)
+    return false;
+  if (!buf_)
+    buf_.reset(new char[kGetdentsBufSize]);
+  return true;
+}
+
+void DirectoryReader::Close() {
+  fd_.reset();
+}
+
+bool DirectoryReader::Stat(struct stat* buf) const {
+  return fd_ && fstat(*fd_, buf) == 0;
+}
+
+bool DirectoryReader::Next(Entry* entry) {
+  if (!fd_)
+    return false;
+  for (;;) {
+    if (buf_pos_ >= buf_len_) {
+      long res = PERFETTO_EINTR(
+          syscall(SYS_getdents64, *fd_, buf_.get(), kGetdentsBufSize));
+      if (res <= 0) {
+        if (res < 0)
+          PERFETTO_DPLOG("getdents64");
+        fd_.reset();
+        return false;
+      }
+      buf_len_ = static_cast<size_t>(res);
+      buf_pos_ = 0;
+    }
+    const auto* dirent =
+        reinterpret_cast<const LinuxDirent64*>(buf_.get() + buf_pos_);
+    buf_pos_ += dirent->d_reclen;
+    if (IsDotOrDotDot(dirent->d_name))
+      continue;
+    entry->inode = static_cast<Inode>(dirent->d_ino);
+    entry->type = dirent->d_type;
+    entry->name = dirent->d_name;
+    return true;
+  }
+}
+
+bool DirectoryReader::is_open() const {
+  return !!fd_;
+}
+
+#else  // defined(PERFETTO_USE_GETDENTS64)
+
+bool DirectoryReader::Open(const std::string& path) {
+  dir_.reset(opendir(path.c_str()));
+  return !!dir_;
+}
+
+void DirectoryReader::Close() {
+  dir_.reset();
+}
+
+bool DirectoryReader::Stat(struct stat* buf) const {
+  return dir_ && fstat(dirfd(dir_.get()), buf) == 0;
+}
+
+bool DirectoryReader::Next(Entry* entry) {
+  if (!dir_)
+    return false;
+  while (struct dirent* dirent = readdir(dir_.get())) {
+    if (IsDotOrDotDot(dirent->d_name))
+      continue;
+    entry->inode = static_cast<Inode>(dirent->d_ino);
+    entry->type = dirent->d_type;
+    entry->name = dirent->d_name;
+    return true;
+  }
+  dir_.reset();
+  return false;
+}
+
+bool DirectoryReader::is_open() const {
+  return !!dir_;
+}
+
+#endif  // defined(PERFETTO_USE_GETDENTS64)
+
+}  // namespace perfetto
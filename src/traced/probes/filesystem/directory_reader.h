@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FILESYSTEM_DIRECTORY_READER_H_
+#define SRC_TRACED_PROBES_FILESYSTEM_DIRECTORY_READER_H_
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include <memory>
+#include <string>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/traced/data_source_types.h"
+
+namespace perfetto {
+
+// Iterates over the entries of a directory.
+// On Linux and Android this issues getdents64() directly into a large buffer,
+// which takes far fewer syscalls than readdir() on big directories and doesn't
+// need a DIR stream per directory. Other platforms fall back on readdir().
+class DirectoryReader {
+ public:
+  struct Entry {
+    Inode inode;
+    unsigned char type;  // One of the DT_* constants from <dirent.h>.
+    const char* name;    // Valid until the next call to Next().
+  };
+
+  DirectoryReader();
+  ~DirectoryReader();
+
+  DirectoryReader(const DirectoryReader&) = delete;
+  DirectoryReader& operator=(const DirectoryReader&) = delete;
+
+  // Opens |path| for reading, closing the previously open directory, if any.
+  bool Open(const std::string& path);
+  void Close();
+
+  // fstat()s the open directory.
+  bool Stat(struct stat* buf) const;
+
+  // Returns false when the end of the directory is reached or on error.
+  // "." and ".." are skipped.
+  bool Next(Entry* entry);
+
+  bool is_open() const;
+
+ private:
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  base::ScopedFile fd_;
+  std::unique_ptr<char[]> buf_;
+  size_t buf_len_ = 0;
+  size_t buf_pos_ = 0;
+#else
+  base::ScopedDir dir_;
+#endif
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FILESYSTEM_DIRECTORY_READER_H_
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/directory_reader.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::UnorderedElementsAre;
+
+constexpr char kTestDir[] = "src/traced/probes/filesystem/testdata";
+
+using ReadEntry = std::tuple<std::string, Inode, unsigned char>;
+
+ReadEntry StatEntry(const std::string& name, unsigned char type) {
+  struct stat buf;
+  PERFETTO_CHECK(lstat((std::string(kTestDir) + "/" + name).c_str(), &buf) !=
+                 -1);
+  return ReadEntry(name, buf.st_ino, type);
+}
+
+TEST(DirectoryReaderTest, ListsEntries) {
+  DirectoryReader reader;
+  ASSERT_TRUE(reader.Open(kTestDir));
+  ASSERT_TRUE(reader.is_open());
+
+  std::vector<ReadEntry> entries;
+  DirectoryReader::Entry entry;
+  while (reader.Next(&entry))
+    entries.emplace_back(entry.name, entry.inode, entry.type);
+
+  EXPECT_FALSE(reader.is_open());
+  EXPECT_THAT(entries, UnorderedElementsAre(StatEntry("dir1", DT_DIR),
+                                            StatEntry("file2", DT_REG)));
+}
+
+TEST(DirectoryReaderTest, Stat) {
+  DirectoryReader reader;
+  ASSERT_TRUE(reader.Open(kTestDir));
+  struct stat buf;
+  ASSERT_TRUE(reader.Stat(&buf));
+  EXPECT_TRUE(S_ISDIR(buf.st_mode));
+
+  reader.Close();
+  EXPECT_FALSE(reader.is_open());
+  EXPECT_FALSE(reader.Stat(&buf));
+}
+
+TEST(DirectoryReaderTest, OpenFails) {
+  DirectoryReader reader;
+  EXPECT_FALSE(reader.Open(std::string(kTestDir) + "/file2"));
+  EXPECT_FALSE(reader.Open(std::string(kTestDir) + "/does_not_exist"));
+  DirectoryReader::Entry entry;
+  EXPECT_FALSE(reader.Next(&entry));
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -17,15 +17,25 @@
 #include "src/traced/probes/filesystem/file_scanner.h"
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
+#include "perfetto/base/file_utils.h"
+#include "perfetto/base/scoped_file.h"
 #include "src/traced/probes/filesystem/inode_file_data_source.h"
 
 namespace perfetto {
 namespace {
 
+constexpr uint32_t kIndexMagic = 0x58444950;  // "PIDX"
+constexpr uint32_t kIndexVersion = 1;
+
 std::string JoinPaths(const std::string& one, const std::string& other) {
   std::string result;
   result.reserve(one.size() + other.size() + 1);
@@ -36,6 +46,64 @@ std::string JoinPaths(const std::string& one, const std::string& other) {
   return result;
 }
 
+protos::pbzero::InodeFileMap_Entry_Type ToInodeType(unsigned char d_type) {
+  // Readdir and stat not guaranteed to have directory info for all systems
+  if (d_type == DT_DIR)
+    return protos::pbzero::InodeFileMap_Entry_Type_DIRECTORY;
+  if (d_type == DT_REG)
+    return protos::pbzero::InodeFileMap_Entry_Type_FILE;
+  return protos::pbzero::InodeFileMap_Entry_Type_UNKNOWN;
+}
+
+int64_t GetMtimeNs(const struct stat& buf) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_MACOSX)
+  const struct timespec& ts = buf.st_mtimespec;
+#else
+  const struct timespec& ts = buf.st_mtim;
+#endif
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+template <typename T>
+void AppendPod(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Bounds-checked reader for the serialized index.
+class IndexReader {
+ public:
+  explicit IndexReader(const std::string& data)
+      : ptr_(data.data()), end_(data.data() + data.size()) {}
+
+  template <typename T>
+  bool ReadPod(T* value) {
+    if (static_cast<size_t>(end_ - ptr_) < sizeof(T))
+      return false;
+    memcpy(value, ptr_, sizeof(T));
+    ptr_ += sizeof(T);
+    return true;
+  }
+
+  bool ReadString(size_t size, std::string* value) {
+    if (static_cast<size_t>(end_ - ptr_) < size)
+      return false;
+    value->assign(ptr_, size);
+    ptr_ += size;
+    return true;
+  }
+
+  bool at_end() const { return ptr_ == end_; }
+
+ private:
+  const char* ptr_;
+  const char* end_;
+};
+
+// Owned by us, and only writable by us.
+bool IsPrivate(const struct stat& st) {
+  return st.st_uid == geteuid() && !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
 }  // namespace
 
 FileScanner::FileScanner(std::vector<std::string> root_directories,
@@ -78,8 +146,7 @@ void FileScanner::Scan(base::TaskRunner* task_runner) {
 void FileScanner::NextDirectory() {
   std::string directory = std::move(queue_.back());
   queue_.pop_back();
-  current_dir_handle_.reset(opendir(directory.c_str()));
-  if (!current_dir_handle_) {
+  if (!current_dir_.Open(directory)) {
     PERFETTO_DPLOG("opendir %s", directory.c_str());
     current_directory_.clear();
     return;
@@ -87,15 +154,9 @@ void FileScanner::NextDirectory() {
   current_directory_ = std::move(directory);
 
   struct stat buf;
-  if (fstat(dirfd(current_dir_handle_.get()), &buf) != 0) {
+  if (!current_dir_.Stat(&buf)) {
     PERFETTO_DPLOG("fstat %s", current_directory_.c_str());
-    current_dir_handle_.reset();
-    current_directory_.clear();
-    return;
-  }
-
-  if (S_ISLNK(buf.st_mode)) {
-    current_dir_handle_.reset();
+    current_dir_.Close();
     current_directory_.clear();
     return;
   }
@@ -103,42 +164,29 @@ void FileScanner::NextDirectory() {
 }
 
 void FileScanner::Step() {
-  if (!current_dir_handle_) {
+  if (!current_dir_.is_open()) {
     if (queue_.empty())
       return;
     NextDirectory();
   }
 
-  if (!current_dir_handle_)
+  if (!current_dir_.is_open())
     return;
 
-  struct dirent* entry = readdir(current_dir_handle_.get());
-  if (entry == nullptr) {
-    current_dir_handle_.reset();
-    return;
-  }
-
-  std::string filename = entry->d_name;
-  if (filename == "." || filename == "..")
+  DirectoryReader::Entry entry;
+  if (!current_dir_.Next(&entry))
     return;
 
-  std::string filepath = JoinPaths(current_directory_, filename);
+  std::string filepath = JoinPaths(current_directory_, entry.name);
 
-  protos::pbzero::InodeFileMap_Entry_Type type =
-      protos::pbzero::InodeFileMap_Entry_Type_UNKNOWN;
-  // Readdir and stat not guaranteed to have directory info for all systems
-  if (entry->d_type == DT_DIR) {
-    // Continue iterating through files if current entry is a directory
+  // Continue iterating through files if current entry is a directory
+  if (entry.type == DT_DIR)
     queue_.emplace_back(filepath);
-    type = protos::pbzero::InodeFileMap_Entry_Type_DIRECTORY;
-  } else if (entry->d_type == DT_REG) {
-    type = protos::pbzero::InodeFileMap_Entry_Type_FILE;
-  }
 
-  if (!delegate_->OnInodeFound(current_block_device_id_, entry->d_ino, filepath,
-                               type)) {
+  if (!delegate_->OnInodeFound(current_block_device_id_, entry.inode, filepath,
+                               ToInodeType(entry.type))) {
     queue_.clear();
-    current_dir_handle_.reset();
+    current_dir_.Close();
   }
 }
 
@@ -148,9 +196,253 @@ void FileScanner::Steps(uint32_t n) {
 }
 
 bool FileScanner::Done() {
-  return !current_dir_handle_ && queue_.empty();
+  return !current_dir_.is_open() && queue_.empty();
 }
 
 FileScanner::Delegate::~Delegate() = default;
 
+ParallelFileScanner::ParallelFileScanner(
+    std::vector<std::string> root_directories,
+    FileScanner::Delegate* delegate,
+    base::ThreadPool* pool,
+    std::string index_path)
+    : delegate_(delegate),
+      pool_(pool),
+      index_path_(std::move(index_path)),
+      root_directories_(std::move(root_directories)),
+      weak_factory_(this) {}
+
+// Destroying |group_| cancels the tasks that didn't start and waits for the
+// others.
+ParallelFileScanner::~ParallelFileScanner() = default;
+
+void ParallelFileScanner::Scan() {
+  std::unique_ptr<base::ThreadPool> calling_thread_only;
+  if (!pool_)
+    calling_thread_only.reset(new base::ThreadPool(0));
+  base::TaskGroup group(pool_ ? pool_ : calling_thread_only.get());
+  StartListing(&group);
+  group.Wait();
+  saved_index_.clear();
+  if (!index_path_.empty())
+    SaveIndex();
+  ReportListings();
+  listings_.clear();
+}
+
+void ParallelFileScanner::Scan(base::TaskRunner* task_runner) {
+  PERFETTO_DCHECK(pool_ && pool_->num_workers() > 0 && !group_);
+  group_.reset(new base::TaskGroup(pool_));
+  StartListing(group_.get());
+  auto weak_this = weak_factory_.GetWeakPtr();
+  group_->PostWhenDone(task_runner, [weak_this] {
+    if (!weak_this)
+      return;
+    ParallelFileScanner* scanner = weak_this.get();
+    scanner->ReportListings();
+    // Writing the index and freeing the listings can take a while, keep them
+    // off |task_runner|.
+    scanner->group_->PostTask([scanner] {
+      scanner->saved_index_.clear();
+      if (!scanner->index_path_.empty())
+        scanner->SaveIndex();
+      scanner->listings_.clear();
+    });
+  });
+}
+
+void ParallelFileScanner::StartListing(base::TaskGroup* group) {
+  group->PostTask([this, group] {
+    if (!index_path_.empty())
+      LoadIndex();
+    for (const std::string& root : root_directories_)
+      PostListDirectory(group, root);
+  });
+}
+
+void ParallelFileScanner::PostListDirectory(base::TaskGroup* group,
+                                            std::string path) {
+  group->PostTask([this, group, path] {
+    DirectoryListing listing;
+    ListDirectory(path, &listing);
+    for (const DirectoryEntry& entry : listing.entries) {
+      if (entry.type == DT_DIR)
+        PostListDirectory(group, JoinPaths(path, entry.name));
+    }
+    if (!listing.inode)
+      return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    listings_.emplace_back(path, std::move(listing));
+  });
+}
+
+void ParallelFileScanner::ReportListings() {
+  for (const auto& path_and_listing : listings_) {
+    const std::string& path = path_and_listing.first;
+    const DirectoryListing& listing = path_and_listing.second;
+    for (const DirectoryEntry& entry : listing.entries) {
+      stats_.inodes_found++;
+      if (!delegate_->OnInodeFound(listing.block_device_id, entry.inode,
+                                   JoinPaths(path, entry.name),
+                                   ToInodeType(entry.type))) {
+        delegate_->OnInodeScanDone();
+        return;
+      }
+    }
+  }
+  delegate_->OnInodeScanDone();
+}
+
+void ParallelFileScanner::ListDirectory(const std::string& path,
+                                        DirectoryListing* listing) {
+  DirectoryReader reader;
+  if (!reader.Open(path)) {
+    PERFETTO_DPLOG("opendir %s", path.c_str());
+    return;
+  }
+  struct stat buf;
+  if (!reader.Stat(&buf)) {
+    PERFETTO_DPLOG("fstat %s", path.c_str());
+    return;
+  }
+  listing->block_device_id = buf.st_dev;
+  listing->inode = buf.st_ino;
+  listing->mtime_ns = GetMtimeNs(buf);
+
+  // Any change to the set of entries of a directory bumps its mtime, so an
+  // unchanged (device, inode, mtime) means the saved listing is still valid.
+  auto it = saved_index_.find(path);
+  if (it != saved_index_.end() &&
+      it->second.block_device_id == listing->block_device_id &&
+      it->second.inode == listing->inode &&
+      it->second.mtime_ns == listing->mtime_ns) {
+    listing->entries = std::move(it->second.entries);
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.directories_reused++;
+    return;
+  }
+
+  DirectoryReader::Entry entry;
+  while (reader.Next(&entry))
+    listing->entries.push_back({entry.inode, entry.type, entry.name});
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.directories_listed++;
+}
+
+void ParallelFileScanner::LoadIndex() {
+  base::ScopedFile fd =
+      base::OpenFile(index_path_, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (!fd)
+    return;
+  // The index ends up in traces as inode -> path mappings, only trust it if
+  // nobody else could have written it: it must be a file that only we can
+  // access, as created by SaveIndex(), in a directory that only we can
+  // modify. Other daemons running as the same uid are kept out by SELinux.
+  struct stat st;
+  if (fstat(*fd, &st) != 0 || !IsPrivate(st) || !S_ISREG(st.st_mode) ||
+      (st.st_mode & (S_IRWXG | S_IRWXO))) {
+    PERFETTO_ELOG("Ignoring inode index %s: not a private file",
+                  index_path_.c_str());
+    return;
+  }
+  size_t slash = index_path_.rfind('/');
+  std::string dir = slash == std::string::npos
+                        ? "."
+                        : index_path_.substr(0, std::max<size_t>(slash, 1));
+  if (stat(dir.c_str(), &st) != 0 || !IsPrivate(st) || !S_ISDIR(st.st_mode)) {
+    PERFETTO_ELOG("Ignoring inode index %s: directory writable by others",
+                  index_path_.c_str());
+    return;
+  }
+  std::string data;
+  if (!base::ReadFileDescriptor(*fd, &data) || data.empty())
+    return;
+
+  IndexReader reader(data);
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  if (!reader.ReadPod(&magic) || magic != kIndexMagic ||
+      !reader.ReadPod(&version) || version != kIndexVersion) {
+    PERFETTO_ELOG("Ignoring inode index %s: bad header", index_path_.c_str());
+    return;
+  }
+
+  while (!reader.at_end()) {
+    uint32_t path_size = 0;
+    std::string path;
+    DirectoryListing listing;
+    uint32_t num_entries = 0;
+    bool ok = reader.ReadPod(&path_size) &&
+              reader.ReadString(path_size, &path) &&
+              reader.ReadPod(&listing.block_device_id) &&
+              reader.ReadPod(&listing.inode) &&
+              reader.ReadPod(&listing.mtime_ns) &&
+              reader.ReadPod(&num_entries);
+    for (uint32_t i = 0; ok && i < num_entries; ++i) {
+      DirectoryEntry entry;
+      uint16_t name_size = 0;
+      ok = reader.ReadPod(&entry.inode) && reader.ReadPod(&entry.type) &&
+           reader.ReadPod(&name_size) &&
+           reader.ReadString(name_size, &entry.name);
+      if (ok)
+        listing.entries.emplace_back(std::move(entry));
+    }
+    if (!ok) {
+      // A partially valid index could hide new files, drop all of it.
+      PERFETTO_ELOG("Ignoring inode index %s: truncated", index_path_.c_str());
+      saved_index_.clear();
+      return;
+    }
+    saved_index_.emplace(std::move(path), std::move(listing));
+  }
+}
+
+void ParallelFileScanner::SaveIndex() const {
+  std::string data;
+  AppendPod(&data, kIndexMagic);
+  AppendPod(&data, kIndexVersion);
+  for (const auto& path_and_listing : listings_) {
+    const std::string& path = path_and_listing.first;
+    const DirectoryListing& listing = path_and_listing.second;
+    AppendPod(&data, static_cast<uint32_t>(path.size()));
+    data.append(path);
+    AppendPod(&data, listing.block_device_id);
+    AppendPod(&data, listing.inode);
+    AppendPod(&data, listing.mtime_ns);
+    AppendPod(&data, static_cast<uint32_t>(listing.entries.size()));
+    for (const DirectoryEntry& entry : listing.entries) {
+      AppendPod(&data, entry.inode);
+      AppendPod(&data, entry.type);
+      // NAME_MAX is 255 on all the filesystems we care about.
+      AppendPod(&data, static_cast<uint16_t>(entry.name.size()));
+      data.append(entry.name);
+    }
+  }
+
+  // Write to a temporary file and rename it over the old index, so that a
+  // crash mid-write never leaves a torn index behind. Any leftover (including
+  // a planted symlink, which unlink() doesn't follow) is removed first, and the
+  // temporary file must be created by us.
+  std::string tmp_path = index_path_ + ".tmp";
+  unlink(tmp_path.c_str());
+  base::ScopedFile fd = base::OpenFile(
+      tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (!fd) {
+    PERFETTO_PLOG("Failed to create %s", tmp_path.c_str());
+    return;
+  }
+  if (base::WriteAll(*fd, data.data(), data.size()) !=
+          static_cast<ssize_t>(data.size()) ||
+      !base::FlushFile(*fd)) {
+    PERFETTO_PLOG("Failed to write %s", tmp_path.c_str());
+    unlink(tmp_path.c_str());
+    return;
+  }
+  fd.reset();
+  if (rename(tmp_path.c_str(), index_path_.c_str()) != 0) {
+    PERFETTO_PLOG("Failed to rename %s", tmp_path.c_str());
+    unlink(tmp_path.c_str());
+  }
+}
+
 }  // namespace perfetto
@@ -17,13 +17,20 @@
 #ifndef SRC_TRACED_PROBES_FILESYSTEM_FILE_SCANNER_H_
 #define SRC_TRACED_PROBES_FILESYSTEM_FILE_SCANNER_H_
 
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
-#include "perfetto/base/scoped_file.h"
 #include "perfetto/base/task_runner.h"
+#include "perfetto/base/thread_pool.h"
 #include "perfetto/base/weak_ptr.h"
 #include "perfetto/traced/data_source_types.h"
+#include "src/traced/probes/filesystem/directory_reader.h"
 
 namespace perfetto {
 
@@ -64,12 +71,91 @@ class FileScanner {
   const uint32_t scan_steps_;
 
   std::vector<std::string> queue_;
-  base::ScopedDir current_dir_handle_;
+  DirectoryReader current_dir_;
   std::string current_directory_;
   BlockDeviceID current_block_device_id_;
   base::WeakPtrFactory<FileScanner> weak_factory_;  // Keep last.
 };
 
+// Scanner that lists directories in parallel on a base::ThreadPool, one task
+// per directory.
+// If |index_path| is not empty, the listing of every directory is persisted
+// there once the scan completes. The next scan only re-lists directories whose
+// (device, inode, mtime) changed since, and reuses the saved entries for all
+// others. The delegate is only called once all the directories are listed.
+class ParallelFileScanner {
+ public:
+  struct Stats {
+    uint64_t directories_listed = 0;
+    uint64_t directories_reused = 0;
+    uint64_t inodes_found = 0;
+  };
+
+  // |pool| must outlive the scanner. If null, only the blocking Scan() can be
+  // used, and it lists everything on the calling thread.
+  ParallelFileScanner(std::vector<std::string> root_directories,
+                      FileScanner::Delegate* delegate,
+                      base::ThreadPool* pool,
+                      std::string index_path = "");
+  ~ParallelFileScanner();
+
+  ParallelFileScanner(const ParallelFileScanner&) = delete;
+  ParallelFileScanner& operator=(const ParallelFileScanner&) = delete;
+
+  // Blocks until the scan is complete. The delegate is called on the calling
+  // thread.
+  void Scan();
+
+  // Lists the directories on the workers of the pool, then calls the delegate
+  // on |task_runner| and saves the index in the background. Destroying the
+  // scanner cancels the scan.
+  void Scan(base::TaskRunner* task_runner);
+
+  // Only valid once the delegate got OnInodeScanDone().
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct DirectoryEntry {
+    Inode inode;
+    unsigned char type;  // DT_* constant.
+    std::string name;
+  };
+
+  struct DirectoryListing {
+    BlockDeviceID block_device_id = 0;
+    Inode inode = 0;
+    int64_t mtime_ns = 0;
+    std::vector<DirectoryEntry> entries;
+  };
+
+  void StartListing(base::TaskGroup* group);
+  void PostListDirectory(base::TaskGroup* group, std::string path);
+  void ReportListings();
+  void ListDirectory(const std::string& path, DirectoryListing* listing);
+  void LoadIndex();
+  void SaveIndex() const;
+
+  FileScanner::Delegate* const delegate_;
+  base::ThreadPool* const pool_;
+  const std::string index_path_;
+  std::vector<std::string> root_directories_;
+  Stats stats_;
+
+  // Listings from the previous scan, keyed by path. Read-only while the
+  // directories are listed, except for moving out the entries of reused
+  // directories (every path is visited at most once).
+  std::unordered_map<std::string, DirectoryListing> saved_index_;
+
+  std::mutex mutex_;
+  std::vector<std::pair<std::string, DirectoryListing>>
+      listings_;  // Guarded by |mutex_| while the directories are listed.
+
+  // Tasks of the background scan. Destroyed before the members above, as the
+  // tasks use them.
+  std::unique_ptr<base::TaskGroup> group_;
+  base::WeakPtrFactory<ParallelFileScanner> weak_factory_;  // Keep last.
+};
+
 }  // namespace perfetto
 
 #endif  // SRC_TRACED_PROBES_FILESYSTEM_FILE_SCANNER_H_
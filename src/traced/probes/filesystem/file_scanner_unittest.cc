@@ -19,11 +19,16 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <memory>
 #include <string>
+#include <thread>
 
+#include "perfetto/base/file_utils.h"
 #include "perfetto/base/logging.h"
+#include "perfetto/base/temp_file.h"
 #include "src/base/test/test_task_runner.h"
 
 namespace perfetto {
@@ -187,5 +192,213 @@ TEST(FileScannerTest, TestAsynchronousFindFiles) {
               protos::pbzero::InodeFileMap_Entry_Type_DIRECTORY))));
 }
 
+std::vector<FileEntry> ScanTestData(uint32_t num_threads,
+                                    const std::string& index_path,
+                                    ParallelFileScanner::Stats* stats) {
+  std::vector<FileEntry> file_entries;
+  bool done = false;
+  TestDelegate delegate(
+      [&file_entries](BlockDeviceID block_device_id, Inode inode,
+                      const std::string& path,
+                      protos::pbzero::InodeFileMap_Entry_Type type) {
+        file_entries.emplace_back(block_device_id, inode, path, type);
+        return true;
+      },
+      [&done] { done = true; });
+
+  // The calling thread helps the workers.
+  base::ThreadPool pool(num_threads - 1);
+  ParallelFileScanner fs({"src/traced/probes/filesystem/testdata"}, &delegate,
+                         &pool, index_path);
+  fs.Scan();
+  EXPECT_TRUE(done);
+  *stats = fs.stats();
+  return file_entries;
+}
+
+TEST(ParallelFileScannerTest, TestStop) {
+  uint64_t seen = 0;
+  bool done = false;
+  TestDelegate delegate(
+      [&seen](BlockDeviceID, Inode, const std::string&,
+              protos::pbzero::InodeFileMap_Entry_Type) {
+        ++seen;
+        return false;
+      },
+      [&done] { done = true; });
+
+  base::ThreadPool pool(1);
+  ParallelFileScanner fs({"src/traced/probes/filesystem/testdata"}, &delegate,
+                         &pool);
+  fs.Scan();
+
+  EXPECT_EQ(seen, 1u);
+  EXPECT_TRUE(done);
+}
+
+TEST(ParallelFileScannerTest, TestFindFiles) {
+  for (uint32_t num_threads : {1u, 4u}) {
+    ParallelFileScanner::Stats stats;
+    std::vector<FileEntry> file_entries = ScanTestData(num_threads, "", &stats);
+
+    EXPECT_THAT(
+        file_entries,
+        UnorderedElementsAre(
+            Eq(StatFileEntry("src/traced/probes/filesystem/testdata/dir1/file1",
+                             protos::pbzero::InodeFileMap_Entry_Type_FILE)),
+            Eq(StatFileEntry("src/traced/probes/filesystem/testdata/file2",
+                             protos::pbzero::InodeFileMap_Entry_Type_FILE)),
+            Eq(StatFileEntry(
+                "src/traced/probes/filesystem/testdata/dir1",
+                protos::pbzero::InodeFileMap_Entry_Type_DIRECTORY))));
+    EXPECT_EQ(stats.directories_listed, 2u);
+    EXPECT_EQ(stats.directories_reused, 0u);
+    EXPECT_EQ(stats.inodes_found, 3u);
+  }
+}
+
+// The index must live in a directory that only we can write.
+class IndexDir {
+ public:
+  IndexDir() : dir_(base::TempDir::Create()) {}
+  ~IndexDir() {
+    unlink(index_path().c_str());
+    unlink((index_path() + ".tmp").c_str());
+  }
+
+  std::string path() const { return dir_.path(); }
+  std::string index_path() const { return dir_.path() + "/index"; }
+
+ private:
+  base::TempDir dir_;
+};
+
+TEST(ParallelFileScannerTest, TestReuseIndex) {
+  IndexDir dir;
+  ParallelFileScanner::Stats stats;
+  std::vector<FileEntry> first = ScanTestData(2, dir.index_path(), &stats);
+  EXPECT_EQ(stats.directories_listed, 2u);
+  EXPECT_EQ(stats.directories_reused, 0u);
+
+  std::vector<FileEntry> second = ScanTestData(2, dir.index_path(), &stats);
+  EXPECT_EQ(stats.directories_listed, 0u);
+  EXPECT_EQ(stats.directories_reused, 2u);
+  EXPECT_THAT(second, ::testing::UnorderedElementsAreArray(first));
+}
+
+TEST(ParallelFileScannerTest, TestTruncatedIndex) {
+  IndexDir dir;
+  ParallelFileScanner::Stats stats;
+  std::vector<FileEntry> first = ScanTestData(1, dir.index_path(), &stats);
+
+  std::string data;
+  ASSERT_TRUE(base::ReadFile(dir.index_path(), &data));
+  ASSERT_GT(data.size(), 1u);
+  base::ScopedFile fd = base::OpenFile(dir.index_path(), O_WRONLY | O_TRUNC);
+  ASSERT_TRUE(fd);
+  ASSERT_EQ(base::WriteAll(*fd, data.data(), data.size() - 1),
+            static_cast<ssize_t>(data.size() - 1));
+  fd.reset();
+
+  std::vector<FileEntry> second = ScanTestData(1, dir.index_path(), &stats);
+  EXPECT_EQ(stats.directories_listed, 2u);
+  EXPECT_EQ(stats.directories_reused, 0u);
+  EXPECT_THAT(second, ::testing::UnorderedElementsAreArray(first));
+}
+
+TEST(ParallelFileScannerTest, TestIgnoreNonPrivateIndex) {
+  IndexDir dir;
+  ParallelFileScanner::Stats stats;
+  for (mode_t mode : {0666, 0620, 0640}) {
+    ScanTestData(1, dir.index_path(), &stats);
+    ASSERT_EQ(chmod(dir.index_path().c_str(), mode), 0);
+
+    ScanTestData(1, dir.index_path(), &stats);
+    EXPECT_EQ(stats.directories_listed, 2u);
+    EXPECT_EQ(stats.directories_reused, 0u);
+  }
+}
+
+TEST(ParallelFileScannerTest, TestIgnoreIndexInSharedDirectory) {
+  IndexDir dir;
+  ParallelFileScanner::Stats stats;
+  ScanTestData(1, dir.index_path(), &stats);
+  ASSERT_EQ(chmod(dir.path().c_str(), 0777), 0);
+
+  ScanTestData(1, dir.index_path(), &stats);
+  EXPECT_EQ(stats.directories_listed, 2u);
+  EXPECT_EQ(stats.directories_reused, 0u);
+}
+
+TEST(ParallelFileScannerTest, TestAsynchronousScan) {
+  base::TestTaskRunner task_runner;
+  std::vector<FileEntry> file_entries;
+  auto done = task_runner.CreateCheckpoint("done");
+  std::thread::id main_thread = std::this_thread::get_id();
+  TestDelegate delegate(
+      [&file_entries, main_thread](
+          BlockDeviceID block_device_id, Inode inode, const std::string& path,
+          protos::pbzero::InodeFileMap_Entry_Type type) {
+        EXPECT_EQ(std::this_thread::get_id(), main_thread);
+        file_entries.emplace_back(block_device_id, inode, path, type);
+        return true;
+      },
+      done);
+
+  base::ThreadPool pool(1);
+  ParallelFileScanner fs({"src/traced/probes/filesystem/testdata"}, &delegate,
+                         &pool);
+  fs.Scan(&task_runner);
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_EQ(file_entries.size(), 3u);
+  EXPECT_EQ(fs.stats().directories_listed, 2u);
+}
+
+TEST(ParallelFileScannerTest, TestDestroyDuringAsynchronousScan) {
+  base::TestTaskRunner task_runner;
+  TestDelegate delegate(
+      [](BlockDeviceID, Inode, const std::string&,
+         protos::pbzero::InodeFileMap_Entry_Type) {
+        ADD_FAILURE();
+        return true;
+      },
+      [] { ADD_FAILURE(); });
+
+  base::ThreadPool pool(1);
+  {
+    ParallelFileScanner fs({"src/traced/probes/filesystem/testdata"},
+                           &delegate, &pool);
+    fs.Scan(&task_runner);
+  }
+  // The result posted by the scan, if any, is dropped.
+  task_runner.RunUntilIdle();
+}
+
+TEST(ParallelFileScannerTest, TestTempIndexSymlinkNotFollowed) {
+  IndexDir dir;
+  std::string index_path = dir.index_path();
+  std::string tmp_path = index_path + ".tmp";
+  std::string victim_path = dir.path() + "/victim";
+  {
+    base::ScopedFile fd = base::OpenFile(victim_path, O_WRONLY | O_CREAT, 0600);
+    ASSERT_TRUE(fd);
+    ASSERT_EQ(base::WriteAll(*fd, "victim", 6), 6);
+  }
+  ASSERT_EQ(symlink(victim_path.c_str(), tmp_path.c_str()), 0);
+
+  ParallelFileScanner::Stats stats;
+  ScanTestData(1, index_path, &stats);
+  std::string victim;
+  ASSERT_TRUE(base::ReadFile(victim_path, &victim));
+  EXPECT_EQ(victim, "victim");
+
+  // The index was written anyways, and is reused.
+  ScanTestData(1, index_path, &stats);
+  EXPECT_EQ(stats.directories_reused, 2u);
+
+  unlink(victim_path.c_str());
+}
+
 }  // namespace
 }  // namespace perfetto
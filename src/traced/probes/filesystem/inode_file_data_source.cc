@@ -17,9 +17,11 @@
 #include "src/traced/probes/filesystem/inode_file_data_source.h"
 
 #include <dirent.h>
+#include <inttypes.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <queue>
 #include <unordered_map>
 
@@ -65,9 +67,7 @@ std::map<std::string, std::vector<std::string>> BuildMountpointMapping(
 
 class StaticMapDelegate : public FileScanner::Delegate {
  public:
-  StaticMapDelegate(
-      std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>* map)
-      : map_(map) {}
+  StaticMapDelegate(StaticInodeIndex* map) : map_(map) {}
   ~StaticMapDelegate() {}
 
  private:
@@ -75,14 +75,11 @@ class StaticMapDelegate : public FileScanner::Delegate {
                     Inode inode_number,
                     const std::string& path,
                     protos::pbzero::InodeFileMap_Entry_Type type) {
-    std::unordered_map<Inode, InodeMapValue>& inode_map =
-        (*map_)[block_device_id];
-    inode_map[inode_number].SetType(type);
-    inode_map[inode_number].AddPath(path);
+    map_->Add(block_device_id, inode_number, type, path);
     return true;
   }
-  void OnInodeScanDone() {}
-  std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>* map_;
+  void OnInodeScanDone() { map_->Finalize(); }
+  StaticInodeIndex* map_;
 };
 
 }  // namespace
@@ -90,13 +87,49 @@ class StaticMapDelegate : public FileScanner::Delegate {
 // static
 constexpr int InodeFileDataSource::kTypeId;
 
-void CreateStaticDeviceToInodeMap(
-    const std::string& root_directory,
-    std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
-        static_file_map) {
+void CreateStaticDeviceToInodeMap(const std::string& root_directory,
+                                  StaticInodeIndex* static_file_map,
+                                  const std::string& index_path,
+                                  base::ThreadPool* pool) {
   StaticMapDelegate delegate(static_file_map);
-  FileScanner scanner({root_directory}, &delegate);
+  ParallelFileScanner scanner({root_directory}, &delegate, pool, index_path);
   scanner.Scan();
+  PERFETTO_DLOG("Static inode map: %" PRIu64 " inodes, %" PRIu64
+                " directories listed, %" PRIu64 " reused",
+                scanner.stats().inodes_found,
+                scanner.stats().directories_listed,
+                scanner.stats().directories_reused);
+}
+
+StaticInodeIndexBuilder::StaticInodeIndexBuilder(
+    const std::string& root_directory,
+    StaticInodeIndex* static_file_map,
+    const std::string& index_path,
+    base::ThreadPool* pool,
+    base::TaskRunner* task_runner)
+    : static_file_map_(static_file_map),
+      scanner_({root_directory}, this, pool, index_path) {
+  scanner_.Scan(task_runner);
+}
+
+StaticInodeIndexBuilder::~StaticInodeIndexBuilder() = default;
+
+bool StaticInodeIndexBuilder::OnInodeFound(
+    BlockDeviceID block_device_id,
+    Inode inode_number,
+    const std::string& path,
+    protos::pbzero::InodeFileMap_Entry_Type type) {
+  static_file_map_->Add(block_device_id, inode_number, type, path);
+  return true;
+}
+
+void StaticInodeIndexBuilder::OnInodeScanDone() {
+  static_file_map_->Finalize();
+  PERFETTO_DLOG("Static inode map: %" PRIu64 " inodes, %" PRIu64
+                " directories listed, %" PRIu64 " reused",
+                scanner_.stats().inodes_found,
+                scanner_.stats().directories_listed,
+                scanner_.stats().directories_reused);
 }
 
 void InodeFileDataSource::FillInodeEntry(InodeFileMap* destination,
@@ -113,8 +146,7 @@ InodeFileDataSource::InodeFileDataSource(
     DataSourceConfig source_config,
     base::TaskRunner* task_runner,
     TracingSessionID session_id,
-    std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
-        static_file_map,
+    StaticInodeIndex* static_file_map,
     LRUInodeCache* cache,
     std::unique_ptr<TraceWriter> writer)
     : ProbesDataSource(session_id, kTypeId),
@@ -138,46 +170,35 @@ void InodeFileDataSource::Start() {
 
 void InodeFileDataSource::AddInodesFromStaticMap(
     BlockDeviceID block_device_id,
-    std::set<Inode>* inode_numbers) {
-  // Check if block device id exists in static file map
-  auto static_map_entry = static_file_map_->find(block_device_id);
-  if (static_map_entry == static_file_map_->end())
-    return;
-
-  uint64_t system_found_count = 0;
-  for (auto it = inode_numbers->begin(); it != inode_numbers->end();) {
-    Inode inode_number = *it;
-    // Check if inode number exists in static file map for given block device id
-    auto inode_it = static_map_entry->second.find(inode_number);
-    if (inode_it == static_map_entry->second.end()) {
-      ++it;
-      continue;
-    }
-    system_found_count++;
-    it = inode_numbers->erase(it);
-    FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
-                   inode_it->second);
-  }
-  PERFETTO_DLOG("%" PRIu64 " inodes found in static file map",
-                system_found_count);
+    std::vector<Inode>* inode_numbers) {
+  size_t system_found_count = static_file_map_->Resolve(
+      block_device_id, inode_numbers,
+      [this, block_device_id](Inode inode_number,
+                              const InodeMapValue& inode_map_value) {
+        FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
+                       inode_map_value);
+      });
+  if (system_found_count > 0)
+    PERFETTO_DLOG("%zu inodes found in static file map", system_found_count);
 }
 
 void InodeFileDataSource::AddInodesFromLRUCache(
     BlockDeviceID block_device_id,
-    std::set<Inode>* inode_numbers) {
+    std::vector<Inode>* inode_numbers) {
   uint64_t cache_found_count = 0;
-  for (auto it = inode_numbers->begin(); it != inode_numbers->end();) {
+  auto wr_it = inode_numbers->begin();
+  for (auto it = inode_numbers->begin(); it != inode_numbers->end(); ++it) {
     Inode inode_number = *it;
     auto value = cache_->Get(std::make_pair(block_device_id, inode_number));
     if (value == nullptr) {
-      ++it;
+      *(wr_it++) = inode_number;
       continue;
     }
     cache_found_count++;
-    it = inode_numbers->erase(it);
     FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
                    *value);
   }
+  inode_numbers->erase(wr_it, inode_numbers->end());
   if (cache_found_count > 0)
     PERFETTO_DLOG("%" PRIu64 " inodes found in cache", cache_found_count);
 }
@@ -193,20 +214,29 @@ void InodeFileDataSource::OnInodes(
   if (mount_points_.empty()) {
     mount_points_ = ParseMounts();
   }
-  // Group inodes from FtraceMetadata by block device
-  std::map<BlockDeviceID, std::set<Inode>> inode_file_maps;
-  for (const auto& inodes_pair : inodes) {
-    Inode inode_number = inodes_pair.first;
-    BlockDeviceID block_device_id = inodes_pair.second;
-    inode_file_maps[block_device_id].emplace(inode_number);
-  }
-  if (inode_file_maps.size() > 1)
-    PERFETTO_DLOG("Saw %zu block devices.", inode_file_maps.size());
+  // Group inodes from FtraceMetadata by block device. Sorting a flat copy is
+  // much cheaper than building a std::set per block device and leaves each
+  // device's inodes sorted, as required by AddInodesFromStaticMap().
+  sorted_inodes_.clear();
+  sorted_inodes_.reserve(inodes.size());
+  for (const auto& inodes_pair : inodes)
+    sorted_inodes_.emplace_back(inodes_pair.second, inodes_pair.first);
+  std::sort(sorted_inodes_.begin(), sorted_inodes_.end());
+  sorted_inodes_.erase(
+      std::unique(sorted_inodes_.begin(), sorted_inodes_.end()),
+      sorted_inodes_.end());
 
   // Write a TracePacket with an InodeFileMap proto for each block device id
-  for (auto& inode_file_map_data : inode_file_maps) {
-    BlockDeviceID block_device_id = inode_file_map_data.first;
-    std::set<Inode>& inode_numbers = inode_file_map_data.second;
+  std::vector<Inode> inode_numbers;
+  for (auto inode_it = sorted_inodes_.cbegin();
+       inode_it != sorted_inodes_.cend();) {
+    BlockDeviceID block_device_id = inode_it->first;
+    inode_numbers.clear();
+    for (; inode_it != sorted_inodes_.cend() &&
+           inode_it->first == block_device_id;
+         ++inode_it) {
+      inode_numbers.push_back(inode_it->second);
+    }
     PERFETTO_DLOG("Saw %zu unique inode numbers.", inode_numbers.size());
 
     // Add entries to InodeFileMap as inodes are found and resolved to their
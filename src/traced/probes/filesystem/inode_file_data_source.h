@@ -23,7 +23,7 @@
 #include <memory>
 #include <set>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/base/weak_ptr.h"
@@ -34,6 +34,7 @@
 #include "src/traced/probes/filesystem/file_scanner.h"
 #include "src/traced/probes/filesystem/fs_mount.h"
 #include "src/traced/probes/filesystem/lru_inode_cache.h"
+#include "src/traced/probes/filesystem/static_inode_index.h"
 #include "src/traced/probes/probes_data_source.h"
 
 #include "perfetto/trace/filesystem/inode_file_map.pbzero.h"
@@ -43,11 +44,38 @@ namespace perfetto {
 using InodeFileMap = protos::pbzero::InodeFileMap;
 class TraceWriter;
 
-// Creates block_device_map for /system partition
-void CreateStaticDeviceToInodeMap(
-    const std::string& root_directory,
-    std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
-        static_file_map);
+// Creates block_device_map for /system partition.
+// If |index_path| is not empty, directory listings are cached there across
+// restarts and only directories that changed since are listed again.
+// The directories are listed on |pool| if given, else on the calling thread.
+void CreateStaticDeviceToInodeMap(const std::string& root_directory,
+                                  StaticInodeIndex* static_file_map,
+                                  const std::string& index_path = "",
+                                  base::ThreadPool* pool = nullptr);
+
+// Like CreateStaticDeviceToInodeMap(), but without blocking: the directories
+// are listed on the workers of |pool|, and |static_file_map| is filled on
+// |task_runner| once all of them are. The map stays empty until then.
+// Destroying the builder cancels the scan.
+class StaticInodeIndexBuilder : public FileScanner::Delegate {
+ public:
+  StaticInodeIndexBuilder(const std::string& root_directory,
+                          StaticInodeIndex* static_file_map,
+                          const std::string& index_path,
+                          base::ThreadPool* pool,
+                          base::TaskRunner* task_runner);
+  ~StaticInodeIndexBuilder() override;
+
+ private:
+  bool OnInodeFound(BlockDeviceID block_device_id,
+                    Inode inode_number,
+                    const std::string& path,
+                    protos::pbzero::InodeFileMap_Entry_Type type) override;
+  void OnInodeScanDone() override;
+
+  StaticInodeIndex* const static_file_map_;
+  ParallelFileScanner scanner_;  // Keep last, calls into |this|.
+};
 
 class InodeFileDataSource : public ProbesDataSource,
                             public FileScanner::Delegate {
@@ -58,8 +86,7 @@ class InodeFileDataSource : public ProbesDataSource,
       DataSourceConfig,
       base::TaskRunner*,
       TracingSessionID,
-      std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
-          static_file_map,
+      StaticInodeIndex* static_file_map,
       LRUInodeCache* cache,
       std::unique_ptr<TraceWriter> writer);
 
@@ -71,13 +98,14 @@ class InodeFileDataSource : public ProbesDataSource,
   // TODO(fmayer): Change  to std::pair<BlockDeviceID, Inode>.
   void OnInodes(const std::vector<std::pair<Inode, BlockDeviceID>>& inodes);
 
-  // Search in /system partition and add inodes to InodeFileMap proto if found
+  // Search in /system partition and add inodes to InodeFileMap proto if found.
+  // |inode_numbers| must be sorted and free of duplicates.
   void AddInodesFromStaticMap(BlockDeviceID block_device_id,
-                              std::set<Inode>* inode_numbers);
+                              std::vector<Inode>* inode_numbers);
 
   // Search in LRUInodeCache and add inodes to InodeFileMap if found
   void AddInodesFromLRUCache(BlockDeviceID block_device_id,
-                             std::set<Inode>* inode_numbers);
+                             std::vector<Inode>* inode_numbers);
 
   virtual void FillInodeEntry(InodeFileMap* destination,
                               Inode inode_number,
@@ -116,12 +144,13 @@ class InodeFileDataSource : public ProbesDataSource,
   std::map<std::string, std::vector<std::string>> mount_point_mapping_;
 
   base::TaskRunner* task_runner_;
-  std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
-      static_file_map_;
+  StaticInodeIndex* static_file_map_;
   LRUInodeCache* cache_;
   std::unique_ptr<TraceWriter> writer_;
   std::map<BlockDeviceID, std::set<Inode>> missing_inodes_;
   std::map<BlockDeviceID, std::set<Inode>> next_missing_inodes_;
+  // Scratch buffer for OnInodes(), kept to avoid reallocating on each call.
+  std::vector<std::pair<BlockDeviceID, Inode>> sorted_inodes_;
   std::set<BlockDeviceID> seen_block_devices_;
   BlockDeviceID current_block_device_id_;
   TraceWriter::TracePacketHandle current_trace_packet_;
@@ -0,0 +1,133 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/tracing/core/data_source_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/traced/probes/filesystem/inode_file_data_source.h"
+#include "src/traced/probes/filesystem/lru_inode_cache.h"
+#include "src/traced/probes/filesystem/static_inode_index.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+#include "src/tracing/core/null_trace_writer.h"
+
+namespace {
+
+using perfetto::BlockDeviceID;
+using perfetto::DataSourceConfig;
+using perfetto::FtraceMetadata;
+using perfetto::Inode;
+using perfetto::InodeFileDataSource;
+using perfetto::LRUInodeCache;
+using perfetto::NullTraceWriter;
+using perfetto::StaticInodeIndex;
+
+constexpr BlockDeviceID kSystemDevice = 1;
+constexpr BlockDeviceID kDataDevice = 2;
+
+// Simulates heavy I/O tracing: |num_events| inode-bearing events hitting only
+// |num_distinct| distinct inodes, split between two block devices.
+std::vector<std::pair<Inode, BlockDeviceID>> GetEvents(size_t num_events,
+                                                       size_t num_distinct) {
+  std::minstd_rand0 rnd(0);
+  std::vector<std::pair<Inode, BlockDeviceID>> events;
+  events.reserve(num_events);
+  for (size_t i = 0; i < num_events; i++) {
+    Inode inode = static_cast<Inode>(rnd() % num_distinct);
+    events.emplace_back(inode, inode % 2 ? kSystemDevice : kDataDevice);
+  }
+  return events;
+}
+
+void FillStaticIndex(StaticInodeIndex* index, size_t num_inodes) {
+  for (Inode inode = 0; inode < num_inodes; inode++) {
+    index->Add(kSystemDevice, inode,
+               perfetto::protos::pbzero::InodeFileMap_Entry_Type_FILE,
+               "/system/lib/" + std::to_string(inode) + ".so");
+  }
+  index->Finalize();
+}
+
+}  // namespace
+
+static void BM_FtraceMetadataAddInode(benchmark::State& state) {
+  const auto events = GetEvents(static_cast<size_t>(state.range(0)),
+                                static_cast<size_t>(state.range(1)));
+  FtraceMetadata metadata;
+  int32_t pid = getpid() + 1;
+  while (state.KeepRunning()) {
+    for (const auto& event : events) {
+      metadata.AddCommonPid(pid);
+      metadata.AddDevice(event.second);
+      metadata.AddInode(event.first);
+      metadata.FinishEvent();
+    }
+    benchmark::DoNotOptimize(metadata.inode_and_device.data());
+    metadata.Clear();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FtraceMetadataAddInode)
+    ->Args({4096, 64})
+    ->Args({4096, 4096})
+    ->Args({65536, 256});
+
+static void BM_InodeFileDataSourceOnInodes(benchmark::State& state) {
+  const size_t num_distinct = static_cast<size_t>(state.range(1));
+  const auto events =
+      GetEvents(static_cast<size_t>(state.range(0)), num_distinct);
+
+  perfetto::base::TestTaskRunner task_runner;
+  StaticInodeIndex static_file_map;
+  FillStaticIndex(&static_file_map, num_distinct);
+  LRUInodeCache cache(num_distinct);
+  for (Inode inode = 0; inode < num_distinct; inode += 2) {
+    cache.Insert(std::make_pair(kDataDevice, inode),
+                 perfetto::InodeMapValue(
+                     perfetto::protos::pbzero::InodeFileMap_Entry_Type_FILE,
+                     {"/data/" + std::to_string(inode)}));
+  }
+
+  DataSourceConfig config;
+  config.mutable_inode_file_config()->set_do_not_scan(true);
+  InodeFileDataSource data_source(
+      config, &task_runner, 0, &static_file_map, &cache,
+      std::unique_ptr<NullTraceWriter>(new NullTraceWriter()));
+
+  // Go through FtraceMetadata, as ProbesProducer does, so that the benchmark
+  // reflects the end-to-end cost of resolving the inodes of a drain cycle.
+  FtraceMetadata metadata;
+  int32_t pid = getpid() + 1;
+  while (state.KeepRunning()) {
+    for (const auto& event : events) {
+      metadata.AddCommonPid(pid);
+      metadata.AddDevice(event.second);
+      metadata.AddInode(event.first);
+      metadata.FinishEvent();
+    }
+    data_source.OnInodes(metadata.inode_and_device);
+    metadata.Clear();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_InodeFileDataSourceOnInodes)
+    ->Args({4096, 64})
+    ->Args({4096, 4096})
+    ->Args({65536, 256});
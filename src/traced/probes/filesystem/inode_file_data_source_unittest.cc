@@ -39,8 +39,7 @@ class TestInodeFileDataSource : public InodeFileDataSource {
       DataSourceConfig cfg,
       base::TaskRunner* task_runner,
       TracingSessionID tsid,
-      std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
-          static_file_map,
+      StaticInodeIndex* static_file_map,
       LRUInodeCache* cache,
       std::unique_ptr<TraceWriter> writer)
       : InodeFileDataSource(std::move(cfg),
@@ -72,8 +71,7 @@ class InodeFileDataSourceTest : public ::testing::Test {
   }
 
   LRUInodeCache cache_{100};
-  std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>
-      static_file_map_;
+  StaticInodeIndex static_file_map_;
   base::TestTaskRunner task_runner_;
 };
 
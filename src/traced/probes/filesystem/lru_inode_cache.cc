@@ -23,11 +23,9 @@ InodeMapValue* LRUInodeCache::Get(const InodeKey& k) {
   if (map_it == map_.end()) {
     return nullptr;
   }
-  auto list_entry = map_it->second;
-  // Bump this item to the front of the cache.
-  // We can borrow both elements of the pair stored in the list because
-  // insert does not need them.
-  Insert(map_it, std::move(list_entry->first), std::move(list_entry->second));
+  // Bump this item to the front of the cache. Splicing relinks the existing
+  // node, so neither the map nor the list allocate on a cache hit.
+  list_.splice(list_.begin(), list_, map_it->second);
   return &list_.begin()->second;
 }
 
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/static_inode_index.h"
+
+#include <iterator>
+
+namespace perfetto {
+
+StaticInodeIndex::StaticInodeIndex() = default;
+StaticInodeIndex::~StaticInodeIndex() = default;
+
+void StaticInodeIndex::Add(BlockDeviceID block_device_id,
+                           Inode inode_number,
+                           protos::pbzero::InodeFileMap_Entry_Type type,
+                           std::string path) {
+  finalized_ = false;
+  entries_.emplace_back();
+  Entry& entry = entries_.back();
+  entry.block_device_id = block_device_id;
+  entry.inode_number = inode_number;
+  entry.value.SetType(type);
+  entry.value.AddPath(std::move(path));
+}
+
+void StaticInodeIndex::Finalize() {
+  if (finalized_)
+    return;
+  std::stable_sort(entries_.begin(), entries_.end());
+
+  // Merge the paths of hardlinks, which were added as separate entries.
+  auto wr_it = entries_.begin();
+  for (auto rd_it = entries_.begin(); rd_it != entries_.end(); ++rd_it) {
+    if (wr_it != entries_.begin() &&
+        std::prev(wr_it)->block_device_id == rd_it->block_device_id &&
+        std::prev(wr_it)->inode_number == rd_it->inode_number) {
+      for (const std::string& path : rd_it->value.paths())
+        std::prev(wr_it)->value.AddPath(path);
+      continue;
+    }
+    if (wr_it != rd_it)
+      *wr_it = std::move(*rd_it);
+    ++wr_it;
+  }
+  entries_.erase(wr_it, entries_.end());
+  entries_.shrink_to_fit();
+  finalized_ = true;
+}
+
+std::pair<StaticInodeIndex::EntryIterator, StaticInodeIndex::EntryIterator>
+StaticInodeIndex::DeviceRange(BlockDeviceID block_device_id) const {
+  auto begin = std::lower_bound(
+      entries_.cbegin(), entries_.cend(), block_device_id,
+      [](const Entry& entry, BlockDeviceID device) {
+        return entry.block_device_id < device;
+      });
+  auto end = std::upper_bound(
+      begin, entries_.cend(), block_device_id,
+      [](BlockDeviceID device, const Entry& entry) {
+        return device < entry.block_device_id;
+      });
+  return std::make_pair(begin, end);
+}
+
+const InodeMapValue* StaticInodeIndex::Find(BlockDeviceID block_device_id,
+                                            Inode inode_number) const {
+  PERFETTO_DCHECK(finalized_);
+  auto range = DeviceRange(block_device_id);
+  auto it = std::lower_bound(range.first, range.second, inode_number,
+                             [](const Entry& entry, Inode inode) {
+                               return entry.inode_number < inode;
+                             });
+  if (it == range.second || it->inode_number != inode_number)
+    return nullptr;
+  return &it->value;
+}
+
+}  // namespace perfetto
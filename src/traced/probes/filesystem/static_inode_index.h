@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FILESYSTEM_STATIC_INODE_INDEX_H_
+#define SRC_TRACED_PROBES_FILESYSTEM_STATIC_INODE_INDEX_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/traced/data_source_types.h"
+
+namespace perfetto {
+
+// Read-only index of the inodes of partitions that don't change while
+// traced_probes is running (i.e. /system).
+// All entries live in a single vector sorted by (block device, inode). This is
+// considerably more compact than a map of hash maps and allows resolving a
+// sorted batch of inodes with a single forward pass over the index.
+class StaticInodeIndex {
+ public:
+  StaticInodeIndex();
+  ~StaticInodeIndex();
+
+  // Adds |path| to the entry for the given inode. Finalize() must be called
+  // after the last Add() and before any lookup.
+  void Add(BlockDeviceID block_device_id,
+           Inode inode_number,
+           protos::pbzero::InodeFileMap_Entry_Type type,
+           std::string path);
+  void Finalize();
+
+  const InodeMapValue* Find(BlockDeviceID block_device_id,
+                            Inode inode_number) const;
+
+  // Resolves the sorted and deduplicated |inode_numbers| on |block_device_id|.
+  // Every inode found is passed to |fn(Inode, const InodeMapValue&)| and
+  // removed from |inode_numbers|. Returns the number of inodes found.
+  template <typename Fn>
+  size_t Resolve(BlockDeviceID block_device_id,
+                 std::vector<Inode>* inode_numbers,
+                 Fn fn) const {
+    PERFETTO_DCHECK(finalized_);
+    PERFETTO_DCHECK(std::is_sorted(inode_numbers->begin(),
+                                   inode_numbers->end()));
+    auto range = DeviceRange(block_device_id);
+    auto entry_it = range.first;
+    size_t found = 0;
+    auto wr_it = inode_numbers->begin();
+    for (auto rd_it = inode_numbers->begin(); rd_it != inode_numbers->end();
+         ++rd_it) {
+      Inode inode_number = *rd_it;
+      entry_it = std::lower_bound(entry_it, range.second, inode_number,
+                                  [](const Entry& entry, Inode inode) {
+                                    return entry.inode_number < inode;
+                                  });
+      if (entry_it != range.second && entry_it->inode_number == inode_number) {
+        fn(inode_number, entry_it->value);
+        found++;
+        continue;
+      }
+      *(wr_it++) = inode_number;
+    }
+    inode_numbers->erase(wr_it, inode_numbers->end());
+    return found;
+  }
+
+  bool empty() const { return entries_.empty(); }
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    bool operator<(const Entry& other) const {
+      return std::tie(block_device_id, inode_number) <
+             std::tie(other.block_device_id, other.inode_number);
+    }
+
+    BlockDeviceID block_device_id;
+    Inode inode_number;
+    InodeMapValue value;
+  };
+  using EntryIterator = std::vector<Entry>::const_iterator;
+
+  std::pair<EntryIterator, EntryIterator> DeviceRange(
+      BlockDeviceID block_device_id) const;
+
+  std::vector<Entry> entries_;
+  bool finalized_ = true;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FILESYSTEM_STATIC_INODE_INDEX_H_
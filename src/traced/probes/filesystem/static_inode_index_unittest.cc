@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/static_inode_index.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsNull;
+using ::testing::Pair;
+using ::testing::UnorderedElementsAre;
+
+constexpr auto kFile = protos::pbzero::InodeFileMap_Entry_Type_FILE;
+constexpr auto kDir = protos::pbzero::InodeFileMap_Entry_Type_DIRECTORY;
+
+TEST(StaticInodeIndexTest, Find) {
+  StaticInodeIndex index;
+  EXPECT_TRUE(index.empty());
+  index.Add(2, 20, kFile, "/b/file");
+  index.Add(1, 10, kDir, "/a");
+  index.Add(1, 5, kFile, "/a/file");
+  index.Finalize();
+
+  EXPECT_EQ(index.size(), 3u);
+  ASSERT_NE(index.Find(1, 10), nullptr);
+  EXPECT_EQ(index.Find(1, 10)->type(), kDir);
+  EXPECT_THAT(index.Find(1, 10)->paths(), ElementsAre("/a"));
+  ASSERT_NE(index.Find(2, 20), nullptr);
+  EXPECT_THAT(index.Find(2, 20)->paths(), ElementsAre("/b/file"));
+  EXPECT_THAT(index.Find(1, 20), IsNull());
+  EXPECT_THAT(index.Find(2, 10), IsNull());
+  EXPECT_THAT(index.Find(3, 5), IsNull());
+}
+
+TEST(StaticInodeIndexTest, MergesHardlinks) {
+  StaticInodeIndex index;
+  index.Add(1, 10, kFile, "/a/link1");
+  index.Add(1, 11, kFile, "/a/other");
+  index.Add(1, 10, kFile, "/a/link2");
+  index.Finalize();
+
+  EXPECT_EQ(index.size(), 2u);
+  ASSERT_NE(index.Find(1, 10), nullptr);
+  EXPECT_THAT(index.Find(1, 10)->paths(),
+              UnorderedElementsAre("/a/link1", "/a/link2"));
+}
+
+TEST(StaticInodeIndexTest, Resolve) {
+  StaticInodeIndex index;
+  for (Inode inode = 0; inode < 100; inode += 2) {
+    index.Add(1, inode, kFile, "/one/" + std::to_string(inode));
+    index.Add(2, inode + 1, kFile, "/two/" + std::to_string(inode + 1));
+  }
+  index.Finalize();
+
+  std::vector<Inode> inodes{1, 2, 3, 4, 98, 99, 1000};
+  std::vector<std::pair<Inode, std::string>> found;
+  size_t count = index.Resolve(
+      1, &inodes, [&found](Inode inode, const InodeMapValue& value) {
+        found.emplace_back(inode, *value.paths().begin());
+      });
+  EXPECT_EQ(count, 3u);
+  EXPECT_THAT(found, ElementsAre(Pair(2, "/one/2"), Pair(4, "/one/4"),
+                                 Pair(98, "/one/98")));
+  EXPECT_THAT(inodes, ElementsAre(1, 3, 99, 1000));
+
+  found.clear();
+  count = index.Resolve(
+      2, &inodes, [&found](Inode inode, const InodeMapValue& value) {
+        found.emplace_back(inode, *value.paths().begin());
+      });
+  EXPECT_EQ(count, 3u);
+  EXPECT_THAT(found, ElementsAre(Pair(1, "/two/1"), Pair(3, "/two/3"),
+                                 Pair(99, "/two/99")));
+  EXPECT_THAT(inodes, ElementsAre(1000));
+}
+
+}  // namespace
+}  // namespace perfetto
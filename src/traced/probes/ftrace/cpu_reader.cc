@@ -68,10 +68,11 @@ struct TimeStamp {
   uint64_t tv_sec;
 };
 
+template <typename Out>
 bool ReadIntoString(const uint8_t* start,
                     const uint8_t* end,
                     uint32_t field_id,
-                    protozero::Message* out) {
+                    Out* out) {
   for (const uint8_t* c = start; c < end; c++) {
     if (*c != '\0')
       continue;
@@ -82,11 +83,12 @@ bool ReadIntoString(const uint8_t* start,
   return false;
 }
 
+template <typename Out>
 bool ReadDataLoc(const uint8_t* start,
                  const uint8_t* field_start,
                  const uint8_t* end,
                  const Field& field,
-                 protozero::Message* message) {
+                 Out* message) {
   PERFETTO_DCHECK(field.ftrace_size == 4);
   // See
   // https://github.com/torvalds/linux/blob/master/include/trace/trace_events.h
@@ -156,6 +158,8 @@ CpuReader::CpuReader(const ProtoTranslationTable* table,
     : table_(table),
       thread_sync_(thread_sync),
       cpu_(cpu),
+      drain_metatrace_name_(base::MetaTrace::InternName(
+          "Drain(" + std::to_string(cpu) + ")")),
       trace_fd_(std::move(fd)) {
   // Make reads from the raw pipe blocking so that splice() can sleep.
   PERFETTO_CHECK(trace_fd_);
@@ -399,8 +403,7 @@ void CpuReader::RunWorkerThread(size_t cpu,
 // first CPU wakes up from the blocking read()/splice().
 void CpuReader::Drain(const std::set<FtraceDataSource*>& data_sources) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
-  PERFETTO_METATRACE("Drain(" + std::to_string(cpu_) + ")",
-                     base::MetaTrace::kMainThreadCpu);
+  PERFETTO_METATRACE(drain_metatrace_name_, base::MetaTrace::kMainThreadCpu);
 
   auto page_blocks = pool_.BeginRead();
   for (const auto& page_block : page_blocks) {
@@ -577,8 +580,18 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
       success &= ParseField(field, start, end, generic_field, metadata);
     }
   } else {  // Parse all other events.
-    for (const Field& field : info.fields) {
-      success &= ParseField(field, start, end, nested, metadata);
+    // Most events have only fixed size fields: encode them without per-field
+    // bounds checks, unless the worst case size straddles a chunk boundary.
+    protozero::ReservedFieldWriter writer;
+    if (info.max_encoded_size)
+      writer = nested->BeginReservedWrite(info.max_encoded_size);
+    if (writer) {
+      for (const Field& field : info.fields)
+        success &= ParseField(field, start, end, &writer, metadata);
+      nested->EndReservedWrite(writer);
+    } else {
+      for (const Field& field : info.fields)
+        success &= ParseField(field, start, end, nested, metadata);
     }
   }
 
@@ -602,10 +615,11 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
 // The only exception is fields with strategy = kCStringToString
 // where the total size isn't known up front. In this case ParseField
 // will check the string terminates in the bounds and won't read past |end|.
+template <typename Out>
 bool CpuReader::ParseField(const Field& field,
                            const uint8_t* start,
                            const uint8_t* end,
-                           protozero::Message* message,
+                           Out* message,
                            FtraceMetadata* metadata) {
   PERFETTO_DCHECK(start + field.ftrace_offset + field.ftrace_size <= end);
   const uint8_t* field_start = start + field.ftrace_offset;
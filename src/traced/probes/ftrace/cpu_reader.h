@@ -83,48 +83,49 @@ class CpuReader {
   // Caller must do the bounds check:
   // [start + offset, start + offset + sizeof(T))
   // Returns the raw value not the varint.
-  template <typename T>
-  static T ReadIntoVarInt(const uint8_t* start,
-                          uint32_t field_id,
-                          protozero::Message* out) {
+  // |Out| is either a protozero::Message or a protozero::ReservedFieldWriter.
+  template <typename T, typename Out>
+  static T ReadIntoVarInt(const uint8_t* start, uint32_t field_id, Out* out) {
     T t;
     memcpy(&t, reinterpret_cast<const void*>(start), sizeof(T));
-    out->AppendVarInt<T>(field_id, t);
+    out->AppendVarInt(field_id, t);
     return t;
   }
 
-  template <typename T>
+  template <typename T, typename Out>
   static void ReadInode(const uint8_t* start,
                         uint32_t field_id,
-                        protozero::Message* out,
+                        Out* out,
                         FtraceMetadata* metadata) {
     T t = ReadIntoVarInt<T>(start, field_id, out);
     metadata->AddInode(static_cast<Inode>(t));
   }
 
-  template <typename T>
+  template <typename T, typename Out>
   static void ReadDevId(const uint8_t* start,
                         uint32_t field_id,
-                        protozero::Message* out,
+                        Out* out,
                         FtraceMetadata* metadata) {
     T t;
     memcpy(&t, reinterpret_cast<const void*>(start), sizeof(T));
     BlockDeviceID dev_id = TranslateBlockDeviceIDToUserspace<T>(t);
-    out->AppendVarInt<BlockDeviceID>(field_id, dev_id);
+    out->AppendVarInt(field_id, dev_id);
     metadata->AddDevice(dev_id);
   }
 
+  template <typename Out>
   static void ReadPid(const uint8_t* start,
                       uint32_t field_id,
-                      protozero::Message* out,
+                      Out* out,
                       FtraceMetadata* metadata) {
     int32_t pid = ReadIntoVarInt<int32_t>(start, field_id, out);
     metadata->AddPid(pid);
   }
 
+  template <typename Out>
   static void ReadCommonPid(const uint8_t* start,
                             uint32_t field_id,
-                            protozero::Message* out,
+                            Out* out,
                             FtraceMetadata* metadata) {
     int32_t pid = ReadIntoVarInt<int32_t>(start, field_id, out);
     metadata->AddCommonPid(pid);
@@ -173,10 +174,12 @@ class CpuReader {
                          protozero::Message* message,
                          FtraceMetadata* metadata);
 
+  // |Out| is either a protozero::Message or a protozero::ReservedFieldWriter.
+  template <typename Out>
   static bool ParseField(const Field& field,
                          const uint8_t* start,
                          const uint8_t* end,
-                         protozero::Message* message,
+                         Out* message,
                          FtraceMetadata* metadata);
 
  private:
@@ -193,6 +196,7 @@ class CpuReader {
   const ProtoTranslationTable* const table_;
   FtraceThreadSync* const thread_sync_;
   const size_t cpu_;
+  const char* const drain_metatrace_name_;
   PagePool pool_;
   base::ScopedFile trace_fd_;
   std::thread worker_thread_;
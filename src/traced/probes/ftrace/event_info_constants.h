@@ -163,6 +163,11 @@ struct Event {
   // terminated string of unknown size. This size doesn't include the length of
   // that string.
   uint16_t size;
+
+  // Upper bound of the encoded size of the fields of the subevent proto, or 0
+  // if it depends on the contents of the event (e.g. null terminated strings).
+  // When known, CpuReader encodes the fields in a single reserved span.
+  uint32_t max_encoded_size = 0;
 };
 
 // The compile time information needed to read the common fields from
@@ -46,6 +46,8 @@ using testing::Return;
 using testing::IsEmpty;
 using testing::ElementsAre;
 using testing::Pair;
+using testing::Contains;
+using testing::Not;
 
 using Table = perfetto::ProtoTranslationTable;
 using FtraceEventBundle = perfetto::protos::pbzero::FtraceEventBundle;
@@ -594,6 +596,30 @@ TEST(FtraceMetadataTest, AddInode) {
               ElementsAre(Pair(2, 3), Pair(1, 3), Pair(3, 4)));
 }
 
+TEST(FtraceMetadataTest, AddInodeDeduplicates) {
+  FtraceMetadata metadata;
+  for (int i = 0; i < 2; i++) {
+    for (Inode inode = 1; inode <= 1000; inode++) {
+      metadata.AddCommonPid(getpid() + 1);
+      metadata.AddDevice(inode % 2 ? 3 : 4);
+      metadata.AddInode(inode);
+      metadata.FinishEvent();
+    }
+  }
+  EXPECT_EQ(metadata.inode_and_device.size(), 1000u);
+  EXPECT_THAT(metadata.inode_and_device, Contains(Pair(1, 3)));
+  EXPECT_THAT(metadata.inode_and_device, Contains(Pair(1000, 4)));
+  EXPECT_THAT(metadata.inode_and_device, Not(Contains(Pair(1, 4))));
+
+  // After a Clear() the same inodes should be reported again.
+  metadata.Clear();
+  metadata.AddCommonPid(getpid() + 1);
+  metadata.AddDevice(3);
+  metadata.AddInode(1);
+  metadata.AddInode(1);
+  EXPECT_THAT(metadata.inode_and_device, ElementsAre(Pair(1, 3)));
+}
+
 TEST(FtraceMetadataTest, AddPid) {
   FtraceMetadata metadata;
   metadata.AddPid(1);
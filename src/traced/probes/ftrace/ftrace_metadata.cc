@@ -17,10 +17,23 @@
 #include "src/traced/probes/ftrace/ftrace_metadata.h"
 
 namespace perfetto {
+namespace {
+
+// Must be a power of two.
+constexpr size_t kInitialInodeSlots = 64;
+
+inline size_t HashInode(Inode inode, BlockDeviceID device) {
+  uint64_t h = static_cast<uint64_t>(inode) * 0x9E3779B97F4A7C15ull;
+  h ^= static_cast<uint64_t>(device) + 0x9E3779B9ull + (h << 6) + (h >> 2);
+  return static_cast<size_t>(h ^ (h >> 32));
+}
+
+}  // namespace
 
 FtraceMetadata::FtraceMetadata() {
   // A lot of the time there will only be a small number of inodes.
   inode_and_device.reserve(10);
+  inode_slots_.resize(kInitialInodeSlots);
   // A sched_switch is 64 bytes, a page is 4096 bytes and we expect
   // 2 pid's per sched_switch. 4096/64*2=128
   pids.reserve(128);
@@ -46,9 +59,37 @@ void FtraceMetadata::AddInode(Inode inode_number) {
   PERFETTO_DCHECK(last_seen_common_pid);
   PERFETTO_DCHECK(cached_pid == getpid());
   // Ignore own scanning activity.
-  if (cached_pid != last_seen_common_pid) {
-    inode_and_device.push_back(
-        std::make_pair(inode_number, last_seen_device_id));
+  if (cached_pid == last_seen_common_pid)
+    return;
+
+  uint32_t* slot = FindInodeSlot(inode_number, last_seen_device_id);
+  if (*slot)
+    return;  // Already seen in this drain cycle.
+  inode_and_device.push_back(std::make_pair(inode_number, last_seen_device_id));
+  *slot = static_cast<uint32_t>(inode_and_device.size());
+  if (inode_and_device.size() * 2 > inode_slots_.size())
+    GrowInodeSlots();
+}
+
+uint32_t* FtraceMetadata::FindInodeSlot(Inode inode_number,
+                                        BlockDeviceID device_id) {
+  const size_t mask = inode_slots_.size() - 1;
+  for (size_t i = HashInode(inode_number, device_id) & mask;;
+       i = (i + 1) & mask) {
+    uint32_t* slot = &inode_slots_[i];
+    if (*slot == 0)
+      return slot;
+    const auto& entry = inode_and_device[*slot - 1];
+    if (entry.first == inode_number && entry.second == device_id)
+      return slot;
+  }
+}
+
+void FtraceMetadata::GrowInodeSlots() {
+  inode_slots_.assign(inode_slots_.size() * 2, 0);
+  for (size_t i = 0; i < inode_and_device.size(); i++) {
+    const auto& entry = inode_and_device[i];
+    *FindInodeSlot(entry.first, entry.second) = static_cast<uint32_t>(i + 1);
   }
 }
 
@@ -79,6 +120,9 @@ void FtraceMetadata::FinishEvent() {
 
 void FtraceMetadata::Clear() {
   inode_and_device.clear();
+  // Shrinking keeps the capacity, so a busy drain cycle doesn't cause
+  // reallocations on the following ones.
+  inode_slots_.assign(kInitialInodeSlots, 0);
   pids.clear();
   rename_pids.clear();
   overwrite_count = 0;
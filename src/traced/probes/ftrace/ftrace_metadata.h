@@ -41,7 +41,8 @@ struct FtraceMetadata {
 #endif
   int32_t last_seen_common_pid = 0;
 
-  // A vector not a set to keep the writer_fast.
+  // A vector not a set to keep the writer_fast. Duplicates within the same
+  // drain cycle are filtered out through |inode_slots_| below.
   std::vector<std::pair<Inode, BlockDeviceID>> inode_and_device;
   std::vector<int32_t> pids;
   std::vector<int32_t> rename_pids;
@@ -53,6 +54,18 @@ struct FtraceMetadata {
   void AddRenamePid(int32_t);
   void Clear();
   void FinishEvent();
+
+ private:
+  void GrowInodeSlots();
+  uint32_t* FindInodeSlot(Inode, BlockDeviceID);
+
+  // Open-addressing hash set (linear probing) of indexes into
+  // |inode_and_device|. Each slot holds index + 1, 0 marks a free slot. With
+  // heavy I/O tracing the same few inodes are seen over and over within a
+  // drain cycle, this keeps |inode_and_device| bounded by the number of
+  // distinct inodes rather than the number of events. The size is always a
+  // power of two and is kept at most half full.
+  std::vector<uint32_t> inode_slots_;
 };
 
 }  // namespace perfetto
@@ -187,6 +187,25 @@ uint16_t MergeFields(const std::vector<FtraceEvent::Field>& ftrace_fields,
   return fields_end;
 }
 
+// Returns an upper bound of the encoded size of |fields|, or 0 if it depends
+// on the contents of the event.
+uint32_t GetMaxEncodedSize(const std::vector<Field>& fields) {
+  using protozero::proto_utils::kMaxSimpleFieldEncodedSize;
+  uint32_t size = 0;
+  for (const Field& field : fields) {
+    if (field.strategy == kCStringToString ||
+        field.strategy == kDataLocToString) {
+      return 0;
+    }
+    if (field.strategy == kStringPtrToString)
+      continue;
+    size += static_cast<uint32_t>(kMaxSimpleFieldEncodedSize);
+    if (field.strategy == kFixedCStringToString)
+      size += field.ftrace_size;
+  }
+  return size;
+}
+
 bool Contains(const std::string& haystack, const std::string& needle) {
   return haystack.find(needle) != std::string::npos;
 }
@@ -437,6 +456,7 @@ std::unique_ptr<ProtoTranslationTable> ProtoTranslationTable::Create(
         MergeFields(ftrace_event.fields, &event.fields, event.name);
 
     event.size = std::max<uint16_t>(fields_end, common_fields_end);
+    event.max_encoded_size = GetMaxEncodedSize(event.fields);
   }
 
   events.erase(std::remove_if(events.begin(), events.end(),
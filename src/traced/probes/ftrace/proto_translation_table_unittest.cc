@@ -100,6 +100,8 @@ TEST_P(AllTranslationTableTest, Create) {
     EXPECT_EQ(event->fields.at(1).proto_field_type, ProtoSchemaType::kString);
     EXPECT_EQ(event->fields.at(1).ftrace_type, kFtraceCString);
     EXPECT_EQ(event->fields.at(1).strategy, kCStringToString);
+    // The size of the string is not known upfront.
+    EXPECT_EQ(event->max_encoded_size, 0u);
   }
 }
 
@@ -244,6 +246,8 @@ print fmt: "some format")"));
   EXPECT_EQ(event->ftrace_event_id, 42ul);
   EXPECT_EQ(event->proto_field_id, 21ul);
   EXPECT_EQ(event->size, 36u);
+  // Two tags and varints, plus the 16 bytes of field_a.
+  EXPECT_EQ(event->max_encoded_size, 46u);
   EXPECT_EQ(std::string(event->name), "foo");
   EXPECT_EQ(std::string(event->group), "group");
 
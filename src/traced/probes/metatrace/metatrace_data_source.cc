@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/metatrace/metatrace_data_source.h"
+
+#include <algorithm>
+#include <map>
+
+#include "perfetto/base/task_runner.h"
+
+#include "perfetto/trace/perfetto_metatrace.pbzero.h"
+#include "perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+
+// static
+constexpr int MetatraceDataSource::kTypeId;
+constexpr uint32_t MetatraceDataSource::kReadPeriodMs;
+
+MetatraceDataSource::MetatraceDataSource(base::TaskRunner* task_runner,
+                                         TracingSessionID session_id,
+                                         std::unique_ptr<TraceWriter> writer)
+    : ProbesDataSource(session_id, kTypeId),
+      task_runner_(task_runner),
+      writer_(std::move(writer)),
+      cursor_(base::MetaTrace::EnableRing()),
+      weak_factory_(this) {}
+
+MetatraceDataSource::~MetatraceDataSource() {
+  base::MetaTrace::DisableRing();
+}
+
+void MetatraceDataSource::Start() {
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      std::bind(&MetatraceDataSource::Tick, weak_this), kReadPeriodMs);
+}
+
+// static
+void MetatraceDataSource::Tick(base::WeakPtr<MetatraceDataSource> weak_this) {
+  if (!weak_this)
+    return;
+  weak_this->task_runner_->PostDelayedTask(
+      std::bind(&MetatraceDataSource::Tick, weak_this), kReadPeriodMs);
+  weak_this->WriteEvents();
+}
+
+void MetatraceDataSource::WriteEvents() {
+  records_.clear();
+  uint64_t overruns = base::MetaTrace::ReadRing(&cursor_, &records_);
+  if (records_.empty() && !overruns)
+    return;
+
+  // The rings are read in order of end, sort by start so that parents precede their
+  // children.
+  std::stable_sort(records_.begin(), records_.end(),
+                   [](const base::MetaTrace::Record& a,
+                      const base::MetaTrace::Record& b) {
+                     return a.start_ns < b.start_ns;
+                   });
+
+  auto packet = writer_->NewTracePacket();
+  uint64_t base_ns = records_.empty() ? 0 : records_.front().start_ns;
+  if (base_ns)
+    packet->set_timestamp(base_ns);
+  auto* metatrace = packet->set_perfetto_metatrace();
+  std::map<const char*, uint32_t> name_iids;
+  for (const base::MetaTrace::Record& record : records_) {
+    auto it_and_inserted = name_iids.emplace(
+        record.name, static_cast<uint32_t>(name_iids.size() + 1));
+    uint32_t iid = it_and_inserted.first->second;
+    if (it_and_inserted.second) {
+      auto* event_name = metatrace->add_event_names();
+      event_name->set_iid(iid);
+      event_name->set_name(record.name);
+    }
+    auto* event = metatrace->add_events();
+    event->set_name_iid(iid);
+    event->set_timestamp_delta_ns(record.start_ns - base_ns);
+    event->set_duration_ns(record.duration_ns);
+    event->set_cpu(record.cpu);
+    event->set_tid(record.tid);
+  }
+  if (overruns)
+    metatrace->set_overruns(overruns);
+}
+
+void MetatraceDataSource::Flush(FlushRequestID,
+                                std::function<void()> callback) {
+  WriteEvents();
+  writer_->Flush(callback);
+}
+
+}  // namespace perfetto
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_METATRACE_METATRACE_DATA_SOURCE_H_
+#define SRC_TRACED_PROBES_METATRACE_METATRACE_DATA_SOURCE_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/metatrace.h"
+#include "perfetto/base/weak_ptr.h"
+#include "perfetto/tracing/core/basic_types.h"
+#include "perfetto/tracing/core/trace_writer.h"
+#include "src/traced/probes/probes_data_source.h"
+
+namespace perfetto {
+
+namespace base {
+class TaskRunner;
+}
+
+// Records the PERFETTO_METATRACE scopes of traced_probes into the in-memory
+// rings of base::MetaTrace while active, and periodically moves them into
+// PerfettoMetatrace packets.
+class MetatraceDataSource : public ProbesDataSource {
+ public:
+  static constexpr int kTypeId = 8;
+  static constexpr uint32_t kReadPeriodMs = 100;
+
+  MetatraceDataSource(base::TaskRunner*,
+                      TracingSessionID,
+                      std::unique_ptr<TraceWriter> writer);
+  ~MetatraceDataSource() override;
+
+  // ProbesDataSource implementation.
+  void Start() override;
+  void Flush(FlushRequestID, std::function<void()> callback) override;
+
+  // Emits the events recorded so far. Public for testing.
+  void WriteEvents();
+
+ private:
+  static void Tick(base::WeakPtr<MetatraceDataSource>);
+
+  MetatraceDataSource(const MetatraceDataSource&) = delete;
+  MetatraceDataSource& operator=(const MetatraceDataSource&) = delete;
+
+  base::TaskRunner* const task_runner_;
+  std::unique_ptr<TraceWriter> writer_;
+  std::vector<base::MetaTrace::Record> records_;
+  // Position of this data source in the rings, independent of other sessions.
+  base::MetaTrace::RingCursor cursor_;
+
+  base::WeakPtrFactory<MetatraceDataSource> weak_factory_;  // Keep last.
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_METATRACE_METATRACE_DATA_SOURCE_H_
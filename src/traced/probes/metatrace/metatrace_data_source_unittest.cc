@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/metatrace/metatrace_data_source.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/tracing/core/trace_writer_for_testing.h"
+
+#include "perfetto/trace/trace_packet.pb.h"
+
+namespace perfetto {
+namespace {
+
+class MetatraceDataSourceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    auto writer =
+        std::unique_ptr<TraceWriterForTesting>(new TraceWriterForTesting());
+    writer_raw_ = writer.get();
+    data_source_.reset(
+        new MetatraceDataSource(&task_runner_, 0, std::move(writer)));
+  }
+
+  base::TestTaskRunner task_runner_;
+  TraceWriterForTesting* writer_raw_ = nullptr;
+  std::unique_ptr<MetatraceDataSource> data_source_;
+};
+
+TEST_F(MetatraceDataSourceTest, WritesEventsWithInternedNames) {
+  {
+    PERFETTO_METATRACE("outer", 1);
+    { PERFETTO_METATRACE("inner", 1); }
+    { PERFETTO_METATRACE("inner", 2); }
+  }
+  data_source_->WriteEvents();
+
+  auto packets = writer_raw_->GetAllTracePackets();
+  ASSERT_EQ(packets.size(), 1u);
+  const protos::TracePacket& packet = packets.back();
+  ASSERT_TRUE(packet.has_perfetto_metatrace());
+  const protos::PerfettoMetatrace& metatrace = packet.perfetto_metatrace();
+  ASSERT_EQ(metatrace.event_names_size(), 2);
+  ASSERT_EQ(metatrace.events_size(), 3);
+  EXPECT_EQ(metatrace.overruns(), 0u);
+
+  // The events are sorted by start, so the enclosing one comes first.
+  std::map<uint32_t, std::string> names;
+  for (const auto& event_name : metatrace.event_names())
+    names[event_name.iid()] = event_name.name();
+  const auto& outer = metatrace.events(0);
+  EXPECT_EQ(names[outer.name_iid()], "outer");
+  EXPECT_EQ(outer.timestamp_delta_ns(), 0u);
+  EXPECT_EQ(outer.cpu(), 1u);
+  for (int i = 1; i < 3; i++) {
+    const auto& inner = metatrace.events(i);
+    EXPECT_EQ(names[inner.name_iid()], "inner");
+    EXPECT_EQ(inner.name_iid(), metatrace.events(1).name_iid());
+    EXPECT_EQ(inner.cpu(), static_cast<uint32_t>(i));
+    EXPECT_LE(inner.timestamp_delta_ns() + inner.duration_ns(),
+              outer.duration_ns());
+  }
+  EXPECT_GT(packet.timestamp(), 0u);
+
+  // Nothing new to write.
+  data_source_->WriteEvents();
+  EXPECT_EQ(writer_raw_->GetAllTracePackets().size(), 1u);
+}
+
+TEST_F(MetatraceDataSourceTest, ConcurrentSessionsGetAllEvents) {
+  auto writer =
+      std::unique_ptr<TraceWriterForTesting>(new TraceWriterForTesting());
+  TraceWriterForTesting* writer_raw = writer.get();
+  MetatraceDataSource data_source(&task_runner_, 1, std::move(writer));
+
+  { PERFETTO_METATRACE("evt", 0); }
+  data_source_->WriteEvents();
+  data_source.WriteEvents();
+
+  for (TraceWriterForTesting* w : {writer_raw_, writer_raw}) {
+    auto packets = w->GetAllTracePackets();
+    ASSERT_EQ(packets.size(), 1u);
+    EXPECT_EQ(packets[0].perfetto_metatrace().events_size(), 1);
+  }
+}
+
+TEST_F(MetatraceDataSourceTest, StopsRecordingWhenDestroyed) {
+  data_source_.reset();
+  base::MetaTrace::RingCursor cursor = base::MetaTrace::EnableRing();
+  base::MetaTrace::DisableRing();
+
+  { PERFETTO_METATRACE("not recorded", 0); }
+
+  std::vector<base::MetaTrace::Record> records;
+  EXPECT_EQ(base::MetaTrace::ReadRing(&cursor, &records), 0u);
+  EXPECT_TRUE(records.empty());
+}
+
+}  // namespace
+}  // namespace perfetto
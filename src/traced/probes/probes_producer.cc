@@ -23,6 +23,7 @@
 #include <queue>
 #include <string>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/utils.h"
 #include "perfetto/base/weak_ptr.h"
@@ -36,6 +37,7 @@
 #include "src/traced/probes/android_log/android_log_data_source.h"
 #include "src/traced/probes/filesystem/inode_file_data_source.h"
 #include "src/traced/probes/ftrace/ftrace_data_source.h"
+#include "src/traced/probes/metatrace/metatrace_data_source.h"
 #include "src/traced/probes/packages_list/packages_list_data_source.h"
 #include "src/traced/probes/power/android_power_data_source.h"
 #include "src/traced/probes/probes_data_source.h"
@@ -56,6 +58,15 @@ constexpr uint32_t kMaxConnectionBackoffMs = 30 * 1000;
 // Should be larger than FtraceController::kControllerFlushTimeoutMs.
 constexpr uint32_t kFlushTimeoutMs = 1000;
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+// Directory listings of /system, reused across traced_probes restarts. The
+// directory is only writable by traced_probes (see perfetto.rc).
+constexpr char kSystemInodeIndexPath[] =
+    "/data/misc/traced_probes/system_inode_index";
+#else
+constexpr char kSystemInodeIndexPath[] = "";
+#endif
+
 constexpr char kFtraceSourceName[] = "linux.ftrace";
 constexpr char kProcessStatsSourceName[] = "linux.process_stats";
 constexpr char kInodeMapSourceName[] = "linux.inode_file_map";
@@ -63,6 +74,7 @@ constexpr char kSysStatsSourceName[] = "linux.sys_stats";
 constexpr char kAndroidPowerSourceName[] = "android.power";
 constexpr char kAndroidLogSourceName[] = "android.log";
 constexpr char kPackagesListSourceName[] = "android.packages_list";
+constexpr char kMetatraceSourceName[] = "perfetto.metatrace";
 
 }  // namespace.
 
@@ -129,6 +141,12 @@ void ProbesProducer::OnConnect() {
     desc.set_name(kPackagesListSourceName);
     endpoint_->RegisterDataSource(desc);
   }
+
+  {
+    DataSourceDescriptor desc;
+    desc.set_name(kMetatraceSourceName);
+    endpoint_->RegisterDataSource(desc);
+  }
 }
 
 void ProbesProducer::OnDisconnect() {
@@ -183,6 +201,8 @@ void ProbesProducer::SetupDataSource(DataSourceInstanceID instance_id,
     data_source = CreateAndroidLogDataSource(session_id, config);
   } else if (config.name() == kPackagesListSourceName) {
     data_source = CreatePackagesListDataSource(session_id, config);
+  } else if (config.name() == kMetatraceSourceName) {
+    data_source = CreateMetatraceDataSource(session_id, config);
   }
 
   if (!data_source) {
@@ -259,8 +279,15 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreateInodeFileDataSource(
   PERFETTO_LOG("Inode file map setup (target_buf=%" PRIu32 ")",
                source_config.target_buffer());
   auto buffer_id = static_cast<BufferID>(source_config.target_buffer());
-  if (system_inodes_.empty())
-    CreateStaticDeviceToInodeMap("/system", &system_inodes_);
+  // Inodes seen before the scan completes are resolved by the slower
+  // per-session scan instead.
+  if (!system_inodes_builder_) {
+    if (!thread_pool_)
+      thread_pool_.reset(new base::ThreadPool());
+    system_inodes_builder_.reset(new StaticInodeIndexBuilder(
+        "/system", &system_inodes_, kSystemInodeIndexPath, thread_pool_.get(),
+        task_runner_));
+  }
   return std::unique_ptr<InodeFileDataSource>(new InodeFileDataSource(
       std::move(source_config), task_runner_, session_id, &system_inodes_,
       &cache_, endpoint_->CreateTraceWriter(buffer_id)));
@@ -301,6 +328,14 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreatePackagesListDataSource(
       config, session_id, endpoint_->CreateTraceWriter(buffer_id)));
 }
 
+std::unique_ptr<ProbesDataSource> ProbesProducer::CreateMetatraceDataSource(
+    TracingSessionID session_id,
+    const DataSourceConfig& config) {
+  auto buffer_id = static_cast<BufferID>(config.target_buffer());
+  return std::unique_ptr<ProbesDataSource>(new MetatraceDataSource(
+      task_runner_, session_id, endpoint_->CreateTraceWriter(buffer_id)));
+}
+
 std::unique_ptr<ProbesDataSource> ProbesProducer::CreateSysStatsDataSource(
     TracingSessionID session_id,
     const DataSourceConfig& config) {
@@ -470,6 +505,7 @@ void ProbesProducer::OnFtraceDataWrittenIntoDataSourceBuffers() {
       case SysStatsDataSource::kTypeId:
       case AndroidLogDataSource::kTypeId:
       case PackagesListDataSource::kTypeId:
+      case MetatraceDataSource::kTypeId:
         break;
       default:
         PERFETTO_DFATAL("Invalid data source.");
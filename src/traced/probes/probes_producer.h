@@ -22,6 +22,7 @@
 #include <utility>
 
 #include "perfetto/base/task_runner.h"
+#include "perfetto/base/thread_pool.h"
 #include "perfetto/base/watchdog.h"
 #include "perfetto/base/weak_ptr.h"
 #include "perfetto/tracing/core/producer.h"
@@ -84,6 +85,9 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
   std::unique_ptr<ProbesDataSource> CreatePackagesListDataSource(
       TracingSessionID session_id,
       const DataSourceConfig& config);
+  std::unique_ptr<ProbesDataSource> CreateMetatraceDataSource(
+      TracingSessionID session_id,
+      const DataSourceConfig& config);
 
  private:
   enum State {
@@ -124,8 +128,11 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
 
   std::unordered_map<DataSourceInstanceID, base::Watchdog::Timer> watchdogs_;
   LRUInodeCache cache_{kLRUInodeCacheSize};
-  std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>
-      system_inodes_;
+  StaticInodeIndex system_inodes_;
+  // For the data sources that work in the background, created on first use.
+  // Must outlive its users below.
+  std::unique_ptr<base::ThreadPool> thread_pool_;
+  std::unique_ptr<StaticInodeIndexBuilder> system_inodes_builder_;
 
   base::WeakPtrFactory<ProbesProducer> weak_factory_;  // Keep last.
 };
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/proc_connector.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/base/utils.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#define PERFETTO_HAS_PROC_CONNECTOR 1
+#endif
+
+namespace perfetto {
+namespace {
+
+// Each proc event is ~80 bytes, this fits a few hundred of them.
+constexpr size_t kRecvBufSize = 32 * 1024;
+
+// Upper bound on the datagrams read per wakeup, so that a fork storm cannot
+// starve the other tasks of the task runner. The fd watch is level-triggered,
+// whatever is left is picked up on the next wakeup.
+constexpr int kMaxRecvPerWakeup = 16;
+
+#if defined(PERFETTO_HAS_PROC_CONNECTOR)
+// Values of proc_event.what. Spelled out because the enum moved out of
+// struct proc_event in newer uapi headers.
+constexpr uint32_t kProcEventFork = 0x00000001;
+constexpr uint32_t kProcEventExec = 0x00000002;
+constexpr uint32_t kProcEventComm = 0x00000200;
+constexpr uint32_t kProcEventExit = 0x80000000;
+
+bool SendMcastOp(int sock, enum proc_cn_mcast_op op) {
+  char msg[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+  memset(msg, 0, sizeof(msg));
+  auto* nlh = reinterpret_cast<struct nlmsghdr*>(msg);
+  nlh->nlmsg_len = static_cast<uint32_t>(
+      NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op)));
+  nlh->nlmsg_type = NLMSG_DONE;
+  nlh->nlmsg_pid = 0;
+
+  auto* cn = reinterpret_cast<struct cn_msg*>(NLMSG_DATA(nlh));
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(enum proc_cn_mcast_op);
+  memcpy(cn->data, &op, sizeof(op));
+
+  return PERFETTO_EINTR(send(sock, msg, nlh->nlmsg_len, 0)) ==
+         static_cast<ssize_t>(nlh->nlmsg_len);
+}
+#endif
+
+// Any local process can unicast to our netlink port id, only trust messages
+// sent by the kernel (port id 0). Sockets of other families are only used by
+// tests.
+bool IsFromKernel(const struct sockaddr_storage& sender, socklen_t len) {
+#if defined(PERFETTO_HAS_PROC_CONNECTOR)
+  if (len < sizeof(struct sockaddr_nl) || sender.ss_family != AF_NETLINK)
+    return true;
+  struct sockaddr_nl nl;
+  memcpy(&nl, &sender, sizeof(nl));
+  return nl.nl_pid == 0;
+#else
+  base::ignore_result(sender);
+  base::ignore_result(len);
+  return true;
+#endif
+}
+
+}  // namespace
+
+ProcConnector::Delegate::~Delegate() = default;
+
+// static
+std::unique_ptr<ProcConnector> ProcConnector::Create(
+    base::TaskRunner* task_runner,
+    Delegate* delegate) {
+#if defined(PERFETTO_HAS_PROC_CONNECTOR)
+  base::ScopedFile sock(socket(PF_NETLINK,
+                               SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               NETLINK_CONNECTOR));
+  if (!sock) {
+    PERFETTO_PLOG("Failed to create proc connector socket");
+    return nullptr;
+  }
+  struct sockaddr_nl addr {};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  addr.nl_pid = 0;  // Let the kernel pick a unique port id.
+  if (bind(*sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))) {
+    PERFETTO_PLOG("Failed to bind proc connector socket");
+    return nullptr;
+  }
+  if (!SendMcastOp(*sock, PROC_CN_MCAST_LISTEN)) {
+    PERFETTO_PLOG("Failed to subscribe to proc events");
+    return nullptr;
+  }
+  std::unique_ptr<ProcConnector> connector(
+      new ProcConnector(task_runner, delegate, std::move(sock)));
+  connector->subscribed_ = true;
+  return connector;
+#else
+  base::ignore_result(task_runner);
+  base::ignore_result(delegate);
+  return nullptr;
+#endif
+}
+
+ProcConnector::ProcConnector(base::TaskRunner* task_runner,
+                             Delegate* delegate,
+                             base::ScopedFile sock)
+    : task_runner_(task_runner),
+      delegate_(delegate),
+      sock_(std::move(sock)),
+      buf_(new char[kRecvBufSize]),
+      weak_factory_(this) {
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->AddFileDescriptorWatch(*sock_, [weak_this] {
+    if (weak_this)
+      weak_this->OnSocketReadable();
+  });
+}
+
+ProcConnector::~ProcConnector() {
+  task_runner_->RemoveFileDescriptorWatch(*sock_);
+#if defined(PERFETTO_HAS_PROC_CONNECTOR)
+  // The kernel keeps a global count of listeners and broadcasts proc events
+  // for as long as it is non-zero, closing the socket does not decrement it.
+  if (subscribed_ && !SendMcastOp(*sock_, PROC_CN_MCAST_IGNORE))
+    PERFETTO_PLOG("Failed to unsubscribe from proc events");
+#endif
+}
+
+void ProcConnector::OnSocketReadable() {
+  events_.clear();
+  for (int i = 0; i < kMaxRecvPerWakeup; i++) {
+    struct sockaddr_storage sender {};
+    socklen_t sender_len = sizeof(sender);
+    ssize_t rsize = PERFETTO_EINTR(
+        recvfrom(*sock_, buf_.get(), kRecvBufSize, 0,
+                 reinterpret_cast<struct sockaddr*>(&sender), &sender_len));
+    if (rsize < 0) {
+      if (errno == ENOBUFS) {
+        events_.push_back({Event::kOverflow, 0, 0});
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        PERFETTO_PLOG("recv() on proc connector socket failed");
+      break;
+    }
+    if (rsize == 0)
+      break;
+    if (!IsFromKernel(sender, sender_len))
+      continue;
+    ParseMessages(buf_.get(), static_cast<size_t>(rsize), &events_);
+  }
+  if (!events_.empty())
+    delegate_->OnProcEvents(events_);
+}
+
+// static
+void ProcConnector::ParseMessages(const char* buf,
+                                  size_t size,
+                                  std::vector<Event>* events) {
+#if defined(PERFETTO_HAS_PROC_CONNECTOR)
+  int len = static_cast<int>(size);
+  for (auto* nlh = reinterpret_cast<const struct nlmsghdr*>(buf);
+       NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+    if (nlh->nlmsg_type == NLMSG_NOOP || nlh->nlmsg_type == NLMSG_ERROR)
+      continue;
+    if (nlh->nlmsg_type == NLMSG_OVERRUN) {
+      events->push_back({Event::kOverflow, 0, 0});
+      continue;
+    }
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg)))
+      continue;
+    const auto* cn = reinterpret_cast<const struct cn_msg*>(NLMSG_DATA(nlh));
+    if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC ||
+        cn->len < sizeof(struct proc_event) ||
+        nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg) + cn->len)) {
+      continue;
+    }
+    struct proc_event ev;
+    memcpy(&ev, cn->data, sizeof(ev));
+    switch (static_cast<uint32_t>(ev.what)) {
+      case kProcEventFork:
+        events->push_back({Event::kFork, ev.event_data.fork.child_pid,
+                           ev.event_data.fork.child_tgid});
+        break;
+      case kProcEventExec:
+        events->push_back({Event::kExec, ev.event_data.exec.process_pid,
+                           ev.event_data.exec.process_tgid});
+        break;
+      case kProcEventComm:
+        events->push_back({Event::kComm, ev.event_data.comm.process_pid,
+                           ev.event_data.comm.process_tgid});
+        break;
+      case kProcEventExit:
+        events->push_back({Event::kExit, ev.event_data.exit.process_pid,
+                           ev.event_data.exit.process_tgid});
+        break;
+      default:
+        break;
+    }
+  }
+#else
+  base::ignore_result(buf);
+  base::ignore_result(size);
+  base::ignore_result(events);
+#endif
+}
+
+}  // namespace perfetto
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
+#define SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/weak_ptr.h"
+
+namespace perfetto {
+
+namespace base {
+class TaskRunner;
+}
+
+// Receives fork/exec/comm/exit notifications from the kernel proc connector
+// (NETLINK_CONNECTOR, CN_IDX_PROC). Subscribing requires CAP_NET_ADMIN, so
+// Create() returns nullptr when unavailable and callers are expected to fall
+// back on scanning /proc.
+class ProcConnector {
+ public:
+  struct Event {
+    enum Type {
+      kFork,
+      kExec,
+      kComm,
+      kExit,
+      // Some events were dropped because the socket buffer overflowed. The
+      // receiver should resynchronize its state from /proc.
+      kOverflow,
+    };
+
+    Type type;
+    int32_t pid;   // Thread id. For kFork, the child.
+    int32_t tgid;  // Process id. For kFork, the child's.
+  };
+
+  class Delegate {
+   public:
+    virtual ~Delegate();
+    // Called on the task runner with all the events read in one go.
+    virtual void OnProcEvents(const std::vector<Event>&) = 0;
+  };
+
+  static std::unique_ptr<ProcConnector> Create(base::TaskRunner*, Delegate*);
+
+  // |sock| must be a non-blocking datagram socket that delivers proc connector
+  // netlink messages. Exposed for testing.
+  ProcConnector(base::TaskRunner*, Delegate*, base::ScopedFile sock);
+  ~ProcConnector();
+
+  ProcConnector(const ProcConnector&) = delete;
+  ProcConnector& operator=(const ProcConnector&) = delete;
+
+  // Parses one buffer of netlink messages, appending to |events|.
+  // Exposed for testing.
+  static void ParseMessages(const char* buf,
+                            size_t size,
+                            std::vector<Event>* events);
+
+ private:
+  void OnSocketReadable();
+
+  base::TaskRunner* const task_runner_;
+  Delegate* const delegate_;
+  base::ScopedFile sock_;
+  std::unique_ptr<char[]> buf_;
+  std::vector<Event> events_;
+  // Set by Create(), which subscribed |sock_| to proc events.
+  bool subscribed_ = false;
+  base::WeakPtrFactory<ProcConnector> weak_factory_;  // Keep last.
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/proc_connector.h"
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "src/base/test/test_task_runner.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::ElementsAre;
+
+MATCHER_P3(IsEvent, type, pid, tgid, "") {
+  return arg.type == type && arg.pid == pid && arg.tgid == tgid;
+}
+
+// Appends a netlink message carrying a proc_event, as sent by the kernel.
+void AppendProcEvent(std::string* buf,
+                     uint32_t what,
+                     int32_t pid,
+                     int32_t tgid,
+                     uint32_t cn_idx = CN_IDX_PROC) {
+  struct proc_event ev;
+  memset(&ev, 0, sizeof(ev));
+  uint32_t what_u32 = what;
+  memcpy(&ev.what, &what_u32, sizeof(what_u32));
+  // fork's child_pid/child_tgid overlap with the process_pid/process_tgid of
+  // the other events.
+  switch (what) {
+    case 0x00000001:
+      ev.event_data.fork.child_pid = pid;
+      ev.event_data.fork.child_tgid = tgid;
+      break;
+    default:
+      ev.event_data.exec.process_pid = pid;
+      ev.event_data.exec.process_tgid = tgid;
+      break;
+  }
+
+  std::string msg(NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(ev)), '\0');
+  auto* nlh = reinterpret_cast<struct nlmsghdr*>(&msg[0]);
+  nlh->nlmsg_len =
+      static_cast<uint32_t>(NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(ev)));
+  nlh->nlmsg_type = NLMSG_DONE;
+  auto* cn = reinterpret_cast<struct cn_msg*>(NLMSG_DATA(nlh));
+  cn->id.idx = cn_idx;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(ev);
+  memcpy(cn->data, &ev, sizeof(ev));
+  buf->append(msg);
+}
+
+TEST(ProcConnectorTest, ParseMessages) {
+  std::string buf;
+  AppendProcEvent(&buf, 0x00000001, 11, 10);  // fork
+  AppendProcEvent(&buf, 0x00000002, 10, 10);  // exec
+  AppendProcEvent(&buf, 0x00000200, 11, 10);  // comm
+  AppendProcEvent(&buf, 0x00000004, 11, 10);  // uid change, ignored.
+  AppendProcEvent(&buf, 0x00000001, 12, 12, CN_IDX_PROC + 1);  // Not proc.
+  AppendProcEvent(&buf, 0x80000000, 11, 10);  // exit
+
+  std::vector<ProcConnector::Event> events;
+  ProcConnector::ParseMessages(buf.data(), buf.size(), &events);
+  using Event = ProcConnector::Event;
+  EXPECT_THAT(events, ElementsAre(IsEvent(Event::kFork, 11, 10),
+                                  IsEvent(Event::kExec, 10, 10),
+                                  IsEvent(Event::kComm, 11, 10),
+                                  IsEvent(Event::kExit, 11, 10)));
+}
+
+TEST(ProcConnectorTest, ParseTruncatedMessage) {
+  std::string buf;
+  AppendProcEvent(&buf, 0x00000001, 11, 10);
+  AppendProcEvent(&buf, 0x00000001, 12, 10);
+  buf.resize(buf.size() - 8);
+
+  std::vector<ProcConnector::Event> events;
+  ProcConnector::ParseMessages(buf.data(), buf.size(), &events);
+  EXPECT_THAT(events, ElementsAre(IsEvent(ProcConnector::Event::kFork, 11, 10)));
+}
+
+class FakeDelegate : public ProcConnector::Delegate {
+ public:
+  void OnProcEvents(const std::vector<ProcConnector::Event>& events) override {
+    events_.insert(events_.end(), events.begin(), events.end());
+    if (on_events_)
+      on_events_();
+  }
+
+  std::vector<ProcConnector::Event> events_;
+  std::function<void()> on_events_;
+};
+
+TEST(ProcConnectorTest, ReadsFromSocket) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds), 0);
+  base::ScopedFile peer(fds[1]);
+
+  base::TestTaskRunner task_runner;
+  FakeDelegate delegate;
+  delegate.on_events_ = task_runner.CreateCheckpoint("events");
+  ProcConnector connector(&task_runner, &delegate, base::ScopedFile(fds[0]));
+
+  std::string msg1;
+  AppendProcEvent(&msg1, 0x00000001, 11, 10);
+  std::string msg2;
+  AppendProcEvent(&msg2, 0x80000000, 11, 10);
+  ASSERT_EQ(send(*peer, msg1.data(), msg1.size(), 0),
+            static_cast<ssize_t>(msg1.size()));
+  ASSERT_EQ(send(*peer, msg2.data(), msg2.size(), 0),
+            static_cast<ssize_t>(msg2.size()));
+
+  task_runner.RunUntilCheckpoint("events");
+  using Event = ProcConnector::Event;
+  EXPECT_THAT(delegate.events_, ElementsAre(IsEvent(Event::kFork, 11, 10),
+                                            IsEvent(Event::kExit, 11, 10)));
+}
+
+TEST(ProcConnectorTest, BoundsReadsPerWakeup) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds), 0);
+  base::ScopedFile peer(fds[1]);
+
+  constexpr int kNumMessages = 100;
+  base::TestTaskRunner task_runner;
+  FakeDelegate delegate;
+  int num_calls = 0;
+  auto all_read = task_runner.CreateCheckpoint("all_read");
+  delegate.on_events_ = [&] {
+    num_calls++;
+    if (delegate.events_.size() == kNumMessages)
+      all_read();
+  };
+  ProcConnector connector(&task_runner, &delegate, base::ScopedFile(fds[0]));
+
+  for (int i = 0; i < kNumMessages; i++) {
+    std::string msg;
+    AppendProcEvent(&msg, 0x00000001, 100 + i, 100 + i);
+    ASSERT_EQ(send(*peer, msg.data(), msg.size(), 0),
+              static_cast<ssize_t>(msg.size()));
+  }
+
+  task_runner.RunUntilCheckpoint("all_read");
+  EXPECT_GT(num_calls, 1);
+  for (int i = 0; i < kNumMessages; i++)
+    EXPECT_EQ(delegate.events_[static_cast<size_t>(i)].pid, 100 + i);
+}
+
+TEST(ProcConnectorTest, IgnoresMessagesFromUserspace) {
+  base::ScopedFile receiver(
+      socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK, NETLINK_CONNECTOR));
+  base::ScopedFile sender(socket(PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR));
+  if (!receiver || !sender)
+    return;  // Netlink is not available in this environment.
+  struct sockaddr_nl addr {};
+  addr.nl_family = AF_NETLINK;
+  socklen_t addr_len = sizeof(addr);
+  ASSERT_EQ(bind(*receiver, reinterpret_cast<struct sockaddr*>(&addr),
+                 sizeof(addr)),
+            0);
+  ASSERT_EQ(getsockname(*receiver, reinterpret_cast<struct sockaddr*>(&addr),
+                        &addr_len),
+            0);
+  ASSERT_NE(addr.nl_pid, 0u);
+
+  base::TestTaskRunner task_runner;
+  FakeDelegate delegate;
+  base::ScopedFile receiver_dup(dup(*receiver));
+  ProcConnector connector(&task_runner, &delegate, std::move(receiver_dup));
+
+  // A spoofed exit event, unicast from another process to our port id.
+  std::string msg;
+  AppendProcEvent(&msg, 0x80000000, 11, 10);
+  ASSERT_EQ(sendto(*sender, msg.data(), msg.size(), 0,
+                   reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)),
+            static_cast<ssize_t>(msg.size()));
+
+  task_runner.RunUntilIdle();
+  EXPECT_TRUE(delegate.events_.empty());
+  char buf[16];
+  EXPECT_EQ(recv(*receiver, buf, sizeof(buf), 0), -1);  // Already drained.
+}
+
+}  // namespace
+}  // namespace perfetto
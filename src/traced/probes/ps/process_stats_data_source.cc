@@ -16,7 +16,12 @@
 
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <utility>
@@ -46,6 +51,19 @@ namespace perfetto {
 
 namespace {
 
+// Large enough for /proc/pid/status, the biggest file read while polling.
+constexpr size_t kReadBufSize = 16 * 1024;
+
+// /proc/pid/status is re-read at least this often even if statm is unchanged.
+// Keep in sync with the comment of proc_stats_poll_ms in
+// process_stats_config.proto.
+constexpr uint32_t kMaxPollsBetweenStatusReads = 10;
+
+// At most a quarter of RLIMIT_NOFILE (and no more than kMaxCachedFds) is used
+// to keep /proc/pid files open across polls.
+constexpr rlim_t kCachedFdsRlimitDivisor = 4;
+constexpr rlim_t kMaxCachedFds = 16 * 1024;
+
 inline int32_t ParseIntValue(const char* str) {
   int32_t ret = 0;
   for (;;) {
@@ -95,6 +113,8 @@ ProcessStatsDataSource::ProcessStatsDataSource(
       record_thread_names_(config.process_stats_config().record_thread_names()),
       dump_all_procs_on_start_(
           config.process_stats_config().scan_all_processes_on_start()),
+      use_proc_connector_(config.process_stats_config().use_proc_connector()),
+      read_buf_(base::PagedMemory::Allocate(kReadBufSize)),
       weak_factory_(this) {
   const auto& ps_config = config.process_stats_config();
   const auto& quirks = ps_config.quirks();
@@ -113,12 +133,29 @@ ProcessStatsDataSource::ProcessStatsDataSource(
     auto proc_stats_ttl_ms = ps_config.proc_stats_cache_ttl_ms();
     process_stats_cache_ttl_ticks_ =
         std::max(proc_stats_ttl_ms / poll_period_ms_, 1u);
+
+    struct rlimit rlim {};
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+      max_cached_fds_ = static_cast<size_t>(
+          std::min(rlim.rlim_cur / kCachedFdsRlimitDivisor, kMaxCachedFds));
+    }
   }
 }
 
 ProcessStatsDataSource::~ProcessStatsDataSource() = default;
 
 void ProcessStatsDataSource::Start() {
+  if (use_proc_connector_) {
+    // Subscribe before listing /proc, so that no process can slip through
+    // in between.
+    proc_connector_ = CreateProcConnector();
+    if (proc_connector_) {
+      ResyncLiveProcesses();
+    } else {
+      PERFETTO_ELOG("Proc connector unavailable, falling back on /proc scans");
+    }
+  }
+
   if (dump_all_procs_on_start_)
     WriteAllProcesses();
 
@@ -192,6 +229,83 @@ void ProcessStatsDataSource::OnRenamePids(const std::vector<int32_t>& pids) {
   }
 }
 
+void ProcessStatsDataSource::OnProcEvents(
+    const std::vector<ProcConnector::Event>& events) {
+  PERFETTO_METATRACE("OnProcEvents", 0);
+  PERFETTO_DCHECK(!cur_ps_tree_);
+  // (pid, tgid) pairs that need a process tree entry.
+  std::vector<std::pair<int32_t, int32_t>> pending;
+  for (const ProcConnector::Event& event : events) {
+    switch (event.type) {
+      case ProcConnector::Event::kFork:
+        if (event.pid == event.tgid)
+          live_processes_.insert(event.tgid);
+        pending.emplace_back(event.pid, event.tgid);
+        break;
+      case ProcConnector::Event::kExec:
+        // The cmdline has changed, dump the process again.
+        seen_pids_.erase(event.tgid);
+        pending.emplace_back(event.tgid, event.tgid);
+        break;
+      case ProcConnector::Event::kComm:
+        if (!record_thread_names_ || event.pid == event.tgid)
+          break;
+        seen_pids_.erase(event.pid);
+        pending.emplace_back(event.pid, event.tgid);
+        break;
+      case ProcConnector::Event::kExit:
+        // The pid can be recycled from now on.
+        seen_pids_.erase(event.pid);
+        if (event.pid != event.tgid)
+          break;
+        live_processes_.erase(event.tgid);
+        process_stats_cache_.erase(event.tgid);
+        DropSampledProcess(event.tgid);
+        if (skip_stats_for_pids_.size() > static_cast<uint32_t>(event.tgid))
+          skip_stats_for_pids_[static_cast<uint32_t>(event.tgid)] = false;
+        break;
+      case ProcConnector::Event::kOverflow:
+        ResyncLiveProcesses();
+        break;
+    }
+  }
+
+  if (!enable_on_demand_dumps_)
+    return;
+  for (const auto& pid_and_tgid : pending) {
+    int32_t pid = pid_and_tgid.first;
+    int32_t tgid = pid_and_tgid.second;
+    if (pid == 0 || seen_pids_.count(pid))
+      continue;
+    // The event already tells us the tgid, so there is nothing to read from
+    // /proc for a thread of a known process unless we want its name.
+    if (pid != tgid && !record_thread_names_ && seen_pids_.count(tgid)) {
+      WriteThread(pid, tgid, /*optional_name=*/nullptr);
+      continue;
+    }
+    WriteProcessOrThread(pid);
+  }
+  FinalizeCurPacket();
+}
+
+void ProcessStatsDataSource::DropSampledProcess(int32_t pid) {
+  auto it = sampled_processes_.find(pid);
+  if (it == sampled_processes_.end())
+    return;
+  num_cached_fds_ -= it->second.num_cached_fds();
+  sampled_processes_.erase(it);
+}
+
+void ProcessStatsDataSource::ResyncLiveProcesses() {
+  PERFETTO_METATRACE("ResyncLiveProcesses", 0);
+  live_processes_.clear();
+  base::ScopedDir proc_dir = OpenProcDir();
+  if (!proc_dir)
+    return;
+  while (int32_t pid = ReadNextNumericDir(*proc_dir))
+    live_processes_.insert(pid);
+}
+
 void ProcessStatsDataSource::Flush(FlushRequestID,
                                    std::function<void()> callback) {
   // We shouldn't get this in the middle of WriteAllProcesses() or OnPids().
@@ -259,6 +373,17 @@ base::ScopedDir ProcessStatsDataSource::OpenProcDir() {
   return proc_dir;
 }
 
+base::ScopedFile ProcessStatsDataSource::OpenProcPidFile(int32_t pid,
+                                                         const char* file) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+  return base::OpenFile(path, O_RDONLY | O_CLOEXEC);
+}
+
+std::unique_ptr<ProcConnector> ProcessStatsDataSource::CreateProcConnector() {
+  return ProcConnector::Create(task_runner_, this);
+}
+
 std::string ProcessStatsDataSource::ReadProcPidFile(int32_t pid,
                                                     const std::string& file) {
   std::string contents;
@@ -359,164 +484,235 @@ void ProcessStatsDataSource::Tick(
 
 void ProcessStatsDataSource::WriteAllProcessStats() {
   // TODO(primiano): implement whitelisting of processes by names.
-  // TODO(primiano): Have a pid cache to avoid wasting cycles reading kthreads
-  // proc files over and over. Same for non-whitelist processes (see above).
 
   CacheProcFsScanStartTimestamp();
   PERFETTO_METATRACE("WriteAllProcessStats", 0);
-  base::ScopedDir proc_dir = OpenProcDir();
-  if (!proc_dir)
-    return;
+  poll_count_++;
   std::vector<int32_t> pids;
-  while (int32_t pid = ReadNextNumericDir(*proc_dir)) {
-    cur_ps_stats_process_ = nullptr;
+  if (proc_connector_) {
+    for (int32_t pid : live_processes_) {
+      if (WriteProcessStats(pid))
+        pids.push_back(pid);
+    }
+  } else {
+    base::ScopedDir proc_dir = OpenProcDir();
+    if (!proc_dir)
+      return;
+    while (int32_t pid = ReadNextNumericDir(*proc_dir)) {
+      if (WriteProcessStats(pid))
+        pids.push_back(pid);
+    }
+  }
+  FinalizeCurPacket();
 
-    uint32_t pid_u = static_cast<uint32_t>(pid);
-    if (skip_stats_for_pids_.size() > pid_u && skip_stats_for_pids_[pid_u])
+  // Forget about the processes that have gone away since the previous poll.
+  for (auto it = sampled_processes_.begin(); it != sampled_processes_.end();) {
+    if (it->second.last_poll == poll_count_) {
+      ++it;
       continue;
+    }
+    num_cached_fds_ -= it->second.num_cached_fds();
+    it = sampled_processes_.erase(it);
+  }
 
-    std::string proc_status = ReadProcPidFile(pid, "status");
-    if (proc_status.empty())
-      continue;
+  // Ensure that we write once long-term process info (e.g., name) for new pids
+  // that we haven't seen before.
+  OnPids(pids);
+}
+
+// Returns false if |pid| was skipped, i.e. it is gone or it is a kernel
+// thread.
+bool ProcessStatsDataSource::WriteProcessStats(int32_t pid) {
+  cur_ps_stats_process_ = nullptr;
 
-    if (!WriteMemCounters(pid, proc_status)) {
-      // If WriteMemCounters() fails the pid is very likely a kernel thread
-      // that has a valid /proc/[pid]/status but no memory values. In this
-      // case avoid keep polling it over and over.
+  uint32_t pid_u = static_cast<uint32_t>(pid);
+  if (skip_stats_for_pids_.size() > pid_u && skip_stats_for_pids_[pid_u])
+    return false;
+
+  SampledProcess& sample = sampled_processes_[pid];
+  sample.last_poll = poll_count_;
+
+  // /proc/pid/statm is much cheaper for the kernel to produce than
+  // /proc/pid/status. Use it to tell whether the memory counters may have
+  // changed, and re-read status only in that case (or every now and then, to
+  // catch changes that don't show up in statm, e.g. VmLck).
+  size_t rsize = ReadProcPidFileIntoBuf(pid, "statm", &sample.statm_fd);
+  if (!rsize) {
+    DropSampledProcess(pid);
+    return false;
+  }
+  uint32_t statm[3] = {};
+  base::StringSplitter words(static_cast<char*>(read_buf_.Get()), rsize, ' ');
+  for (size_t i = 0; i < base::ArraySize(statm) && words.Next(); i++)
+    statm[i] = ToU32(words.cur_token());
+
+  if (statm[0] == 0 || !sample.has_status ||
+      memcmp(statm, sample.statm, sizeof(statm)) != 0 ||
+      ++sample.polls_since_status >= kMaxPollsBetweenStatusReads) {
+    rsize = ReadProcPidFileIntoBuf(pid, "status", nullptr);
+    if (!rsize)
+      return false;
+    sample.has_status =
+        ParseMemCounters(static_cast<char*>(read_buf_.Get()), rsize,
+                         &sample.status);
+    if (!sample.has_status) {
+      // If there are no memory counters the pid is very likely a kernel
+      // thread that has a valid /proc/[pid]/status but no memory values. In
+      // this case avoid keep polling it over and over.
       if (skip_stats_for_pids_.size() <= pid_u)
         skip_stats_for_pids_.resize(pid_u + 1);
       skip_stats_for_pids_[pid_u] = true;
-      continue;
+      DropSampledProcess(pid);
+      return false;
     }
-
-    std::string oom_score_adj = ReadProcPidFile(pid, "oom_score_adj");
-    if (!oom_score_adj.empty()) {
-      CachedProcessStats& cached = process_stats_cache_[pid];
-      auto counter = ToInt(oom_score_adj);
-      if (counter != cached.oom_score_adj) {
-        GetOrCreateStatsProcess(pid)->set_oom_score_adj(counter);
-        cached.oom_score_adj = counter;
-      }
+    memcpy(sample.statm, statm, sizeof(statm));
+    sample.polls_since_status = 0;
+  }
+  WriteMemCounters(pid, sample.status);
+
+  rsize = ReadProcPidFileIntoBuf(pid, "oom_score_adj", &sample.oom_score_adj_fd);
+  if (rsize) {
+    CachedProcessStats& cached = process_stats_cache_[pid];
+    auto counter = static_cast<int>(
+        strtol(static_cast<char*>(read_buf_.Get()), nullptr, 10));
+    if (counter != cached.oom_score_adj) {
+      GetOrCreateStatsProcess(pid)->set_oom_score_adj(counter);
+      cached.oom_score_adj = counter;
     }
-
-    pids.push_back(pid);
   }
-  FinalizeCurPacket();
-
-  // Ensure that we write once long-term process info (e.g., name) for new pids
-  // that we haven't seen before.
-  OnPids(pids);
+  return true;
 }
 
-// Returns true if the stats for the given |pid| have been written, false it
-// it failed (e.g., |pid| was a kernel thread and, as such, didn't report any
-// memory counters).
-bool ProcessStatsDataSource::WriteMemCounters(int32_t pid,
-                                              const std::string& proc_status) {
+// Parses the memory counters out of /proc/[pid]/status, which looks like this:
+// Name:   cat
+// Umask:  0027
+// State:  R (running)
+// FDSize: 256
+// Groups: 4 20 24 46 997
+// VmPeak:     5992 kB
+// VmSize:     5992 kB
+// VmLck:         0 kB
+// ...
+// Returns false if there are no memory counters (e.g., |pid| was a kernel
+// thread).
+// static
+bool ProcessStatsDataSource::ParseMemCounters(char* buf,
+                                              size_t size,
+                                              CachedProcessStats* out) {
+  *out = CachedProcessStats();
   bool proc_status_has_mem_counters = false;
-  CachedProcessStats& cached = process_stats_cache_[pid];
-
-  // Parse /proc/[pid]/status, which looks like this:
-  // Name:   cat
-  // Umask:  0027
-  // State:  R (running)
-  // FDSize: 256
-  // Groups: 4 20 24 46 997
-  // VmPeak:     5992 kB
-  // VmSize:     5992 kB
-  // VmLck:         0 kB
-  // ...
-  std::vector<char> key;
-  std::vector<char> value;
-  enum { kKey, kSeparator, kValue } state = kKey;
-  for (char c : proc_status) {
-    if (c == '\n') {
-      key.push_back('\0');
-      value.push_back('\0');
-
-      // |value| will contain "1234 KB". We rely on strtol() (in ToU32()) to
-      // stop parsing at the first non-numeric character.
-      if (strcmp(key.data(), "VmSize") == 0) {
-        // Assume that if we see VmSize we'll see also the others.
-        proc_status_has_mem_counters = true;
-
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_size_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_size_kb(counter);
-          cached.vm_size_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmLck") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_locked_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_locked_kb(counter);
-          cached.vm_locked_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmHWM") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_hvm_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_hwm_kb(counter);
-          cached.vm_hvm_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmRSS") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_rss_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_rss_kb(counter);
-          cached.vm_rss_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssAnon") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.rss_anon_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_anon_kb(counter);
-          cached.rss_anon_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssFile") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.rss_file_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_file_kb(counter);
-          cached.rss_file_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssShmem") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.rss_shmem_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_shmem_kb(counter);
-          cached.rss_shmem_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmSwap") == 0) {
-        auto counter = ToU32(value.data());
-        if (counter != cached.vm_swap_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_swap_kb(counter);
-          cached.vm_swap_kb = counter;
-        }
-      }
-
-      key.clear();
-      state = kKey;
+  for (base::StringSplitter lines(buf, size, '\n'); lines.Next();) {
+    base::StringSplitter fields(&lines, ':');
+    if (!fields.Next())
       continue;
-    }
-
-    if (state == kKey) {
-      if (c == ':') {
-        state = kSeparator;
-        continue;
-      }
-      key.push_back(c);
+    const char* key = fields.cur_token();
+    // Only the Vm* and Rss* keys are interesting.
+    if ((key[0] != 'V' || key[1] != 'm') && (key[0] != 'R' || key[1] != 's'))
       continue;
-    }
-
-    if (state == kSeparator) {
-      if (isspace(c))
-        continue;
-      value.clear();
-      value.push_back(c);
-      state = kValue;
+    if (!fields.Next())
       continue;
+    // The value looks like "   1234 kB". We rely on strtol() (in ToU32()) to
+    // skip the leading whitespace and to stop at the first non-numeric char.
+    uint32_t counter = ToU32(fields.cur_token());
+    if (strcmp(key, "VmSize") == 0) {
+      // Assume that if we see VmSize we'll see also the others.
+      proc_status_has_mem_counters = true;
+      out->vm_size_kb = counter;
+    } else if (strcmp(key, "VmLck") == 0) {
+      out->vm_locked_kb = counter;
+    } else if (strcmp(key, "VmHWM") == 0) {
+      out->vm_hvm_kb = counter;
+    } else if (strcmp(key, "VmRSS") == 0) {
+      out->vm_rss_kb = counter;
+    } else if (strcmp(key, "RssAnon") == 0) {
+      out->rss_anon_kb = counter;
+    } else if (strcmp(key, "RssFile") == 0) {
+      out->rss_file_kb = counter;
+    } else if (strcmp(key, "RssShmem") == 0) {
+      out->rss_shmem_kb = counter;
+    } else if (strcmp(key, "VmSwap") == 0) {
+      out->vm_swap_kb = counter;
     }
+  }
+  return proc_status_has_mem_counters;
+}
 
-    if (state == kValue) {
-      value.push_back(c);
+// Writes the counters in |sample| that changed since they were last written.
+void ProcessStatsDataSource::WriteMemCounters(
+    int32_t pid,
+    const CachedProcessStats& sample) {
+  CachedProcessStats& cached = process_stats_cache_[pid];
+  if (sample.vm_size_kb != cached.vm_size_kb) {
+    GetOrCreateStatsProcess(pid)->set_vm_size_kb(sample.vm_size_kb);
+    cached.vm_size_kb = sample.vm_size_kb;
+  }
+  if (sample.vm_locked_kb != cached.vm_locked_kb) {
+    GetOrCreateStatsProcess(pid)->set_vm_locked_kb(sample.vm_locked_kb);
+    cached.vm_locked_kb = sample.vm_locked_kb;
+  }
+  if (sample.vm_hvm_kb != cached.vm_hvm_kb) {
+    GetOrCreateStatsProcess(pid)->set_vm_hwm_kb(sample.vm_hvm_kb);
+    cached.vm_hvm_kb = sample.vm_hvm_kb;
+  }
+  if (sample.vm_rss_kb != cached.vm_rss_kb) {
+    GetOrCreateStatsProcess(pid)->set_vm_rss_kb(sample.vm_rss_kb);
+    cached.vm_rss_kb = sample.vm_rss_kb;
+  }
+  if (sample.rss_anon_kb != cached.rss_anon_kb) {
+    GetOrCreateStatsProcess(pid)->set_rss_anon_kb(sample.rss_anon_kb);
+    cached.rss_anon_kb = sample.rss_anon_kb;
+  }
+  if (sample.rss_file_kb != cached.rss_file_kb) {
+    GetOrCreateStatsProcess(pid)->set_rss_file_kb(sample.rss_file_kb);
+    cached.rss_file_kb = sample.rss_file_kb;
+  }
+  if (sample.rss_shmem_kb != cached.rss_shmem_kb) {
+    GetOrCreateStatsProcess(pid)->set_rss_shmem_kb(sample.rss_shmem_kb);
+    cached.rss_shmem_kb = sample.rss_shmem_kb;
+  }
+  if (sample.vm_swap_kb != cached.vm_swap_kb) {
+    GetOrCreateStatsProcess(pid)->set_vm_swap_kb(sample.vm_swap_kb);
+    cached.vm_swap_kb = sample.vm_swap_kb;
+  }
+}
+
+// Reads /proc/|pid|/|file| into |read_buf_| and null-terminates it. Returns
+// the size read including the null terminator, or 0 on failure.
+// If |cached_fd| is not null the file is kept open across polls (within the
+// fd budget) and re-read with pread(), saving the path lookup and the
+// open()/close() syscalls.
+size_t ProcessStatsDataSource::ReadProcPidFileIntoBuf(
+    int32_t pid,
+    const char* file,
+    base::ScopedFile* cached_fd) {
+  base::ScopedFile tmp_fd;
+  base::ScopedFile* fd = cached_fd ? cached_fd : &tmp_fd;
+  if (!*fd) {
+    *fd = OpenProcPidFile(pid, file);
+    if (!*fd)
+      return 0;
+    if (cached_fd) {
+      if (num_cached_fds_ < max_cached_fds_) {
+        num_cached_fds_++;
+      } else {
+        tmp_fd = std::move(*cached_fd);
+        fd = &tmp_fd;
+      }
     }
   }
-  return proc_status_has_mem_counters;
+  ssize_t res = pread(**fd, read_buf_.Get(), kReadBufSize - 1, 0);
+  if (res <= 0) {
+    // The process is gone. If the pid is recycled, a cached fd keeps pointing
+    // to the old process and keeps failing, so drop it.
+    if (fd == cached_fd) {
+      cached_fd->reset();
+      num_cached_fds_--;
+    }
+    return 0;
+  }
+  size_t rsize = static_cast<size_t>(res);
+  static_cast<char*>(read_buf_.Get())[rsize] = '\0';
+  return rsize + 1;  // Include null terminator in the count.
 }
 
 uint64_t ProcessStatsDataSource::CacheProcFsScanStartTimestamp() {
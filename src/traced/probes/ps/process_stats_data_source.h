@@ -23,12 +23,14 @@
 #include <unordered_map>
 #include <vector>
 
+#include "perfetto/base/paged_memory.h"
 #include "perfetto/base/scoped_file.h"
 #include "perfetto/base/weak_ptr.h"
 #include "perfetto/tracing/core/basic_types.h"
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/trace_writer.h"
 #include "src/traced/probes/probes_data_source.h"
+#include "src/traced/probes/ps/proc_connector.h"
 
 namespace perfetto {
 
@@ -44,7 +46,8 @@ class ProcessStats_Process;
 }  // namespace pbzero
 }  // namespace protos
 
-class ProcessStatsDataSource : public ProbesDataSource {
+class ProcessStatsDataSource : public ProbesDataSource,
+                               public ProcConnector::Delegate {
  public:
   static constexpr int kTypeId = 3;
 
@@ -59,16 +62,26 @@ class ProcessStatsDataSource : public ProbesDataSource {
   void OnPids(const std::vector<int32_t>& pids);
   void OnRenamePids(const std::vector<int32_t>& pids);
 
+  // Samples the memory counters of all processes. Called periodically when
+  // |proc_stats_poll_ms| is set, public for benchmarks.
+  void WriteAllProcessStats();
+
   // ProbesDataSource implementation.
   void Start() override;
   void Flush(FlushRequestID, std::function<void()> callback) override;
   void ClearIncrementalState() override;
 
+  // ProcConnector::Delegate implementation.
+  void OnProcEvents(const std::vector<ProcConnector::Event>&) override;
+
   bool on_demand_dumps_enabled() const { return enable_on_demand_dumps_; }
+  bool using_proc_connector() const { return !!proc_connector_; }
 
   // Virtual for testing.
   virtual base::ScopedDir OpenProcDir();
   virtual std::string ReadProcPidFile(int32_t pid, const std::string& file);
+  virtual base::ScopedFile OpenProcPidFile(int32_t pid, const char* file);
+  virtual std::unique_ptr<ProcConnector> CreateProcConnector();
 
  private:
   struct CachedProcessStats {
@@ -83,6 +96,20 @@ class ProcessStatsDataSource : public ProbesDataSource {
     int oom_score_adj = std::numeric_limits<int>::max();
   };
 
+  // Per-process state of the stats poller. Unlike |process_stats_cache_|,
+  // this is not periodically cleared and only goes away with the process.
+  struct SampledProcess {
+    size_t num_cached_fds() const { return !!statm_fd + !!oom_score_adj_fd; }
+
+    base::ScopedFile statm_fd;
+    base::ScopedFile oom_score_adj_fd;
+    uint32_t statm[3] = {};  // size, resident, shared (in pages).
+    bool has_status = false;
+    CachedProcessStats status;  // Last counters parsed from /proc/pid/status.
+    uint32_t polls_since_status = 0;
+    uint64_t last_poll = 0;
+  };
+
   // Common functions.
   ProcessStatsDataSource(const ProcessStatsDataSource&) = delete;
   ProcessStatsDataSource& operator=(const ProcessStatsDataSource&) = delete;
@@ -101,8 +128,17 @@ class ProcessStatsDataSource : public ProbesDataSource {
 
   // Functions for periodically sampling process stats/counters.
   static void Tick(base::WeakPtr<ProcessStatsDataSource>);
-  void WriteAllProcessStats();
-  bool WriteMemCounters(int32_t pid, const std::string& proc_status);
+  bool WriteProcessStats(int32_t pid);
+  void WriteMemCounters(int32_t pid, const CachedProcessStats& sample);
+  static bool ParseMemCounters(char* buf, size_t size, CachedProcessStats*);
+  size_t ReadProcPidFileIntoBuf(int32_t pid,
+                                const char* file,
+                                base::ScopedFile* cached_fd);
+  void DropSampledProcess(int32_t pid);
+
+  // Rebuilds |live_processes_| from the /proc directory listing, without
+  // reading any per-process file.
+  void ResyncLiveProcesses();
 
   // Read and "latch" the current procfs scan-start timestamp, which
   // we reset only in FinalizeCurPacket.
@@ -135,6 +171,14 @@ class ProcessStatsDataSource : public ProbesDataSource {
   // seen, not just the main thread id (aka thread group ID).
   std::set<int32_t> seen_pids_;
 
+  // Only set when the process_stats_config asks for it and the kernel proc
+  // connector is available. In this case |live_processes_| is kept up to date
+  // from fork/exit events, and the periodic stats polling iterates over it
+  // instead of listing /proc.
+  std::unique_ptr<ProcConnector> proc_connector_;
+  bool use_proc_connector_ = false;
+  std::set<int32_t> live_processes_;
+
   // Fields for keeping track of the periodic stats/counters.
   uint32_t poll_period_ms_ = 0;
   uint64_t cache_ticks_ = 0;
@@ -147,6 +191,13 @@ class ProcessStatsDataSource : public ProbesDataSource {
   uint32_t process_stats_cache_ttl_ticks_ = 0;
   std::unordered_map<int32_t, CachedProcessStats> process_stats_cache_;
 
+  // Fields for reading /proc/pid files while polling without allocating.
+  std::unordered_map<int32_t, SampledProcess> sampled_processes_;
+  base::PagedMemory read_buf_;
+  uint64_t poll_count_ = 0;
+  size_t num_cached_fds_ = 0;
+  size_t max_cached_fds_ = 0;
+
   // If true, the next trace packet will have the |incremental_state_cleared|
   // flag set. Set when handling a ClearIncrementalState call.
   //
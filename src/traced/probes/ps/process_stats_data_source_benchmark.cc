@@ -0,0 +1,171 @@
+// Copyright (C) 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "perfetto/base/file_utils.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/temp_file.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/traced/probes/ps/process_stats_data_source.h"
+#include "src/tracing/core/null_trace_writer.h"
+
+namespace {
+
+using perfetto::DataSourceConfig;
+using perfetto::NullTraceWriter;
+using perfetto::ProcessStatsConfig;
+using perfetto::ProcessStatsDataSource;
+
+constexpr const char* kFiles[] = {"statm", "status", "oom_score_adj"};
+
+// A synthetic /proc with |num_processes| processes, each one having the files
+// read when polling memory counters.
+class FakeProcFs {
+ public:
+  explicit FakeProcFs(int num_processes)
+      : root_(perfetto::base::TempDir::Create()),
+        num_processes_(num_processes) {
+    for (int pid = 1; pid <= num_processes_; pid++) {
+      mkdir(PidDir(pid).c_str(), 0755);
+      char status[1024];
+      snprintf(status, sizeof(status),
+               "Name:\tproc_%d\nUmask:\t0077\nState:\tS (sleeping)\n"
+               "Tgid:\t%d\nNgid:\t0\nPid:\t%d\nPPid:\t1\nTracerPid:\t0\n"
+               "Uid:\t0\t0\t0\t0\nGid:\t0\t0\t0\t0\nFDSize:\t64\n"
+               "Groups:\t\nVmPeak:\t   %d kB\nVmSize:\t   %d kB\n"
+               "VmLck:\t       0 kB\nVmPin:\t       0 kB\nVmHWM:\t   %d kB\n"
+               "VmRSS:\t   %d kB\nRssAnon:\t    %d kB\nRssFile:\t    %d kB\n"
+               "RssShmem:\t       0 kB\nVmData:\t    1000 kB\n"
+               "VmStk:\t     132 kB\nVmExe:\t      20 kB\nVmLib:\t    2000 kB\n"
+               "VmPTE:\t      60 kB\nVmSwap:\t       0 kB\nThreads:\t1\n"
+               "SigQ:\t0/31325\nSigPnd:\t0000000000000000\n"
+               "Cpus_allowed_list:\t0-7\nvoluntary_ctxt_switches:\t100\n",
+               pid, pid, pid, pid * 4, pid * 4, pid * 2, pid * 2, pid, pid);
+      WriteFile(pid, "status", status);
+      WriteFile(pid, "statm", std::to_string(pid) + " " +
+                                  std::to_string(pid / 2) + " 10 5 0 100 0\n");
+      WriteFile(pid, "oom_score_adj", "0\n");
+    }
+  }
+
+  ~FakeProcFs() {
+    for (int pid = 1; pid <= num_processes_; pid++) {
+      for (const char* file : kFiles)
+        unlink((PidDir(pid) + "/" + file).c_str());
+      rmdir(PidDir(pid).c_str());
+    }
+  }
+
+  const std::string& path() const { return root_.path(); }
+
+ private:
+  std::string PidDir(int pid) const {
+    return root_.path() + "/" + std::to_string(pid);
+  }
+
+  void WriteFile(int pid, const char* file, const std::string& contents) {
+    perfetto::base::ScopedFile fd = perfetto::base::OpenFile(
+        PidDir(pid) + "/" + file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    PERFETTO_CHECK(fd);
+    PERFETTO_CHECK(perfetto::base::WriteAll(*fd, contents.data(),
+                                            contents.size()) ==
+                   static_cast<ssize_t>(contents.size()));
+  }
+
+  perfetto::base::TempDir root_;
+  const int num_processes_;
+};
+
+class FakeProcFsDataSource : public ProcessStatsDataSource {
+ public:
+  FakeProcFsDataSource(perfetto::base::TaskRunner* task_runner,
+                       const DataSourceConfig& config,
+                       const FakeProcFs* proc_fs)
+      : ProcessStatsDataSource(
+            task_runner,
+            0,
+            std::unique_ptr<NullTraceWriter>(new NullTraceWriter()),
+            config),
+        proc_fs_(proc_fs) {}
+
+  perfetto::base::ScopedDir OpenProcDir() override {
+    return perfetto::base::ScopedDir(opendir(proc_fs_->path().c_str()));
+  }
+
+  perfetto::base::ScopedFile OpenProcPidFile(int32_t pid,
+                                             const char* file) override {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%d/%s", proc_fs_->path().c_str(), pid,
+             file);
+    return perfetto::base::OpenFile(path, O_RDONLY);
+  }
+
+ private:
+  const FakeProcFs* const proc_fs_;
+};
+
+DataSourceConfig GetConfig() {
+  DataSourceConfig config;
+  config.mutable_process_stats_config()->set_proc_stats_poll_ms(100);
+  *(config.mutable_process_stats_config()->add_quirks()) =
+      ProcessStatsConfig::DISABLE_ON_DEMAND;
+  return config;
+}
+
+}  // namespace
+
+// Steady state: the counters of most processes don't change between polls.
+static void BM_ProcessStatsPoll(benchmark::State& state) {
+  FakeProcFs proc_fs(static_cast<int>(state.range(0)));
+  perfetto::base::TestTaskRunner task_runner;
+  FakeProcFsDataSource data_source(&task_runner, GetConfig(), &proc_fs);
+  data_source.WriteAllProcessStats();
+
+  for (auto _ : state)
+    data_source.WriteAllProcessStats();
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          state.range(0));
+}
+BENCHMARK(BM_ProcessStatsPoll)->Arg(1000)->Arg(10000)->Unit(
+    benchmark::kMillisecond);
+
+// First poll of a new data source: every file has to be opened and parsed.
+static void BM_ProcessStatsFirstPoll(benchmark::State& state) {
+  FakeProcFs proc_fs(static_cast<int>(state.range(0)));
+  perfetto::base::TestTaskRunner task_runner;
+  DataSourceConfig config = GetConfig();
+
+  for (auto _ : state) {
+    FakeProcFsDataSource data_source(&task_runner, config, &proc_fs);
+    data_source.WriteAllProcessStats();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          state.range(0));
+}
+BENCHMARK(BM_ProcessStatsFirstPoll)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
@@ -17,9 +17,17 @@
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <set>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "perfetto/base/file_utils.h"
 #include "perfetto/base/temp_file.h"
 #include "perfetto/trace/trace_packet.pb.h"
 #include "perfetto/trace/trace_packet.pbzero.h"
@@ -42,12 +50,81 @@ class TestProcessStatsDataSource : public ProcessStatsDataSource {
                              TracingSessionID id,
                              std::unique_ptr<TraceWriter> writer,
                              const DataSourceConfig& config)
-      : ProcessStatsDataSource(task_runner, id, std::move(writer), config) {}
+      : ProcessStatsDataSource(task_runner, id, std::move(writer), config),
+        task_runner_(task_runner) {}
 
   MOCK_METHOD0(OpenProcDir, base::ScopedDir());
   MOCK_METHOD2(ReadProcPidFile, std::string(int32_t pid, const std::string&));
+  MOCK_METHOD2(OpenProcPidFile, base::ScopedFile(int32_t pid, const char*));
+
+  // Subscribing to the real proc connector requires CAP_NET_ADMIN. Events are
+  // injected by calling OnProcEvents() directly instead.
+  std::unique_ptr<ProcConnector> CreateProcConnector() override {
+    int fds[2];
+    PERFETTO_CHECK(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds) ==
+                   0);
+    proc_connector_peer_.reset(fds[1]);
+    return std::unique_ptr<ProcConnector>(
+        new ProcConnector(task_runner_, this, base::ScopedFile(fds[0])));
+  }
+
+ private:
+  base::TaskRunner* const task_runner_;
+  base::ScopedFile proc_connector_peer_;
+};
+
+// A fake /proc directory, populated with <pid>/<file> entries.
+class FakeProcFs {
+ public:
+  FakeProcFs() : root_(base::TempDir::Create()) {}
+
+  ~FakeProcFs() {
+    // TempDir checks that the directory is empty.
+    for (const std::string& path : files_)
+      unlink(path.c_str());
+    for (const std::string& path : dirs_)
+      rmdir(path.c_str());
+  }
+
+  // Overwrites the file in place, so that fds kept open see the new contents.
+  void WriteFile(int32_t pid, const char* file, const std::string& contents) {
+    std::string dir = root_.path() + "/" + std::to_string(pid);
+    if (dirs_.insert(dir).second)
+      mkdir(dir.c_str(), 0755);
+    std::string path = dir + "/" + file;
+    files_.insert(path);
+    base::ScopedFile fd =
+        base::OpenFile(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    PERFETTO_CHECK(fd);
+    PERFETTO_CHECK(base::WriteAll(*fd, contents.data(), contents.size()) ==
+                   static_cast<ssize_t>(contents.size()));
+  }
+
+  base::ScopedDir OpenProcDir() {
+    return base::ScopedDir(opendir(root_.path().c_str()));
+  }
+
+  base::ScopedFile OpenProcPidFile(int32_t pid, const char* file) {
+    return base::OpenFile(
+        root_.path() + "/" + std::to_string(pid) + "/" + file, O_RDONLY);
+  }
+
+ private:
+  base::TempDir root_;
+  std::set<std::string> files_;
+  std::set<std::string> dirs_;
 };
 
+ProcConnector::Event ProcEvent(ProcConnector::Event::Type type,
+                               int32_t pid,
+                               int32_t tgid) {
+  ProcConnector::Event event;
+  event.type = type;
+  event.pid = pid;
+  event.tgid = tgid;
+  return event;
+}
+
 class ProcessStatsDataSourceTest : public ::testing::Test {
  protected:
   ProcessStatsDataSourceTest() {}
@@ -288,45 +365,37 @@ TEST_F(ProcessStatsDataSourceTest, ProcessStats) {
   auto data_source = GetProcessStatsDataSource(cfg);
 
   // Populate a fake /proc/ directory.
-  auto fake_proc = base::TempDir::Create();
+  FakeProcFs fake_proc;
   const int kPids[] = {1, 2};
-  std::vector<std::string> dirs_to_delete;
-  for (int pid : kPids) {
-    char path[256];
-    sprintf(path, "%s/%d", fake_proc.path().c_str(), pid);
-    dirs_to_delete.push_back(path);
-    mkdir(path, 0755);
-  }
-
-  auto checkpoint = task_runner_.CreateCheckpoint("all_done");
-
-  EXPECT_CALL(*data_source, OpenProcDir()).WillRepeatedly(Invoke([&fake_proc] {
-    return base::ScopedDir(opendir(fake_proc.path().c_str()));
-  }));
-
   const int kNumIters = 4;
   int iter = 0;
-  for (int pid : kPids) {
-    EXPECT_CALL(*data_source, ReadProcPidFile(pid, "status"))
-        .WillRepeatedly(Invoke([checkpoint, &iter](int32_t p,
-                                                   const std::string&) {
+  auto checkpoint = task_runner_.CreateCheckpoint("all_done");
+
+  // /proc is listed at the beginning of each poll, update the counters there.
+  EXPECT_CALL(*data_source, OpenProcDir())
+      .WillRepeatedly(Invoke([&fake_proc, &iter, checkpoint, kPids] {
+        if (iter == kNumIters) {
+          checkpoint();
+          return base::ScopedDir();
+        }
+        for (int pid : kPids) {
           char ret[1024];
+          sprintf(ret, "%d %d 0 0 0 0 0\n", pid * 100 + iter * 10 + 1,
+                  pid * 100 + iter * 10 + 2);
+          fake_proc.WriteFile(pid, "statm", ret);
           sprintf(ret, "Name:	pid_10\nVmSize:	 %d kB\nVmRSS:\t%d  kB\n",
-                  p * 100 + iter * 10 + 1, p * 100 + iter * 10 + 2);
-          return std::string(ret);
-        }));
-
-    EXPECT_CALL(*data_source, ReadProcPidFile(pid, "oom_score_adj"))
-        .WillRepeatedly(Invoke(
-            [checkpoint, kPids, &iter](int32_t inner_pid, const std::string&) {
-              auto oom_score = inner_pid * 100 + iter * 10 + 3;
-              if (inner_pid == kPids[base::ArraySize(kPids) - 1]) {
-                if (++iter == kNumIters)
-                  checkpoint();
-              }
-              return std::to_string(oom_score);
-            }));
-  }
+                  pid * 100 + iter * 10 + 1, pid * 100 + iter * 10 + 2);
+          fake_proc.WriteFile(pid, "status", ret);
+          fake_proc.WriteFile(pid, "oom_score_adj",
+                              std::to_string(pid * 100 + iter * 10 + 3));
+        }
+        iter++;
+        return fake_proc.OpenProcDir();
+      }));
+  EXPECT_CALL(*data_source, OpenProcPidFile(_, _))
+      .WillRepeatedly(Invoke([&fake_proc](int32_t pid, const char* file) {
+        return fake_proc.OpenProcPidFile(pid, file);
+      }));
 
   data_source->Start();
   task_runner_.RunUntilCheckpoint("all_done");
@@ -340,19 +409,15 @@ TEST_F(ProcessStatsDataSourceTest, ProcessStats) {
     }
   }
   ASSERT_EQ(processes.size(), kNumIters * base::ArraySize(kPids));
-  iter = 0;
+  // The order in which the pids are listed within a poll is not guaranteed.
+  std::map<int32_t, int> iter_by_pid;
   for (const auto& proc_counters : processes) {
     int32_t pid = proc_counters.pid();
-    ASSERT_EQ(proc_counters.vm_size_kb(), pid * 100 + iter * 10 + 1);
-    ASSERT_EQ(proc_counters.vm_rss_kb(), pid * 100 + iter * 10 + 2);
-    ASSERT_EQ(proc_counters.oom_score_adj(), pid * 100 + iter * 10 + 3);
-    if (pid == kPids[base::ArraySize(kPids) - 1])
-      iter++;
+    int pid_iter = iter_by_pid[pid]++;
+    ASSERT_EQ(proc_counters.vm_size_kb(), pid * 100 + pid_iter * 10 + 1);
+    ASSERT_EQ(proc_counters.vm_rss_kb(), pid * 100 + pid_iter * 10 + 2);
+    ASSERT_EQ(proc_counters.oom_score_adj(), pid * 100 + pid_iter * 10 + 3);
   }
-
-  // Cleanup |fake_proc|. TempDir checks that the directory is empty.
-  for (std::string& path : dirs_to_delete)
-    rmdir(path.c_str());
 }
 
 TEST_F(ProcessStatsDataSourceTest, CacheProcessStats) {
@@ -364,36 +429,29 @@ TEST_F(ProcessStatsDataSourceTest, CacheProcessStats) {
   auto data_source = GetProcessStatsDataSource(cfg);
 
   // Populate a fake /proc/ directory.
-  auto fake_proc = base::TempDir::Create();
+  FakeProcFs fake_proc;
   const int kPid = 1;
-
-  char path[256];
-  sprintf(path, "%s/%d", fake_proc.path().c_str(), kPid);
-  mkdir(path, 0755);
+  fake_proc.WriteFile(kPid, "statm", "101 102 0 0 0 0 0\n");
+  fake_proc.WriteFile(kPid, "status",
+                      "Name:	pid_10\nVmSize:	 101 kB\nVmRSS:\t102  kB\n");
+  fake_proc.WriteFile(kPid, "oom_score_adj", "100");
 
   auto checkpoint = task_runner_.CreateCheckpoint("all_done");
 
-  EXPECT_CALL(*data_source, OpenProcDir()).WillRepeatedly(Invoke([&fake_proc] {
-    return base::ScopedDir(opendir(fake_proc.path().c_str()));
-  }));
-
   const int kNumIters = 4;
   int iter = 0;
-  EXPECT_CALL(*data_source, ReadProcPidFile(kPid, "status"))
-      .WillRepeatedly(Invoke([checkpoint](int32_t p, const std::string&) {
-        char ret[1024];
-        sprintf(ret, "Name:	pid_10\nVmSize:	 %d kB\nVmRSS:\t%d  kB\n",
-                p * 100 + 1, p * 100 + 2);
-        return std::string(ret);
+  EXPECT_CALL(*data_source, OpenProcDir())
+      .WillRepeatedly(Invoke([&fake_proc, &iter, checkpoint] {
+        if (iter++ == kNumIters) {
+          checkpoint();
+          return base::ScopedDir();
+        }
+        return fake_proc.OpenProcDir();
+      }));
+  EXPECT_CALL(*data_source, OpenProcPidFile(_, _))
+      .WillRepeatedly(Invoke([&fake_proc](int32_t pid, const char* file) {
+        return fake_proc.OpenProcPidFile(pid, file);
       }));
-
-  EXPECT_CALL(*data_source, ReadProcPidFile(kPid, "oom_score_adj"))
-      .WillRepeatedly(
-          Invoke([checkpoint, &iter](int32_t inner_pid, const std::string&) {
-            if (++iter == kNumIters)
-              checkpoint();
-            return std::to_string(inner_pid * 100);
-          }));
 
   data_source->Start();
   task_runner_.RunUntilCheckpoint("all_done");
@@ -417,9 +475,169 @@ TEST_F(ProcessStatsDataSourceTest, CacheProcessStats) {
     ASSERT_EQ(proc_counters.vm_rss_kb(), kPid * 100 + 2);
     ASSERT_EQ(proc_counters.oom_score_adj(), kPid * 100);
   }
+}
+
+TEST_F(ProcessStatsDataSourceTest, StatusOnlyReadWhenStatmChanges) {
+  DataSourceConfig cfg;
+  cfg.mutable_process_stats_config()->set_proc_stats_poll_ms(100);
+  *(cfg.mutable_process_stats_config()->add_quirks()) =
+      perfetto::ProcessStatsConfig::DISABLE_ON_DEMAND;
+  auto data_source = GetProcessStatsDataSource(cfg);
+
+  FakeProcFs fake_proc;
+  fake_proc.WriteFile(1, "statm", "10 5 0 0 0 0 0\n");
+  fake_proc.WriteFile(1, "status", "VmSize:\t40 kB\nVmRSS:\t20 kB\n");
+  fake_proc.WriteFile(1, "oom_score_adj", "0");
+  // A kernel thread.
+  fake_proc.WriteFile(2, "statm", "0 0 0 0 0 0 0\n");
+  fake_proc.WriteFile(2, "status", "Name:\tkthreadd\n");
+  EXPECT_CALL(*data_source, OpenProcDir()).WillRepeatedly(Invoke([&fake_proc] {
+    return fake_proc.OpenProcDir();
+  }));
+
+  // statm and oom_score_adj are kept open, status is opened only when needed.
+  EXPECT_CALL(*data_source, OpenProcPidFile(1, _))
+      .WillRepeatedly(Invoke([&fake_proc](int32_t pid, const char* file) {
+        return fake_proc.OpenProcPidFile(pid, file);
+      }));
+  EXPECT_CALL(*data_source, OpenProcPidFile(1, Truly([](const char* file) {
+                                              return strcmp(file, "statm") == 0;
+                                            })))
+      .WillOnce(Invoke([&fake_proc](int32_t pid, const char* file) {
+        return fake_proc.OpenProcPidFile(pid, file);
+      }));
+  EXPECT_CALL(*data_source, OpenProcPidFile(1, Truly([](const char* file) {
+                                              return strcmp(file, "status") ==
+                                                     0;
+                                            })))
+      .Times(2)
+      .WillRepeatedly(Invoke([&fake_proc](int32_t pid, const char* file) {
+        return fake_proc.OpenProcPidFile(pid, file);
+      }));
+  // The kernel thread is skipped after the first poll.
+  EXPECT_CALL(*data_source, OpenProcPidFile(2, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&fake_proc](int32_t pid, const char* file) {
+        return fake_proc.OpenProcPidFile(pid, file);
+      }));
+
+  data_source->WriteAllProcessStats();
+  data_source->WriteAllProcessStats();
+  fake_proc.WriteFile(1, "statm", "12 6 0 0 0 0 0\n");
+  fake_proc.WriteFile(1, "status", "VmSize:\t48 kB\nVmRSS:\t24 kB\n");
+  data_source->WriteAllProcessStats();
+  data_source->WriteAllProcessStats();
+
+  std::vector<protos::ProcessStats::Process> processes;
+  for (const auto& packet : writer_raw_->GetAllTracePackets()) {
+    for (const auto& process : packet.process_stats().processes())
+      processes.push_back(process);
+  }
+  ASSERT_EQ(processes.size(), 2);
+  EXPECT_EQ(processes[0].pid(), 1);
+  EXPECT_EQ(processes[0].vm_size_kb(), 40);
+  EXPECT_EQ(processes[0].vm_rss_kb(), 20);
+  EXPECT_EQ(processes[0].oom_score_adj(), 0);
+  EXPECT_EQ(processes[1].vm_size_kb(), 48);
+  EXPECT_EQ(processes[1].vm_rss_kb(), 24);
+  EXPECT_FALSE(processes[1].has_oom_score_adj());
+}
+
+TEST_F(ProcessStatsDataSourceTest, ProcConnectorEvents) {
+  DataSourceConfig cfg;
+  cfg.mutable_process_stats_config()->set_use_proc_connector(true);
+  auto data_source = GetProcessStatsDataSource(cfg);
+
+  auto fake_proc = base::TempDir::Create();
+  EXPECT_CALL(*data_source, OpenProcDir()).WillOnce(Invoke([&fake_proc] {
+    return base::ScopedDir(opendir(fake_proc.path().c_str()));
+  }));
+  data_source->Start();
+  ASSERT_TRUE(data_source->using_proc_connector());
+
+  EXPECT_CALL(*data_source, ReadProcPidFile(10, "status"))
+      .WillRepeatedly(Return("Name: foo\nTgid:\t10\nPid:   10\nPPid:  1\n"));
+  EXPECT_CALL(*data_source, ReadProcPidFile(10, "cmdline"))
+      .WillOnce(Return(std::string("foo\0", 4)))
+      .WillOnce(Return(std::string("bar\0", 4)))
+      .WillOnce(Return(std::string("baz\0", 4)));
+  // The tgid of the thread comes with the fork event, no need to read it.
+  EXPECT_CALL(*data_source, ReadProcPidFile(11, _)).Times(0);
+
+  using Event = ProcConnector::Event;
+  data_source->OnProcEvents(
+      {ProcEvent(Event::kFork, 10, 10), ProcEvent(Event::kFork, 11, 10)});
+  data_source->OnProcEvents({ProcEvent(Event::kExec, 10, 10)});
+  // Forking an already seen pid is a no-op, until it exits and gets recycled.
+  data_source->OnProcEvents({ProcEvent(Event::kFork, 10, 10)});
+  data_source->OnProcEvents(
+      {ProcEvent(Event::kExit, 11, 10), ProcEvent(Event::kExit, 10, 10)});
+  data_source->OnProcEvents({ProcEvent(Event::kFork, 10, 10)});
+
+  std::vector<protos::TracePacket> trace = writer_raw_->GetAllTracePackets();
+  ASSERT_EQ(trace.size(), 3);
+
+  auto ps_tree = trace[0].process_tree();
+  ASSERT_EQ(ps_tree.processes_size(), 1);
+  EXPECT_EQ(ps_tree.processes(0).pid(), 10);
+  EXPECT_EQ(ps_tree.processes(0).ppid(), 1);
+  EXPECT_THAT(ps_tree.processes(0).cmdline(), ElementsAreArray({"foo"}));
+  ASSERT_EQ(ps_tree.threads_size(), 1);
+  EXPECT_EQ(ps_tree.threads(0).tid(), 11);
+  EXPECT_EQ(ps_tree.threads(0).tgid(), 10);
 
-  // Cleanup |fake_proc|. TempDir checks that the directory is empty.
-  rmdir(path);
+  ps_tree = trace[1].process_tree();
+  ASSERT_EQ(ps_tree.processes_size(), 1);
+  EXPECT_THAT(ps_tree.processes(0).cmdline(), ElementsAreArray({"bar"}));
+
+  ps_tree = trace[2].process_tree();
+  ASSERT_EQ(ps_tree.processes_size(), 1);
+  EXPECT_THAT(ps_tree.processes(0).cmdline(), ElementsAreArray({"baz"}));
+}
+
+TEST_F(ProcessStatsDataSourceTest, ProcConnectorProcessStats) {
+  DataSourceConfig cfg;
+  cfg.mutable_process_stats_config()->set_proc_stats_poll_ms(1);
+  cfg.mutable_process_stats_config()->set_use_proc_connector(true);
+  *(cfg.mutable_process_stats_config()->add_quirks()) =
+      perfetto::ProcessStatsConfig::DISABLE_ON_DEMAND;
+  auto data_source = GetProcessStatsDataSource(cfg);
+
+  FakeProcFs fake_proc;
+  auto add_process = [&fake_proc](int32_t pid) {
+    fake_proc.WriteFile(pid, "statm", "1 1 0 0 0 0 0\n");
+    fake_proc.WriteFile(pid, "status", "Name:\tfoo\nVmSize:\t1 kB\n");
+  };
+  add_process(1);
+
+  // /proc is listed once at startup, and never again while polling.
+  EXPECT_CALL(*data_source, OpenProcDir()).WillOnce(Invoke([&fake_proc] {
+    return fake_proc.OpenProcDir();
+  }));
+  auto checkpoint = task_runner_.CreateCheckpoint("all_done");
+  EXPECT_CALL(*data_source, OpenProcPidFile(_, _))
+      .WillRepeatedly(
+          Invoke([&fake_proc, checkpoint](int32_t pid, const char* file) {
+            if (pid == 2 && strcmp(file, "oom_score_adj") == 0)
+              checkpoint();
+            return fake_proc.OpenProcPidFile(pid, file);
+          }));
+
+  data_source->Start();
+  // Pid 2 wasn't in /proc when it was listed.
+  add_process(2);
+  data_source->OnProcEvents({ProcEvent(ProcConnector::Event::kFork, 2, 2),
+                             ProcEvent(ProcConnector::Event::kFork, 3, 3),
+                             ProcEvent(ProcConnector::Event::kExit, 3, 3)});
+  task_runner_.RunUntilCheckpoint("all_done");
+  data_source->Flush(1 /* FlushRequestId */, []() {});
+
+  std::vector<int32_t> pids;
+  for (const auto& packet : writer_raw_->GetAllTracePackets()) {
+    for (const auto& process : packet.process_stats().processes())
+      pids.push_back(process.pid());
+  }
+  EXPECT_THAT(pids, ElementsAreArray({1, 2}));
 }
 
 }  // namespace
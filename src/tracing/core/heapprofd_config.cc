@@ -47,7 +47,8 @@ bool HeapprofdConfig::operator==(const HeapprofdConfig& other) const {
          (skip_symbol_prefix_ == other.skip_symbol_prefix_) &&
          (continuous_dump_config_ == other.continuous_dump_config_) &&
          (shmem_size_bytes_ == other.shmem_size_bytes_) &&
-         (block_client_ == other.block_client_);
+         (block_client_ == other.block_client_) &&
+         (adaptive_stack_copy_ == other.adaptive_stack_copy_);
 }
 #pragma GCC diagnostic pop
 
@@ -99,6 +100,12 @@ void HeapprofdConfig::FromProto(
   static_assert(sizeof(block_client_) == sizeof(proto.block_client()),
                 "size mismatch");
   block_client_ = static_cast<decltype(block_client_)>(proto.block_client());
+
+  static_assert(
+      sizeof(adaptive_stack_copy_) == sizeof(proto.adaptive_stack_copy()),
+      "size mismatch");
+  adaptive_stack_copy_ = static_cast<decltype(adaptive_stack_copy_)>(
+      proto.adaptive_stack_copy());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -145,6 +152,13 @@ void HeapprofdConfig::ToProto(perfetto::protos::HeapprofdConfig* proto) const {
                 "size mismatch");
   proto->set_block_client(
       static_cast<decltype(proto->block_client())>(block_client_));
+
+  static_assert(
+      sizeof(adaptive_stack_copy_) == sizeof(proto->adaptive_stack_copy()),
+      "size mismatch");
+  proto->set_adaptive_stack_copy(
+      static_cast<decltype(proto->adaptive_stack_copy())>(
+          adaptive_stack_copy_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
@@ -164,7 +178,8 @@ operator=(HeapprofdConfig::ContinuousDumpConfig&&) = default;
 bool HeapprofdConfig::ContinuousDumpConfig::operator==(
     const HeapprofdConfig::ContinuousDumpConfig& other) const {
   return (dump_phase_ms_ == other.dump_phase_ms_) &&
-         (dump_interval_ms_ == other.dump_interval_ms_);
+         (dump_interval_ms_ == other.dump_interval_ms_) &&
+         (incremental_ == other.incremental_);
 }
 #pragma GCC diagnostic pop
 
@@ -178,6 +193,10 @@ void HeapprofdConfig::ContinuousDumpConfig::FromProto(
                 "size mismatch");
   dump_interval_ms_ =
       static_cast<decltype(dump_interval_ms_)>(proto.dump_interval_ms());
+
+  static_assert(sizeof(incremental_) == sizeof(proto.incremental()),
+                "size mismatch");
+  incremental_ = static_cast<decltype(incremental_)>(proto.incremental());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -194,6 +213,11 @@ void HeapprofdConfig::ContinuousDumpConfig::ToProto(
                 "size mismatch");
   proto->set_dump_interval_ms(
       static_cast<decltype(proto->dump_interval_ms())>(dump_interval_ms_));
+
+  static_assert(sizeof(incremental_) == sizeof(proto->incremental()),
+                "size mismatch");
+  proto->set_incremental(
+      static_cast<decltype(proto->incremental())>(incremental_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
@@ -47,7 +47,8 @@ bool ProcessStatsConfig::operator==(const ProcessStatsConfig& other) const {
          (scan_all_processes_on_start_ == other.scan_all_processes_on_start_) &&
          (record_thread_names_ == other.record_thread_names_) &&
          (proc_stats_poll_ms_ == other.proc_stats_poll_ms_) &&
-         (proc_stats_cache_ttl_ms_ == other.proc_stats_cache_ttl_ms_);
+         (proc_stats_cache_ttl_ms_ == other.proc_stats_cache_ttl_ms_) &&
+         (use_proc_connector_ == other.use_proc_connector_);
 }
 #pragma GCC diagnostic pop
 
@@ -85,6 +86,12 @@ void ProcessStatsConfig::FromProto(
                 "size mismatch");
   proc_stats_cache_ttl_ms_ = static_cast<decltype(proc_stats_cache_ttl_ms_)>(
       proto.proc_stats_cache_ttl_ms());
+
+  static_assert(
+      sizeof(use_proc_connector_) == sizeof(proto.use_proc_connector()),
+      "size mismatch");
+  use_proc_connector_ =
+      static_cast<decltype(use_proc_connector_)>(proto.use_proc_connector());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -123,6 +130,12 @@ void ProcessStatsConfig::ToProto(
   proto->set_proc_stats_cache_ttl_ms(
       static_cast<decltype(proto->proc_stats_cache_ttl_ms())>(
           proc_stats_cache_ttl_ms_));
+
+  static_assert(
+      sizeof(use_proc_connector_) == sizeof(proto->use_proc_connector()),
+      "size mismatch");
+  proto->set_use_proc_connector(
+      static_cast<decltype(proto->use_proc_connector())>(use_proc_connector_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
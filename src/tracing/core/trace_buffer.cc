@@ -63,9 +63,11 @@ constexpr size_t TraceBuffer::InlineChunkHeaderSize = sizeof(ChunkRecord);
 
 // static
 std::unique_ptr<TraceBuffer> TraceBuffer::Create(size_t size_in_bytes,
-                                                 OverwritePolicy pol) {
+                                                 OverwritePolicy pol,
+                                                 int alloc_flags,
+                                                 int numa_node) {
   std::unique_ptr<TraceBuffer> trace_buffer(new TraceBuffer(pol));
-  if (!trace_buffer->Initialize(size_in_bytes))
+  if (!trace_buffer->Initialize(size_in_bytes, alloc_flags, numa_node))
     return nullptr;
   return trace_buffer;
 }
@@ -79,13 +81,16 @@ TraceBuffer::TraceBuffer(OverwritePolicy pol) : overwrite_policy_(pol) {
 
 TraceBuffer::~TraceBuffer() = default;
 
-bool TraceBuffer::Initialize(size_t size) {
+bool TraceBuffer::Initialize(size_t size, int alloc_flags, int numa_node) {
   static_assert(
       base::kPageSize % sizeof(ChunkRecord) == 0,
       "sizeof(ChunkRecord) must be an integer divider of a page size");
   PERFETTO_CHECK(size % base::kPageSize == 0);
   data_ = base::PagedMemory::Allocate(
-      size, base::PagedMemory::kMayFail | base::PagedMemory::kDontCommit);
+      size,
+      alloc_flags | base::PagedMemory::kMayFail |
+          base::PagedMemory::kDontCommit,
+      numa_node);
   if (!data_.IsValid()) {
     PERFETTO_ELOG("Trace buffer allocation failed (size: %zu)", size);
     return false;
@@ -160,9 +160,14 @@ class TraceBuffer {
     WriterID writer_id;
   };
 
-  // Can return nullptr if the memory allocation fails.
-  static std::unique_ptr<TraceBuffer> Create(size_t size_in_bytes,
-                                             OverwritePolicy = kOverwrite);
+  // Can return nullptr if the memory allocation fails. |alloc_flags| (e.g.
+  // base::PagedMemory::kHugePages) and |numa_node| are passed through to
+  // base::PagedMemory::Allocate().
+  static std::unique_ptr<TraceBuffer> Create(
+      size_t size_in_bytes,
+      OverwritePolicy = kOverwrite,
+      int alloc_flags = 0,
+      int numa_node = base::PagedMemory::kAnyNumaNode);
 
   ~TraceBuffer();
 
@@ -492,7 +497,7 @@ class TraceBuffer {
   TraceBuffer(const TraceBuffer&) = delete;
   TraceBuffer& operator=(const TraceBuffer&) = delete;
 
-  bool Initialize(size_t size);
+  bool Initialize(size_t size, int alloc_flags, int numa_node);
 
   // Returns an object that allows to iterate over chunks in the |index_| that
   // have the same {ProducerID, WriterID} of
@@ -56,8 +56,11 @@ class TraceBufferTest : public testing::Test {
 
   void ResetBuffer(
       size_t size_,
-      TraceBuffer::OverwritePolicy policy = TraceBuffer::kOverwrite) {
-    trace_buffer_ = TraceBuffer::Create(size_, policy);
+      TraceBuffer::OverwritePolicy policy = TraceBuffer::kOverwrite,
+      int alloc_flags = 0,
+      int numa_node = base::PagedMemory::kAnyNumaNode) {
+    trace_buffer_ =
+        TraceBuffer::Create(size_, policy, alloc_flags, numa_node);
     ASSERT_TRUE(trace_buffer_);
   }
 
@@ -181,6 +184,28 @@ TEST_F(TraceBufferTest, ReadWrite_Simple) {
   }
 }
 
+// The allocation flags only change how the memory is backed.
+TEST_F(TraceBufferTest, ReadWrite_HugePages) {
+  for (int flags :
+       {base::PagedMemory::kHugePages, base::PagedMemory::kHugeTlb}) {
+    ResetBuffer(base::PagedMemory::kHugePageSize, TraceBuffer::kOverwrite,
+                flags, /*numa_node=*/0);
+    // ~1.6MB, no overwrites.
+    for (ChunkID chunk_id = 0; chunk_id < 400; chunk_id++) {
+      char seed = static_cast<char>(chunk_id);
+      CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+          .AddPacket(4000, seed)
+          .CopyIntoTraceBuffer();
+    }
+    trace_buffer()->BeginRead();
+    for (ChunkID chunk_id = 0; chunk_id < 400; chunk_id++) {
+      char seed = static_cast<char>(chunk_id);
+      ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(4000, seed)));
+    }
+    ASSERT_THAT(ReadPacket(), IsEmpty());
+  }
+}
+
 TEST_F(TraceBufferTest, ReadWrite_OneChunkPerWriter) {
   for (int8_t num_writers = 1; num_writers <= 10; num_writers++) {
     ResetBuffer(4096);
@@ -308,7 +308,10 @@ TraceConfig::BufferConfig& TraceConfig::BufferConfig::operator=(
 #pragma GCC diagnostic ignored "-Wfloat-equal"
 bool TraceConfig::BufferConfig::operator==(
     const TraceConfig::BufferConfig& other) const {
-  return (size_kb_ == other.size_kb_) && (fill_policy_ == other.fill_policy_);
+  return (size_kb_ == other.size_kb_) && (fill_policy_ == other.fill_policy_) &&
+         (use_huge_pages_ == other.use_huge_pages_) &&
+         (use_numa_node_ == other.use_numa_node_) &&
+         (numa_node_ == other.numa_node_);
 }
 #pragma GCC diagnostic pop
 
@@ -320,6 +323,19 @@ void TraceConfig::BufferConfig::FromProto(
   static_assert(sizeof(fill_policy_) == sizeof(proto.fill_policy()),
                 "size mismatch");
   fill_policy_ = static_cast<decltype(fill_policy_)>(proto.fill_policy());
+
+  static_assert(sizeof(use_huge_pages_) == sizeof(proto.use_huge_pages()),
+                "size mismatch");
+  use_huge_pages_ =
+      static_cast<decltype(use_huge_pages_)>(proto.use_huge_pages());
+
+  static_assert(sizeof(use_numa_node_) == sizeof(proto.use_numa_node()),
+                "size mismatch");
+  use_numa_node_ = static_cast<decltype(use_numa_node_)>(proto.use_numa_node());
+
+  static_assert(sizeof(numa_node_) == sizeof(proto.numa_node()),
+                "size mismatch");
+  numa_node_ = static_cast<decltype(numa_node_)>(proto.numa_node());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -334,6 +350,20 @@ void TraceConfig::BufferConfig::ToProto(
                 "size mismatch");
   proto->set_fill_policy(
       static_cast<decltype(proto->fill_policy())>(fill_policy_));
+
+  static_assert(sizeof(use_huge_pages_) == sizeof(proto->use_huge_pages()),
+                "size mismatch");
+  proto->set_use_huge_pages(
+      static_cast<decltype(proto->use_huge_pages())>(use_huge_pages_));
+
+  static_assert(sizeof(use_numa_node_) == sizeof(proto->use_numa_node()),
+                "size mismatch");
+  proto->set_use_numa_node(
+      static_cast<decltype(proto->use_numa_node())>(use_numa_node_));
+
+  static_assert(sizeof(numa_node_) == sizeof(proto->numa_node()),
+                "size mismatch");
+  proto->set_numa_node(static_cast<decltype(proto->numa_node())>(numa_node_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
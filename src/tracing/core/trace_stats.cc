@@ -49,7 +49,8 @@ bool TraceStats::operator==(const TraceStats& other) const {
          (tracing_sessions_ == other.tracing_sessions_) &&
          (total_buffers_ == other.total_buffers_) &&
          (chunks_discarded_ == other.chunks_discarded_) &&
-         (patches_discarded_ == other.patches_discarded_);
+         (patches_discarded_ == other.patches_discarded_) &&
+         (max_read_behind_bytes_ == other.max_read_behind_bytes_);
 }
 #pragma GCC diagnostic pop
 
@@ -100,6 +101,12 @@ void TraceStats::FromProto(const perfetto::protos::TraceStats& proto) {
                 "size mismatch");
   patches_discarded_ =
       static_cast<decltype(patches_discarded_)>(proto.patches_discarded());
+
+  static_assert(
+      sizeof(max_read_behind_bytes_) == sizeof(proto.max_read_behind_bytes()),
+      "size mismatch");
+  max_read_behind_bytes_ = static_cast<decltype(max_read_behind_bytes_)>(
+      proto.max_read_behind_bytes());
   unknown_fields_ = proto.unknown_fields();
 }
 
@@ -156,6 +163,13 @@ void TraceStats::ToProto(perfetto::protos::TraceStats* proto) const {
       "size mismatch");
   proto->set_patches_discarded(
       static_cast<decltype(proto->patches_discarded())>(patches_discarded_));
+
+  static_assert(
+      sizeof(max_read_behind_bytes_) == sizeof(proto->max_read_behind_bytes()),
+      "size mismatch");
+  proto->set_max_read_behind_bytes(
+      static_cast<decltype(proto->max_read_behind_bytes())>(
+          max_read_behind_bytes_));
   *(proto->mutable_unknown_fields()) = unknown_fields_;
 }
 
@@ -39,6 +39,7 @@
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/file_utils.h"
+#include "perfetto/base/paged_memory.h"
 #include "perfetto/base/task_runner.h"
 #include "perfetto/base/utils.h"
 #include "perfetto/tracing/core/consumer.h"
@@ -445,8 +446,14 @@ bool TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
         buffer_cfg.fill_policy() == TraceConfig::BufferConfig::DISCARD
             ? TraceBuffer::kDiscard
             : TraceBuffer::kOverwrite;
+    const int alloc_flags =
+        buffer_cfg.use_huge_pages() ? base::PagedMemory::kHugePages : 0;
+    const int numa_node = buffer_cfg.use_numa_node()
+                              ? static_cast<int>(buffer_cfg.numa_node())
+                              : base::PagedMemory::kAnyNumaNode;
     auto it_and_inserted = buffers_.emplace(
-        global_id, TraceBuffer::Create(buf_size_bytes, policy));
+        global_id,
+        TraceBuffer::Create(buf_size_bytes, policy, alloc_flags, numa_node));
     PERFETTO_DCHECK(it_and_inserted.second);  // buffers_.count(global_id) == 0.
     std::unique_ptr<TraceBuffer>& trace_buffer = it_and_inserted.first->second;
     if (!trace_buffer) {
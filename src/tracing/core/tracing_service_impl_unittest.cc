@@ -1528,6 +1528,53 @@ TEST_F(TracingServiceImplTest, ImplicitFlushOnTimedTraces) {
                         Property(&protos::TestEvent::str, Eq("payload")))));
 }
 
+// The allocation options of the buffers are only hints: the buffers work the
+// same with or without them, even with a NUMA node that doesn't exist.
+TEST_F(TracingServiceImplTest, BufferAllocationOptions) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  auto* buf_config = trace_config.add_buffers();
+  buf_config->set_size_kb(4096);
+  buf_config->set_use_huge_pages(true);
+  buf_config->set_use_numa_node(true);
+  buf_config->set_numa_node(0);
+  buf_config = trace_config.add_buffers();
+  buf_config->set_size_kb(128);
+  buf_config->set_use_numa_node(true);
+  buf_config->set_numa_node(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  trace_config.set_duration_ms(1);
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload");
+  }
+
+  producer->WaitForFlush(writer.get());
+
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  EXPECT_THAT(
+      consumer->ReadBuffers(),
+      Contains(Property(&protos::TracePacket::for_testing,
+                        Property(&protos::TestEvent::str, Eq("payload")))));
+}
+
 // Tests the monotonic semantic of flush request IDs, i.e., once a producer
 // acks flush request N, all flush requests <= N are considered successful and
 // acked to the consumer.
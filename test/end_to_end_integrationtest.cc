@@ -614,6 +614,17 @@ TEST_F(PerfettoCmdlineTest, NoSanitizers(InvalidCases)) {
 
   EXPECT_EQ(1, ExecPerfetto({"-t", "2s", "--detach=foo"}, cfg));
   EXPECT_THAT(stderr_, HasSubstr("--out or --dropbox is required"));
+
+  // Invalid streaming cases.
+  EXPECT_EQ(1, ExecPerfetto(
+                   {"-c", "-", "--txt", "-o", "-", "--stream-threshold-kb=1"},
+                   cfg));
+  EXPECT_THAT(stderr_, HasSubstr("requires --stream-period-ms"));
+
+  EXPECT_EQ(1, ExecPerfetto({"-c", "-", "--txt", "-o", "-",
+                             "--stream-period-ms=10"},
+                            "duration_ms: 100; write_into_file: true"));
+  EXPECT_THAT(stderr_, HasSubstr("can't be used with write_into_file"));
 }
 
 TEST_F(PerfettoCmdlineTest, NoSanitizers(TxtConfig)) {
@@ -625,6 +636,61 @@ TEST_F(PerfettoCmdlineTest, NoSanitizers(SimpleConfig)) {
   EXPECT_EQ(0, ExecPerfetto({"-o", "-", "-c", "-", "-t", "100ms"}));
 }
 
+TEST_F(PerfettoCmdlineTest, NoSanitizers(StreamingConfig)) {
+  // The producer writes 4x the size of the buffer, which fits in the trace
+  // only if the buffer is read while tracing.
+  constexpr size_t kMessageCount = 256;
+  constexpr size_t kMessageSize = 1024;
+  protos::TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(64);
+  trace_config.set_duration_ms(1000);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("android.perfetto.FakeProducer");
+  ds_config->mutable_for_testing()->set_message_count(kMessageCount);
+  ds_config->mutable_for_testing()->set_message_size(kMessageSize);
+  ds_config->mutable_for_testing()->set_max_messages_per_second(1000);
+
+  base::TestTaskRunner task_runner;
+  TestHelper helper(&task_runner);
+  helper.StartServiceIfRequired();
+  auto* fake_producer = helper.ConnectFakeProducer();
+  EXPECT_TRUE(fake_producer);
+
+  const std::string path = RandomTraceFileName();
+  std::thread background_trace([&path, &trace_config, this]() {
+    EXPECT_EQ(0, ExecPerfetto({"-o", path, "-c", "-", "--stream-period-ms=10"},
+                              trace_config.SerializeAsString()))
+        << stderr_;
+  });
+
+  helper.WaitForProducerEnabled();
+  auto on_data_written = task_runner.CreateCheckpoint("data_written");
+  fake_producer->ProduceEventBatch(helper.WrapTask(on_data_written));
+  task_runner.RunUntilCheckpoint("data_written");
+  background_trace.join();
+
+  std::string trace_str;
+  base::ReadFile(path, &trace_str);
+  protos::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_str));
+  size_t for_testing_packets = 0;
+  for (const auto& packet : trace.packet()) {
+    if (packet.has_for_testing())
+      for_testing_packets++;
+  }
+  EXPECT_EQ(kMessageCount, for_testing_packets);
+
+  // perfetto_cmd appends the final stats, with the read-behind lag it saw.
+  ASSERT_GT(trace.packet_size(), 0);
+  const auto& last_packet = trace.packet(trace.packet_size() - 1);
+  ASSERT_TRUE(last_packet.has_trace_stats());
+  const auto& stats = last_packet.trace_stats();
+  EXPECT_GT(stats.max_read_behind_bytes(), 0u);
+  EXPECT_LT(stats.max_read_behind_bytes(), 64u * 1024);
+  ASSERT_EQ(stats.buffer_stats_size(), 1);
+  EXPECT_EQ(stats.buffer_stats(0).bytes_overwritten(), 0u);
+}
+
 TEST_F(PerfettoCmdlineTest, NoSanitizers(DetachAndAttach)) {
   EXPECT_NE(0, ExecPerfetto({"--attach=not_existent"}));
   EXPECT_THAT(stderr_, HasSubstr("Session re-attach failed"));